@@ -32,7 +32,10 @@ enum {
 G_DEFINE_TYPE (OstreeChecksumInputStream, ostree_checksum_input_stream, G_TYPE_FILTER_INPUT_STREAM)
 
 struct _OstreeChecksumInputStreamPrivate {
-  GChecksum *checksum;
+  OtChecksum *checksum;
+  gboolean collect_stats;
+  guint64 bytes;
+  guint64 usec;
 };
 
 static void     ostree_checksum_input_stream_set_property (GObject              *object,
@@ -129,7 +132,7 @@ ostree_checksum_input_stream_init (OstreeChecksumInputStream *self)
 
 OstreeChecksumInputStream *
 ostree_checksum_input_stream_new (GInputStream    *base,
-                                  GChecksum       *checksum)
+                                  OtChecksum      *checksum)
 {
   OstreeChecksumInputStream *stream;
 
@@ -163,7 +166,49 @@ ostree_checksum_input_stream_read (GInputStream  *stream,
                              cancellable,
                              error);
   if (res > 0)
-    g_checksum_update (self->priv->checksum, buffer, res);
+    {
+      if (self->priv->collect_stats)
+        {
+          gint64 start_time = g_get_monotonic_time ();
+          ot_checksum_update (self->priv->checksum, buffer, res);
+          self->priv->usec += g_get_monotonic_time () - start_time;
+        }
+      else
+        ot_checksum_update (self->priv->checksum, buffer, res);
+      self->priv->bytes += res;
+    }
 
   return res;
 }
+
+/**
+ * ostree_checksum_input_stream_set_collect_stats:
+ * @self:
+ * @collect: Whether to time checksumming
+ *
+ * Timing is off by default, since it takes two clock reads per read.
+ */
+void
+ostree_checksum_input_stream_set_collect_stats (OstreeChecksumInputStream *self,
+                                                gboolean                   collect)
+{
+  self->priv->collect_stats = collect;
+}
+
+/**
+ * ostree_checksum_input_stream_get_stats:
+ * @self:
+ * @out_bytes: (out) (allow-none): Number of bytes checksummed
+ * @out_usec: (out) (allow-none): Time spent checksumming, in microseconds,
+ * or 0 unless ostree_checksum_input_stream_set_collect_stats() was called
+ */
+void
+ostree_checksum_input_stream_get_stats (OstreeChecksumInputStream *self,
+                                        guint64                   *out_bytes,
+                                        guint64                   *out_usec)
+{
+  if (out_bytes)
+    *out_bytes = self->priv->bytes;
+  if (out_usec)
+    *out_usec = self->priv->usec;
+}
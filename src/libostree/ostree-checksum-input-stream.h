@@ -23,6 +23,7 @@
 #define __OSTREE_CHECKSUM_INPUT_STREAM_H__
 
 #include <gio/gio.h>
+#include <otutil.h>
 
 G_BEGIN_DECLS
 
@@ -61,7 +62,14 @@ struct _OstreeChecksumInputStreamClass
 GType          ostree_checksum_input_stream_get_type     (void) G_GNUC_CONST;
 
 OstreeChecksumInputStream * ostree_checksum_input_stream_new          (GInputStream   *stream,
-                                                                       GChecksum      *checksum);
+                                                                       OtChecksum     *checksum);
+
+void           ostree_checksum_input_stream_set_collect_stats (OstreeChecksumInputStream *self,
+                                                               gboolean                   collect);
+
+void           ostree_checksum_input_stream_get_stats    (OstreeChecksumInputStream *self,
+                                                          guint64                   *out_bytes,
+                                                          guint64                   *out_usec);
 
 G_END_DECLS
 
@@ -244,7 +244,7 @@ write_padding (GOutputStream    *output,
                guint             alignment,
                gsize             offset,
                gsize            *out_bytes_written,
-               GChecksum        *checksum,
+               OtChecksum       *checksum,
                GCancellable     *cancellable,
                GError          **error)
 {
@@ -277,7 +277,7 @@ ostree_write_variant_with_size (GOutputStream      *output,
                                 GVariant           *variant,
                                 guint64             alignment_offset,
                                 gsize              *out_bytes_written,
-                                GChecksum          *checksum,
+                                OtChecksum         *checksum,
                                 GCancellable       *cancellable,
                                 GError            **error)
 {
@@ -324,7 +324,7 @@ ostree_write_variant_with_size (GOutputStream      *output,
 gboolean
 ostree_write_file_header_update_checksum (GOutputStream         *out,
                                           GVariant              *header,
-                                          GChecksum             *checksum,
+                                          OtChecksum            *checksum,
                                           GCancellable          *cancellable,
                                           GError               **error)
 {
@@ -525,20 +525,20 @@ ostree_checksum_file_from_input (GFileInfo        *file_info,
 {
   gboolean ret = FALSE;
   ot_lfree guchar *ret_csum = NULL;
-  GChecksum *checksum = NULL;
+  OtChecksum checksum;
 
-  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  ot_checksum_init (&checksum);
 
   if (OSTREE_OBJECT_TYPE_IS_META (objtype))
     {
-      if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
+      if (!ot_gio_splice_update_checksum (NULL, in, &checksum, cancellable, error))
         goto out;
     }
   else if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
     {
       ot_lvariant GVariant *dirmeta = ostree_create_directory_metadata (file_info, xattrs);
-      g_checksum_update (checksum, g_variant_get_data (dirmeta),
-                         g_variant_get_size (dirmeta));
+      ot_checksum_update (&checksum, g_variant_get_data (dirmeta),
+                          g_variant_get_size (dirmeta));
       
     }
   else
@@ -547,23 +547,23 @@ ostree_checksum_file_from_input (GFileInfo        *file_info,
 
       file_header = ostree_file_header_new (file_info, xattrs);
 
-      if (!ostree_write_file_header_update_checksum (NULL, file_header, checksum,
+      if (!ostree_write_file_header_update_checksum (NULL, file_header, &checksum,
                                                      cancellable, error))
         goto out;
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
         {
-          if (!ot_gio_splice_update_checksum (NULL, in, checksum, cancellable, error))
+          if (!ot_gio_splice_update_checksum (NULL, in, &checksum, cancellable, error))
             goto out;
         }
     }
 
-  ret_csum = ot_csum_from_gchecksum (checksum);
+  ret_csum = ot_csum_from_checksum (&checksum);
 
   ret = TRUE;
   ot_transfer_out_value (out_csum, &ret_csum);
  out:
-  g_clear_pointer (&checksum, (GDestroyNotify)g_checksum_free);
+  ot_checksum_clear (&checksum);
   return ret;
 }
 
@@ -742,6 +742,119 @@ ostree_set_xattrs (GFile  *f,
   return ret;
 }
 
+static gboolean
+xattrs_contain (GVariant    *xattrs,
+                const char  *name)
+{
+  int i, n;
+
+  n = g_variant_n_children (xattrs);
+  for (i = 0; i < n; i++)
+    {
+      const guint8* other_name;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)", &other_name, NULL);
+      if (strcmp ((char*)other_name, name) == 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+/*
+ * Remove the attributes of @fd which aren't in @xattrs.  Security
+ * labels are kept, since the system gives them to new files too.
+ */
+static gboolean
+remove_other_xattrs_fd (int           fd,
+                        GVariant     *xattrs,
+                        GError      **error)
+{
+  gboolean ret = FALSE;
+  ssize_t bytes_read;
+  const char *p;
+  ot_lfree char *xattr_names = NULL;
+
+  bytes_read = flistxattr (fd, NULL, 0);
+  if (bytes_read < 0)
+    {
+      if (errno != ENOTSUP)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      bytes_read = 0;
+    }
+  if (bytes_read > 0)
+    {
+      xattr_names = g_malloc (bytes_read);
+      bytes_read = flistxattr (fd, xattr_names, bytes_read);
+      if (bytes_read < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+
+  for (p = xattr_names; p && p < xattr_names + bytes_read; p += strlen (p) + 1)
+    {
+      if (g_str_has_prefix (p, "security.") || xattrs_contain (xattrs, p))
+        continue;
+      if (fremovexattr (fd, p) < 0 && errno != ENODATA)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * Like ostree_set_xattrs(), but for the open file @fd.  Attributes
+ * are created if they don't exist yet, and other attributes the file
+ * has are removed, apart from security labels.
+ */
+gboolean
+ostree_set_xattrs_fd (int           fd,
+                      GVariant     *xattrs,
+                      GCancellable *cancellable,
+                      GError      **error)
+{
+  gboolean ret = FALSE;
+  int i, n;
+
+  if (!remove_other_xattrs_fd (fd, xattrs, error))
+    goto out;
+
+  n = g_variant_n_children (xattrs);
+  for (i = 0; i < n; i++)
+    {
+      const guint8* name;
+      GVariant *value;
+      const guint8* value_data;
+      gsize value_len;
+      gboolean loop_err;
+
+      g_variant_get_child (xattrs, i, "(^&ay@ay)",
+                           &name, &value);
+      value_data = g_variant_get_fixed_array (value, &value_len, 1);
+      
+      loop_err = fsetxattr (fd, (char*)name, (char*)value_data, value_len, 0) < 0;
+      g_clear_pointer (&value, (GDestroyNotify) g_variant_unref);
+      if (loop_err)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 const char *
 ostree_object_type_to_string (OstreeObjectType objtype)
 {
@@ -859,6 +972,13 @@ checksum_to_bytes (const char *checksum,
     }
 }
 
+void
+ostree_checksum_inplace_to_bytes (const char *checksum,
+                                  guchar     *buf)
+{
+  checksum_to_bytes (checksum, buf);
+}
+
 guchar *
 ostree_checksum_to_bytes (const char *checksum)
 {
@@ -875,23 +995,27 @@ ostree_checksum_to_bytes_v (const char *checksum)
   return ot_gvariant_new_bytearray ((guchar*)result, 32);
 }
 
-char *
-ostree_checksum_from_bytes (const guchar *csum)
+void
+ostree_checksum_inplace_from_bytes (const guchar *csum,
+                                    char         *buf)
 {
   static const gchar hexchars[] = "0123456789abcdef";
-  char *ret;
   guint i, j;
 
-  ret = g_malloc (65);
-  
   for (i = 0, j = 0; i < 32; i++, j += 2)
     {
       guchar byte = csum[i];
-      ret[j] = hexchars[byte >> 4];
-      ret[j+1] = hexchars[byte & 0xF];
+      buf[j] = hexchars[byte >> 4];
+      buf[j+1] = hexchars[byte & 0xF];
     }
-  ret[j] = '\0';
+  buf[j] = '\0';
+}
 
+char *
+ostree_checksum_from_bytes (const guchar *csum)
+{
+  char *ret = g_malloc (65);
+  ostree_checksum_inplace_from_bytes (csum, ret);
   return ret;
 }
 
@@ -1054,17 +1178,19 @@ ostree_file_header_parse (GVariant         *metadata,
   return ret;
 }
 
-gboolean
-ostree_create_file_from_input (GFile            *dest_file,
-                               GFileInfo        *finfo,
-                               GVariant         *xattrs,
-                               GInputStream     *input,
-                               GCancellable     *cancellable,
-                               GError          **error)
+static gboolean
+create_file_from_input (GFile            *dest_file,
+                        GFileInfo        *finfo,
+                        GVariant         *xattrs,
+                        GInputStream     *input,
+                        guint64          *out_bytes_written,
+                        GCancellable     *cancellable,
+                        GError          **error)
 {
   gboolean ret = FALSE;
   const char *dest_path;
   guint32 uid, gid, mode;
+  gssize bytes_written = 0;
   ot_lobj GFileOutputStream *out = NULL;
 
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
@@ -1096,8 +1222,9 @@ ostree_create_file_from_input (GFile            *dest_file,
 
       if (input)
         {
-          if (g_output_stream_splice ((GOutputStream*)out, input, 0,
-                                      cancellable, error) < 0)
+          bytes_written = g_output_stream_splice ((GOutputStream*)out, input, 0,
+                                                  cancellable, error);
+          if (bytes_written < 0)
             goto out;
         }
 
@@ -1167,6 +1294,8 @@ ostree_create_file_from_input (GFile            *dest_file,
     }
 
   ret = TRUE;
+  if (out_bytes_written)
+    *out_bytes_written = bytes_written;
  out:
   if (!ret && !S_ISDIR(mode))
     {
@@ -1175,6 +1304,18 @@ ostree_create_file_from_input (GFile            *dest_file,
   return ret;
 }
 
+gboolean
+ostree_create_file_from_input (GFile            *dest_file,
+                               GFileInfo        *finfo,
+                               GVariant         *xattrs,
+                               GInputStream     *input,
+                               GCancellable     *cancellable,
+                               GError          **error)
+{
+  return create_file_from_input (dest_file, finfo, xattrs, input, NULL,
+                                 cancellable, error);
+}
+
 static GString *
 create_tmp_string (const char *dirpath,
                    const char *prefix,
@@ -1223,6 +1364,7 @@ ostree_create_temp_file_from_input (GFile            *dir,
                                     GVariant         *xattrs,
                                     GInputStream     *input,
                                     GFile           **out_file,
+                                    guint64          *out_bytes_written,
                                     GCancellable     *cancellable,
                                     GError          **error)
 {
@@ -1248,8 +1390,8 @@ ostree_create_temp_file_from_input (GFile            *dir,
       g_clear_object (&possible_file);
       possible_file = g_file_get_child (dir, possible_name);
       
-      if (!ostree_create_file_from_input (possible_file, finfo, xattrs, input,
-                                          cancellable, &temp_error))
+      if (!create_file_from_input (possible_file, finfo, xattrs, input,
+                                   out_bytes_written, cancellable, &temp_error))
         {
           if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
             {
@@ -1296,7 +1438,7 @@ ostree_create_temp_regular_file (GFile            *dir,
   ot_lobj GOutputStream *ret_stream = NULL;
 
   if (!ostree_create_temp_file_from_input (dir, prefix, suffix, NULL, NULL, NULL,
-                                           &ret_file, cancellable, error))
+                                           &ret_file, NULL, cancellable, error))
     goto out;
   
   ret_stream = (GOutputStream*)g_file_append_to (ret_file, 0, cancellable, error);
@@ -1343,21 +1485,22 @@ ostree_create_temp_dir (GFile            *dir,
   return ret;
 }
 
-gboolean
-ostree_read_pack_entry_raw (guchar        *pack_data,
-                            guint64        pack_len,
-                            guint64        offset,
-                            gboolean       trusted,
-                            gboolean       is_meta,
-                            GVariant     **out_entry,
-                            GCancellable  *cancellable,
-                            GError       **error)
+/*
+ * Check that the entry at @offset lies within the pack, and return
+ * the position and length of its serialized variant.
+ */
+static gboolean
+get_pack_entry_bounds (guchar        *pack_data,
+                       guint64        pack_len,
+                       guint64        offset,
+                       guint64       *out_entry_start,
+                       guint32       *out_entry_len,
+                       GError       **error)
 {
   gboolean ret = FALSE;
   guint64 entry_start;
   guint64 entry_end;
   guint32 entry_len;
-  ot_lvariant GVariant *ret_entry = NULL;
 
   if (G_UNLIKELY (!(offset <= pack_len)))
     {
@@ -1395,6 +1538,31 @@ ostree_read_pack_entry_raw (guchar        *pack_data,
       goto out;
     }
 
+  ret = TRUE;
+  *out_entry_start = entry_start;
+  *out_entry_len = entry_len;
+ out:
+  return ret;
+}
+
+gboolean
+ostree_read_pack_entry_raw (guchar        *pack_data,
+                            guint64        pack_len,
+                            guint64        offset,
+                            gboolean       trusted,
+                            gboolean       is_meta,
+                            GVariant     **out_entry,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+  gboolean ret = FALSE;
+  guint64 entry_start;
+  guint32 entry_len;
+  ot_lvariant GVariant *ret_entry = NULL;
+
+  if (!get_pack_entry_bounds (pack_data, pack_len, offset, &entry_start, &entry_len, error))
+    goto out;
+
   ret_entry = g_variant_new_from_data (is_meta ? OSTREE_PACK_META_FILE_VARIANT_FORMAT :
                                        OSTREE_PACK_DATA_FILE_VARIANT_FORMAT,
                                        pack_data+entry_start, entry_len,
@@ -1406,6 +1574,167 @@ ostree_read_pack_entry_raw (guchar        *pack_data,
   return ret;
 }
 
+/* Read a little-endian GVariant framing offset of @size bytes */
+static guint64
+read_framing_offset (const guchar  *p,
+                     guint          size)
+{
+  guint64 value = 0;
+  guint i;
+
+  for (i = 0; i < size; i++)
+    value |= ((guint64)p[i]) << (8 * i);
+  return value;
+}
+
+/**
+ * ostree_read_file_pack_entry:
+ *
+ * Like ostree_read_pack_entry_raw() for data packs, but decode the
+ * framing of the serialized entry directly into @out_entry, whose
+ * pointers point into @pack_data.  The header is not validated; see
+ * ostree_file_pack_entry_parse_header().
+ */
+gboolean
+ostree_read_file_pack_entry (guchar               *pack_data,
+                             guint64               pack_len,
+                             guint64               offset,
+                             OstreePackFileEntry  *out_entry,
+                             GError              **error)
+{
+  gboolean ret = FALSE;
+  guint64 entry_start;
+  guint32 entry_len;
+  guint offset_size;
+  guint64 frame_start;
+  guint64 csum_end;
+  guint64 header_start;
+  guint64 header_end;
+  const guchar *entry;
+
+  if (!get_pack_entry_bounds (pack_data, pack_len, offset, &entry_start, &entry_len, error))
+    goto out;
+
+  entry = pack_data + entry_start;
+
+  /* The checksum and header are the variable-sized members before the
+   * last one, so their ends are stored in the last two framing
+   * offsets, in reverse order.
+   */
+  if (entry_len <= G_MAXUINT8)
+    offset_size = 1;
+  else if (entry_len <= G_MAXUINT16)
+    offset_size = 2;
+  else
+    offset_size = 4;
+
+  if (G_UNLIKELY (entry_len < 2 * offset_size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted pack entry; length %u too small", entry_len);
+      goto out;
+    }
+  frame_start = entry_len - 2 * offset_size;
+
+  csum_end = read_framing_offset (entry + entry_len - offset_size, offset_size);
+  header_end = read_framing_offset (entry + frame_start, offset_size);
+  header_start = ALIGN_VALUE (csum_end + 1, 4);
+
+  if (G_UNLIKELY (csum_end != 32
+                  || header_start > header_end
+                  || header_end > frame_start))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Corrupted pack entry; invalid framing at offset %" G_GUINT64_FORMAT,
+                   offset);
+      goto out;
+    }
+
+  out_entry->csum = entry;
+  out_entry->flags = entry[csum_end];
+  out_entry->header = entry + header_start;
+  out_entry->header_len = header_end - header_start;
+  out_entry->data = entry + header_end;
+  out_entry->data_len = frame_start - header_end;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_file_pack_entry_parse_header:
+ *
+ * Parse the file header of @entry.  The returned values don't point
+ * into the pack mapping.
+ */
+gboolean
+ostree_file_pack_entry_parse_header (const OstreePackFileEntry  *entry,
+                                     gboolean                    trusted,
+                                     GFileInfo                 **out_info,
+                                     GVariant                  **out_xattrs,
+                                     GError                    **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *mapped_xattrs = NULL;
+  ot_lobj GFileInfo *ret_info = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
+
+  file_header = g_variant_new_from_data (OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                         entry->header, entry->header_len,
+                                         trusted, NULL, NULL);
+  g_variant_ref_sink (file_header);
+
+  if (!ostree_file_header_parse (file_header, &ret_info,
+                                 out_xattrs ? &mapped_xattrs : NULL, error))
+    goto out;
+  g_file_info_set_size (ret_info, entry->data_len);
+
+  if (mapped_xattrs)
+    {
+      gsize size = g_variant_get_size (mapped_xattrs);
+      ret_xattrs = g_variant_new_from_data (G_VARIANT_TYPE ("a(ayay)"),
+                                            g_memdup (g_variant_get_data (mapped_xattrs), size),
+                                            size, TRUE, g_free, NULL);
+      g_variant_ref_sink (ret_xattrs);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_info, &ret_info);
+  ot_transfer_out_value (out_xattrs, &ret_xattrs);
+ out:
+  return ret;
+}
+
+/**
+ * ostree_file_pack_entry_new_input:
+ *
+ * Returns: (transfer full): A stream of the content of @entry, reading
+ * directly from the pack mapping, which must outlive it
+ */
+GInputStream *
+ostree_file_pack_entry_new_input (const OstreePackFileEntry *entry)
+{
+  GInputStream *memory_input;
+  GConverter *decompressor;
+  GInputStream *ret_input;
+
+  memory_input = g_memory_input_stream_new_from_data (entry->data, entry->data_len, NULL);
+  if (!(entry->flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP))
+    return memory_input;
+
+  decompressor = (GConverter*)g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  ret_input = (GInputStream*)g_object_new (G_TYPE_CONVERTER_INPUT_STREAM,
+                                           "converter", decompressor,
+                                           "base-stream", memory_input,
+                                           "close-base-stream", TRUE,
+                                           NULL);
+  g_object_unref (decompressor);
+  g_object_unref (memory_input);
+  return ret_input;
+}
+
 gboolean
 ostree_parse_file_pack_entry (GVariant       *pack_entry,
                               GInputStream  **out_input,
@@ -1858,3 +2187,111 @@ ostree_validate_structureof_pack_superindex (GVariant      *superindex,
     g_variant_iter_free (content_iter);
   return ret;
 }
+
+gboolean
+ostree_validate_structureof_refs_summary (GVariant      *summary,
+                                          GError       **error)
+{
+  gboolean ret = FALSE;
+  const char *header;
+  const char *prev_name = NULL;
+  guint i, n;
+  ot_lvariant GVariant *refs = NULL;
+
+  if (!validate_variant (summary, OSTREE_REFS_SUMMARY_VARIANT_FORMAT, error))
+    goto out;
+
+  g_variant_get_child (summary, 0, "&s", &header);
+
+  if (strcmp (header, "OSTv0REFSUMMARY") != 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Invalid refs summary; doesn't match header");
+      goto out;
+    }
+
+  refs = g_variant_get_child_value (summary, 2);
+  n = g_variant_n_children (refs);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      ot_lvariant GVariant *csum_v = NULL;
+      guint64 size, timestamp;
+
+      g_variant_get_child (refs, i, "(&s@aytt)", &name, &csum_v, &size, &timestamp);
+
+      if (!ostree_validate_rev (name, error))
+        goto out;
+      if (!ostree_validate_structureof_csum_v (csum_v, error))
+        goto out;
+      if (prev_name && strcmp (prev_name, name) >= 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid refs summary; '%s' is out of order", name);
+          goto out;
+        }
+      prev_name = name;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_refs_summary_lookup:
+ * @summary: A validated refs summary
+ * @out_checksum: (allow-none): Commit checksum of @ref
+ * @out_commit_size: (allow-none): Size of the commit object
+ * @out_timestamp: (allow-none): Timestamp of the commit
+ *
+ * Binary search for @ref; the summary is not parsed otherwise.
+ *
+ * Returns: %TRUE if @ref is in @summary
+ */
+gboolean
+ostree_refs_summary_lookup (GVariant      *summary,
+                            const char    *ref,
+                            char         **out_checksum,
+                            guint64       *out_commit_size,
+                            guint64       *out_timestamp)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *refs = NULL;
+  gsize lo, hi;
+
+  refs = g_variant_get_child_value (summary, 2);
+  lo = 0;
+  hi = g_variant_n_children (refs);
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      ot_lvariant GVariant *entry = NULL;
+      ot_lvariant GVariant *csum_v = NULL;
+      const char *name;
+      guint64 size, timestamp;
+      int c;
+
+      entry = g_variant_get_child_value (refs, mid);
+      g_variant_get_child (entry, 0, "&s", &name);
+      c = strcmp (ref, name);
+      if (c < 0)
+        hi = mid;
+      else if (c > 0)
+        lo = mid + 1;
+      else
+        {
+          g_variant_get (entry, "(&s@aytt)", &name, &csum_v, &size, &timestamp);
+          if (out_checksum)
+            *out_checksum = ostree_checksum_from_bytes_v (csum_v);
+          if (out_commit_size)
+            *out_commit_size = GUINT64_FROM_BE (size);
+          if (out_timestamp)
+            *out_timestamp = GUINT64_FROM_BE (timestamp);
+          ret = TRUE;
+          break;
+        }
+    }
+
+  return ret;
+}
@@ -95,6 +95,14 @@ typedef enum {
  */
 #define OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}a(ayay)a(ayay))")
 
+/* Refs summary, written next to the text refs/summary as refs/summary.v
+ * s - OSTv0REFSUMMARY
+ * a{sv} - Metadata
+ * a(saytt) - (ref name, commit checksum, commit object size, commit
+ *            timestamp); sorted by name, integers are big-endian
+ */
+#define OSTREE_REFS_SUMMARY_VARIANT_FORMAT G_VARIANT_TYPE ("(sa{sv}a(saytt))")
+
 /* Pack index
  * s - OSTv0PACKINDEX
  * a{sv} - Metadata
@@ -134,9 +142,13 @@ const GVariantType *ostree_metadata_variant_type (OstreeObjectType objtype);
 gboolean ostree_validate_checksum_string (const char *sha256,
                                           GError    **error);
 
+void ostree_checksum_inplace_to_bytes (const char *checksum,
+                                       guchar     *buf);
 guchar *ostree_checksum_to_bytes (const char *checksum);
 GVariant *ostree_checksum_to_bytes_v (const char *checksum);
 
+void ostree_checksum_inplace_from_bytes (const guchar *bytes,
+                                         char         *buf);
 char * ostree_checksum_from_bytes (const guchar *bytes);
 char * ostree_checksum_from_bytes_v (GVariant *bytes);
 
@@ -191,6 +203,9 @@ gboolean ostree_get_xattrs_for_file (GFile         *f,
 gboolean ostree_set_xattrs (GFile *f, GVariant *xattrs,
                             GCancellable *cancellable, GError **error);
 
+gboolean ostree_set_xattrs_fd (int fd, GVariant *xattrs,
+                               GCancellable *cancellable, GError **error);
+
 gboolean ostree_map_metadata_file (GFile                       *file,
                                    OstreeObjectType             expected_type,
                                    GVariant                   **out_variant,
@@ -203,7 +218,7 @@ gboolean ostree_write_variant_with_size (GOutputStream      *output,
                                          GVariant           *variant,
                                          guint64             alignment_offset,
                                          gsize              *out_bytes_written,
-                                         GChecksum          *checksum,
+                                         OtChecksum         *checksum,
                                          GCancellable       *cancellable,
                                          GError            **error);
 
@@ -231,7 +246,7 @@ gboolean ostree_content_file_parse (GFile                  *content_path,
 
 gboolean ostree_write_file_header_update_checksum (GOutputStream         *out,
                                                    GVariant              *header,
-                                                   GChecksum             *checksum,
+                                                   OtChecksum            *checksum,
                                                    GCancellable          *cancellable,
                                                    GError               **error);
 
@@ -286,6 +301,7 @@ gboolean ostree_create_temp_file_from_input (GFile            *dir,
                                              GVariant         *xattrs,
                                              GInputStream     *input,
                                              GFile           **out_file,
+                                             guint64          *out_bytes_written,
                                              GCancellable     *cancellable,
                                              GError          **error);
 
@@ -313,6 +329,35 @@ gboolean ostree_read_pack_entry_raw (guchar           *pack_data,
                                      GCancellable     *cancellable,
                                      GError          **error);
 
+/**
+ * OstreePackFileEntry:
+ *
+ * An entry of a data pack, pointing into the mapped pack file.
+ * @data is compressed if @flags has %OSTREE_PACK_FILE_ENTRY_FLAG_GZIP.
+ */
+typedef struct {
+  const guchar *csum;
+  guchar        flags;
+  const guchar *header;
+  gsize         header_len;
+  const guchar *data;
+  gsize         data_len;
+} OstreePackFileEntry;
+
+gboolean ostree_read_file_pack_entry (guchar               *pack_data,
+                                      guint64               pack_len,
+                                      guint64               object_offset,
+                                      OstreePackFileEntry  *out_entry,
+                                      GError              **error);
+
+gboolean ostree_file_pack_entry_parse_header (const OstreePackFileEntry  *entry,
+                                              gboolean                    trusted,
+                                              GFileInfo                 **out_info,
+                                              GVariant                  **out_xattrs,
+                                              GError                    **error);
+
+GInputStream *ostree_file_pack_entry_new_input (const OstreePackFileEntry *entry);
+
 gboolean ostree_parse_file_pack_entry (GVariant       *pack_entry,
                                        GInputStream  **out_input,
                                        GFileInfo     **out_info,
@@ -354,4 +399,13 @@ gboolean ostree_validate_structureof_pack_index (GVariant      *index,
 gboolean ostree_validate_structureof_pack_superindex (GVariant      *superindex,
                                                       GError       **error);
 
+gboolean ostree_validate_structureof_refs_summary (GVariant      *summary,
+                                                   GError       **error);
+
+gboolean ostree_refs_summary_lookup (GVariant      *summary,
+                                     const char    *ref,
+                                     char         **out_checksum,
+                                     guint64       *out_commit_size,
+                                     guint64       *out_timestamp);
+
 #endif /* _OSTREE_REPO */
@@ -0,0 +1,482 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include "ostree.h"
+#include "otutil.h"
+
+OstreeDiffItem *
+ostree_diff_item_ref (OstreeDiffItem *diffitem)
+{
+  g_atomic_int_inc (&diffitem->refcount);
+  return diffitem;
+}
+
+void
+ostree_diff_item_unref (OstreeDiffItem *diffitem)
+{
+  if (!g_atomic_int_dec_and_test (&diffitem->refcount))
+    return;
+
+  g_free (diffitem->path);
+  g_free (diffitem->src_checksum);
+  g_free (diffitem->src_meta_checksum);
+  g_free (diffitem->target_checksum);
+  g_free (diffitem->target_meta_checksum);
+  g_free (diffitem);
+}
+
+static OstreeDiffItem *
+diff_item_new (const char       *path,
+               OstreeObjectType  objtype,
+               GVariant         *src_csum_v,
+               GVariant         *src_meta_csum_v,
+               GVariant         *target_csum_v,
+               GVariant         *target_meta_csum_v)
+{
+  OstreeDiffItem *ret = g_new0 (OstreeDiffItem, 1);
+  ret->refcount = 1;
+  ret->path = g_strdup (path);
+  ret->objtype = objtype;
+  ret->src_checksum = src_csum_v ? ostree_checksum_from_bytes_v (src_csum_v) : NULL;
+  ret->src_meta_checksum = src_meta_csum_v ? ostree_checksum_from_bytes_v (src_meta_csum_v) : NULL;
+  ret->target_checksum = target_csum_v ? ostree_checksum_from_bytes_v (target_csum_v) : NULL;
+  ret->target_meta_checksum = target_meta_csum_v ? ostree_checksum_from_bytes_v (target_meta_csum_v) : NULL;
+  return ret;
+}
+
+static gboolean
+csum_v_equal (GVariant *a,
+              GVariant *b)
+{
+  return ostree_cmp_checksum_bytes (ostree_checksum_bytes_peek (a),
+                                    ostree_checksum_bytes_peek (b)) == 0;
+}
+
+static void
+path_append (GString    *path,
+             const char *name)
+{
+  if (path->len == 0 || path->str[path->len - 1] != '/')
+    g_string_append_c (path, '/');
+  g_string_append (path, name);
+}
+
+/* Entries in a dirtree are sorted by name (see
+ * create_tree_variant_from_hashes()), so both sides can be walked in
+ * a single merge pass.  This is the comparison used for that.
+ */
+static int
+compare_entry_names (const char *a,
+                     const char *b)
+{
+  if (a == NULL)
+    return 1;
+  else if (b == NULL)
+    return -1;
+  return strcmp (a, b);
+}
+
+/* Binary search for @name in the sorted file or directory list
+ * @entries; returns its index, or -1.
+ */
+static gssize
+find_entry (GVariant   *entries,
+            const char *name)
+{
+  gsize lo = 0;
+  gsize hi = g_variant_n_children (entries);
+
+  while (lo < hi)
+    {
+      gsize mid = lo + (hi - lo) / 2;
+      const char *mid_name;
+      ot_lvariant GVariant *entry = NULL;
+      int cmp;
+
+      entry = g_variant_get_child_value (entries, mid);
+      g_variant_get_child (entry, 0, "&s", &mid_name);
+      cmp = strcmp (name, mid_name);
+      if (cmp == 0)
+        return (gssize) mid;
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return -1;
+}
+
+static void
+diff_files_merge (GVariant      *src_files,
+                  GVariant      *target_files,
+                  GVariant      *src_dirs,
+                  GVariant      *target_dirs,
+                  GString       *path,
+                  GPtrArray     *modified,
+                  GPtrArray     *removed,
+                  GPtrArray     *added)
+{
+  gsize base_len = path->len;
+  gsize n_src, n_target;
+  gsize i, j;
+
+  n_src = g_variant_n_children (src_files);
+  n_target = g_variant_n_children (target_files);
+
+  i = j = 0;
+  while (i < n_src || j < n_target)
+    {
+      const char *src_name = NULL;
+      const char *target_name = NULL;
+      ot_lvariant GVariant *src_csum_v = NULL;
+      ot_lvariant GVariant *target_csum_v = NULL;
+      int cmp;
+
+      if (i < n_src)
+        g_variant_get_child (src_files, i, "(&s@ay)", &src_name, &src_csum_v);
+      if (j < n_target)
+        g_variant_get_child (target_files, j, "(&s@ay)", &target_name, &target_csum_v);
+
+      cmp = compare_entry_names (src_name, target_name);
+      if (cmp == 0)
+        {
+          if (!csum_v_equal (src_csum_v, target_csum_v))
+            {
+              path_append (path, src_name);
+              g_ptr_array_add (modified, diff_item_new (path->str, OSTREE_OBJECT_TYPE_FILE,
+                                                        src_csum_v, NULL,
+                                                        target_csum_v, NULL));
+              g_string_truncate (path, base_len);
+            }
+          i++;
+          j++;
+        }
+      else if (cmp < 0)
+        {
+          gssize dir_index = find_entry (target_dirs, src_name);
+
+          path_append (path, src_name);
+          if (dir_index >= 0)
+            {
+              ot_lvariant GVariant *dir_csum_v = NULL;
+              ot_lvariant GVariant *dir_meta_csum_v = NULL;
+
+              /* File replaced by a directory */
+              g_variant_get_child (target_dirs, dir_index, "(&s@ay@ay)",
+                                   NULL, &dir_csum_v, &dir_meta_csum_v);
+              g_ptr_array_add (modified, diff_item_new (path->str, OSTREE_OBJECT_TYPE_FILE,
+                                                        src_csum_v, NULL,
+                                                        dir_csum_v, dir_meta_csum_v));
+            }
+          else
+            g_ptr_array_add (removed, diff_item_new (path->str, OSTREE_OBJECT_TYPE_FILE,
+                                                     src_csum_v, NULL, NULL, NULL));
+          g_string_truncate (path, base_len);
+          i++;
+        }
+      else
+        {
+          /* A directory replaced by this file is reported with the directories */
+          if (find_entry (src_dirs, target_name) < 0)
+            {
+              path_append (path, target_name);
+              g_ptr_array_add (added, diff_item_new (path->str, OSTREE_OBJECT_TYPE_FILE,
+                                                     NULL, NULL, target_csum_v, NULL));
+              g_string_truncate (path, base_len);
+            }
+          j++;
+        }
+    }
+}
+
+static gboolean
+diff_dirtrees_internal (OstreeRepo       *repo,
+                        GVariant         *src_csum_v,
+                        GVariant         *target_csum_v,
+                        GString          *path,
+                        int               recursion_depth,
+                        GPtrArray        *modified,
+                        GPtrArray        *removed,
+                        GPtrArray        *added,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  gboolean ret = FALSE;
+  gsize base_len = path->len;
+  gsize n_src, n_target;
+  gsize i, j;
+  ot_lvariant GVariant *src_tree = NULL;
+  ot_lvariant GVariant *target_tree = NULL;
+  ot_lvariant GVariant *src_files = NULL;
+  ot_lvariant GVariant *target_files = NULL;
+  ot_lvariant GVariant *src_dirs = NULL;
+  ot_lvariant GVariant *target_dirs = NULL;
+  ot_lptrarray GPtrArray *level_added = NULL;
+
+  if (recursion_depth > OSTREE_MAX_RECURSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Maximum recursion limit reached during diff");
+      goto out;
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (!ostree_repo_load_variant_c (repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                   ostree_checksum_bytes_peek (src_csum_v),
+                                   &src_tree, error))
+    goto out;
+  if (!ostree_repo_load_variant_c (repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                   ostree_checksum_bytes_peek (target_csum_v),
+                                   &target_tree, error))
+    goto out;
+
+  /* Entries added at this level are listed after those found by
+   * recursing into common subdirectories, as the GFile walk in
+   * "ostree diff" always did.
+   */
+  level_added = g_ptr_array_new ();
+
+  /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
+  src_files = g_variant_get_child_value (src_tree, 0);
+  target_files = g_variant_get_child_value (target_tree, 0);
+  src_dirs = g_variant_get_child_value (src_tree, 1);
+  target_dirs = g_variant_get_child_value (target_tree, 1);
+  diff_files_merge (src_files, target_files, src_dirs, target_dirs,
+                    path, modified, removed, level_added);
+
+  n_src = g_variant_n_children (src_dirs);
+  n_target = g_variant_n_children (target_dirs);
+
+  i = j = 0;
+  while (i < n_src || j < n_target)
+    {
+      const char *src_name = NULL;
+      const char *target_name = NULL;
+      ot_lvariant GVariant *src_content_csum_v = NULL;
+      ot_lvariant GVariant *src_meta_csum_v = NULL;
+      ot_lvariant GVariant *target_content_csum_v = NULL;
+      ot_lvariant GVariant *target_meta_csum_v = NULL;
+      int cmp;
+
+      if (i < n_src)
+        g_variant_get_child (src_dirs, i, "(&s@ay@ay)",
+                             &src_name, &src_content_csum_v, &src_meta_csum_v);
+      if (j < n_target)
+        g_variant_get_child (target_dirs, j, "(&s@ay@ay)",
+                             &target_name, &target_content_csum_v, &target_meta_csum_v);
+
+      cmp = compare_entry_names (src_name, target_name);
+      if (cmp == 0)
+        {
+          gboolean meta_equal = csum_v_equal (src_meta_csum_v, target_meta_csum_v);
+          gboolean contents_equal = csum_v_equal (src_content_csum_v, target_content_csum_v);
+
+          /* Identical subtrees are skipped without loading them */
+          if (!(meta_equal && contents_equal))
+            {
+              path_append (path, src_name);
+              if (!meta_equal)
+                g_ptr_array_add (modified, diff_item_new (path->str, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                                          src_content_csum_v, src_meta_csum_v,
+                                                          target_content_csum_v, target_meta_csum_v));
+              if (!contents_equal)
+                {
+                  if (!diff_dirtrees_internal (repo, src_content_csum_v, target_content_csum_v,
+                                               path, recursion_depth + 1,
+                                               modified, removed, added,
+                                               cancellable, error))
+                    goto out;
+                }
+              g_string_truncate (path, base_len);
+            }
+          i++;
+          j++;
+        }
+      else if (cmp < 0)
+        {
+          gssize file_index = find_entry (target_files, src_name);
+
+          path_append (path, src_name);
+          if (file_index >= 0)
+            {
+              ot_lvariant GVariant *file_csum_v = NULL;
+
+              /* Directory replaced by a file */
+              g_variant_get_child (target_files, file_index, "(&s@ay)",
+                                   NULL, &file_csum_v);
+              g_ptr_array_add (modified, diff_item_new (path->str, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                                        src_content_csum_v, src_meta_csum_v,
+                                                        file_csum_v, NULL));
+            }
+          else
+            g_ptr_array_add (removed, diff_item_new (path->str, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                                     src_content_csum_v, src_meta_csum_v,
+                                                     NULL, NULL));
+          g_string_truncate (path, base_len);
+          i++;
+        }
+      else
+        {
+          /* A file replaced by this directory was reported with the files */
+          if (find_entry (src_files, target_name) < 0)
+            {
+              path_append (path, target_name);
+              g_ptr_array_add (level_added, diff_item_new (path->str, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                                           NULL, NULL,
+                                                           target_content_csum_v, target_meta_csum_v));
+              g_string_truncate (path, base_len);
+            }
+          j++;
+        }
+    }
+
+  /* Transfer ownership */
+  for (i = 0; i < level_added->len; i++)
+    g_ptr_array_add (added, level_added->pdata[i]);
+  g_ptr_array_set_size (level_added, 0);
+
+  ret = TRUE;
+ out:
+  if (level_added)
+    {
+      for (i = 0; i < level_added->len; i++)
+        ostree_diff_item_unref (level_added->pdata[i]);
+    }
+  return ret;
+}
+
+/**
+ * ostree_diff_dirtrees:
+ * @repo: Repository
+ * @src_contents_checksum: Dirtree checksum of the old tree
+ * @target_contents_checksum: Dirtree checksum of the new tree
+ * @modified: (element-type OstreeDiffItem): Changed entries are appended here
+ * @removed: (element-type OstreeDiffItem): Entries only in the source are appended here
+ * @added: (element-type OstreeDiffItem): Entries only in the target are appended here
+ * @cancellable:
+ * @error:
+ *
+ * Compute the difference between two dirtree objects, by walking
+ * both sorted entry lists in parallel.  Subdirectories whose dirtree
+ * and dirmeta checksums are identical on both sides are skipped
+ * without being loaded.
+ *
+ * Added and removed directories are reported once; their contents
+ * are not listed.  Like "ostree diff" on directories, a directory is
+ * only reported as modified if its metadata changed; changes to its
+ * contents are reported for the entries themselves.  An entry that
+ * changes between file and directory is reported as modified, with
+ * @objtype and the source checksums describing the old entry, and the
+ * target checksums the new one.
+ */
+gboolean
+ostree_diff_dirtrees (OstreeRepo         *repo,
+                      const char         *src_contents_checksum,
+                      const char         *target_contents_checksum,
+                      GPtrArray          *modified,
+                      GPtrArray          *removed,
+                      GPtrArray          *added,
+                      GCancellable       *cancellable,
+                      GError            **error)
+{
+  gboolean ret = FALSE;
+  GString *path = NULL;
+  ot_lvariant GVariant *src_csum_v = NULL;
+  ot_lvariant GVariant *target_csum_v = NULL;
+
+  if (strcmp (src_contents_checksum, target_contents_checksum) == 0)
+    return TRUE;
+
+  src_csum_v = ostree_checksum_to_bytes_v (src_contents_checksum);
+  g_variant_ref_sink (src_csum_v);
+  target_csum_v = ostree_checksum_to_bytes_v (target_contents_checksum);
+  g_variant_ref_sink (target_csum_v);
+
+  path = g_string_new ("");
+  if (!diff_dirtrees_internal (repo, src_csum_v, target_csum_v, path, 0,
+                               modified, removed, added,
+                               cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (path)
+    g_string_free (path, TRUE);
+  return ret;
+}
+
+/**
+ * ostree_diff_commits:
+ *
+ * Like ostree_diff_dirtrees(), but for the root trees of two commit
+ * objects.  As with other directories, the root directory itself is
+ * never reported as modified.
+ */
+gboolean
+ostree_diff_commits (OstreeRepo         *repo,
+                     const char         *src_commit,
+                     const char         *target_commit,
+                     GPtrArray          *modified,
+                     GPtrArray          *removed,
+                     GPtrArray          *added,
+                     GCancellable       *cancellable,
+                     GError            **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *src_commit_v = NULL;
+  ot_lvariant GVariant *target_commit_v = NULL;
+  ot_lvariant GVariant *src_content_csum_v = NULL;
+  ot_lvariant GVariant *target_content_csum_v = NULL;
+  GString *path = NULL;
+
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, src_commit,
+                                 &src_commit_v, error))
+    goto out;
+  if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT, target_commit,
+                                 &target_commit_v, error))
+    goto out;
+
+  /* PARSE OSTREE_SERIALIZED_COMMIT_VARIANT */
+  g_variant_get_child (src_commit_v, 6, "@ay", &src_content_csum_v);
+  g_variant_get_child (target_commit_v, 6, "@ay", &target_content_csum_v);
+
+  if (!csum_v_equal (src_content_csum_v, target_content_csum_v))
+    {
+      path = g_string_new ("");
+      if (!diff_dirtrees_internal (repo, src_content_csum_v, target_content_csum_v,
+                                   path, 0, modified, removed, added,
+                                   cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (path)
+    g_string_free (path, TRUE);
+  return ret;
+}
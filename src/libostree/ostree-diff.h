@@ -0,0 +1,81 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+#ifndef _OSTREE_DIFF
+#define _OSTREE_DIFF
+
+#include "ostree-core.h"
+#include "ostree-types.h"
+
+G_BEGIN_DECLS
+
+/**
+ * OstreeDiffItem:
+ *
+ * One changed entry between two trees.  For files (@objtype is
+ * %OSTREE_OBJECT_TYPE_FILE), the checksums are content object
+ * checksums.  For directories (@objtype is
+ * %OSTREE_OBJECT_TYPE_DIR_TREE), they are dirtree checksums, and the
+ * meta checksums hold the dirmeta checksums.  Checksums for the side
+ * where the entry doesn't exist are %NULL.
+ *
+ * If the entry changed between file and directory, @objtype is its
+ * type in the source, and the target checksums are those of the new
+ * entry; so the target is a directory exactly when
+ * @target_meta_checksum is set.
+ */
+typedef struct {
+  volatile gint refcount;
+
+  char *path;
+  OstreeObjectType objtype;
+
+  char *src_checksum;
+  char *src_meta_checksum;
+  char *target_checksum;
+  char *target_meta_checksum;
+} OstreeDiffItem;
+
+OstreeDiffItem *ostree_diff_item_ref (OstreeDiffItem *diffitem);
+void ostree_diff_item_unref (OstreeDiffItem *diffitem);
+
+gboolean ostree_diff_dirtrees (OstreeRepo         *repo,
+                               const char         *src_contents_checksum,
+                               const char         *target_contents_checksum,
+                               GPtrArray          *modified,
+                               GPtrArray          *removed,
+                               GPtrArray          *added,
+                               GCancellable       *cancellable,
+                               GError            **error);
+
+gboolean ostree_diff_commits (OstreeRepo         *repo,
+                              const char         *src_commit,
+                              const char         *target_commit,
+                              GPtrArray          *modified,
+                              GPtrArray          *removed,
+                              GPtrArray          *added,
+                              GCancellable       *cancellable,
+                              GError            **error);
+
+G_END_DECLS
+
+#endif /* _OSTREE_DIFF */
@@ -22,35 +22,250 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "ostree-mutable-tree.h"
 #include "otutil.h"
 #include "ostree-core.h"
 
+/* Directories with more entries than this get a hash index; below
+ * it, the entry vectors are kept sorted and searched directly.
+ */
+#define OSTREE_MUTABLE_TREE_INDEX_THRESHOLD 64
+
+/**
+ * OstreeMutableTreeArena:
+ *
+ * Shared between a tree and all subdirectories created through it.
+ * Entry names are interned here, so each distinct name is stored
+ * once per tree, without per-string allocation overhead.
+ */
+typedef struct {
+  volatile gint refcount;
+  GStringChunk *names;
+} OstreeMutableTreeArena;
+
+typedef struct {
+  const char *name; /* Interned in the arena */
+  guchar csum[32];
+} OstreeMutableTreeFile;
+
+typedef struct {
+  const char *name; /* Interned in the arena */
+  OstreeMutableTree *tree;
+} OstreeMutableTreeDir;
+
+/* The entry structs above all start with the name */
+typedef struct {
+  GArray *entries;
+  GHashTable *index; /* name -> position + 1, only for large vectors */
+  gboolean sorted;
+} OstreeMutableTreeVec;
+
 struct OstreeMutableTree
 {
   GObject parent_instance;
 
-  char *contents_checksum;
-  char *metadata_checksum;
+  OstreeMutableTreeArena *arena;
+
+  char contents_checksum[65];
+  char metadata_checksum[65];
+
+  OstreeMutableTreeVec files;
+  OstreeMutableTreeVec subdirs;
 
-  GHashTable *files;
-  GHashTable *subdirs;
+  /* Only allocated by the hash table getters */
+  GHashTable *files_table;
+  GHashTable *subdirs_table;
 };
 
 G_DEFINE_TYPE (OstreeMutableTree, ostree_mutable_tree, G_TYPE_OBJECT)
 
+static OstreeMutableTreeArena *
+arena_new (void)
+{
+  OstreeMutableTreeArena *arena = g_slice_new (OstreeMutableTreeArena);
+  arena->refcount = 1;
+  arena->names = g_string_chunk_new (4096);
+  return arena;
+}
+
+static OstreeMutableTreeArena *
+arena_ref (OstreeMutableTreeArena *arena)
+{
+  g_atomic_int_inc (&arena->refcount);
+  return arena;
+}
+
+static void
+arena_unref (OstreeMutableTreeArena *arena)
+{
+  if (!g_atomic_int_dec_and_test (&arena->refcount))
+    return;
+  g_string_chunk_free (arena->names);
+  g_slice_free (OstreeMutableTreeArena, arena);
+}
+
+static const char *
+intern_name (OstreeMutableTree *self,
+             const char        *name)
+{
+  if (!self->arena)
+    self->arena = arena_new ();
+  return g_string_chunk_insert_const (self->arena->names, name);
+}
+
+static int
+compare_entry_names (gconstpointer a,
+                     gconstpointer b)
+{
+  return strcmp (*(const char * const *)a, *(const char * const *)b);
+}
+
+static void
+vec_init (OstreeMutableTreeVec *vec,
+          guint                 elt_size)
+{
+  vec->entries = g_array_new (FALSE, FALSE, elt_size);
+  vec->index = NULL;
+  vec->sorted = TRUE;
+}
+
+static void
+vec_clear (OstreeMutableTreeVec *vec)
+{
+  g_array_free (vec->entries, TRUE);
+  if (vec->index)
+    g_hash_table_destroy (vec->index);
+}
+
+static inline const char *
+vec_name (OstreeMutableTreeVec *vec,
+          guint                 i)
+{
+  return *(const char **)(vec->entries->data + i * g_array_get_element_size (vec->entries));
+}
+
+static void
+vec_rebuild_index (OstreeMutableTreeVec *vec)
+{
+  guint i;
+
+  if (vec->index)
+    g_hash_table_remove_all (vec->index);
+  else
+    vec->index = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < vec->entries->len; i++)
+    g_hash_table_insert (vec->index, (char*)vec_name (vec, i), GUINT_TO_POINTER (i + 1));
+}
+
+/*
+ * Returns the position of @name, or the position it would have to
+ * be inserted at to keep the vector sorted, in @out_pos.  Must only
+ * be called on sorted vectors.
+ */
+static gboolean
+vec_bsearch (OstreeMutableTreeVec *vec,
+             const char           *name,
+             guint                *out_pos)
+{
+  guint lo = 0;
+  guint hi = vec->entries->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      int c = strcmp (name, vec_name (vec, mid));
+      if (c == 0)
+        {
+          *out_pos = mid;
+          return TRUE;
+        }
+      else if (c < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  *out_pos = lo;
+  return FALSE;
+}
+
+static gint
+vec_lookup (OstreeMutableTreeVec *vec,
+            const char           *name)
+{
+  guint pos;
+
+  if (vec->index)
+    return (gint)GPOINTER_TO_UINT (g_hash_table_lookup (vec->index, name)) - 1;
+  if (vec_bsearch (vec, name, &pos))
+    return pos;
+  return -1;
+}
+
+/*
+ * Small vectors stay sorted; once a vector has an index, new entries
+ * are appended and the vector is sorted lazily by vec_ensure_sorted().
+ */
+static guint
+vec_insert (OstreeMutableTreeVec *vec,
+            gconstpointer         entry)
+{
+  const char *name = *(const char * const *)entry;
+  guint pos;
+
+  if (vec->index)
+    {
+      pos = vec->entries->len;
+      g_array_append_vals (vec->entries, entry, 1);
+      if (vec->sorted && pos > 0 && strcmp (vec_name (vec, pos - 1), name) > 0)
+        vec->sorted = FALSE;
+      g_hash_table_insert (vec->index, (char*)name, GUINT_TO_POINTER (pos + 1));
+    }
+  else
+    {
+      (void) vec_bsearch (vec, name, &pos);
+      g_array_insert_vals (vec->entries, pos, entry, 1);
+      if (vec->entries->len > OSTREE_MUTABLE_TREE_INDEX_THRESHOLD)
+        vec_rebuild_index (vec);
+    }
+  return pos;
+}
+
+static void
+vec_ensure_sorted (OstreeMutableTreeVec *vec)
+{
+  if (vec->sorted)
+    return;
+  g_array_sort (vec->entries, compare_entry_names);
+  vec_rebuild_index (vec);
+  vec->sorted = TRUE;
+}
+
+#define vec_index(vec, type, i) (&g_array_index ((vec)->entries, type, i))
+
 static void
 ostree_mutable_tree_finalize (GObject *object)
 {
   OstreeMutableTree *self;
+  guint i;
 
   self = OSTREE_MUTABLE_TREE (object);
 
-  g_free (self->contents_checksum);
-  g_free (self->metadata_checksum);
+  for (i = 0; i < self->subdirs.entries->len; i++)
+    g_object_unref (vec_index (&self->subdirs, OstreeMutableTreeDir, i)->tree);
+
+  vec_clear (&self->files);
+  vec_clear (&self->subdirs);
 
-  g_hash_table_destroy (self->files);
-  g_hash_table_destroy (self->subdirs);
+  if (self->files_table)
+    g_hash_table_destroy (self->files_table);
+  if (self->subdirs_table)
+    g_hash_table_destroy (self->subdirs_table);
+
+  if (self->arena)
+    arena_unref (self->arena);
 
   G_OBJECT_CLASS (ostree_mutable_tree_parent_class)->finalize (object);
 }
@@ -66,41 +281,59 @@ ostree_mutable_tree_class_init (OstreeMutableTreeClass *klass)
 static void
 ostree_mutable_tree_init (OstreeMutableTree *self)
 {
-  self->files = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                       g_free, g_free);
-  self->subdirs = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                         g_free, (GDestroyNotify)g_object_unref);
+  vec_init (&self->files, sizeof (OstreeMutableTreeFile));
+  vec_init (&self->subdirs, sizeof (OstreeMutableTreeDir));
+}
+
+static OstreeMutableTree *
+mutable_tree_new_child (OstreeMutableTree *parent)
+{
+  OstreeMutableTree *ret = g_object_new (OSTREE_TYPE_MUTABLE_TREE, NULL);
+  if (!parent->arena)
+    parent->arena = arena_new ();
+  ret->arena = arena_ref (parent->arena);
+  return ret;
+}
+
+static void
+set_checksum_buf (char       *buf,
+                  const char *checksum)
+{
+  if (checksum)
+    {
+      g_assert (strlen (checksum) == 64);
+      memcpy (buf, checksum, 65);
+    }
+  else
+    buf[0] = '\0';
 }
 
 void
 ostree_mutable_tree_set_metadata_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
 {
-  g_free (self->metadata_checksum);
-  self->metadata_checksum = g_strdup (checksum);
+  set_checksum_buf (self->metadata_checksum, checksum);
 }
 
 const char *
 ostree_mutable_tree_get_metadata_checksum (OstreeMutableTree *self)
 {
-  return self->metadata_checksum;
+  return self->metadata_checksum[0] ? self->metadata_checksum : NULL;
 }
 
 void
 ostree_mutable_tree_set_contents_checksum (OstreeMutableTree *self,
                                            const char        *checksum)
 {
-  g_free (self->contents_checksum);
-  self->contents_checksum = g_strdup (checksum);
+  set_checksum_buf (self->contents_checksum, checksum);
 }
 
 const char *
 ostree_mutable_tree_get_contents_checksum (OstreeMutableTree *self)
 {
-  GHashTableIter iter;
-  gpointer key, value;
+  guint i;
 
-  if (!self->contents_checksum)
+  if (!self->contents_checksum[0])
     return NULL;
 
   /* Ensure the cache is valid; this implementation is a bit
@@ -110,14 +343,12 @@ ostree_mutable_tree_get_contents_checksum (OstreeMutableTree *self)
    *
    * However, we only call this function once right now.
    */
-  g_hash_table_iter_init (&iter, self->subdirs);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for (i = 0; i < self->subdirs.entries->len; i++)
     {
-      OstreeMutableTree *subdir = value;
+      OstreeMutableTree *subdir = vec_index (&self->subdirs, OstreeMutableTreeDir, i)->tree;
       if (!ostree_mutable_tree_get_contents_checksum (subdir))
         {
-          g_free (self->contents_checksum);
-          self->contents_checksum = NULL;
+          self->contents_checksum[0] = '\0';
           return NULL;
         }
     }
@@ -134,6 +365,32 @@ set_error_noent (GError **error, const char *path)
   return FALSE;
 }
 
+static OstreeMutableTree *
+lookup_subdir (OstreeMutableTree *self,
+               const char        *name)
+{
+  gint i = vec_lookup (&self->subdirs, name);
+  if (i < 0)
+    return NULL;
+  return vec_index (&self->subdirs, OstreeMutableTreeDir, i)->tree;
+}
+
+static OstreeMutableTree *
+insert_subdir (OstreeMutableTree *self,
+               const char        *name)
+{
+  OstreeMutableTreeDir dir;
+
+  dir.name = intern_name (self, name);
+  dir.tree = mutable_tree_new_child (self);
+  (void) vec_insert (&self->subdirs, &dir);
+
+  if (self->subdirs_table)
+    g_hash_table_replace (self->subdirs_table, g_strdup (name), g_object_ref (dir.tree));
+
+  return dir.tree;
+}
+
 gboolean
 ostree_mutable_tree_replace_file (OstreeMutableTree *self,
                                   const char        *name,
@@ -141,8 +398,9 @@ ostree_mutable_tree_replace_file (OstreeMutableTree *self,
                                   GError           **error)
 {
   gboolean ret = FALSE;
+  gint i;
 
-  if (g_hash_table_lookup (self->subdirs, name))
+  if (lookup_subdir (self, name))
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Can't replace directory with file: %s", name);
@@ -150,9 +408,23 @@ ostree_mutable_tree_replace_file (OstreeMutableTree *self,
     }
 
   ostree_mutable_tree_set_contents_checksum (self, NULL);
-  g_hash_table_replace (self->files,
-                        g_strdup (name),
-                        g_strdup (checksum));
+
+  i = vec_lookup (&self->files, name);
+  if (i >= 0)
+    {
+      ostree_checksum_inplace_to_bytes (checksum, vec_index (&self->files, OstreeMutableTreeFile, i)->csum);
+    }
+  else
+    {
+      OstreeMutableTreeFile file;
+
+      file.name = intern_name (self, name);
+      ostree_checksum_inplace_to_bytes (checksum, file.csum);
+      (void) vec_insert (&self->files, &file);
+    }
+
+  if (self->files_table)
+    g_hash_table_replace (self->files_table, g_strdup (name), g_strdup (checksum));
 
   ret = TRUE;
  out:
@@ -170,19 +442,18 @@ ostree_mutable_tree_ensure_dir (OstreeMutableTree *self,
 
   g_return_val_if_fail (name != NULL, FALSE);
 
-  if (g_hash_table_lookup (self->files, name))
+  if (vec_lookup (&self->files, name) >= 0)
     {
       g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                    "Can't replace file with directory: %s", name);
       goto out;
     }
 
-  ret_dir = ot_gobject_refz (g_hash_table_lookup (self->subdirs, name));
+  ret_dir = ot_gobject_refz (lookup_subdir (self, name));
   if (!ret_dir)
     {
-      ret_dir = ostree_mutable_tree_new ();
       ostree_mutable_tree_set_contents_checksum (self, NULL);
-      g_hash_table_insert (self->subdirs, g_strdup (name), g_object_ref (ret_dir));
+      ret_dir = g_object_ref (insert_subdir (self, name));
     }
   
   ret = TRUE;
@@ -202,15 +473,16 @@ ostree_mutable_tree_lookup (OstreeMutableTree   *self,
   ot_lobj OstreeMutableTree *ret_subdir = NULL;
   ot_lfree char *ret_file_checksum = NULL;
   
-  ret_subdir = ot_gobject_refz (g_hash_table_lookup (self->subdirs, name));
+  ret_subdir = ot_gobject_refz (lookup_subdir (self, name));
   if (!ret_subdir)
     {
-      ret_file_checksum = g_strdup (g_hash_table_lookup (self->files, name));
-      if (!ret_file_checksum)
+      gint i = vec_lookup (&self->files, name);
+      if (i < 0)
         {
           set_error_noent (error, name);
           goto out;
         }
+      ret_file_checksum = ostree_checksum_from_bytes (vec_index (&self->files, OstreeMutableTreeFile, i)->csum);
     }
 
   ret = TRUE;
@@ -234,7 +506,7 @@ ostree_mutable_tree_ensure_parent_dirs (OstreeMutableTree  *self,
 
   g_assert (metadata_checksum != NULL);
 
-  if (!self->metadata_checksum)
+  if (!self->metadata_checksum[0])
     ostree_mutable_tree_set_metadata_checksum (self, metadata_checksum);
 
   for (i = 0; i+1 < split_path->len; i++)
@@ -242,19 +514,18 @@ ostree_mutable_tree_ensure_parent_dirs (OstreeMutableTree  *self,
       OstreeMutableTree *next;
       const char *name = split_path->pdata[i];
 
-      if (g_hash_table_lookup (subdir->files, name))
+      if (vec_lookup (&subdir->files, name) >= 0)
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
                        "Can't replace file with directory: %s", name);
           goto out;
         }
 
-      next = g_hash_table_lookup (subdir->subdirs, name);
+      next = lookup_subdir (subdir, name);
       if (!next) 
         {
-          next = ostree_mutable_tree_new ();
+          next = insert_subdir (subdir, name);
           ostree_mutable_tree_set_metadata_checksum (next, metadata_checksum);
-          g_hash_table_insert (subdir->subdirs, g_strdup (name), next);
         }
       
       subdir = next;
@@ -288,7 +559,7 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
     {
       OstreeMutableTree *subdir;
 
-      subdir = g_hash_table_lookup (self->subdirs, split_path->pdata[start]);
+      subdir = lookup_subdir (self, split_path->pdata[start]);
       if (!subdir)
         return set_error_noent (error, (char*)split_path->pdata[start]);
 
@@ -296,16 +567,127 @@ ostree_mutable_tree_walk (OstreeMutableTree     *self,
     }
 }
 
+/**
+ * ostree_mutable_tree_get_n_files:
+ *
+ * Returns the number of files directly in @self.  The indexed file
+ * accessors return entries sorted by name, in the order they appear
+ * in the serialized dirtree.
+ */
+guint
+ostree_mutable_tree_get_n_files (OstreeMutableTree *self)
+{
+  vec_ensure_sorted (&self->files);
+  return self->files.entries->len;
+}
+
+const char *
+ostree_mutable_tree_get_file_name (OstreeMutableTree *self,
+                                   guint              i)
+{
+  vec_ensure_sorted (&self->files);
+  g_return_val_if_fail (i < self->files.entries->len, NULL);
+  return vec_index (&self->files, OstreeMutableTreeFile, i)->name;
+}
+
+/**
+ * ostree_mutable_tree_get_file_csum:
+ *
+ * Returns: (transfer none): The 32 byte binary checksum of file @i
+ */
+const guchar *
+ostree_mutable_tree_get_file_csum (OstreeMutableTree *self,
+                                   guint              i)
+{
+  vec_ensure_sorted (&self->files);
+  g_return_val_if_fail (i < self->files.entries->len, NULL);
+  return vec_index (&self->files, OstreeMutableTreeFile, i)->csum;
+}
+
+/**
+ * ostree_mutable_tree_get_n_subdirs:
+ *
+ * Like ostree_mutable_tree_get_n_files(), for subdirectories.
+ */
+guint
+ostree_mutable_tree_get_n_subdirs (OstreeMutableTree *self)
+{
+  vec_ensure_sorted (&self->subdirs);
+  return self->subdirs.entries->len;
+}
+
+const char *
+ostree_mutable_tree_get_subdir_name (OstreeMutableTree *self,
+                                     guint              i)
+{
+  vec_ensure_sorted (&self->subdirs);
+  g_return_val_if_fail (i < self->subdirs.entries->len, NULL);
+  return vec_index (&self->subdirs, OstreeMutableTreeDir, i)->name;
+}
+
+/**
+ * ostree_mutable_tree_get_subdir:
+ *
+ * Returns: (transfer none): Subdirectory @i
+ */
+OstreeMutableTree *
+ostree_mutable_tree_get_subdir (OstreeMutableTree *self,
+                                guint              i)
+{
+  vec_ensure_sorted (&self->subdirs);
+  g_return_val_if_fail (i < self->subdirs.entries->len, NULL);
+  return vec_index (&self->subdirs, OstreeMutableTreeDir, i)->tree;
+}
+
+/**
+ * ostree_mutable_tree_get_subdirs:
+ *
+ * Returns: (transfer none): A table mapping names to subdirectories.
+ * It is built on first use and kept up to date afterwards; prefer
+ * the indexed accessors, which don't need it.
+ */
 GHashTable *
 ostree_mutable_tree_get_subdirs (OstreeMutableTree *self)
 {
-  return self->subdirs;
+  if (!self->subdirs_table)
+    {
+      guint i;
+
+      self->subdirs_table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify)g_object_unref);
+      for (i = 0; i < self->subdirs.entries->len; i++)
+        {
+          OstreeMutableTreeDir *dir = vec_index (&self->subdirs, OstreeMutableTreeDir, i);
+          g_hash_table_insert (self->subdirs_table, g_strdup (dir->name),
+                               g_object_ref (dir->tree));
+        }
+    }
+  return self->subdirs_table;
 }
 
+/**
+ * ostree_mutable_tree_get_files:
+ *
+ * Returns: (transfer none): A table mapping names to checksum
+ * strings; see ostree_mutable_tree_get_subdirs().
+ */
 GHashTable *
 ostree_mutable_tree_get_files (OstreeMutableTree *self)
 {
-  return self->files;
+  if (!self->files_table)
+    {
+      guint i;
+
+      self->files_table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, g_free);
+      for (i = 0; i < self->files.entries->len; i++)
+        {
+          OstreeMutableTreeFile *file = vec_index (&self->files, OstreeMutableTreeFile, i);
+          g_hash_table_insert (self->files_table, g_strdup (file->name),
+                               ostree_checksum_from_bytes (file->csum));
+        }
+    }
+  return self->files_table;
 }
 
 OstreeMutableTree *
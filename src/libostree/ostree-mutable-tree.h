@@ -89,6 +89,18 @@ gboolean ostree_mutable_tree_walk (OstreeMutableTree   *self,
                                    OstreeMutableTree  **out_subdir,
                                    GError             **error);
 
+guint ostree_mutable_tree_get_n_files (OstreeMutableTree *self);
+const char *ostree_mutable_tree_get_file_name (OstreeMutableTree *self,
+                                               guint              i);
+const guchar *ostree_mutable_tree_get_file_csum (OstreeMutableTree *self,
+                                                 guint              i);
+
+guint ostree_mutable_tree_get_n_subdirs (OstreeMutableTree *self);
+const char *ostree_mutable_tree_get_subdir_name (OstreeMutableTree *self,
+                                                 guint              i);
+OstreeMutableTree *ostree_mutable_tree_get_subdir (OstreeMutableTree *self,
+                                                   guint              i);
+
 GHashTable * ostree_mutable_tree_get_subdirs (OstreeMutableTree *self);
 GHashTable * ostree_mutable_tree_get_files (OstreeMutableTree *self);
 
@@ -33,6 +33,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #ifdef HAVE_LIBARCHIVE
 #include <archive.h>
@@ -40,6 +46,36 @@
 #include "ostree-libarchive-input-stream.h"
 #endif
 
+/* Pack files mapped by checksum, evicted least recently used first
+ * once there are more than pack_cache_max_mappings of them or they
+ * add up to more than pack_cache_max_bytes.  Evicting only drops the
+ * cache's reference; users of a mapping hold their own.
+ *
+ * Lookups only take pack_cache_lock for reading.  Instead of keeping
+ * a list in order of use, which every lookup would have to write,
+ * each insertion starts a new epoch, and lookups stamp entries with
+ * the current one; entries stamped in the same epoch are shared by
+ * readers without further writes, other than an atomic hit count.
+ * Eviction picks the entry with the oldest stamp.
+ */
+typedef struct {
+  GHashTable *entries;
+  GBoxedCopyFunc value_ref;
+  GDestroyNotify value_free;
+  volatile gint epoch;
+  guint64 total_size;
+  volatile guint64 hits;
+  guint64 misses;
+  guint64 evictions;
+} OstreeRepoPackCache;
+
+typedef struct {
+  char *checksum;
+  gpointer value;
+  gsize size;
+  volatile gint last_used;
+} OstreeRepoPackCacheEntry;
+
 struct OstreeRepo {
   GObject parent;
 
@@ -53,18 +89,60 @@ struct OstreeRepo {
   GFile *remote_cache_dir;
   GFile *config_file;
 
+  int objects_dir_fd;
+  int tmp_dir_fd;
+  /* Bitmap of objects/XX directories known to exist */
+  volatile guint32 loose_object_dirs[8];
+  /* Lazily opened descriptors for objects/XX, or -1.  Together with
+   * objects_dir_fd and tmp_dir_fd, a repository keeps at most 258
+   * descriptors open until it is finalized.
+   */
+  volatile gint loose_object_dir_fds[256];
+
 #if GLIB_CHECK_VERSION(2,32,0) && !defined(OSTREE_GLIB_TARGET_MIN)
   GMutex cache_lock;
 #else
   GMutex *cache_lock;
 #endif
+  /* Protected by pack_cache_lock; the index lists are replaced, never
+   * modified, when the set of packs changes.  The generation is bumped
+   * whenever they are dropped, so that a list read before that is not
+   * installed after it.
+   */
+  GRWLock pack_cache_lock;
   GPtrArray *cached_meta_indexes;
   GPtrArray *cached_content_indexes;
-  GHashTable *cached_pack_index_mappings;
-  GHashTable *cached_pack_data_mappings;
+  guint pack_indexes_generation;
+  OstreeRepoPackCache cached_pack_index_mappings;
+  OstreeRepoPackCache cached_pack_data_mappings;
+  guint pack_cache_max_mappings;
+  guint64 pack_cache_max_bytes;
+  gboolean sequential_pack_access;
+
+  /* Protected by cache_lock */
+  GHashTable *metadata_cache;
+  GQueue metadata_cache_lru;
+  guint metadata_cache_size;
+  guint64 metadata_cache_hits;
+  guint64 metadata_cache_misses;
 
   gboolean inited;
   gboolean in_transaction;
+  gboolean enable_fsync;
+  /* Protected by cache_lock; with fsync enabled, objects staged in
+   * the current transaction, in order, and a map from their path
+   * relative to objects/ to the staged temporary file.
+   */
+  GPtrArray *pending_objects;
+  GHashTable *pending_object_paths;
+  /* Protected by cache_lock; OstreeRepoCopyMethod for each pair of
+   * filesystems a checkout has copied between.
+   */
+  GArray *copy_methods;
+  volatile gint checkout_method_counts[OSTREE_REPO_CHECKOUT_N_METHODS];
+  /* Counters updated atomically while collect_stats is set */
+  gboolean collect_stats;
+  volatile guint64 stats[OSTREE_REPO_N_STATS];
   GHashTable *loose_object_devino_hash;
 
   GKeyFile *config;
@@ -77,6 +155,36 @@ typedef struct {
   GObjectClass parent_class;
 } OstreeRepoClass;
 
+#define OSTREE_REPO_DEFAULT_METADATA_CACHE_SIZE (4096)
+
+/* Stay well below the default vm.max_map_count of 65530, and leave
+ * address space on 32 bit systems.
+ */
+#define OSTREE_REPO_DEFAULT_PACK_CACHE_MAPPINGS (256)
+#if GLIB_SIZEOF_VOID_P == 8
+#define OSTREE_REPO_DEFAULT_PACK_CACHE_BYTES (G_GUINT64_CONSTANT (32) << 30)
+#else
+#define OSTREE_REPO_DEFAULT_PACK_CACHE_BYTES (G_GUINT64_CONSTANT (512) << 20)
+#endif
+
+/* Entries are linked from most to least recently used in
+ * metadata_cache_lru.  The entry itself is the hash key; only csum
+ * and objtype are used for lookups.
+ */
+typedef struct {
+  guchar csum[32];
+  OstreeObjectType objtype;
+
+  GVariant *variant;
+  GList link;
+} OstreeRepoMetadataCacheEntry;
+
+typedef struct {
+  dev_t src_dev;
+  dev_t dest_dev;
+  OstreeRepoCheckoutMethod method;
+} OstreeRepoCopyMethod;
+
 static gboolean      
 repo_find_object (OstreeRepo           *self,
                   OstreeObjectType      objtype,
@@ -96,10 +204,224 @@ enum {
 
 G_DEFINE_TYPE (OstreeRepo, ostree_repo, G_TYPE_OBJECT)
 
+/* GLib has no 64 bit atomics; these are also atomic on 32 bit targets */
+static inline void
+atomic_add_uint64 (volatile guint64  *counter,
+                   guint64            value)
+{
+  (void) __sync_fetch_and_add (counter, value);
+}
+
+static inline guint64
+atomic_get_uint64 (volatile guint64 *counter)
+{
+  return __sync_fetch_and_add (counter, 0);
+}
+
+static void
+pack_cache_entry_free (OstreeRepoPackCache       *cache,
+                       OstreeRepoPackCacheEntry  *entry)
+{
+  cache->value_free (entry->value);
+  g_free (entry->checksum);
+  g_free (entry);
+}
+
+static void
+pack_cache_init (OstreeRepoPackCache  *cache,
+                 GBoxedCopyFunc        value_ref,
+                 GDestroyNotify        value_free)
+{
+  memset (cache, 0, sizeof (*cache));
+  cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+  cache->value_ref = value_ref;
+  cache->value_free = value_free;
+}
+
+static void
+pack_cache_clear (OstreeRepoPackCache *cache)
+{
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&hash_iter, cache->entries);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    pack_cache_entry_free (cache, value);
+  g_hash_table_destroy (cache->entries);
+}
+
+/* Called with pack_cache_lock held for writing */
+static void
+pack_cache_trim (OstreeRepoPackCache  *cache,
+                 guint                 max_mappings,
+                 guint64               max_bytes)
+{
+  guint epoch = (guint) cache->epoch;
+
+  /* The most recent mapping is kept even if it alone is too large */
+  while (g_hash_table_size (cache->entries) > max_mappings
+         || (g_hash_table_size (cache->entries) > 1 && cache->total_size > max_bytes))
+    {
+      GHashTableIter hash_iter;
+      gpointer key, value;
+      OstreeRepoPackCacheEntry *oldest = NULL;
+      guint oldest_age = 0;
+
+      g_hash_table_iter_init (&hash_iter, cache->entries);
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        {
+          OstreeRepoPackCacheEntry *entry = value;
+          guint age = epoch - (guint) entry->last_used;
+
+          if (!oldest || age > oldest_age)
+            {
+              oldest = entry;
+              oldest_age = age;
+            }
+        }
+
+      g_hash_table_remove (cache->entries, oldest->checksum);
+      cache->total_size -= oldest->size;
+      cache->evictions++;
+      pack_cache_entry_free (cache, oldest);
+    }
+}
+
+/*
+ * Called with pack_cache_lock held for reading or writing.
+ *
+ * Returns: (transfer full): The cached value for @checksum, or %NULL
+ */
+static gpointer
+pack_cache_lookup (OstreeRepoPackCache  *cache,
+                   const char           *checksum)
+{
+  OstreeRepoPackCacheEntry *entry;
+  gint epoch;
+
+  entry = g_hash_table_lookup (cache->entries, checksum);
+  if (!entry)
+    return NULL;
+
+  epoch = g_atomic_int_get (&cache->epoch);
+  if (g_atomic_int_get (&entry->last_used) != epoch)
+    g_atomic_int_set (&entry->last_used, epoch);
+  atomic_add_uint64 (&cache->hits, 1);
+  return cache->value_ref (entry->value);
+}
+
+/*
+ * Called with pack_cache_lock held for writing.  Add @value, of which
+ * a reference is taken, unless another thread added @checksum since
+ * it was looked up.
+ *
+ * Returns: (transfer full): The cached value for @checksum
+ */
+static gpointer
+pack_cache_insert (OstreeRepo           *self,
+                   OstreeRepoPackCache  *cache,
+                   const char           *checksum,
+                   gpointer              value,
+                   gsize                 size)
+{
+  OstreeRepoPackCacheEntry *entry;
+  gpointer existing;
+
+  existing = pack_cache_lookup (cache, checksum);
+  if (existing)
+    return existing;
+
+  cache->misses++;
+  g_atomic_int_inc (&cache->epoch);
+
+  entry = g_new0 (OstreeRepoPackCacheEntry, 1);
+  entry->checksum = g_strdup (checksum);
+  entry->value = cache->value_ref (value);
+  entry->size = size;
+  entry->last_used = cache->epoch;
+
+  g_hash_table_insert (cache->entries, entry->checksum, entry);
+  cache->total_size += size;
+
+  pack_cache_trim (cache, self->pack_cache_max_mappings, self->pack_cache_max_bytes);
+
+  return cache->value_ref (value);
+}
+
+static void
+pack_cache_get_stats (OstreeRepoPackCache       *cache,
+                      OstreeRepoPackCacheStats  *out_stats)
+{
+  if (!out_stats)
+    return;
+  out_stats->n_mappings = g_hash_table_size (cache->entries);
+  out_stats->mapped_bytes = cache->total_size;
+  out_stats->hits = atomic_get_uint64 (&cache->hits);
+  out_stats->misses = cache->misses;
+  out_stats->evictions = cache->evictions;
+}
+
+/*
+ * Give the kernel @advice for the pages of a mapping that hold the
+ * @len bytes at @data.
+ */
+static void
+advise_mapped_range (const guchar  *data,
+                     gsize          len,
+                     int            advice)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+  guintptr start = ((guintptr)data) & ~((guintptr)page_size - 1);
+
+  if (len == 0)
+    return;
+  (void) madvise ((void*)start, ((guintptr)data - start) + len, advice);
+}
+
+/* Default for ostree_repo_set_collect_stats(); the repositories
+ * alive and the counters of those finalized so far, for
+ * ostree_repo_get_total_stats()
+ */
+static volatile gint default_collect_stats;
+static GMutex total_stats_lock;
+static GList *live_repos;
+static guint64 finalized_stats[OSTREE_REPO_N_STATS];
+
+static inline void
+count_stat (OstreeRepo     *self,
+            OstreeRepoStat  stat,
+            guint64         value)
+{
+  if (self->collect_stats)
+    atomic_add_uint64 (&self->stats[stat], value);
+}
+
+static inline gint64
+stats_timer_start (OstreeRepo *self)
+{
+  return self->collect_stats ? g_get_monotonic_time () : 0;
+}
+
+static inline void
+stats_timer_stop (OstreeRepo     *self,
+                  OstreeRepoStat  stat,
+                  gint64          start_time)
+{
+  if (start_time > 0)
+    atomic_add_uint64 (&self->stats[stat], g_get_monotonic_time () - start_time);
+}
+
 static void
 ostree_repo_finalize (GObject *object)
 {
   OstreeRepo *self = OSTREE_REPO (object);
+  guint i;
+
+  g_mutex_lock (&total_stats_lock);
+  live_repos = g_list_remove (live_repos, self);
+  for (i = 0; i < OSTREE_REPO_N_STATS; i++)
+    finalized_stats[i] += self->stats[i];
+  g_mutex_unlock (&total_stats_lock);
 
   g_clear_object (&self->parent_repo);
 
@@ -112,14 +434,28 @@ ostree_repo_finalize (GObject *object)
   g_clear_object (&self->pack_dir);
   g_clear_object (&self->remote_cache_dir);
   g_clear_object (&self->config_file);
+  if (self->objects_dir_fd != -1)
+    (void) close (self->objects_dir_fd);
+  if (self->tmp_dir_fd != -1)
+    (void) close (self->tmp_dir_fd);
+  for (i = 0; i < G_N_ELEMENTS (self->loose_object_dir_fds); i++)
+    {
+      if (self->loose_object_dir_fds[i] != -1)
+        (void) close (self->loose_object_dir_fds[i]);
+    }
   if (self->loose_object_devino_hash)
     g_hash_table_destroy (self->loose_object_devino_hash);
   if (self->config)
     g_key_file_free (self->config);
   g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
-  g_hash_table_destroy (self->cached_pack_index_mappings);
-  g_hash_table_destroy (self->cached_pack_data_mappings);
+  pack_cache_clear (&self->cached_pack_index_mappings);
+  pack_cache_clear (&self->cached_pack_data_mappings);
+  g_rw_lock_clear (&self->pack_cache_lock);
+  g_hash_table_destroy (self->metadata_cache);
+  g_array_unref (self->copy_methods);
+  g_ptr_array_unref (self->pending_objects);
+  g_hash_table_destroy (self->pending_object_paths);
   g_mutex_clear (&self->cache_lock);
 
   G_OBJECT_CLASS (ostree_repo_parent_class)->finalize (object);
@@ -211,16 +547,65 @@ ostree_repo_class_init (OstreeRepoClass *klass)
                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
 
+static guint
+metadata_cache_entry_hash (gconstpointer v)
+{
+  const OstreeRepoMetadataCacheEntry *entry = v;
+  guint hash;
+
+  memcpy (&hash, entry->csum, sizeof (hash));
+  return hash + entry->objtype;
+}
+
+static gboolean
+metadata_cache_entry_equal (gconstpointer a,
+                            gconstpointer b)
+{
+  const OstreeRepoMetadataCacheEntry *entry_a = a;
+  const OstreeRepoMetadataCacheEntry *entry_b = b;
+
+  return entry_a->objtype == entry_b->objtype
+    && memcmp (entry_a->csum, entry_b->csum, 32) == 0;
+}
+
+static void
+metadata_cache_entry_free (OstreeRepoMetadataCacheEntry *entry)
+{
+  g_variant_unref (entry->variant);
+  g_free (entry);
+}
+
 static void
 ostree_repo_init (OstreeRepo *self)
 {
+  guint i;
+
   g_mutex_init (&self->cache_lock);
-  self->cached_pack_index_mappings = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                            g_free,
-                                                            (GDestroyNotify)g_variant_unref);
-  self->cached_pack_data_mappings = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                           g_free,
-                                                           (GDestroyNotify)g_mapped_file_unref);
+  g_rw_lock_init (&self->pack_cache_lock);
+  self->collect_stats = g_atomic_int_get (&default_collect_stats);
+  g_mutex_lock (&total_stats_lock);
+  live_repos = g_list_prepend (live_repos, self);
+  g_mutex_unlock (&total_stats_lock);
+  pack_cache_init (&self->cached_pack_index_mappings,
+                   (GBoxedCopyFunc)g_variant_ref, (GDestroyNotify)g_variant_unref);
+  pack_cache_init (&self->cached_pack_data_mappings,
+                   (GBoxedCopyFunc)g_mapped_file_ref, (GDestroyNotify)g_mapped_file_unref);
+  self->pack_cache_max_mappings = OSTREE_REPO_DEFAULT_PACK_CACHE_MAPPINGS;
+  self->pack_cache_max_bytes = OSTREE_REPO_DEFAULT_PACK_CACHE_BYTES;
+  self->metadata_cache = g_hash_table_new_full (metadata_cache_entry_hash,
+                                                metadata_cache_entry_equal,
+                                                (GDestroyNotify)metadata_cache_entry_free,
+                                                NULL);
+  g_queue_init (&self->metadata_cache_lru);
+  self->metadata_cache_size = OSTREE_REPO_DEFAULT_METADATA_CACHE_SIZE;
+  self->objects_dir_fd = -1;
+  self->tmp_dir_fd = -1;
+  for (i = 0; i < G_N_ELEMENTS (self->loose_object_dir_fds); i++)
+    self->loose_object_dir_fds[i] = -1;
+  self->pending_objects = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free);
+  self->pending_object_paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                      g_free, (GDestroyNotify)g_object_unref);
+  self->copy_methods = g_array_new (FALSE, FALSE, sizeof (OstreeRepoCopyMethod));
 }
 
 OstreeRepo*
@@ -391,6 +776,7 @@ ostree_repo_resolve_rev (OstreeRepo     *self,
         }
       ret_rev = ostree_checksum_from_bytes_v (parent_csum_v);
     }
+  /* Not from refs/summary.v, which can be older than the ref files */
   else
     {
       child = g_file_resolve_relative_path (self->local_heads_dir, rev);
@@ -618,6 +1004,39 @@ keyfile_get_boolean_with_default (GKeyFile      *keyfile,
   return ret;
 }
 
+static gboolean
+keyfile_get_integer_with_default (GKeyFile      *keyfile,
+                                  const char    *section,
+                                  const char    *value,
+                                  gint           default_value,
+                                  gint          *out_int,
+                                  GError       **error)
+{
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  gint ret_int;
+
+  ret_int = g_key_file_get_integer (keyfile, section, value, &temp_error);
+  if (temp_error)
+    {
+      if (g_error_matches (temp_error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND))
+        {
+          g_clear_error (&temp_error);
+          ret_int = default_value;
+        }
+      else
+        {
+          g_propagate_error (error, temp_error);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+  *out_int = ret_int;
+ out:
+  return ret;
+}
+
 static gboolean
 keyfile_get_value_with_default (GKeyFile      *keyfile,
                                 const char    *section,
@@ -651,11 +1070,119 @@ keyfile_get_value_with_default (GKeyFile      *keyfile,
   return ret;
 }
                                 
+/*
+ * Returns: Index of the objects/XX directory for @checksum, or -1 if
+ * it doesn't start with two lowercase hexadecimal digits.
+ */
+static inline int
+loose_object_dir_index (const char *checksum)
+{
+  if (!(g_ascii_isxdigit (checksum[0]) && !g_ascii_isupper (checksum[0])
+        && g_ascii_isxdigit (checksum[1]) && !g_ascii_isupper (checksum[1])))
+    return -1;
+  return (g_ascii_xdigit_value (checksum[0]) << 4) | g_ascii_xdigit_value (checksum[1]);
+}
+
+static gboolean
+get_loose_object_dir_index (const char   *checksum,
+                            int          *out_index,
+                            GError      **error)
+{
+  int index = loose_object_dir_index (checksum);
+
+  if (index == -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid object checksum '%s'", checksum);
+      return FALSE;
+    }
+  *out_index = index;
+  return TRUE;
+}
+
+static inline void
+mark_loose_object_dir (OstreeRepo  *self,
+                       int          index)
+{
+  g_atomic_int_or (&self->loose_object_dirs[index / 32], 1U << (index % 32));
+}
+
+static gboolean
+open_repo_dir_fds (OstreeRepo  *self,
+                   GError     **error)
+{
+  gboolean ret = FALSE;
+  int dfd;
+  DIR *d = NULL;
+  struct dirent *dent;
+
+  self->objects_dir_fd = open (ot_gfile_get_path_cached (self->objects_dir),
+                               O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (self->objects_dir_fd == -1)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "Opening objects directory: ");
+      goto out;
+    }
+
+  self->tmp_dir_fd = open (ot_gfile_get_path_cached (self->tmp_dir),
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (self->tmp_dir_fd == -1)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "Opening tmp directory: ");
+      goto out;
+    }
+
+  /* Note which objects/XX directories already exist, so staging
+   * doesn't need to try creating them.
+   */
+  dfd = dup (self->objects_dir_fd);
+  if (dfd == -1 || (d = fdopendir (dfd)) == NULL)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      if (dfd != -1)
+        (void) close (dfd);
+      goto out;
+    }
+  while ((dent = readdir (d)) != NULL)
+    {
+      struct stat stbuf;
+
+      if (strlen (dent->d_name) != 2
+          || !g_ascii_isxdigit (dent->d_name[0])
+          || !g_ascii_isxdigit (dent->d_name[1])
+          || g_ascii_isupper (dent->d_name[0])
+          || g_ascii_isupper (dent->d_name[1]))
+        continue;
+
+      if (dent->d_type == DT_UNKNOWN)
+        {
+          if (fstatat (self->objects_dir_fd, dent->d_name, &stbuf, AT_SYMLINK_NOFOLLOW) < 0
+              || !S_ISDIR (stbuf.st_mode))
+            continue;
+        }
+      else if (dent->d_type != DT_DIR)
+        continue;
+
+      mark_loose_object_dir (self, loose_object_dir_index (dent->d_name));
+    }
+
+  ret = TRUE;
+ out:
+  if (d)
+    (void) closedir (d);
+  return ret;
+}
+
 gboolean
 ostree_repo_check (OstreeRepo *self, GError **error)
 {
   gboolean ret = FALSE;
   gboolean is_archive;
+  gint metadata_cache_size;
+  gint pack_cache_mappings;
+  gint pack_cache_size_mb;
   ot_lfree char *version = NULL;
   ot_lfree char *mode = NULL;
   ot_lfree char *parent_repo_path = NULL;
@@ -675,6 +1202,9 @@ ostree_repo_check (OstreeRepo *self, GError **error)
 
   if (!ot_gfile_ensure_directory (self->pending_dir, FALSE, error))
     goto out;
+
+  if (!open_repo_dir_fds (self, error))
+    goto out;
   
   self->config = g_key_file_new ();
   if (!g_key_file_load_from_file (self->config, ot_gfile_get_path_cached (self->config_file), 0, error))
@@ -718,6 +1248,40 @@ ostree_repo_check (OstreeRepo *self, GError **error)
         }
     }
 
+  if (!keyfile_get_boolean_with_default (self->config, "core", "fsync",
+                                         FALSE, &self->enable_fsync, error))
+    goto out;
+
+  if (!keyfile_get_integer_with_default (self->config, "core", "metadata-cache-size",
+                                         OSTREE_REPO_DEFAULT_METADATA_CACHE_SIZE,
+                                         &metadata_cache_size, error))
+    goto out;
+  if (metadata_cache_size < 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid metadata-cache-size %d in repository configuration",
+                   metadata_cache_size);
+      goto out;
+    }
+  ostree_repo_set_metadata_cache_size (self, metadata_cache_size);
+
+  if (!keyfile_get_integer_with_default (self->config, "core", "pack-cache-mappings",
+                                         OSTREE_REPO_DEFAULT_PACK_CACHE_MAPPINGS,
+                                         &pack_cache_mappings, error))
+    goto out;
+  if (!keyfile_get_integer_with_default (self->config, "core", "pack-cache-size-mb",
+                                         OSTREE_REPO_DEFAULT_PACK_CACHE_BYTES >> 20,
+                                         &pack_cache_size_mb, error))
+    goto out;
+  if (pack_cache_mappings < 1 || pack_cache_size_mb < 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid pack-cache-mappings or pack-cache-size-mb in repository configuration");
+      goto out;
+    }
+  ostree_repo_set_pack_cache_limits (self, pack_cache_mappings,
+                                     ((guint64)pack_cache_size_mb) << 20);
+
   if (!keyfile_get_value_with_default (self->config, "core", "parent",
                                        NULL, &parent_repo_path, error))
     goto out;
@@ -797,58 +1361,307 @@ ostree_repo_get_archive_content_path (OstreeRepo    *self,
   return g_file_resolve_relative_path (self->repodir, path);
 }
 
-static gboolean
-commit_loose_object_impl (OstreeRepo        *self,
-                          GFile             *tempfile_path,
-                          GFile             *dest,
-                          GCancellable      *cancellable,
-                          GError           **error)
+/* "XX/" + 62 hex digits + "." + longest suffix ("filecontent") + NUL */
+#define OSTREE_LOOSE_OBJECT_RELPATH_MAX (3 + 62 + 1 + 11 + 1)
+
+/*
+ * Store the path of the loose object @checksum with extension @suffix,
+ * relative to objects/, in @buf.
+ */
+static void
+get_loose_object_relpath (char          *buf,
+                          const char    *checksum,
+                          const char    *suffix)
 {
-  gboolean ret = FALSE;
-  ot_lobj GFile *parent = NULL;
+  gsize suffix_len = strlen (suffix);
 
-  parent = g_file_get_parent (dest);
-  if (!ot_gfile_ensure_directory (parent, FALSE, error))
-    goto out;
-  
-  if (link (ot_gfile_get_path_cached (tempfile_path), ot_gfile_get_path_cached (dest)) < 0)
+  g_assert (3 + 62 + 1 + suffix_len + 1 <= OSTREE_LOOSE_OBJECT_RELPATH_MAX);
+
+  buf[0] = checksum[0];
+  buf[1] = checksum[1];
+  buf[2] = '/';
+  memcpy (buf + 3, checksum + 2, 62);
+  buf[65] = '.';
+  memcpy (buf + 66, suffix, suffix_len + 1);
+}
+
+/*
+ * Returns: (transfer full): If the loose object @checksum with
+ * extension @suffix was staged in the current transaction but not yet
+ * linked into place, the temporary file holding it, otherwise %NULL
+ */
+static GFile *
+lookup_pending_object (OstreeRepo   *self,
+                       const char   *checksum,
+                       const char   *suffix)
+{
+  GFile *ret = NULL;
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->pending_objects->len > 0)
     {
-      if (errno != EEXIST)
-        {
-          ot_util_set_error_from_errno (error, errno);
-          g_prefix_error (error, "Storing file '%s': ",
-                          ot_gfile_get_path_cached (dest));
-          goto out;
-        }
+      get_loose_object_relpath (relpath, checksum, suffix);
+      ret = g_hash_table_lookup (self->pending_object_paths, relpath);
+      if (ret)
+        g_object_ref (ret);
     }
+  g_mutex_unlock (&self->cache_lock);
 
-  (void) unlink (ot_gfile_get_path_cached (tempfile_path));
-  ret = TRUE;
- out:
   return ret;
 }
 
 static gboolean
-commit_loose_object_trusted (OstreeRepo        *self,
-                             const char        *checksum,
-                             OstreeObjectType   objtype,
-                             GFile             *tempfile_path,
-                             GCancellable      *cancellable,
-                             GError           **error)
+ensure_loose_object_dir (OstreeRepo   *self,
+                         const char   *relpath,
+                         GError      **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *dest_file = NULL;
+  int index;
+  char dirname[3];
+  gint64 start_time;
 
-  dest_file = ostree_repo_get_object_path (self, checksum, objtype);
+  if (!get_loose_object_dir_index (relpath, &index, error))
+    return FALSE;
 
-  if (!commit_loose_object_impl (self, tempfile_path, dest_file,
-                                 cancellable, error))
-    goto out;
+  if (g_atomic_int_get (&self->loose_object_dirs[index / 32]) & (1U << (index % 32)))
+    return TRUE;
 
-  ret = TRUE;
- out:
-  return ret;
-}
+  start_time = stats_timer_start (self);
+
+  dirname[0] = relpath[0];
+  dirname[1] = relpath[1];
+  dirname[2] = '\0';
+  if (mkdirat (self->objects_dir_fd, dirname, 0777) < 0 && errno != EEXIST)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "Creating objects/%s: ", dirname);
+      goto out;
+    }
+  mark_loose_object_dir (self, index);
+
+  ret = TRUE;
+ out:
+  stats_timer_stop (self, OSTREE_REPO_STAT_MKDIR_USEC, start_time);
+  return ret;
+}
+
+/*
+ * Store in @out_fd a descriptor for the objects/XX directory holding
+ * @checksum, or -1 if it doesn't exist.  The descriptor is owned by
+ * @self and stays open until it is finalized; there are at most 256.
+ */
+static gboolean
+get_loose_object_dir_fd (OstreeRepo   *self,
+                         const char   *checksum,
+                         int          *out_fd,
+                         GError      **error)
+{
+  gboolean ret = FALSE;
+  int index;
+  int fd;
+  char dirname[3];
+
+  if (!get_loose_object_dir_index (checksum, &index, error))
+    goto out;
+
+  fd = g_atomic_int_get (&self->loose_object_dir_fds[index]);
+  if (fd == -1)
+    {
+      dirname[0] = checksum[0];
+      dirname[1] = checksum[1];
+      dirname[2] = '\0';
+      fd = openat (self->objects_dir_fd, dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd == -1)
+        {
+          if (errno != ENOENT)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              g_prefix_error (error, "Opening objects/%s: ", dirname);
+              goto out;
+            }
+        }
+      else if (!g_atomic_int_compare_and_exchange (&self->loose_object_dir_fds[index], -1, fd))
+        {
+          /* Another thread got there first */
+          (void) close (fd);
+          fd = g_atomic_int_get (&self->loose_object_dir_fds[index]);
+        }
+    }
+
+  ret = TRUE;
+  *out_fd = fd;
+ out:
+  return ret;
+}
+
+/*
+ * Stat the loose object @checksum with extension @suffix, without
+ * following symbolic links.  If it doesn't exist, @out_found is set
+ * to %FALSE and @out_stbuf is untouched.
+ */
+static gboolean
+stat_loose_object (OstreeRepo   *self,
+                   const char   *checksum,
+                   const char   *suffix,
+                   struct stat  *out_stbuf,
+                   gboolean     *out_found,
+                   GError      **error)
+{
+  gboolean ret = FALSE;
+  gboolean ret_found = FALSE;
+  int dfd;
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+
+  if (!get_loose_object_dir_fd (self, checksum, &dfd, error))
+    goto out;
+
+  if (dfd != -1)
+    {
+      get_loose_object_relpath (relpath, checksum, suffix);
+      if (fstatat (dfd, relpath + 3, out_stbuf, AT_SYMLINK_NOFOLLOW) == 0)
+        ret_found = TRUE;
+      else if (errno != ENOENT)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Querying objects/%s: ", relpath);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+  *out_found = ret_found;
+ out:
+  return ret;
+}
+
+/*
+ * Open the loose object @checksum with extension @suffix for reading;
+ * @out_fd is set to -1 if it doesn't exist.
+ */
+static gboolean
+open_loose_object (OstreeRepo   *self,
+                   const char   *checksum,
+                   const char   *suffix,
+                   int          *out_fd,
+                   GError      **error)
+{
+  gboolean ret = FALSE;
+  int dfd;
+  int fd = -1;
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+
+  if (!get_loose_object_dir_fd (self, checksum, &dfd, error))
+    goto out;
+
+  if (dfd != -1)
+    {
+      get_loose_object_relpath (relpath, checksum, suffix);
+      fd = openat (dfd, relpath + 3, O_RDONLY | O_CLOEXEC);
+      if (fd == -1 && errno != ENOENT)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Opening objects/%s: ", relpath);
+          goto out;
+        }
+    }
+
+  ret = TRUE;
+  *out_fd = fd;
+ out:
+  return ret;
+}
+
+/*
+ * Move @tempfile_path, which must be directly in the repository tmp/
+ * directory, to @relpath below objects/.
+ */
+static gboolean
+link_loose_object (OstreeRepo        *self,
+                   GFile             *tempfile_path,
+                   const char        *relpath,
+                   GCancellable      *cancellable,
+                   GError           **error)
+{
+  gboolean ret = FALSE;
+  const char *temp_name = ot_gfile_get_basename_cached (tempfile_path);
+  const char *name;
+  int dfd;
+
+  if (!ensure_loose_object_dir (self, relpath, error))
+    goto out;
+
+  if (!get_loose_object_dir_fd (self, relpath, &dfd, error))
+    goto out;
+  if (dfd != -1)
+    name = relpath + 3;
+  else
+    {
+      dfd = self->objects_dir_fd;
+      name = relpath;
+    }
+  
+  if (linkat (self->tmp_dir_fd, temp_name, dfd, name, 0) < 0)
+    {
+      if (errno != EEXIST)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Storing file 'objects/%s': ", relpath);
+          goto out;
+        }
+    }
+
+  (void) unlinkat (self->tmp_dir_fd, temp_name, 0);
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+commit_loose_object_impl (OstreeRepo        *self,
+                          GFile             *tempfile_path,
+                          const char        *checksum,
+                          const char        *suffix,
+                          GCancellable      *cancellable,
+                          GError           **error)
+{
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+
+  get_loose_object_relpath (relpath, checksum, suffix);
+
+  if (!(self->enable_fsync && self->in_transaction))
+    return link_loose_object (self, tempfile_path, relpath, cancellable, error);
+
+  /* Objects only become visible in objects/ after
+   * ostree_repo_commit_transaction() synced them; until then, lookups
+   * find the temporary file through lookup_pending_object().
+   */
+  g_mutex_lock (&self->cache_lock);
+  if (g_hash_table_lookup (self->pending_object_paths, relpath))
+    (void) unlink (ot_gfile_get_path_cached (tempfile_path));
+  else
+    {
+      g_ptr_array_add (self->pending_objects, g_strdup (relpath));
+      g_hash_table_insert (self->pending_object_paths, g_strdup (relpath),
+                           g_object_ref (tempfile_path));
+    }
+  g_mutex_unlock (&self->cache_lock);
+
+  return TRUE;
+}
+
+static gboolean
+commit_loose_object_trusted (OstreeRepo        *self,
+                             const char        *checksum,
+                             OstreeObjectType   objtype,
+                             GFile             *tempfile_path,
+                             GCancellable      *cancellable,
+                             GError           **error)
+{
+  return commit_loose_object_impl (self, tempfile_path, checksum,
+                                   ostree_object_type_to_string (objtype),
+                                   cancellable, error);
+}
 
 typedef enum {
   OSTREE_REPO_STAGE_FLAGS_STORE_IF_PACKED = (1<<0),
@@ -876,15 +1689,25 @@ stage_object_internal (OstreeRepo         *self,
   ot_lfree char *pack_checksum = NULL;
   ot_lfree guchar *ret_csum = NULL;
   ot_lobj OstreeChecksumInputStream *checksum_input = NULL;
-  GChecksum *checksum = NULL;
+  OtChecksum checksum_data;
+  OtChecksum *checksum = NULL;
+  guchar digest[32];
+  char actual_checksum_buf[65];
   gboolean staged_raw_file = FALSE;
   gboolean staged_archive_file = FALSE;
+  guint64 bytes_written = 0;
+  guint64 file_bytes_written;
+  gint64 start_time = stats_timer_start (self);
 
   if (out_csum)
     {
-      checksum = g_checksum_new (G_CHECKSUM_SHA256);
+      checksum = &checksum_data;
+      ot_checksum_init (checksum);
       if (input)
-        checksum_input = ostree_checksum_input_stream_new (input, checksum);
+        {
+          checksum_input = ostree_checksum_input_stream_new (input, checksum);
+          ostree_checksum_input_stream_set_collect_stats (checksum_input, self->collect_stats);
+        }
     }
 
   if (objtype == OSTREE_OBJECT_TYPE_FILE
@@ -905,9 +1728,11 @@ stage_object_internal (OstreeRepo         *self,
           if (!ostree_create_temp_file_from_input (self->tmp_dir,
                                                    ostree_object_type_to_string (objtype), NULL,
                                                    file_info, xattrs, file_input,
-                                                   &temp_file,
+                                                   &temp_file, &file_bytes_written,
                                                    cancellable, error))
             goto out;
+          count_stat (self, OSTREE_REPO_STAT_TMPFILES_CREATED, 1);
+          bytes_written += file_bytes_written;
           staged_raw_file = TRUE;
         }
       else
@@ -915,6 +1740,7 @@ stage_object_internal (OstreeRepo         *self,
           ot_lvariant GVariant *file_meta = NULL;
           ot_lobj GInputStream *file_meta_input = NULL;
           ot_lobj GFileInfo *archive_content_file_info = NULL;
+          gssize content_bytes_written;
 
           file_meta = ostree_file_header_new (file_info, xattrs);
           file_meta_input = ot_variant_read (file_meta);
@@ -922,9 +1748,11 @@ stage_object_internal (OstreeRepo         *self,
           if (!ostree_create_temp_file_from_input (self->tmp_dir,
                                                    ostree_object_type_to_string (objtype), NULL,
                                                    NULL, NULL, file_meta_input,
-                                                   &temp_file,
+                                                   &temp_file, &file_bytes_written,
                                                    cancellable, error))
             goto out;
+          count_stat (self, OSTREE_REPO_STAT_TMPFILES_CREATED, 1);
+          bytes_written += file_bytes_written;
 
           if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR)
             {
@@ -937,6 +1765,7 @@ stage_object_internal (OstreeRepo         *self,
                                                     &raw_temp_file, &content_out,
                                                     cancellable, error))
                 goto out;
+              count_stat (self, OSTREE_REPO_STAT_TMPFILES_CREATED, 1);
 
               /* Don't make setuid files in the repository; all we want to preserve
                * is file type and permissions.
@@ -950,10 +1779,12 @@ stage_object_internal (OstreeRepo         *self,
                   goto out;
                 }
 
-              if (g_output_stream_splice (content_out, file_input,
-                                          G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
-                                          cancellable, error) < 0)
+              content_bytes_written = g_output_stream_splice (content_out, file_input,
+                                                              G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE | G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                                              cancellable, error);
+              if (content_bytes_written < 0)
                 goto out;
+              bytes_written += content_bytes_written;
 
               staged_archive_file = TRUE;
             }
@@ -965,16 +1796,20 @@ stage_object_internal (OstreeRepo         *self,
                                                ostree_object_type_to_string (objtype), NULL,
                                                NULL, NULL,
                                                checksum_input ? (GInputStream*)checksum_input : input,
-                                               &temp_file,
+                                               &temp_file, &file_bytes_written,
                                                cancellable, error))
         goto out;
+      count_stat (self, OSTREE_REPO_STAT_TMPFILES_CREATED, 1);
+      bytes_written += file_bytes_written;
     }
           
   if (!checksum)
     actual_checksum = expected_checksum;
   else
     {
-      actual_checksum = g_checksum_get_string (checksum);
+      ot_checksum_get_digest (checksum, digest);
+      ostree_checksum_inplace_from_bytes (digest, actual_checksum_buf);
+      actual_checksum = actual_checksum_buf;
       if (expected_checksum && strcmp (actual_checksum, expected_checksum) != 0)
         {
           g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -1016,9 +1851,11 @@ stage_object_internal (OstreeRepo         *self,
           if (!ostree_create_temp_file_from_input (self->tmp_dir,
                                                    ostree_object_type_to_string (objtype), NULL,
                                                    file_info, xattrs, file_input,
-                                                   &raw_temp_file,
+                                                   &raw_temp_file, &file_bytes_written,
                                                    cancellable, error))
             goto out;
+          count_stat (self, OSTREE_REPO_STAT_TMPFILES_CREATED, 1);
+          bytes_written += file_bytes_written;
 
           if (!commit_loose_object_trusted (self, actual_checksum, objtype, 
                                             raw_temp_file, cancellable, error))
@@ -1030,12 +1867,8 @@ stage_object_internal (OstreeRepo         *self,
           /* Commit content first so the process is atomic */
           if (staged_archive_file)
             {
-              ot_lobj GFile *archive_content_dest = NULL;
-
-              archive_content_dest = ostree_repo_get_archive_content_path (self, actual_checksum);
-                                                                   
-              if (!commit_loose_object_impl (self, raw_temp_file, archive_content_dest,
-                                             cancellable, error))
+              if (!commit_loose_object_impl (self, raw_temp_file, actual_checksum,
+                                             "filecontent", cancellable, error))
                 goto out;
               g_clear_object (&raw_temp_file);
             }
@@ -1047,7 +1880,18 @@ stage_object_internal (OstreeRepo         *self,
     }
       
   if (checksum)
-    ret_csum = ot_csum_from_gchecksum (checksum);
+    ret_csum = ot_csum_from_checksum (checksum);
+
+  if (checksum_input)
+    {
+      guint64 bytes_hashed;
+      guint64 hash_usec;
+
+      ostree_checksum_input_stream_get_stats (checksum_input, &bytes_hashed, &hash_usec);
+      count_stat (self, OSTREE_REPO_STAT_BYTES_HASHED, bytes_hashed);
+      count_stat (self, OSTREE_REPO_STAT_HASH_USEC, hash_usec);
+    }
+  count_stat (self, OSTREE_REPO_STAT_BYTES_WRITTEN, bytes_written);
 
   ret = TRUE;
   ot_transfer_out_value(out_csum, &ret_csum);
@@ -1056,7 +1900,9 @@ stage_object_internal (OstreeRepo         *self,
     (void) unlink (ot_gfile_get_path_cached (temp_file));
   if (raw_temp_file)
     (void) unlink (ot_gfile_get_path_cached (raw_temp_file));
-  g_clear_pointer (&checksum, (GDestroyNotify) g_checksum_free);
+  if (checksum)
+    ot_checksum_clear (checksum);
+  stats_timer_stop (self, OSTREE_REPO_STAT_STAGE_USEC, start_time);
   return ret;
 }
 
@@ -1324,6 +2170,175 @@ ostree_repo_prepare_transaction (OstreeRepo     *self,
   return ret;
 }
 
+typedef struct {
+  volatile gint first_errno;
+} FdatasyncData;
+
+static void
+fdatasync_thread (gpointer     data,
+                  gpointer     user_data)
+{
+  GFile *path = data;
+  FdatasyncData *fdatasync_data = user_data;
+  int fd;
+
+  fd = open (ot_gfile_get_path_cached (path), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    {
+      /* Symbolic links are stored as such, and have no data to sync */
+      if (errno != ELOOP)
+        g_atomic_int_compare_and_exchange (&fdatasync_data->first_errno, 0, errno);
+      return;
+    }
+  if (fdatasync (fd) < 0)
+    g_atomic_int_compare_and_exchange (&fdatasync_data->first_errno, 0, errno);
+  (void) close (fd);
+}
+
+/*
+ * Make the data of @files durable, using one syncfs() of the
+ * filesystem holding @dir if available, or otherwise fdatasync() of
+ * each file from a thread pool.
+ */
+static gboolean
+sync_files (GFile          *dir,
+            GPtrArray      *files,
+            GError        **error)
+{
+  gboolean ret = FALSE;
+  int i;
+  GThreadPool *pool = NULL;
+  FdatasyncData fdatasync_data;
+
+#ifdef HAVE_SYNCFS
+  {
+    int dir_fd = open (ot_gfile_get_path_cached (dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
+      {
+        ot_util_set_error_from_errno (error, errno);
+        goto out;
+      }
+    if (syncfs (dir_fd) == 0)
+      {
+        (void) close (dir_fd);
+        ret = TRUE;
+        goto out;
+      }
+    (void) close (dir_fd);
+    if (errno != ENOSYS)
+      {
+        ot_util_set_error_from_errno (error, errno);
+        goto out;
+      }
+  }
+#endif
+
+  fdatasync_data.first_errno = 0;
+  pool = g_thread_pool_new (fdatasync_thread, &fdatasync_data, 8, FALSE, error);
+  if (!pool)
+    goto out;
+  for (i = 0; i < files->len; i++)
+    g_thread_pool_push (pool, files->pdata[i], NULL);
+  /* Waits for all queued syncs */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (fdatasync_data.first_errno != 0)
+    {
+      ot_util_set_error_from_errno (error, fdatasync_data.first_errno);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+clear_pending_objects (OstreeRepo     *self,
+                       gboolean        unlink_staged)
+{
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  g_mutex_lock (&self->cache_lock);
+  if (unlink_staged)
+    {
+      g_hash_table_iter_init (&hash_iter, self->pending_object_paths);
+      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+        (void) unlink (ot_gfile_get_path_cached ((GFile*)value));
+    }
+  g_hash_table_remove_all (self->pending_object_paths);
+  g_ptr_array_set_size (self->pending_objects, 0);
+  g_mutex_unlock (&self->cache_lock);
+}
+
+/*
+ * With fsync enabled, the staged objects are synced in one batch, then
+ * linked into objects/ in the order they were staged (so archive
+ * content files precede their headers), and then the new directory
+ * entries are synced.  Refs should only be written after this
+ * returns.
+ */
+static gboolean
+commit_pending_objects (OstreeRepo     *self,
+                        GCancellable   *cancellable,
+                        GError        **error)
+{
+  gboolean ret = FALSE;
+  int i;
+  gboolean dir_seen[256] = { 0, };
+  ot_lptrarray GPtrArray *staged = NULL;
+  ot_lptrarray GPtrArray *dirs = NULL;
+
+  if (self->pending_objects->len == 0)
+    return TRUE;
+
+  staged = g_ptr_array_new ();
+  dirs = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+  for (i = 0; i < self->pending_objects->len; i++)
+    {
+      const char *relpath = self->pending_objects->pdata[i];
+      int index = loose_object_dir_index (relpath);
+
+      g_assert (index != -1);
+      g_ptr_array_add (staged, g_hash_table_lookup (self->pending_object_paths, relpath));
+      if (!dir_seen[index])
+        {
+          char dirname[3] = { relpath[0], relpath[1], '\0' };
+          dir_seen[index] = TRUE;
+          g_ptr_array_add (dirs, g_file_get_child (self->objects_dir, dirname));
+        }
+    }
+
+  if (!sync_files (self->tmp_dir, staged, error))
+    goto out;
+
+  for (i = 0; i < self->pending_objects->len; i++)
+    {
+      if (!link_loose_object (self, staged->pdata[i], self->pending_objects->pdata[i],
+                              cancellable, error))
+        goto out;
+    }
+
+  /* Now the new directory entries; objects/ is on the same
+   * filesystem as tmp/, so this is normally another syncfs().
+   */
+  if (!sync_files (self->objects_dir, dirs, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_commit_transaction:
+ *
+ * Finish staging objects.  If the "fsync" key of the "core"
+ * configuration section is set, this ensures all objects staged in
+ * the transaction are on stable storage before returning, so refs
+ * written afterwards never point to incomplete objects.
+ */
 gboolean      
 ostree_repo_commit_transaction (OstreeRepo     *self,
                                 GCancellable   *cancellable,
@@ -1333,9 +2348,13 @@ ostree_repo_commit_transaction (OstreeRepo     *self,
 
   g_return_val_if_fail (self->in_transaction == TRUE, FALSE);
 
+  if (!commit_pending_objects (self, cancellable, error))
+    goto out;
+
   ret = TRUE;
-  /* out: */
+ out:
   self->in_transaction = FALSE;
+  clear_pending_objects (self, TRUE);
   if (self->loose_object_devino_hash)
     g_hash_table_remove_all (self->loose_object_devino_hash);
 
@@ -1350,6 +2369,7 @@ ostree_repo_abort_transaction (OstreeRepo     *self,
   gboolean ret = FALSE;
 
   self->in_transaction = FALSE;
+  clear_pending_objects (self, TRUE);
   if (self->loose_object_devino_hash)
     g_hash_table_remove_all (self->loose_object_devino_hash);
 
@@ -1474,40 +2494,157 @@ ostree_repo_stage_file_object_trusted (OstreeRepo       *self,
                        cancellable, error);
 }
 
-gboolean
-ostree_repo_stage_file_object (OstreeRepo       *self,
-                               const char       *expected_checksum,
-                               GInputStream     *object_input,
-                               guint64           length,
-                               GCancellable     *cancellable,
-                               GError          **error)
+/*
+ * Hardlink @src into the temporary directory under a new name ending
+ * in @suffix.  @out_temp_path is %NULL if @src doesn't exist.
+ */
+static gboolean
+link_into_tmpdir (OstreeRepo       *self,
+                  GFile            *src,
+                  const char       *suffix,
+                  GFile           **out_temp_path,
+                  GError          **error)
 {
   gboolean ret = FALSE;
-  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
-  ot_lfree guchar *actual_csum = NULL;
-  
-  if (!stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE, 
-                     object_input, length, expected_checksum, &actual_csum,
-                     cancellable, error))
-    goto out;
+  ot_lfree char *temp_name = NULL;
+  ot_lobj GFile *ret_temp_path = NULL;
+
+  temp_name = g_strdup_printf ("link-%08x%08x.%s", g_random_int (), g_random_int (), suffix);
+  if (linkat (AT_FDCWD, ot_gfile_get_path_cached (src), self->tmp_dir_fd, temp_name, 0) < 0)
+    {
+      int errsv = errno;
+
+      if (errsv == EXDEV || errsv == EMLINK)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Can't hardlink %s: %s", ot_gfile_get_path_cached (src),
+                       g_strerror (errsv));
+          goto out;
+        }
+      else if (errsv != ENOENT)
+        {
+          ot_util_set_error_from_errno (error, errsv);
+          g_prefix_error (error, "Hardlinking %s: ", ot_gfile_get_path_cached (src));
+          goto out;
+        }
+    }
+  else
+    ret_temp_path = g_file_get_child (self->tmp_dir, temp_name);
 
   ret = TRUE;
+  ot_transfer_out_value (out_temp_path, &ret_temp_path);
  out:
   return ret;
 }
 
-static GVariant *
-create_empty_gvariant_dict (void)
+/**
+ * ostree_repo_stage_object_link:
+ * @source: A repository in the same mode as @self
+ * @out_linked: (out): Whether @source has the object loose
+ *
+ * Stage the loose object @checksum of @source in @self by hardlinking
+ * its files into the temporary directory, so that it is committed
+ * (and synced) with the rest of the transaction.  The object is
+ * trusted, not verified.  Fails with %G_IO_ERROR_NOT_SUPPORTED if the
+ * files can't be hardlinked, for example across filesystems, and with
+ * %G_IO_ERROR_PERMISSION_DENIED if only this object may not be linked,
+ * e.g. because of fs.protected_hardlinks.
+ */
+gboolean
+ostree_repo_stage_object_link (OstreeRepo       *self,
+                               OstreeRepo       *source,
+                               OstreeObjectType  objtype,
+                               const char       *checksum,
+                               gboolean         *out_linked,
+                               GCancellable     *cancellable,
+                               GError          **error)
 {
-  GVariantBuilder builder;
-  g_variant_builder_init (&builder, G_VARIANT_TYPE("a{sv}"));
-  return g_variant_builder_end (&builder);
-}
+  gboolean ret = FALSE;
+  gboolean ret_linked = FALSE;
+  const char *suffix = ostree_object_type_to_string (objtype);
+  ot_lobj GFile *src_path = NULL;
+  ot_lobj GFile *temp_path = NULL;
+  ot_lobj GFile *src_content_path = NULL;
+  ot_lobj GFile *content_temp_path = NULL;
 
-static gboolean
-enumerate_refs_recurse (OstreeRepo    *repo,
-                        GFile         *base,
-                        GFile         *dir,
+  g_return_val_if_fail (self->in_transaction, FALSE);
+  g_return_val_if_fail (self->mode == source->mode, FALSE);
+
+  src_path = ostree_repo_get_object_path (source, checksum, objtype);
+  if (!link_into_tmpdir (self, src_path, suffix, &temp_path, error))
+    goto out;
+  if (!temp_path)
+    goto done;
+
+  /* Archived symbolic links have no content file */
+  if (objtype == OSTREE_OBJECT_TYPE_FILE && self->mode == OSTREE_REPO_MODE_ARCHIVE)
+    {
+      src_content_path = ostree_repo_get_archive_content_path (source, checksum);
+      if (!link_into_tmpdir (self, src_content_path, "filecontent",
+                             &content_temp_path, error))
+        goto out;
+    }
+
+  /* Content first, as in stage_object() */
+  if (content_temp_path)
+    {
+      if (!commit_loose_object_impl (self, content_temp_path, checksum,
+                                     "filecontent", cancellable, error))
+        goto out;
+      g_clear_object (&content_temp_path);
+    }
+  if (!commit_loose_object_trusted (self, checksum, objtype, temp_path,
+                                    cancellable, error))
+    goto out;
+  g_clear_object (&temp_path);
+  ret_linked = TRUE;
+
+ done:
+  ret = TRUE;
+  if (out_linked)
+    *out_linked = ret_linked;
+ out:
+  if (temp_path)
+    (void) unlink (ot_gfile_get_path_cached (temp_path));
+  if (content_temp_path)
+    (void) unlink (ot_gfile_get_path_cached (content_temp_path));
+  return ret;
+}
+
+gboolean
+ostree_repo_stage_file_object (OstreeRepo       *self,
+                               const char       *expected_checksum,
+                               GInputStream     *object_input,
+                               guint64           length,
+                               GCancellable     *cancellable,
+                               GError          **error)
+{
+  gboolean ret = FALSE;
+  int flags = OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID;
+  ot_lfree guchar *actual_csum = NULL;
+  
+  if (!stage_object (self, flags, OSTREE_OBJECT_TYPE_FILE, 
+                     object_input, length, expected_checksum, &actual_csum,
+                     cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static GVariant *
+create_empty_gvariant_dict (void)
+{
+  GVariantBuilder builder;
+  g_variant_builder_init (&builder, G_VARIANT_TYPE("a{sv}"));
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+enumerate_refs_recurse (OstreeRepo    *repo,
+                        GFile         *base,
+                        GFile         *dir,
                         GHashTable    *refs,
                         GCancellable  *cancellable,
                         GError       **error)
@@ -1581,6 +2718,89 @@ ostree_repo_list_all_refs (OstreeRepo       *repo,
   return ret;
 }
 
+static gboolean
+write_binary_ref_summary (OstreeRepo      *self,
+                          GHashTable      *all_refs,
+                          GCancellable    *cancellable,
+                          GError         **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  GSList *sorted_names = NULL;
+  GSList *iter;
+  GVariantBuilder refs_builder;
+  ot_lobj GFile *summary_path = NULL;
+  ot_lvariant GVariant *summary = NULL;
+  ot_lvariant GVariant *old_summary = NULL;
+
+  summary_path = g_file_resolve_relative_path (ostree_repo_get_path (self),
+                                               "refs/summary.v");
+
+  /* Commits of refs which haven't changed are not loaded again */
+  if (g_file_query_exists (summary_path, cancellable)
+      && (!ot_util_variant_map (summary_path, OSTREE_REFS_SUMMARY_VARIANT_FORMAT, FALSE,
+                                &old_summary, NULL)
+          || !ostree_validate_structureof_refs_summary (old_summary, NULL)))
+    g_clear_pointer (&old_summary, (GDestroyNotify) g_variant_unref);
+
+  g_hash_table_iter_init (&hash_iter, all_refs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    sorted_names = g_slist_prepend (sorted_names, key);
+  sorted_names = g_slist_sort (sorted_names, (GCompareFunc)strcmp);
+
+  g_variant_builder_init (&refs_builder, G_VARIANT_TYPE ("a(saytt)"));
+  for (iter = sorted_names; iter; iter = iter->next)
+    {
+      const char *name = iter->data;
+      const char *sha256 = g_hash_table_lookup (all_refs, name);
+      ot_lvariant GVariant *commit = NULL;
+      ot_lfree char *old_sha256 = NULL;
+      guint64 old_size = 0;
+      guint64 old_timestamp = 0;
+      guint64 size = 0;
+      guint64 timestamp = 0;
+
+      /* Leave out refs that don't hold a checksum */
+      if (!ostree_validate_checksum_string (sha256, NULL))
+        continue;
+
+      if (old_summary
+          && ostree_refs_summary_lookup (old_summary, name, &old_sha256,
+                                         &old_size, &old_timestamp)
+          && strcmp (old_sha256, sha256) == 0
+          && old_size != 0)
+        {
+          size = old_size;
+          timestamp = old_timestamp;
+        }
+      /* The commit may not be in this repository */
+      else if (ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, sha256, &commit, NULL))
+        {
+          size = g_variant_get_size (commit);
+          g_variant_get_child (commit, 5, "t", &timestamp);
+          timestamp = GUINT64_FROM_BE (timestamp);
+        }
+
+      g_variant_builder_add (&refs_builder, "(s@aytt)", name,
+                             ostree_checksum_to_bytes_v (sha256),
+                             GUINT64_TO_BE (size), GUINT64_TO_BE (timestamp));
+    }
+
+  summary = g_variant_new ("(s@a{sv}@a(saytt))", "OSTv0REFSUMMARY",
+                           g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
+                           g_variant_builder_end (&refs_builder));
+  g_variant_ref_sink (summary);
+
+  if (!ot_util_variant_save (summary_path, summary, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  g_slist_free (sorted_names);
+  return ret;
+}
+
 static gboolean
 write_ref_summary (OstreeRepo      *self,
                    GCancellable    *cancellable,
@@ -1620,6 +2840,9 @@ write_ref_summary (OstreeRepo      *self,
   if (!g_output_stream_close (out, cancellable, error))
     goto out;
 
+  if (!write_binary_ref_summary (self, all_refs, cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
   return ret;
@@ -1923,14 +3146,18 @@ ostree_repo_list_pack_indexes (OstreeRepo              *self,
   ot_lobj GFile *superindex_path = NULL;
   ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
   ot_lptrarray GPtrArray *ret_data_indexes = NULL;
+  guint generation;
 
-  g_mutex_lock (&self->cache_lock);
+  g_rw_lock_reader_lock (&self->pack_cache_lock);
   if (self->cached_meta_indexes)
     {
       ret_meta_indexes = g_ptr_array_ref (self->cached_meta_indexes);
       ret_data_indexes = g_ptr_array_ref (self->cached_content_indexes);
     }
-  else
+  generation = self->pack_indexes_generation;
+  g_rw_lock_reader_unlock (&self->pack_cache_lock);
+
+  if (!ret_meta_indexes)
     {
       superindex_path = g_file_get_child (self->pack_dir, "index");
 
@@ -1947,15 +3174,21 @@ ostree_repo_list_pack_indexes (OstreeRepo              *self,
           ret_data_indexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_free); 
         }
 
-      self->cached_meta_indexes = g_ptr_array_ref (ret_meta_indexes);
-      self->cached_content_indexes = g_ptr_array_ref (ret_data_indexes);
+      /* Don't cache what was read before a regeneration */
+      g_rw_lock_writer_lock (&self->pack_cache_lock);
+      if (!self->cached_meta_indexes
+          && self->pack_indexes_generation == generation)
+        {
+          self->cached_meta_indexes = g_ptr_array_ref (ret_meta_indexes);
+          self->cached_content_indexes = g_ptr_array_ref (ret_data_indexes);
+        }
+      g_rw_lock_writer_unlock (&self->pack_cache_lock);
     }
 
   ret = TRUE;
   ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
   ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
  out:
-  g_mutex_unlock (&self->cache_lock);
   return ret;
 }
 
@@ -2025,9 +3258,6 @@ ostree_repo_regenerate_pack_index (OstreeRepo       *self,
   GVariantBuilder *meta_index_content_builder = NULL;
   GVariantBuilder *data_index_content_builder = NULL;
 
-  g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
-  g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
-
   superindex_path = g_file_get_child (self->pack_dir, "index");
 
   g_clear_pointer (&pack_indexes, (GDestroyNotify) g_ptr_array_unref);
@@ -2060,6 +3290,13 @@ ostree_repo_regenerate_pack_index (OstreeRepo       *self,
                              cancellable, error))
     goto out;
 
+  /* Only now, so that lists read in the meantime are of the old file */
+  g_rw_lock_writer_lock (&self->pack_cache_lock);
+  g_clear_pointer (&self->cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
+  g_clear_pointer (&self->cached_content_indexes, (GDestroyNotify) g_ptr_array_unref);
+  self->pack_indexes_generation++;
+  g_rw_lock_writer_unlock (&self->pack_cache_lock);
+
   ret = TRUE;
  out:
   if (meta_index_content_builder)
@@ -2091,6 +3328,18 @@ get_pack_data_path (GFile            *parent,
   return ret;
 }
 
+static gboolean
+sync_files (GFile          *dir,
+            GPtrArray      *files,
+            GError        **error);
+
+/**
+ * ostree_repo_add_pack_file:
+ *
+ * Move the pack @index_path and @data_path into the repository.  If
+ * the "fsync" key of the "core" configuration section is set, both
+ * are synced first, and the pack directory after.
+ */
 gboolean
 ostree_repo_add_pack_file (OstreeRepo       *self,
                            const char       *pack_checksum,
@@ -2103,10 +3352,22 @@ ostree_repo_add_pack_file (OstreeRepo       *self,
   gboolean ret = FALSE;
   ot_lobj GFile *pack_index_path = NULL;
   ot_lobj GFile *pack_data_path = NULL;
+  ot_lobj GFile *temp_dir = NULL;
+  ot_lptrarray GPtrArray *to_sync = NULL;
 
   if (!ot_gfile_ensure_directory (self->pack_dir, FALSE, error))
     goto out;
 
+  if (self->enable_fsync)
+    {
+      to_sync = g_ptr_array_new ();
+      g_ptr_array_add (to_sync, index_path);
+      g_ptr_array_add (to_sync, data_path);
+      temp_dir = g_file_get_parent (data_path);
+      if (!sync_files (temp_dir, to_sync, error))
+        goto out;
+    }
+
   pack_data_path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
   if (!ot_gfile_rename (data_path, pack_data_path, cancellable, error))
     goto out;
@@ -2115,6 +3376,14 @@ ostree_repo_add_pack_file (OstreeRepo       *self,
   if (!ot_gfile_rename (index_path, pack_index_path, cancellable, error))
     goto out;
 
+  if (to_sync)
+    {
+      g_ptr_array_set_size (to_sync, 0);
+      g_ptr_array_add (to_sync, self->pack_dir);
+      if (!sync_files (self->pack_dir, to_sync, error))
+        goto out;
+    }
+
   ret = TRUE;
  out:
   return ret;
@@ -2538,132 +3807,393 @@ ostree_repo_take_cached_remote_pack_data (OstreeRepo       *self,
   return ret;
 }
 
-static GVariant *
-create_tree_variant_from_hashes (GHashTable            *file_checksums,
-                                 GHashTable            *dir_contents_checksums,
-                                 GHashTable            *dir_metadata_checksums)
+/**
+ * ostree_repo_list_cached_remote_pack_indexes:
+ *
+ * List the pack indexes referenced by the superindex last saved by
+ * ostree_repo_resync_cached_remote_pack_indexes() for @remote_name,
+ * without touching the cache.  If there is no cached superindex, the
+ * output arrays are %NULL.
+ */
+gboolean
+ostree_repo_list_cached_remote_pack_indexes (OstreeRepo       *self,
+                                             const char       *remote_name,
+                                             GPtrArray       **out_meta_indexes,
+                                             GPtrArray       **out_data_indexes,
+                                             GCancellable     *cancellable,
+                                             GError          **error)
 {
-  GHashTableIter hash_iter;
-  gpointer key, value;
-  GVariantBuilder files_builder;
-  GVariantBuilder dirs_builder;
-  GSList *sorted_filenames = NULL;
-  GSList *iter;
-  GVariant *serialized_tree;
+  gboolean ret = FALSE;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lobj GFile *superindex_cache_path = NULL;
+  ot_lvariant GVariant *superindex_variant = NULL;
+  ot_lvariant GVariant *csum_bytes = NULL;
+  ot_lvariant GVariant *bloom = NULL;
+  ot_lptrarray GPtrArray *ret_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *ret_data_indexes = NULL;
+  GVariantIter *superindex_contents_iter = NULL;
 
-  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
-  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
 
-  g_hash_table_iter_init (&hash_iter, file_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+  superindex_cache_path = g_file_get_child (cache_path, "index");
+  if (!g_file_query_exists (superindex_cache_path, cancellable))
     {
-      const char *name = key;
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
+      ret = TRUE;
+      goto out;
     }
 
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
-
-  for (iter = sorted_filenames; iter; iter = iter->next)
-    {
-      const char *name = iter->data;
-      const char *value;
+  if (!ot_util_variant_map (superindex_cache_path, OSTREE_PACK_SUPER_INDEX_VARIANT_FORMAT,
+                            FALSE, &superindex_variant, error))
+    goto out;
 
-      value = g_hash_table_lookup (file_checksums, name);
-      g_variant_builder_add (&files_builder, "(s@ay)", name,
-                             ostree_checksum_to_bytes_v (value));
-    }
-  
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+  ret_meta_indexes = g_ptr_array_new_with_free_func (g_free);
+  ret_data_indexes = g_ptr_array_new_with_free_func (g_free);
 
-  g_hash_table_iter_init (&hash_iter, dir_metadata_checksums);
-  while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      const char *name = key;
-      sorted_filenames = g_slist_prepend (sorted_filenames, (char*)name);
-    }
+  g_variant_get_child (superindex_variant, 2, "a(ayay)",
+                       &superindex_contents_iter);
+  while (g_variant_iter_loop (superindex_contents_iter,
+                              "(@ay@ay)", &csum_bytes, &bloom))
+    g_ptr_array_add (ret_meta_indexes, ostree_checksum_from_bytes_v (csum_bytes));
+  g_variant_iter_free (superindex_contents_iter);
 
-  sorted_filenames = g_slist_sort (sorted_filenames, (GCompareFunc)strcmp);
+  g_variant_get_child (superindex_variant, 3, "a(ayay)",
+                       &superindex_contents_iter);
+  while (g_variant_iter_loop (superindex_contents_iter,
+                              "(@ay@ay)", &csum_bytes, &bloom))
+    g_ptr_array_add (ret_data_indexes, ostree_checksum_from_bytes_v (csum_bytes));
+  g_variant_iter_free (superindex_contents_iter);
 
-  for (iter = sorted_filenames; iter; iter = iter->next)
-    {
-      const char *name = iter->data;
-      const char *content_checksum;
-      const char *meta_checksum;
+  ret = TRUE;
+  ot_transfer_out_value (out_meta_indexes, &ret_meta_indexes);
+  ot_transfer_out_value (out_data_indexes, &ret_data_indexes);
+ out:
+  return ret;
+}
 
-      content_checksum = g_hash_table_lookup (dir_contents_checksums, name);
-      meta_checksum = g_hash_table_lookup (dir_metadata_checksums, name);
+/**
+ * Validate the binary refs summary in @summary_path, fetched from
+ * @remote_name, and move it into the cache directory.
+ */
+gboolean
+ostree_repo_take_cached_remote_refs_summary (OstreeRepo       *self,
+                                             const char       *remote_name,
+                                             GFile            *summary_path,
+                                             GCancellable     *cancellable,
+                                             GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lobj GFile *target_path = NULL;
+  ot_lvariant GVariant *summary = NULL;
 
-      g_variant_builder_add (&dirs_builder, "(s@ay@ay)",
-                             name,
-                             ostree_checksum_to_bytes_v (content_checksum),
-                             ostree_checksum_to_bytes_v (meta_checksum));
-    }
+  if (!ot_util_variant_map (summary_path, OSTREE_REFS_SUMMARY_VARIANT_FORMAT, FALSE,
+                            &summary, error))
+    goto out;
+  if (!ostree_validate_structureof_refs_summary (summary, error))
+    goto out;
 
-  g_slist_free (sorted_filenames);
-  sorted_filenames = NULL;
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
 
-  serialized_tree = g_variant_new ("(@a(say)@a(sayay))",
-                                   g_variant_builder_end (&files_builder),
-                                   g_variant_builder_end (&dirs_builder));
-  g_variant_ref_sink (serialized_tree);
+  target_path = g_file_get_child (cache_path, "summary.v");
+  if (!ot_gfile_rename (summary_path, target_path, cancellable, error))
+    goto out;
 
-  return serialized_tree;
+  ret = TRUE;
+ out:
+  return ret;
 }
 
-static GFileInfo *
-create_modified_file_info (GFileInfo               *info,
-                           OstreeRepoCommitModifier *modifier)
+/**
+ * Map the refs summary of @remote_name last saved with
+ * ostree_repo_take_cached_remote_refs_summary(), or set
+ * @out_summary to %NULL if there is none.
+ */
+gboolean
+ostree_repo_load_cached_remote_refs_summary (OstreeRepo       *self,
+                                             const char       *remote_name,
+                                             GVariant        **out_summary,
+                                             GCancellable     *cancellable,
+                                             GError          **error)
 {
-  GFileInfo *ret;
+  gboolean ret = FALSE;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lobj GFile *summary_path = NULL;
+  ot_lvariant GVariant *ret_summary = NULL;
 
-  if (!modifier)
-    return (GFileInfo*)g_object_ref (info);
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
 
-  ret = g_file_info_dup (info);
-  
+  summary_path = g_file_get_child (cache_path, "summary.v");
+  if (g_file_query_exists (summary_path, cancellable))
+    {
+      /* Validated when it was added */
+      if (!ot_util_variant_map (summary_path, OSTREE_REFS_SUMMARY_VARIANT_FORMAT, TRUE,
+                                &ret_summary, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_summary, &ret_summary);
+ out:
   return ret;
 }
 
-static OstreeRepoCommitFilterResult
-apply_commit_filter (OstreeRepo            *self,
-                     OstreeRepoCommitModifier *modifier,
-                     GPtrArray                *path,
-                     GFileInfo                *file_info,
-                     GFileInfo               **out_modified_info)
+static gboolean
+load_remote_cache_validators (OstreeRepo       *self,
+                              const char       *remote_name,
+                              GFile           **out_path,
+                              GKeyFile        **out_keyfile,
+                              GCancellable     *cancellable,
+                              GError          **error)
 {
-  GString *path_buf;
-  guint i;
-  OstreeRepoCommitFilterResult result;
-  GFileInfo *modified_info;
-  
-  if (modifier == NULL || modifier->filter == NULL)
-    {
-      *out_modified_info = g_object_ref (file_info);
-      return OSTREE_REPO_COMMIT_FILTER_ALLOW;
-    }
+  gboolean ret = FALSE;
+  GError *temp_error = NULL;
+  ot_lobj GFile *cache_path = NULL;
+  ot_lobj GFile *ret_path = NULL;
+  GKeyFile *ret_keyfile = NULL;
 
-  path_buf = g_string_new ("");
+  if (!ensure_remote_cache_dir (self, remote_name, &cache_path, cancellable, error))
+    goto out;
 
-  if (path->len == 0)
-    g_string_append_c (path_buf, '/');
-  else
+  ret_path = g_file_get_child (cache_path, "validators");
+  ret_keyfile = g_key_file_new ();
+  if (!g_key_file_load_from_file (ret_keyfile, ot_gfile_get_path_cached (ret_path),
+                                  0, &temp_error))
     {
-      for (i = 0; i < path->len; i++)
+      if (g_error_matches (temp_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_clear_error (&temp_error);
+      else
         {
-          const char *elt = path->pdata[i];
-          
-          g_string_append_c (path_buf, '/');
-          g_string_append (path_buf, elt);
+          g_propagate_error (error, temp_error);
+          goto out;
         }
     }
 
-  modified_info = g_file_info_dup (file_info);
-  result = modifier->filter (self, path_buf->str, modified_info, modifier->user_data);
-  *out_modified_info = modified_info;
-
-  g_string_free (path_buf, TRUE);
-  return result;
+  ret = TRUE;
+  ot_transfer_out_value (out_path, &ret_path);
+  *out_keyfile = ret_keyfile;
+  ret_keyfile = NULL;
+ out:
+  if (ret_keyfile)
+    g_key_file_free (ret_keyfile);
+  return ret;
+}
+
+/**
+ * ostree_repo_get_remote_cache_validators:
+ * @out_contents: (allow-none): Short response body saved with the validators
+ *
+ * Look up the HTTP validators (ETag and Last-Modified header values)
+ * saved for @path, relative to the base URL of @remote_name, and the
+ * response body saved with them, if any.  Each output may be %NULL
+ * if nothing was saved.
+ */
+gboolean
+ostree_repo_get_remote_cache_validators (OstreeRepo       *self,
+                                         const char       *remote_name,
+                                         const char       *path,
+                                         char            **out_etag,
+                                         char            **out_last_modified,
+                                         char            **out_contents,
+                                         GCancellable     *cancellable,
+                                         GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *validators_path = NULL;
+  GKeyFile *keyfile = NULL;
+  ot_lfree char *ret_etag = NULL;
+  ot_lfree char *ret_last_modified = NULL;
+  ot_lfree char *ret_contents = NULL;
+
+  if (!load_remote_cache_validators (self, remote_name, &validators_path, &keyfile,
+                                     cancellable, error))
+    goto out;
+
+  ret_etag = g_key_file_get_string (keyfile, path, "etag", NULL);
+  ret_last_modified = g_key_file_get_string (keyfile, path, "last-modified", NULL);
+  ret_contents = g_key_file_get_string (keyfile, path, "contents", NULL);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_etag, &ret_etag);
+  ot_transfer_out_value (out_last_modified, &ret_last_modified);
+  ot_transfer_out_value (out_contents, &ret_contents);
+ out:
+  if (keyfile)
+    g_key_file_free (keyfile);
+  return ret;
+}
+
+/**
+ * ostree_repo_set_remote_cache_validators:
+ * @contents: (allow-none): Short response body, such as a ref's checksum
+ *
+ * Save HTTP validators for @path; see
+ * ostree_repo_get_remote_cache_validators().  @contents stands in for
+ * the response when the server reports it unchanged.  If both @etag
+ * and @last_modified are %NULL, everything saved for @path is removed.
+ */
+gboolean
+ostree_repo_set_remote_cache_validators (OstreeRepo       *self,
+                                         const char       *remote_name,
+                                         const char       *path,
+                                         const char       *etag,
+                                         const char       *last_modified,
+                                         const char       *contents,
+                                         GCancellable     *cancellable,
+                                         GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *validators_path = NULL;
+  ot_lfree char *data = NULL;
+  GKeyFile *keyfile = NULL;
+  gsize len;
+
+  if (!load_remote_cache_validators (self, remote_name, &validators_path, &keyfile,
+                                     cancellable, error))
+    goto out;
+
+  (void) g_key_file_remove_group (keyfile, path, NULL);
+  if (etag)
+    g_key_file_set_string (keyfile, path, "etag", etag);
+  if (last_modified)
+    g_key_file_set_string (keyfile, path, "last-modified", last_modified);
+  if ((etag || last_modified) && contents)
+    g_key_file_set_string (keyfile, path, "contents", contents);
+
+  data = g_key_file_to_data (keyfile, &len, error);
+  if (!data)
+    goto out;
+  if (!g_file_replace_contents (validators_path, data, len, NULL, FALSE, 0, NULL,
+                                cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (keyfile)
+    g_key_file_free (keyfile);
+  return ret;
+}
+
+/*
+ * The mutable tree keeps its entries sorted by name, which is the
+ * order the dirtree format requires.  @child_contents_checksums
+ * holds the contents checksum of each subdirectory, by index.
+ */
+static GVariant *
+create_tree_variant_from_mtree (OstreeMutableTree     *mtree,
+                                GPtrArray             *child_contents_checksums)
+{
+  GVariantBuilder files_builder;
+  GVariantBuilder dirs_builder;
+  GVariant *serialized_tree;
+  guint i, n;
+
+  g_variant_builder_init (&files_builder, G_VARIANT_TYPE ("a(say)"));
+  g_variant_builder_init (&dirs_builder, G_VARIANT_TYPE ("a(sayay)"));
+
+  n = ostree_mutable_tree_get_n_files (mtree);
+  for (i = 0; i < n; i++)
+    {
+      g_variant_builder_add (&files_builder, "(s@ay)",
+                             ostree_mutable_tree_get_file_name (mtree, i),
+                             ot_gvariant_new_bytearray (ostree_mutable_tree_get_file_csum (mtree, i), 32));
+    }
+
+  n = ostree_mutable_tree_get_n_subdirs (mtree);
+  g_assert_cmpuint (n, ==, child_contents_checksums->len);
+  for (i = 0; i < n; i++)
+    {
+      OstreeMutableTree *child = ostree_mutable_tree_get_subdir (mtree, i);
+      const char *meta_checksum = ostree_mutable_tree_get_metadata_checksum (child);
+
+      g_assert (meta_checksum);
+      g_variant_builder_add (&dirs_builder, "(s@ay@ay)",
+                             ostree_mutable_tree_get_subdir_name (mtree, i),
+                             ostree_checksum_to_bytes_v (child_contents_checksums->pdata[i]),
+                             ostree_checksum_to_bytes_v (meta_checksum));
+    }
+
+  serialized_tree = g_variant_new ("(@a(say)@a(sayay))",
+                                   g_variant_builder_end (&files_builder),
+                                   g_variant_builder_end (&dirs_builder));
+  g_variant_ref_sink (serialized_tree);
+
+  return serialized_tree;
+}
+
+static GFileInfo *
+create_modified_file_info (GFileInfo               *info,
+                           OstreeRepoCommitModifier *modifier)
+{
+  GFileInfo *ret;
+
+  if (!modifier)
+    return (GFileInfo*)g_object_ref (info);
+
+  ret = g_file_info_dup (info);
+  
+  return ret;
+}
+
+static char *
+join_commit_path (GPtrArray   *path)
+{
+  GString *path_buf;
+  guint i;
+
+  path_buf = g_string_new ("");
+  for (i = 0; i < path->len; i++)
+    {
+      const char *elt = path->pdata[i];
+
+      if (i > 0)
+        g_string_append_c (path_buf, '/');
+      g_string_append (path_buf, elt);
+    }
+  return g_string_free (path_buf, FALSE);
+}
+
+static OstreeRepoCommitFilterResult
+apply_commit_filter (OstreeRepo            *self,
+                     OstreeRepoCommitModifier *modifier,
+                     GPtrArray                *path,
+                     GFileInfo                *file_info,
+                     GFileInfo               **out_modified_info)
+{
+  GString *path_buf;
+  guint i;
+  OstreeRepoCommitFilterResult result;
+  GFileInfo *modified_info;
+  
+  if (modifier == NULL || modifier->filter == NULL)
+    {
+      *out_modified_info = g_object_ref (file_info);
+      return OSTREE_REPO_COMMIT_FILTER_ALLOW;
+    }
+
+  path_buf = g_string_new ("");
+
+  if (path->len == 0)
+    g_string_append_c (path_buf, '/');
+  else
+    {
+      for (i = 0; i < path->len; i++)
+        {
+          const char *elt = path->pdata[i];
+          
+          g_string_append_c (path_buf, '/');
+          g_string_append (path_buf, elt);
+        }
+    }
+
+  modified_info = g_file_info_dup (file_info);
+  result = modifier->filter (self, path_buf->str, modified_info, modifier->user_data);
+  *out_modified_info = modified_info;
+
+  g_string_free (path_buf, TRUE);
+  return result;
 }
 
 static gboolean
@@ -2683,8 +4213,12 @@ stage_directory_to_mtree_internal (OstreeRepo           *self,
   ot_lobj GFileEnumerator *dir_enum = NULL;
   ot_lobj GFileInfo *child_info = NULL;
 
-  /* We can only reuse checksums directly if there's no modifier */
-  if (OSTREE_IS_REPO_FILE (dir) && modifier == NULL)
+  /* We can only reuse checksums directly if the modifier doesn't
+   * change the content; a stat cache alone is fine.
+   */
+  if (OSTREE_IS_REPO_FILE (dir)
+      && (modifier == NULL
+          || (modifier->filter == NULL && !modifier->skip_xattrs)))
     repo_dir = (OstreeRepoFile*)g_object_ref (dir);
 
   if (repo_dir)
@@ -2694,8 +4228,8 @@ stage_directory_to_mtree_internal (OstreeRepo           *self,
 
       ostree_mutable_tree_set_metadata_checksum (mtree, ostree_repo_file_get_checksum (repo_dir));
       repo_dir_was_empty = 
-        g_hash_table_size (ostree_mutable_tree_get_files (mtree)) == 0
-        && g_hash_table_size (ostree_mutable_tree_get_subdirs (mtree)) == 0;
+        ostree_mutable_tree_get_n_files (mtree) == 0
+        && ostree_mutable_tree_get_n_subdirs (mtree) == 0;
 
       filter_result = OSTREE_REPO_COMMIT_FILTER_ALLOW;
     }
@@ -2777,13 +4311,51 @@ stage_directory_to_mtree_internal (OstreeRepo           *self,
                 {
                   guint64 file_obj_length;
                   const char *loose_checksum;
+                  struct stat stbuf;
                   ot_lobj GInputStream *file_input = NULL;
                   ot_lvariant GVariant *xattrs = NULL;
                   ot_lobj GInputStream *file_object_input = NULL;
                   ot_lfree guchar *child_file_csum = NULL;
                   ot_lfree char *tmp_checksum = NULL;
+                  ot_lfree char *stat_cache_path = NULL;
+
+                  if (modifier && modifier->stat_cache)
+                    {
+                      if (lstat (ot_gfile_get_path_cached (child), &stbuf) < 0)
+                        {
+                          ot_util_set_error_from_errno (error, errno);
+                          goto out;
+                        }
+                      stat_cache_path = join_commit_path (path);
+                    }
+
+                  loose_checksum = NULL;
+                  if (stat_cache_path && !modifier->stat_cache_verify)
+                    {
+                      gboolean have_obj;
+
+                      loose_checksum = ostree_stat_cache_lookup (modifier->stat_cache,
+                                                                 stat_cache_path, &stbuf);
+                      /* The cache may also have been filled by a diff
+                       * against files which were never committed.
+                       */
+                      if (loose_checksum)
+                        {
+                          if (!ostree_repo_has_object (self, OSTREE_OBJECT_TYPE_FILE, loose_checksum,
+                                                       &have_obj, cancellable, error))
+                            goto out;
+                          if (!have_obj)
+                            loose_checksum = NULL;
+                        }
+                    }
 
-                  loose_checksum = devino_cache_lookup (self, child_info);
+                  if (!loose_checksum)
+                    {
+                      loose_checksum = devino_cache_lookup (self, child_info);
+                      if (loose_checksum && stat_cache_path)
+                        ostree_stat_cache_update (modifier->stat_cache, stat_cache_path,
+                                                  &stbuf, loose_checksum);
+                    }
 
                   if (loose_checksum)
                     {
@@ -2822,6 +4394,10 @@ stage_directory_to_mtree_internal (OstreeRepo           *self,
                       if (!ostree_mutable_tree_replace_file (mtree, name, tmp_checksum,
                                                              error))
                         goto out;
+
+                      if (stat_cache_path)
+                        ostree_stat_cache_update (modifier->stat_cache, stat_cache_path,
+                                                  &stbuf, tmp_checksum);
                     }
                 }
 
@@ -2856,6 +4432,10 @@ ostree_repo_stage_directory_to_mtree (OstreeRepo           *self,
   gboolean ret = FALSE;
   GPtrArray *path = NULL;
 
+  /* Several local trees may be staged with one cache */
+  if (modifier && modifier->stat_cache && !OSTREE_IS_REPO_FILE (dir))
+    ostree_stat_cache_set_root (modifier->stat_cache, dir);
+
   path = g_ptr_array_new ();
   if (!stage_directory_to_mtree_internal (self, dir, mtree, modifier, path, cancellable, error))
     goto out;
@@ -2867,6 +4447,150 @@ ostree_repo_stage_directory_to_mtree (OstreeRepo           *self,
   return ret;
 }
 
+/* Number of threads staging dirtree objects in ostree_repo_stage_mtree() */
+#define OSTREE_REPO_STAGE_MTREE_THREADS (4)
+
+typedef struct _StageMtreeNode StageMtreeNode;
+
+/*
+ * A directory whose dirtree needs to be staged.  Its height is the
+ * length of the longest chain of such directories below it, so all
+ * nodes of one height can be staged independently once the lower
+ * heights are done.
+ */
+struct _StageMtreeNode {
+  OstreeMutableTree *mtree;
+  guint height;
+  StageMtreeNode *parent;
+  guint parent_slot;
+  /* Contents checksums of the subdirectories, by index */
+  GPtrArray *child_contents_checksums;
+  char *contents_checksum;
+};
+
+static void
+stage_mtree_node_free (StageMtreeNode *node)
+{
+  g_ptr_array_unref (node->child_contents_checksums);
+  g_free (node->contents_checksum);
+  g_slice_free (StageMtreeNode, node);
+}
+
+static guint
+plan_stage_mtree (OstreeMutableTree  *mtree,
+                  StageMtreeNode     *parent,
+                  guint               parent_slot,
+                  GPtrArray          *nodes)
+{
+  StageMtreeNode *node;
+  const char *existing_checksum;
+  guint i, n_subdirs;
+
+  existing_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
+  if (existing_checksum)
+    {
+      g_assert (parent != NULL);
+      parent->child_contents_checksums->pdata[parent_slot] = g_strdup (existing_checksum);
+      return 0;
+    }
+
+  node = g_slice_new0 (StageMtreeNode);
+  node->mtree = mtree;
+  node->parent = parent;
+  node->parent_slot = parent_slot;
+  g_ptr_array_add (nodes, node);
+
+  /* This also sorts the entries, after which the tree is only read */
+  n_subdirs = ostree_mutable_tree_get_n_subdirs (mtree);
+  node->child_contents_checksums = g_ptr_array_new_with_free_func (g_free);
+  g_ptr_array_set_size (node->child_contents_checksums, n_subdirs);
+  (void) ostree_mutable_tree_get_n_files (mtree);
+
+  for (i = 0; i < n_subdirs; i++)
+    {
+      OstreeMutableTree *child = ostree_mutable_tree_get_subdir (mtree, i);
+      guint child_height = plan_stage_mtree (child, node, i, nodes);
+      node->height = MAX (node->height, child_height);
+    }
+
+  return node->height + 1;
+}
+
+static int
+compare_stage_mtree_node_heights (gconstpointer a,
+                                  gconstpointer b)
+{
+  const StageMtreeNode *node_a = *(StageMtreeNode * const *)a;
+  const StageMtreeNode *node_b = *(StageMtreeNode * const *)b;
+
+  if (node_a->height < node_b->height)
+    return -1;
+  else if (node_a->height > node_b->height)
+    return 1;
+  return 0;
+}
+
+static gboolean
+stage_mtree_node (OstreeRepo        *self,
+                  StageMtreeNode    *node,
+                  GCancellable      *cancellable,
+                  GError           **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *serialized_tree = NULL;
+  ot_lfree guchar *contents_csum = NULL;
+
+  serialized_tree = create_tree_variant_from_mtree (node->mtree, node->child_contents_checksums);
+  if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_TREE,
+                              serialized_tree, &contents_csum,
+                              cancellable, error))
+    goto out;
+
+  node->contents_checksum = ostree_checksum_from_bytes (contents_csum);
+  /* Each node has its own slot in the parent, and the parent is
+   * only staged after this whole height is done.
+   */
+  if (node->parent)
+    node->parent->child_contents_checksums->pdata[node->parent_slot] = g_strdup (node->contents_checksum);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  GCancellable *cancellable;
+  GError * volatile first_error;
+} StageMtreeData;
+
+static void
+stage_mtree_thread (gpointer     data,
+                    gpointer     user_data)
+{
+  StageMtreeNode *node = data;
+  StageMtreeData *stage_data = user_data;
+  GError *local_error = NULL;
+
+  if (g_atomic_pointer_get (&stage_data->first_error) != NULL)
+    return;
+
+  if (!stage_mtree_node (stage_data->repo, node, stage_data->cancellable, &local_error))
+    {
+      if (!g_atomic_pointer_compare_and_exchange (&stage_data->first_error, NULL, local_error))
+        g_error_free (local_error);
+    }
+}
+
+/**
+ * ostree_repo_stage_mtree:
+ *
+ * Stage the dirtree objects of every modified directory in @mtree,
+ * and return the contents checksum of the root.  Directories are
+ * staged bottom up; all directories of the same height are
+ * independent, and are staged concurrently.  The result does not
+ * depend on the order they complete in.
+ */
 gboolean
 ostree_repo_stage_mtree (OstreeRepo           *self,
                          OstreeMutableTree    *mtree,
@@ -2875,59 +4599,69 @@ ostree_repo_stage_mtree (OstreeRepo           *self,
                          GError              **error)
 {
   gboolean ret = FALSE;
-  GHashTableIter hash_iter;
-  gpointer key, value;
+  guint i, start;
   const char *existing_checksum;
   ot_lfree char *ret_contents_checksum = NULL;
-  ot_lhash GHashTable *dir_metadata_checksums = NULL;
-  ot_lhash GHashTable *dir_contents_checksums = NULL;
-  ot_lvariant GVariant *serialized_tree = NULL;
-  ot_lfree guchar *contents_csum = NULL;
+  ot_lptrarray GPtrArray *nodes = NULL;
+  StageMtreeNode *root;
+  StageMtreeData stage_data;
 
   existing_checksum = ostree_mutable_tree_get_contents_checksum (mtree);
   if (existing_checksum)
     {
       ret_contents_checksum = g_strdup (existing_checksum);
+      goto done;
     }
-  else
+
+  nodes = g_ptr_array_new_with_free_func ((GDestroyNotify)stage_mtree_node_free);
+  (void) plan_stage_mtree (mtree, NULL, 0, nodes);
+  root = nodes->pdata[0];
+  g_ptr_array_sort (nodes, compare_stage_mtree_node_heights);
+
+  stage_data.repo = self;
+  stage_data.cancellable = cancellable;
+  stage_data.first_error = NULL;
+
+  for (start = 0; start < nodes->len; start = i)
     {
-      dir_contents_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-      dir_metadata_checksums = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                      (GDestroyNotify)g_free, (GDestroyNotify)g_free);
-      
-      g_hash_table_iter_init (&hash_iter, ostree_mutable_tree_get_subdirs (mtree));
-      while (g_hash_table_iter_next (&hash_iter, &key, &value))
+      guint height = ((StageMtreeNode*)nodes->pdata[start])->height;
+      GThreadPool *pool;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      for (i = start; i < nodes->len; i++)
         {
-          const char *name = key;
-          const char *metadata_checksum;
-          OstreeMutableTree *child_dir = value;
-          char *child_dir_contents_checksum;
+          if (((StageMtreeNode*)nodes->pdata[i])->height != height)
+            break;
+        }
 
-          if (!ostree_repo_stage_mtree (self, child_dir, &child_dir_contents_checksum,
-                                        cancellable, error))
+      if (i - start == 1)
+        {
+          if (!stage_mtree_node (self, nodes->pdata[start], cancellable, error))
             goto out;
-      
-          g_assert (child_dir_contents_checksum);
-          g_hash_table_replace (dir_contents_checksums, g_strdup (name),
-                                child_dir_contents_checksum); /* Transfer ownership */
-          metadata_checksum = ostree_mutable_tree_get_metadata_checksum (child_dir);
-          g_assert (metadata_checksum);
-          g_hash_table_replace (dir_metadata_checksums, g_strdup (name),
-                                g_strdup (metadata_checksum));
+          continue;
         }
-    
-      serialized_tree = create_tree_variant_from_hashes (ostree_mutable_tree_get_files (mtree),
-                                                         dir_contents_checksums,
-                                                         dir_metadata_checksums);
-      
-      if (!stage_metadata_object (self, OSTREE_OBJECT_TYPE_DIR_TREE,
-                                  serialized_tree, &contents_csum,
-                                  cancellable, error))
+
+      pool = g_thread_pool_new (stage_mtree_thread, &stage_data,
+                                OSTREE_REPO_STAGE_MTREE_THREADS, FALSE, error);
+      if (!pool)
         goto out;
-      ret_contents_checksum = ostree_checksum_from_bytes (contents_csum);
+      for (; start < i; start++)
+        g_thread_pool_push (pool, nodes->pdata[start], NULL);
+      /* Waits for this height to be staged */
+      g_thread_pool_free (pool, FALSE, TRUE);
+
+      if (stage_data.first_error)
+        {
+          g_propagate_error (error, stage_data.first_error);
+          goto out;
+        }
     }
 
+  ret_contents_checksum = g_strdup (root->contents_checksum);
+
+ done:
   ret = TRUE;
   ot_transfer_out_value(out_contents_checksum, &ret_contents_checksum);
  out:
@@ -3016,30 +4750,286 @@ import_libarchive_entry_file (OstreeRepo           *self,
   return ret;
 }
 
-static gboolean
-stage_libarchive_entry_to_mtree (OstreeRepo           *self,
-                                 OstreeMutableTree    *root,
-                                 struct archive       *a,
-                                 struct archive_entry *entry,
-                                 OstreeRepoCommitModifier *modifier,
-                                 const guchar         *tmp_dir_csum,
-                                 GCancellable         *cancellable,
-                                 GError              **error)
-{
-  gboolean ret = FALSE;
-  const char *pathname;
-  const char *hardlink;
-  const char *basename;
-  ot_lobj GFileInfo *file_info = NULL;
-  ot_lptrarray GPtrArray *split_path = NULL;
-  ot_lptrarray GPtrArray *hardlink_split_path = NULL;
-  ot_lobj OstreeMutableTree *subdir = NULL;
-  ot_lobj OstreeMutableTree *parent = NULL;
+/* Number of threads hashing and staging archive entries */
+#define OSTREE_REPO_IMPORT_THREADS (4)
+/* Regular files larger than this are staged by the reader directly */
+#define OSTREE_REPO_IMPORT_MAX_BUFFERED (16 * 1024 * 1024)
+/* Bound on entry data read but not yet staged */
+#define OSTREE_REPO_IMPORT_MAX_IN_FLIGHT (128 * 1024 * 1024)
+
+/*
+ * A file or hardlink entry; @csum is set once a file has been staged.
+ * A hardlink is resolved when it is read, to the file entry it names
+ * (@link_target) or to a checksum already in the tree (@link_checksum).
+ * Entries are added to the tree in archive order after all of them
+ * are staged.
+ */
+typedef struct _ImportArchiveFile ImportArchiveFile;
+struct _ImportArchiveFile {
+  OstreeMutableTree *parent;
+  char *basename;
+  GFileInfo *file_info;
+  guchar *data;
+  gsize len;
+  guchar *csum;
+  ImportArchiveFile *link_target;
+  char *link_checksum;
+};
+
+typedef struct {
+  OstreeRepo *repo;
+  OstreeMutableTree *root;
+  OstreeRepoCommitModifier *modifier;
+  GCancellable *cancellable;
+
+  GPtrArray *files;
+  /* Path -> latest file or hardlink entry for it */
+  GHashTable *paths;
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond cond;
+  /* Protected by lock */
+  gsize in_flight;
+  guint64 stage_usec;
+
+  GError * volatile first_error;
+
+  OstreeRepoImportStats stats;
+} ImportArchiveData;
+
+static void
+import_archive_file_free (ImportArchiveFile *file)
+{
+  g_clear_object (&file->parent);
+  g_free (file->basename);
+  g_clear_object (&file->file_info);
+  g_free (file->data);
+  g_free (file->csum);
+  g_free (file->link_checksum);
+  g_slice_free (ImportArchiveFile, file);
+}
+
+static char *
+import_archive_path_key (GPtrArray *split_path)
+{
+  GString *key = g_string_new ("");
+  guint i;
+
+  for (i = 0; i < split_path->len; i++)
+    {
+      if (i > 0)
+        g_string_append_c (key, '/');
+      g_string_append (key, split_path->pdata[i]);
+    }
+  return g_string_free (key, FALSE);
+}
+
+static gboolean
+import_archive_file_stage (OstreeRepo           *self,
+                           ImportArchiveFile    *file,
+                           GCancellable         *cancellable,
+                           GError              **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GInputStream *file_object_input = NULL;
+  ot_lobj GInputStream *data_input = NULL;
+  guint64 length;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (g_file_info_get_file_type (file->file_info) == G_FILE_TYPE_REGULAR)
+    data_input = g_memory_input_stream_new_from_data (file->data, file->len, NULL);
+
+  if (!ostree_raw_file_to_content_stream (data_input, file->file_info, NULL,
+                                          &file_object_input, &length, cancellable, error))
+    goto out;
+
+  if (!stage_object (self, OSTREE_REPO_STAGE_FLAGS_LENGTH_VALID, OSTREE_OBJECT_TYPE_FILE,
+                     file_object_input, length, NULL, &file->csum,
+                     cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+import_archive_thread (gpointer     data,
+                       gpointer     user_data)
+{
+  ImportArchiveFile *file = data;
+  ImportArchiveData *import = user_data;
+  GError *local_error = NULL;
+  gint64 start_time = g_get_monotonic_time ();
+  gsize len = file->len;
+
+  if (g_atomic_pointer_get (&import->first_error) == NULL)
+    {
+      if (!import_archive_file_stage (import->repo, file, import->cancellable, &local_error))
+        {
+          if (!g_atomic_pointer_compare_and_exchange (&import->first_error, NULL, local_error))
+            g_error_free (local_error);
+        }
+    }
+
+  g_free (file->data);
+  file->data = NULL;
+
+  g_mutex_lock (&import->lock);
+  import->stage_usec += g_get_monotonic_time () - start_time;
+  import->in_flight -= len;
+  g_cond_signal (&import->cond);
+  g_mutex_unlock (&import->lock);
+}
+
+/*
+ * Read the data of a regular file entry into memory, waiting for
+ * the workers while too much data is queued.
+ */
+static gboolean
+import_archive_read_data (ImportArchiveData    *import,
+                          struct archive       *a,
+                          ImportArchiveFile    *file,
+                          GError              **error)
+{
+  gboolean ret = FALSE;
+  guint64 size = g_file_info_get_size (file->file_info);
+  gint64 start_time;
+  gsize n_read = 0;
+
+  g_mutex_lock (&import->lock);
+  while (import->in_flight > 0
+         && import->in_flight + size > OSTREE_REPO_IMPORT_MAX_IN_FLIGHT)
+    g_cond_wait (&import->cond, &import->lock);
+  import->in_flight += size;
+  g_mutex_unlock (&import->lock);
+
+  start_time = g_get_monotonic_time ();
+  file->data = g_malloc (MAX (size, 1));
+  while (n_read < size)
+    {
+      ssize_t r = archive_read_data (a, file->data + n_read, size - n_read);
+      if (r < 0)
+        {
+          propagate_libarchive_error (error, a);
+          goto out;
+        }
+      else if (r == 0)
+        break;
+      n_read += r;
+    }
+  /* The entry may be shorter than its header claims */
+  file->len = n_read;
+
+  ret = TRUE;
+ out:
+  import->stats.read_usec += g_get_monotonic_time () - start_time;
+  if (!ret || n_read < size)
+    {
+      g_mutex_lock (&import->lock);
+      import->in_flight -= ret ? size - n_read : size;
+      g_mutex_unlock (&import->lock);
+    }
+  return ret;
+}
+
+/*
+ * Point @link at what @hardlink names right now: the latest entry
+ * read for that path, or failing that a file already in the tree.
+ */
+static gboolean
+import_archive_resolve_hardlink (ImportArchiveData      *import,
+                                 ImportArchiveFile      *link,
+                                 const char             *pathname,
+                                 const char             *hardlink,
+                                 GError                **error)
+{
+  gboolean ret = FALSE;
+  const char *hardlink_basename;
+  ImportArchiveFile *target;
+  ot_lptrarray GPtrArray *hardlink_split_path = NULL;
+  ot_lfree char *hardlink_key = NULL;
   ot_lobj OstreeMutableTree *hardlink_source_parent = NULL;
   ot_lfree char *hardlink_source_checksum = NULL;
   ot_lobj OstreeMutableTree *hardlink_source_subdir = NULL;
+
+  if (!ot_util_path_split_validate (hardlink, &hardlink_split_path, error))
+    goto out;
+  if (hardlink_split_path->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid hardlink path %s", hardlink);
+      goto out;
+    }
+
+  hardlink_key = import_archive_path_key (hardlink_split_path);
+  target = g_hash_table_lookup (import->paths, hardlink_key);
+  if (target)
+    {
+      if (target->link_checksum)
+        link->link_checksum = g_strdup (target->link_checksum);
+      else if (target->link_target)
+        link->link_target = target->link_target;
+      else
+        link->link_target = target;
+      ret = TRUE;
+      goto out;
+    }
+
+  hardlink_basename = hardlink_split_path->pdata[hardlink_split_path->len - 1];
+      
+  if (!ostree_mutable_tree_walk (import->root, hardlink_split_path, 0, &hardlink_source_parent, error))
+    goto out;
+      
+  if (!ostree_mutable_tree_lookup (hardlink_source_parent, hardlink_basename,
+                                   &hardlink_source_checksum,
+                                   &hardlink_source_subdir,
+                                   error))
+    {
+      g_prefix_error (error, "While resolving hardlink target: ");
+      goto out;
+    }
+      
+  if (hardlink_source_subdir)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Hardlink %s refers to directory %s",
+                   pathname, hardlink);
+      goto out;
+    }
+  g_assert (hardlink_source_checksum);
+
+  ot_transfer_out_value (&link->link_checksum, &hardlink_source_checksum);
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static gboolean
+stage_libarchive_entry_to_mtree (ImportArchiveData    *import,
+                                 struct archive       *a,
+                                 struct archive_entry *entry,
+                                 const guchar         *tmp_dir_csum,
+                                 GError              **error)
+{
+  gboolean ret = FALSE;
+  OstreeRepo *self = import->repo;
+  OstreeMutableTree *root = import->root;
+  GCancellable *cancellable = import->cancellable;
+  const char *pathname;
+  const char *hardlink;
+  const char *basename;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lptrarray GPtrArray *split_path = NULL;
+  ot_lobj OstreeMutableTree *subdir = NULL;
+  ot_lobj OstreeMutableTree *parent = NULL;
   ot_lfree guchar *tmp_csum = NULL;
   ot_lfree char *tmp_checksum = NULL;
+  ot_lfree char *key = NULL;
 
   pathname = archive_entry_pathname (entry); 
       
@@ -3069,56 +5059,31 @@ stage_libarchive_entry_to_mtree (OstreeRepo           *self,
             goto out;
         }
       basename = (char*)split_path->pdata[split_path->len-1];
+      key = import_archive_path_key (split_path);
     }
 
   hardlink = archive_entry_hardlink (entry);
   if (hardlink)
     {
-      const char *hardlink_basename;
-      
+      ImportArchiveFile *link;
+
       g_assert (parent != NULL);
 
-      if (!ot_util_path_split_validate (hardlink, &hardlink_split_path, error))
-        goto out;
-      if (hardlink_split_path->len == 0)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Invalid hardlink path %s", hardlink);
-          goto out;
-        }
-      
-      hardlink_basename = hardlink_split_path->pdata[hardlink_split_path->len - 1];
-      
-      if (!ostree_mutable_tree_walk (root, hardlink_split_path, 0, &hardlink_source_parent, error))
-        goto out;
-      
-      if (!ostree_mutable_tree_lookup (hardlink_source_parent, hardlink_basename,
-                                       &hardlink_source_checksum,
-                                       &hardlink_source_subdir,
-                                       error))
-        {
-              g_prefix_error (error, "While resolving hardlink target: ");
-              goto out;
-        }
-      
-      if (hardlink_source_subdir)
-        {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Hardlink %s refers to directory %s",
-                       pathname, hardlink);
-          goto out;
-        }
-      g_assert (hardlink_source_checksum);
-      
-      if (!ostree_mutable_tree_replace_file (parent,
-                                             basename,
-                                             hardlink_source_checksum,
-                                             error))
+      link = g_slice_new0 (ImportArchiveFile);
+      link->parent = g_object_ref (parent);
+      link->basename = g_strdup (basename);
+      g_ptr_array_add (import->files, link);
+
+      if (!import_archive_resolve_hardlink (import, link, pathname, hardlink, error))
         goto out;
+
+      g_hash_table_replace (import->paths, key, link);
+      key = NULL;
+      import->stats.n_hardlinks++;
     }
   else
     {
-      file_info = file_info_from_archive_entry_and_modifier (entry, modifier);
+      file_info = file_info_from_archive_entry_and_modifier (entry, import->modifier);
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_UNKNOWN)
         {
@@ -3146,9 +5111,15 @@ stage_libarchive_entry_to_mtree (OstreeRepo           *self,
           g_free (tmp_checksum);
           tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
           ostree_mutable_tree_set_metadata_checksum (subdir, tmp_checksum);
+          if (key)
+            g_hash_table_remove (import->paths, key);
+          import->stats.n_directories++;
         }
       else 
         {
+          ImportArchiveFile *file;
+          gboolean is_regular;
+
           if (parent == NULL)
             {
               g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
@@ -3156,15 +5127,36 @@ stage_libarchive_entry_to_mtree (OstreeRepo           *self,
               goto out;
             }
 
-          if (!import_libarchive_entry_file (self, a, entry, file_info, &tmp_csum, cancellable, error))
-            goto out;
-          
-          g_free (tmp_checksum);
-          tmp_checksum = ostree_checksum_from_bytes (tmp_csum);
-          if (!ostree_mutable_tree_replace_file (parent, basename,
-                                                 tmp_checksum,
-                                                 error))
-            goto out;
+          file = g_slice_new0 (ImportArchiveFile);
+          file->parent = g_object_ref (parent);
+          file->basename = g_strdup (basename);
+          file->file_info = g_object_ref (file_info);
+          g_ptr_array_add (import->files, file);
+          g_hash_table_replace (import->paths, key, file);
+          key = NULL;
+          import->stats.n_files++;
+
+          is_regular = g_file_info_get_file_type (file_info) == G_FILE_TYPE_REGULAR;
+          if (is_regular && g_file_info_get_size (file_info) > OSTREE_REPO_IMPORT_MAX_BUFFERED)
+            {
+              gint64 start_time = g_get_monotonic_time ();
+
+              if (!import_libarchive_entry_file (self, a, entry, file_info, &file->csum,
+                                                 cancellable, error))
+                goto out;
+              import->stats.large_bytes += g_file_info_get_size (file_info);
+              import->stats.large_usec += g_get_monotonic_time () - start_time;
+            }
+          else
+            {
+              if (is_regular)
+                {
+                  if (!import_archive_read_data (import, a, file, error))
+                    goto out;
+                  import->stats.bytes += file->len;
+                }
+              g_thread_pool_push (import->pool, file, NULL);
+            }
         }
     }
 
@@ -3182,14 +5174,60 @@ ostree_repo_stage_archive_to_mtree (OstreeRepo                *self,
                                     gboolean                   autocreate_parents,
                                     GCancellable             *cancellable,
                                     GError                  **error)
+{
+  return ostree_repo_stage_archive_to_mtree_with_stats (self, archive_f, root, modifier,
+                                                        autocreate_parents, NULL,
+                                                        cancellable, error);
+}
+
+/**
+ * ostree_repo_stage_archive_to_mtree_with_stats:
+ * @out_stats: (allow-none): Return location for import statistics
+ *
+ * Like ostree_repo_stage_archive_to_mtree().  The calling thread
+ * reads and decompresses the archive; entry data is buffered and
+ * hashed and staged by a pool of worker threads.  Files and
+ * hardlinks are added to @root in archive order once all of them
+ * are staged; a hardlink gets the contents its target had when the
+ * hardlink entry was read.
+ */
+gboolean
+ostree_repo_stage_archive_to_mtree_with_stats (OstreeRepo                *self,
+                                               GFile                     *archive_f,
+                                               OstreeMutableTree         *root,
+                                               OstreeRepoCommitModifier  *modifier,
+                                               gboolean                   autocreate_parents,
+                                               OstreeRepoImportStats     *out_stats,
+                                               GCancellable              *cancellable,
+                                               GError                   **error)
 {
 #ifdef HAVE_LIBARCHIVE
   gboolean ret = FALSE;
   struct archive *a = NULL;
   struct archive_entry *entry;
   int r;
+  guint i;
+  gint64 start_time;
   ot_lobj GFileInfo *tmp_dir_info = NULL;
   ot_lfree guchar *tmp_csum = NULL;
+  ImportArchiveData import;
+
+  start_time = g_get_monotonic_time ();
+
+  memset (&import, 0, sizeof (import));
+  import.repo = self;
+  import.root = root;
+  import.modifier = modifier;
+  import.cancellable = cancellable;
+  import.files = g_ptr_array_new_with_free_func ((GDestroyNotify)import_archive_file_free);
+  import.paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_mutex_init (&import.lock);
+  g_cond_init (&import.cond);
+
+  import.pool = g_thread_pool_new (import_archive_thread, &import,
+                                   OSTREE_REPO_IMPORT_THREADS, FALSE, error);
+  if (!import.pool)
+    goto out;
 
   a = archive_read_new ();
   archive_read_support_compression_all (a);
@@ -3200,7 +5238,7 @@ ostree_repo_stage_archive_to_mtree (OstreeRepo                *self,
       goto out;
     }
 
-  while (TRUE)
+  while (g_atomic_pointer_get (&import.first_error) == NULL)
     {
       r = archive_read_next_header (a, &entry);
       if (r == ARCHIVE_EOF)
@@ -3223,20 +5261,59 @@ ostree_repo_stage_archive_to_mtree (OstreeRepo                *self,
             goto out;
         }
 
-      if (!stage_libarchive_entry_to_mtree (self, root, a,
-                                            entry, modifier,
+      if (!stage_libarchive_entry_to_mtree (&import, a, entry,
                                             autocreate_parents ? tmp_csum : NULL,
-                                            cancellable, error))
+                                            error))
         goto out;
     }
+
+  /* Waits for the queued files */
+  g_thread_pool_free (import.pool, FALSE, TRUE);
+  import.pool = NULL;
+  if (import.first_error)
+    {
+      g_propagate_error (error, import.first_error);
+      import.first_error = NULL;
+      goto out;
+    }
+
   if (archive_read_close (a) != ARCHIVE_OK)
     {
       propagate_libarchive_error (error, a);
       goto out;
     }
 
+  for (i = 0; i < import.files->len; i++)
+    {
+      ImportArchiveFile *file = import.files->pdata[i];
+      char checksum[65];
+
+      if (file->link_checksum)
+        strcpy (checksum, file->link_checksum);
+      else if (file->link_target)
+        ostree_checksum_inplace_from_bytes (file->link_target->csum, checksum);
+      else
+        ostree_checksum_inplace_from_bytes (file->csum, checksum);
+      if (!ostree_mutable_tree_replace_file (file->parent, file->basename,
+                                             checksum, error))
+        goto out;
+    }
+
+  import.stats.stage_usec = import.stage_usec;
+  import.stats.total_usec = g_get_monotonic_time () - start_time;
+  if (out_stats)
+    *out_stats = import.stats;
+
   ret = TRUE;
  out:
+  if (import.pool)
+    g_thread_pool_free (import.pool, FALSE, TRUE);
+  if (import.first_error)
+    g_error_free (import.first_error);
+  g_ptr_array_unref (import.files);
+  g_hash_table_unref (import.paths);
+  g_mutex_clear (&import.lock);
+  g_cond_clear (&import.cond);
   if (a)
     (void)archive_read_close (a);
   return ret;
@@ -3390,41 +5467,48 @@ ostree_repo_load_pack_index (OstreeRepo    *self,
 {
   gboolean ret = FALSE;
   ot_lvariant GVariant *ret_variant = NULL;
+  ot_lvariant GVariant *new_variant = NULL;
   ot_lobj GFile *path = NULL;
   
-  g_mutex_lock (&self->cache_lock);
+  g_rw_lock_reader_lock (&self->pack_cache_lock);
+  ret_variant = pack_cache_lookup (&self->cached_pack_index_mappings, pack_checksum);
+  g_rw_lock_reader_unlock (&self->pack_cache_lock);
 
-  ret_variant = g_hash_table_lookup (self->cached_pack_index_mappings, pack_checksum);
   if (ret_variant)
-    {
-      g_variant_ref (ret_variant);
-    }
+    count_stat (self, OSTREE_REPO_STAT_PACK_CACHE_HITS, 1);
   else
     {
       path = get_pack_index_path (self->pack_dir, is_meta, pack_checksum);
       if (!map_variant_file_check_header_string (path,
                                                  OSTREE_PACK_INDEX_VARIANT_FORMAT,
                                                  "OSTv0PACKINDEX", TRUE,
-                                                 &ret_variant,
+                                                 &new_variant,
                                                  cancellable, error))
         goto out;
-      g_hash_table_insert (self->cached_pack_index_mappings, g_strdup (pack_checksum),
-                           g_variant_ref (ret_variant));
+      count_stat (self, OSTREE_REPO_STAT_PACK_MAPS, 1);
+      /* Lookups binary search the whole index */
+      advise_mapped_range (g_variant_get_data (new_variant), g_variant_get_size (new_variant),
+                           MADV_WILLNEED);
+
+      g_rw_lock_writer_lock (&self->pack_cache_lock);
+      ret_variant = pack_cache_insert (self, &self->cached_pack_index_mappings, pack_checksum,
+                                       new_variant, g_variant_get_size (new_variant));
+      g_rw_lock_writer_unlock (&self->pack_cache_lock);
     }
 
   ret = TRUE;
   ot_transfer_out_value (out_variant, &ret_variant);
  out:
-  g_mutex_unlock (&self->cache_lock);
   return ret;
 }
 
 /**
  * @sha256: Checksum of pack file
  * @out_data: (out): Pointer to pack file data
+ * @out_map: (out) (transfer full): Keeps @out_data mapped while in use
  *
- * Ensure that the given pack file is mapped into
- * memory.
+ * Ensure that the given pack file is mapped into memory.  Mappings
+ * are cached, but may be evicted as soon as @out_map is released.
  */
 gboolean
 ostree_repo_map_pack_file (OstreeRepo    *self,
@@ -3432,104 +5516,314 @@ ostree_repo_map_pack_file (OstreeRepo    *self,
                            gboolean       is_meta,
                            guchar       **out_data,
                            guint64       *out_len,
+                           GMappedFile  **out_map,
                            GCancellable  *cancellable,
                            GError       **error)
 {
   gboolean ret = FALSE;
-  gpointer ret_data;
-  guint64 ret_len;
   GMappedFile *map = NULL;
+  GMappedFile *new_map = NULL;
   ot_lobj GFile *path = NULL;
 
-  g_mutex_lock (&self->cache_lock);
+  g_return_val_if_fail (out_map != NULL, FALSE);
 
-  map = g_hash_table_lookup (self->cached_pack_data_mappings, pack_checksum);
-  if (map == NULL)
+  g_rw_lock_reader_lock (&self->pack_cache_lock);
+  map = pack_cache_lookup (&self->cached_pack_data_mappings, pack_checksum);
+  g_rw_lock_reader_unlock (&self->pack_cache_lock);
+
+  if (map)
+    count_stat (self, OSTREE_REPO_STAT_PACK_CACHE_HITS, 1);
+  else
     {
       path = get_pack_data_path (self->pack_dir, is_meta, pack_checksum);
 
-      map = g_mapped_file_new (ot_gfile_get_path_cached (path), FALSE, error);
-      if (!map)
+      new_map = g_mapped_file_new (ot_gfile_get_path_cached (path), FALSE, error);
+      if (!new_map)
         goto out;
-
-      g_hash_table_insert (self->cached_pack_data_mappings, g_strdup (pack_checksum), map);
-      ret_data = g_mapped_file_get_contents (map);
+      count_stat (self, OSTREE_REPO_STAT_PACK_MAPS, 1);
+      if (g_atomic_int_get (&self->sequential_pack_access))
+        advise_mapped_range ((guchar*)g_mapped_file_get_contents (new_map),
+                             g_mapped_file_get_length (new_map), MADV_SEQUENTIAL);
+
+      g_rw_lock_writer_lock (&self->pack_cache_lock);
+      map = pack_cache_insert (self, &self->cached_pack_data_mappings, pack_checksum,
+                               new_map, g_mapped_file_get_length (new_map));
+      g_rw_lock_writer_unlock (&self->pack_cache_lock);
     }
 
-  ret_data = g_mapped_file_get_contents (map);
-  ret_len = (guint64)g_mapped_file_get_length (map);
-
   ret = TRUE;
   if (out_data)
-    *out_data = ret_data;
+    *out_data = (guchar*)g_mapped_file_get_contents (map);
   if (out_len)
-    *out_len = ret_len;
+    *out_len = (guint64)g_mapped_file_get_length (map);
+  *out_map = map;
  out:
-  g_mutex_unlock (&self->cache_lock);
+  if (new_map)
+    g_mapped_file_unref (new_map);
   return ret;
 }
 
-gboolean
-ostree_repo_load_file (OstreeRepo         *self,
-                       const char         *checksum,
-                       GInputStream      **out_input,
-                       GFileInfo         **out_file_info,
-                       GVariant          **out_xattrs,
-                       GCancellable       *cancellable,
-                       GError            **error)
+/**
+ * ostree_repo_set_pack_cache_limits:
+ * @self:
+ * @max_mappings: Maximum number of pack files of each kind to keep mapped
+ * @max_bytes: Maximum total size of the pack files of each kind kept mapped
+ *
+ * Pack indexes and pack data files stay mapped after use, least
+ * recently used first out.  The defaults can be set with the
+ * "pack-cache-mappings" and "pack-cache-size-mb" keys of the "core"
+ * configuration section.
+ */
+void
+ostree_repo_set_pack_cache_limits (OstreeRepo  *self,
+                                   guint        max_mappings,
+                                   guint64      max_bytes)
 {
-  gboolean ret = FALSE;
-  guchar *pack_data;
-  guint64 pack_len;
-  guint64 pack_offset;
-  ot_lvariant GVariant *packed_object = NULL;
-  ot_lvariant GVariant *file_data = NULL;
-  ot_lobj GFile *loose_path = NULL;
-  ot_lobj GFileInfo *content_loose_info = NULL;
-  ot_lfree char *pack_checksum = NULL;
-  ot_lobj GInputStream *ret_input = NULL;
-  ot_lobj GFileInfo *ret_file_info = NULL;
-  ot_lvariant GVariant *ret_xattrs = NULL;
+  g_return_if_fail (max_mappings > 0);
+
+  g_rw_lock_writer_lock (&self->pack_cache_lock);
+  self->pack_cache_max_mappings = max_mappings;
+  self->pack_cache_max_bytes = max_bytes;
+  pack_cache_trim (&self->cached_pack_index_mappings, max_mappings, max_bytes);
+  pack_cache_trim (&self->cached_pack_data_mappings, max_mappings, max_bytes);
+  g_rw_lock_writer_unlock (&self->pack_cache_lock);
+}
 
-  if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE,
-                         checksum, FALSE, &loose_path,
-                         &pack_checksum, &pack_offset,
-                         cancellable, error))
-    goto out;
+/**
+ * ostree_repo_set_sequential_pack_access:
+ * @self:
+ * @sequential: Whether whole packs will be read
+ *
+ * Tell the kernel that pack data files mapped from now on will be
+ * read through, as when checking or unpacking every object, so it can
+ * read ahead aggressively.  This applies to whole mappings; random
+ * lookups should leave it unset.
+ */
+void
+ostree_repo_set_sequential_pack_access (OstreeRepo  *self,
+                                        gboolean     sequential)
+{
+  g_atomic_int_set (&self->sequential_pack_access, sequential);
+}
 
-  if (loose_path)
-    {
-      if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
-        {
-          ot_lvariant GVariant *archive_meta = NULL;
+/**
+ * ostree_repo_get_pack_cache_stats:
+ * @self:
+ * @out_index_stats: (out) (allow-none): State of the pack index mappings
+ * @out_data_stats: (out) (allow-none): State of the pack data mappings
+ */
+void
+ostree_repo_get_pack_cache_stats (OstreeRepo                *self,
+                                  OstreeRepoPackCacheStats  *out_index_stats,
+                                  OstreeRepoPackCacheStats  *out_data_stats)
+{
+  g_rw_lock_reader_lock (&self->pack_cache_lock);
+  pack_cache_get_stats (&self->cached_pack_index_mappings, out_index_stats);
+  pack_cache_get_stats (&self->cached_pack_data_mappings, out_data_stats);
+  g_rw_lock_reader_unlock (&self->pack_cache_lock);
+}
 
-          if (!ot_util_variant_map (loose_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT,
-                                    TRUE, &archive_meta, error))
-            goto out;
+/**
+ * ostree_repo_stat_to_string:
+ *
+ * Returns: The name of @stat, as used by "ostree --stats"
+ */
+const char *
+ostree_repo_stat_to_string (OstreeRepoStat stat)
+{
+  switch (stat)
+    {
+    case OSTREE_REPO_STAT_LOOSE_LOOKUPS:
+      return "loose_lookups";
+    case OSTREE_REPO_STAT_LOOSE_HITS:
+      return "loose_hits";
+    case OSTREE_REPO_STAT_PACK_LOOKUPS:
+      return "pack_lookups";
+    case OSTREE_REPO_STAT_PACK_HITS:
+      return "pack_hits";
+    case OSTREE_REPO_STAT_PACK_MAPS:
+      return "pack_maps";
+    case OSTREE_REPO_STAT_PACK_CACHE_HITS:
+      return "pack_cache_hits";
+    case OSTREE_REPO_STAT_BYTES_HASHED:
+      return "bytes_hashed";
+    case OSTREE_REPO_STAT_BYTES_WRITTEN:
+      return "bytes_written";
+    case OSTREE_REPO_STAT_TMPFILES_CREATED:
+      return "tmpfiles_created";
+    case OSTREE_REPO_STAT_FIND_OBJECT_USEC:
+      return "find_object_usec";
+    case OSTREE_REPO_STAT_HASH_USEC:
+      return "hash_usec";
+    case OSTREE_REPO_STAT_STAGE_USEC:
+      return "stage_usec";
+    case OSTREE_REPO_STAT_MKDIR_USEC:
+      return "mkdir_usec";
+    default:
+      g_assert_not_reached ();
+    }
+}
 
-          if (!ostree_file_header_parse (archive_meta, &ret_file_info, &ret_xattrs,
-                                         error))
+/**
+ * ostree_repo_set_collect_stats:
+ * @self:
+ * @collect: Whether to update the counters of ostree_repo_get_stats()
+ *
+ * Counting is off by default, since every lookup would otherwise
+ * update counters shared between threads.
+ */
+void
+ostree_repo_set_collect_stats (OstreeRepo  *self,
+                               gboolean     collect)
+{
+  self->collect_stats = collect;
+}
+
+/**
+ * ostree_repo_set_default_collect_stats:
+ * @collect: Whether repositories created from now on collect stats
+ */
+void
+ostree_repo_set_default_collect_stats (gboolean collect)
+{
+  g_atomic_int_set (&default_collect_stats, collect);
+}
+
+/**
+ * ostree_repo_get_stats:
+ * @self:
+ * @values: (out): Value of each #OstreeRepoStat
+ *
+ * Counters are cumulative while collection is enabled.
+ */
+void
+ostree_repo_get_stats (OstreeRepo  *self,
+                       guint64      values[OSTREE_REPO_N_STATS])
+{
+  guint i;
+
+  for (i = 0; i < OSTREE_REPO_N_STATS; i++)
+    values[i] = atomic_get_uint64 (&self->stats[i]);
+}
+
+/**
+ * ostree_repo_get_total_stats:
+ * @values: (out): Value of each #OstreeRepoStat
+ *
+ * Sums of the counters of every repository of this process, both
+ * those still alive and those already finalized.
+ */
+void
+ostree_repo_get_total_stats (guint64 values[OSTREE_REPO_N_STATS])
+{
+  GList *iter;
+  guint i;
+
+  g_mutex_lock (&total_stats_lock);
+  for (i = 0; i < OSTREE_REPO_N_STATS; i++)
+    values[i] = finalized_stats[i];
+  for (iter = live_repos; iter; iter = iter->next)
+    {
+      OstreeRepo *repo = iter->data;
+
+      for (i = 0; i < OSTREE_REPO_N_STATS; i++)
+        values[i] += atomic_get_uint64 (&repo->stats[i]);
+    }
+  g_mutex_unlock (&total_stats_lock);
+}
+
+gboolean
+ostree_repo_load_file (OstreeRepo         *self,
+                       const char         *checksum,
+                       GInputStream      **out_input,
+                       GFileInfo         **out_file_info,
+                       GVariant          **out_xattrs,
+                       GCancellable       *cancellable,
+                       GError            **error)
+{
+  gboolean ret = FALSE;
+  guchar *pack_data;
+  guint64 pack_len;
+  guint64 pack_offset;
+  OstreePackFileEntry pack_entry;
+  GMappedFile *pack_map = NULL;
+  ot_lobj GFile *loose_path = NULL;
+  ot_lobj GFileInfo *content_loose_info = NULL;
+  ot_lfree char *pack_checksum = NULL;
+  ot_lobj GInputStream *ret_input = NULL;
+  ot_lobj GFileInfo *ret_file_info = NULL;
+  ot_lvariant GVariant *ret_xattrs = NULL;
+
+  if (!repo_find_object (self, OSTREE_OBJECT_TYPE_FILE,
+                         checksum, FALSE, &loose_path,
+                         &pack_checksum, &pack_offset,
+                         cancellable, error))
+    goto out;
+
+  if (loose_path)
+    {
+      if (ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
+        {
+          ot_lvariant GVariant *archive_meta = NULL;
+
+          if (!ot_util_variant_map (loose_path, OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                    TRUE, &archive_meta, error))
+            goto out;
+
+          if (!ostree_file_header_parse (archive_meta, &ret_file_info, &ret_xattrs,
+                                         error))
             goto out;
 
-          if (g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
+          /* Callers only wanting the xattrs don't need the content */
+          if (g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR
+              && (out_input || out_file_info))
             {
               ot_lobj GFile *archive_content_path = NULL;
               ot_lobj GFileInfo *content_info = NULL;
 
-              archive_content_path = ostree_repo_get_archive_content_path (self, checksum);
-              content_info = g_file_query_info (archive_content_path, OSTREE_GIO_FAST_QUERYINFO,
-                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-                                                cancellable, error);
-              if (!content_info)
-                goto out;
+              archive_content_path = lookup_pending_object (self, checksum, "filecontent");
+              if (archive_content_path)
+                {
+                  content_info = g_file_query_info (archive_content_path, OSTREE_GIO_FAST_QUERYINFO,
+                                                    G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                                    cancellable, error);
+                  if (!content_info)
+                    goto out;
 
-              if (out_input)
+                  if (out_input)
+                    {
+                      ret_input = (GInputStream*)g_file_read (archive_content_path, cancellable, error);
+                      if (!ret_input)
+                        goto out;
+                    }
+                  g_file_info_set_size (ret_file_info, g_file_info_get_size (content_info));
+                }
+              else
                 {
-                  ret_input = (GInputStream*)g_file_read (archive_content_path, cancellable, error);
-                  if (!ret_input)
+                  int fd;
+                  struct stat stbuf;
+
+                  if (!open_loose_object (self, checksum, "filecontent", &fd, error))
                     goto out;
+                  if (fd == -1)
+                    {
+                      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                   "Missing content for archived file %s", checksum);
+                      goto out;
+                    }
+                  if (fstat (fd, &stbuf) < 0)
+                    {
+                      ot_util_set_error_from_errno (error, errno);
+                      (void) close (fd);
+                      goto out;
+                    }
+
+                  if (out_input)
+                    ret_input = g_unix_input_stream_new (fd, TRUE);
+                  else
+                    (void) close (fd);
+                  g_file_info_set_size (ret_file_info, stbuf.st_size);
                 }
-              g_file_info_set_size (ret_file_info, g_file_info_get_size (content_info));
             }
         }
       else
@@ -3561,21 +5855,27 @@ ostree_repo_load_file (OstreeRepo         *self,
   else if (pack_checksum)
     {
       if (!ostree_repo_map_pack_file (self, pack_checksum, FALSE,
-                                      &pack_data, &pack_len,
+                                      &pack_data, &pack_len, &pack_map,
                                       cancellable, error))
         goto out;
 
-      if (!ostree_read_pack_entry_raw (pack_data, pack_len,
-                                       pack_offset, TRUE, FALSE,
-                                       &packed_object, cancellable, error))
+      if (!ostree_read_file_pack_entry (pack_data, pack_len, pack_offset,
+                                        &pack_entry, error))
         goto out;
 
-      if (!ostree_parse_file_pack_entry (packed_object,
-                                         out_input ? &ret_input : NULL,
-                                         out_file_info ? &ret_file_info : NULL,
-                                         out_xattrs ? &ret_xattrs : NULL,
-                                         cancellable, error))
+      if (!ostree_file_pack_entry_parse_header (&pack_entry, TRUE, &ret_file_info,
+                                                out_xattrs ? &ret_xattrs : NULL,
+                                                error))
         goto out;
+
+      if (out_input && g_file_info_get_file_type (ret_file_info) == G_FILE_TYPE_REGULAR)
+        {
+          ret_input = ostree_file_pack_entry_new_input (&pack_entry);
+          /* The stream reads from the mapping */
+          g_object_set_data_full ((GObject*)ret_input, "ostree-pack-map",
+                                  g_mapped_file_ref (pack_map),
+                                  (GDestroyNotify)g_mapped_file_unref);
+        }
     }
   else if (self->parent_repo)
     {
@@ -3598,6 +5898,8 @@ ostree_repo_load_file (OstreeRepo         *self,
   ot_transfer_out_value (out_file_info, &ret_file_info);
   ot_transfer_out_value (out_xattrs, &ret_xattrs);
  out:
+  if (pack_map)
+    g_mapped_file_unref (pack_map);
   return ret;
 }
 
@@ -3729,6 +6031,8 @@ find_object_in_packs (OstreeRepo        *self,
   ot_lvariant GVariant *csum_bytes = NULL;
   ot_lvariant GVariant *index_variant = NULL;
 
+  count_stat (self, OSTREE_REPO_STAT_PACK_LOOKUPS, 1);
+
   csum_bytes = ostree_checksum_to_bytes_v (checksum);
 
   is_meta = OSTREE_OBJECT_TYPE_IS_META (objtype);
@@ -3761,6 +6065,7 @@ find_object_in_packs (OstreeRepo        *self,
 
       ret_pack_checksum = g_strdup (pack_checksum);
       ret_pack_offset = offset;
+      count_stat (self, OSTREE_REPO_STAT_PACK_HITS, 1);
       break;
     }
 
@@ -3772,6 +6077,42 @@ find_object_in_packs (OstreeRepo        *self,
   return ret;
 }
 
+/*
+ * Set @out_path to the loose object @checksum if it exists, including
+ * objects pending in the current transaction, or %NULL otherwise.
+ */
+static gboolean
+find_loose_object (OstreeRepo         *self,
+                   const char         *checksum,
+                   OstreeObjectType    objtype,
+                   GFile             **out_path,
+                   GError            **error)
+{
+  gboolean ret = FALSE;
+  gboolean found;
+  struct stat stbuf;
+  ot_lobj GFile *ret_path = NULL;
+
+  count_stat (self, OSTREE_REPO_STAT_LOOSE_LOOKUPS, 1);
+
+  ret_path = lookup_pending_object (self, checksum, ostree_object_type_to_string (objtype));
+  if (!ret_path)
+    {
+      if (!stat_loose_object (self, checksum, ostree_object_type_to_string (objtype),
+                              &stbuf, &found, error))
+        goto out;
+      if (found)
+        ret_path = ostree_repo_get_object_path (self, checksum, objtype);
+    }
+  if (ret_path)
+    count_stat (self, OSTREE_REPO_STAT_LOOSE_HITS, 1);
+
+  ret = TRUE;
+  ot_transfer_out_value (out_path, &ret_path);
+ out:
+  return ret;
+}
+
 static gboolean      
 repo_find_object (OstreeRepo           *self,
                   OstreeObjectType      objtype,
@@ -3785,8 +6126,7 @@ repo_find_object (OstreeRepo           *self,
 {
   gboolean ret = FALSE;
   guint64 ret_pack_offset = 0;
-  struct stat stbuf;
-  ot_lobj GFile *object_path = NULL;
+  gint64 start_time = stats_timer_start (self);
   ot_lobj GFile *ret_stored_path = NULL;
   ot_lfree char *ret_pack_checksum = NULL;
 
@@ -3807,34 +6147,16 @@ repo_find_object (OstreeRepo           *self,
         }
       if (!ret_pack_checksum || lookup_all)
         {
-          object_path = ostree_repo_get_object_path (self, checksum, objtype);
-  
-          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
-            {
-              ret_stored_path = object_path;
-              object_path = NULL;
-            }
-          else
-            {
-              g_clear_object (&object_path);
-            }
+          if (!find_loose_object (self, checksum, objtype, &ret_stored_path, error))
+            goto out;
         }
     }
   else
     {
       if (out_stored_path)
         {
-          object_path = ostree_repo_get_object_path (self, checksum, objtype);
-  
-          if (lstat (ot_gfile_get_path_cached (object_path), &stbuf) == 0)
-            {
-              ret_stored_path = object_path;
-              object_path = NULL;
-            }
-          else
-            {
-              g_clear_object (&object_path);
-            }
+          if (!find_loose_object (self, checksum, objtype, &ret_stored_path, error))
+            goto out;
         }
       if (!ret_stored_path || lookup_all)
         {
@@ -3854,6 +6176,7 @@ repo_find_object (OstreeRepo           *self,
   if (out_pack_offset)
     *out_pack_offset = ret_pack_offset;
 out:
+  stats_timer_stop (self, OSTREE_REPO_STAT_FIND_OBJECT_USEC, start_time);
   return ret;
 }
 
@@ -3892,79 +6215,362 @@ ostree_repo_has_object (OstreeRepo           *self,
   return ret;
 }
 
+/* Called with cache_lock held */
+static void
+metadata_cache_trim (OstreeRepo *self)
+{
+  while (self->metadata_cache_lru.length > self->metadata_cache_size)
+    {
+      GList *link = g_queue_pop_tail_link (&self->metadata_cache_lru);
+      g_hash_table_remove (self->metadata_cache, link->data);
+    }
+}
+
+static GVariant *
+metadata_cache_lookup (OstreeRepo          *self,
+                       OstreeObjectType     objtype,
+                       const guchar        *csum)
+{
+  OstreeRepoMetadataCacheEntry key;
+  OstreeRepoMetadataCacheEntry *entry;
+  GVariant *ret = NULL;
+
+  memcpy (key.csum, csum, 32);
+  key.objtype = objtype;
+
+  g_mutex_lock (&self->cache_lock);
+  entry = g_hash_table_lookup (self->metadata_cache, &key);
+  if (entry)
+    {
+      g_queue_unlink (&self->metadata_cache_lru, &entry->link);
+      g_queue_push_head_link (&self->metadata_cache_lru, &entry->link);
+      ret = g_variant_ref (entry->variant);
+      self->metadata_cache_hits++;
+    }
+  else
+    self->metadata_cache_misses++;
+  g_mutex_unlock (&self->cache_lock);
+
+  return ret;
+}
+
+static void
+metadata_cache_insert (OstreeRepo          *self,
+                       OstreeObjectType     objtype,
+                       const guchar        *csum,
+                       GVariant            *variant)
+{
+  OstreeRepoMetadataCacheEntry *entry;
+
+  entry = g_new0 (OstreeRepoMetadataCacheEntry, 1);
+  memcpy (entry->csum, csum, 32);
+  entry->objtype = objtype;
+  entry->variant = g_variant_ref (variant);
+  entry->link.data = entry;
+
+  g_mutex_lock (&self->cache_lock);
+  if (self->metadata_cache_size == 0
+      || g_hash_table_lookup (self->metadata_cache, entry) != NULL)
+    {
+      /* Disabled, or another thread loaded it concurrently */
+      metadata_cache_entry_free (entry);
+    }
+  else
+    {
+      g_hash_table_add (self->metadata_cache, entry);
+      g_queue_push_head_link (&self->metadata_cache_lru, &entry->link);
+      metadata_cache_trim (self);
+    }
+  g_mutex_unlock (&self->cache_lock);
+}
+
+/**
+ * ostree_repo_set_metadata_cache_size:
+ * @self:
+ * @n_entries: Maximum number of parsed metadata objects to keep, or 0
+ *
+ * The repository keeps the most recently loaded metadata objects in
+ * memory, so that repeated ostree_repo_load_variant() calls don't hit
+ * the filesystem.  The default size can be set with the
+ * "metadata-cache-size" key of the "core" configuration section.
+ */
+void
+ostree_repo_set_metadata_cache_size (OstreeRepo  *self,
+                                     guint        n_entries)
+{
+  g_mutex_lock (&self->cache_lock);
+  self->metadata_cache_size = n_entries;
+  metadata_cache_trim (self);
+  g_mutex_unlock (&self->cache_lock);
+}
+
+/**
+ * ostree_repo_get_metadata_cache_stats:
+ * @self:
+ * @out_hits: (out) (allow-none): Number of loads served from memory
+ * @out_misses: (out) (allow-none): Number of loads which read the object
+ */
+void
+ostree_repo_get_metadata_cache_stats (OstreeRepo  *self,
+                                      guint64     *out_hits,
+                                      guint64     *out_misses)
+{
+  g_mutex_lock (&self->cache_lock);
+  if (out_hits)
+    *out_hits = self->metadata_cache_hits;
+  if (out_misses)
+    *out_misses = self->metadata_cache_misses;
+  g_mutex_unlock (&self->cache_lock);
+}
+
+static void
+metadata_cache_remove (OstreeRepo          *self,
+                       OstreeObjectType     objtype,
+                       const guchar        *csum)
+{
+  OstreeRepoMetadataCacheEntry key;
+  OstreeRepoMetadataCacheEntry *entry;
+
+  memcpy (key.csum, csum, 32);
+  key.objtype = objtype;
+
+  g_mutex_lock (&self->cache_lock);
+  entry = g_hash_table_lookup (self->metadata_cache, &key);
+  if (entry)
+    {
+      g_queue_unlink (&self->metadata_cache_lru, &entry->link);
+      g_hash_table_remove (self->metadata_cache, entry);
+    }
+  g_mutex_unlock (&self->cache_lock);
+}
+
+/**
+ * ostree_repo_delete_object:
+ * @self:
+ * @objtype: Object type
+ * @sha256: Checksum
+ *
+ * Remove the loose object @sha256, including the content file of
+ * archive mode file objects, and forget any cached copy of it.
+ * Objects in packs are not affected.
+ */
 gboolean
-ostree_repo_load_variant_c (OstreeRepo          *self,
-                            OstreeObjectType     objtype,
-                            const guchar        *csum, 
-                            GVariant           **out_variant,
-                            GError             **error)
+ostree_repo_delete_object (OstreeRepo           *self,
+                           OstreeObjectType      objtype,
+                           const char           *sha256,
+                           GCancellable         *cancellable,
+                           GError              **error)
 {
   gboolean ret = FALSE;
-  ot_lfree char *checksum = NULL;
+  ot_lobj GFile *objpath = NULL;
+  ot_lobj GFile *content_path = NULL;
+
+  if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+    {
+      guchar csum[32];
 
-  checksum = ostree_checksum_from_bytes (csum);
+      ostree_checksum_inplace_to_bytes (sha256, csum);
+      metadata_cache_remove (self, objtype, csum);
+    }
 
-  if (!ostree_repo_load_variant (self, objtype, checksum, out_variant, error))
+  objpath = ostree_repo_get_object_path (self, sha256, objtype);
+  if (!ot_gfile_unlink (objpath, cancellable, error))
     goto out;
 
+  if (objtype == OSTREE_OBJECT_TYPE_FILE
+      && ostree_repo_get_mode (self) == OSTREE_REPO_MODE_ARCHIVE)
+    {
+      content_path = ostree_repo_get_archive_content_path (self, sha256);
+      /* Symbolic links have no content file */
+      (void) ot_gfile_unlink (content_path, cancellable, NULL);
+    }
+
   ret = TRUE;
  out:
   return ret;
 }
 
-gboolean
-ostree_repo_load_variant (OstreeRepo  *self,
-                          OstreeObjectType  objtype,
-                          const char    *sha256, 
-                          GVariant     **out_variant,
-                          GError       **error)
+/*
+ * Read the loose metadata object @sha256 directly, without a separate
+ * existence check; @out_variant is set to %NULL if it doesn't exist.
+ * The data is copied rather than mapped, since these objects are small
+ * and may be kept in the metadata cache.
+ */
+static gboolean
+read_loose_variant (OstreeRepo        *self,
+                    OstreeObjectType   objtype,
+                    const char        *sha256,
+                    GVariant         **out_variant,
+                    GError           **error)
+{
+  gboolean ret = FALSE;
+  int fd = -1;
+  struct stat stbuf;
+  gsize bytes_read = 0;
+  ot_lfree guchar *data = NULL;
+  ot_lvariant GVariant *ret_variant = NULL;
+
+  if (!open_loose_object (self, sha256, ostree_object_type_to_string (objtype),
+                          &fd, error))
+    goto out;
+
+  if (fd != -1)
+    {
+      if (fstat (fd, &stbuf) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+
+      data = g_malloc (stbuf.st_size);
+      while (bytes_read < (gsize)stbuf.st_size)
+        {
+          gssize n = read (fd, data + bytes_read, stbuf.st_size - bytes_read);
+          if (n < 0 && errno == EINTR)
+            continue;
+          if (n < 0)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
+            }
+          if (n == 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "Short read of metadata object %s.%s",
+                           sha256, ostree_object_type_to_string (objtype));
+              goto out;
+            }
+          bytes_read += n;
+        }
+
+      ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
+                                             data, bytes_read, TRUE,
+                                             g_free, data);
+      data = NULL;
+      g_variant_ref_sink (ret_variant);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  if (fd != -1)
+    (void) close (fd);
+  return ret;
+}
+
+static gboolean
+load_variant_uncached (OstreeRepo  *self,
+                       OstreeObjectType  objtype,
+                       const char    *sha256, 
+                       GVariant     **out_variant,
+                       GError       **error)
 {
   gboolean ret = FALSE;
   guchar *pack_data;
   guint64 pack_len;
   guint64 object_offset;
   GCancellable *cancellable = NULL;
+  GMappedFile *pack_map = NULL;
   ot_lobj GFile *object_path = NULL;
   ot_lvariant GVariant *packed_object = NULL;
+  ot_lvariant GVariant *pack_variant = NULL;
   ot_lvariant GVariant *ret_variant = NULL;
   ot_lfree char *pack_checksum = NULL;
 
-  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
-
-  if (!repo_find_object (self, objtype, sha256, FALSE,
-                         &object_path, &pack_checksum, &object_offset,
-                         cancellable, error))
+  if (!find_object_in_packs (self, sha256, objtype,
+                             &pack_checksum, &object_offset,
+                             cancellable, error))
     goto out;
 
   if (pack_checksum != NULL)
     {
+      gsize size;
+
       if (!ostree_repo_map_pack_file (self, pack_checksum, TRUE, &pack_data, &pack_len,
-                                      cancellable, error))
+                                      &pack_map, cancellable, error))
         goto out;
       
       if (!ostree_read_pack_entry_raw (pack_data, pack_len, object_offset,
                                        TRUE, TRUE, &packed_object, cancellable, error))
         goto out;
 
-      g_variant_get_child (packed_object, 2, "v", &ret_variant);
+      g_variant_get_child (packed_object, 2, "v", &pack_variant);
+
+      /* The pack entry points into the pack mapping; the cached copy
+       * must own its data.
+       */
+      size = g_variant_get_size (pack_variant);
+      ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
+                                             g_memdup (g_variant_get_data (pack_variant), size),
+                                             size, TRUE, g_free, NULL);
+      g_variant_ref_sink (ret_variant);
     }
-  else if (object_path != NULL)
+  else
     {
-      if (!ot_util_variant_map (object_path, ostree_metadata_variant_type (objtype),
-                                TRUE, &ret_variant, error))
+      object_path = lookup_pending_object (self, sha256, ostree_object_type_to_string (objtype));
+      if (object_path != NULL)
+        {
+          char *contents;
+          gsize len;
+
+          if (!g_file_load_contents (object_path, NULL, &contents, &len, NULL, error))
+            goto out;
+          ret_variant = g_variant_new_from_data (ostree_metadata_variant_type (objtype),
+                                                 contents, len, TRUE, g_free, contents);
+          g_variant_ref_sink (ret_variant);
+        }
+      else if (!read_loose_variant (self, objtype, sha256, &ret_variant, error))
         goto out;
+
+      if (ret_variant == NULL)
+        {
+          if (self->parent_repo)
+            {
+              if (!ostree_repo_load_variant (self->parent_repo, objtype, sha256, &ret_variant, error))
+                goto out;
+            }
+          else
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           "No such metadata object %s.%s",
+                           sha256, ostree_object_type_to_string (objtype));
+              goto out;
+            }
+        }
     }
-  else if (self->parent_repo)
+
+  ret = TRUE;
+  ot_transfer_out_value (out_variant, &ret_variant);
+ out:
+  if (pack_map)
+    g_mapped_file_unref (pack_map);
+  return ret;
+}
+
+static gboolean
+load_variant_internal (OstreeRepo          *self,
+                       OstreeObjectType     objtype,
+                       const guchar        *csum,
+                       const char          *sha256,
+                       GVariant           **out_variant,
+                       GError             **error)
+{
+  gboolean ret = FALSE;
+  ot_lvariant GVariant *ret_variant = NULL;
+  ot_lfree char *tmp_checksum = NULL;
+
+  g_return_val_if_fail (OSTREE_OBJECT_TYPE_IS_META (objtype), FALSE);
+
+  ret_variant = metadata_cache_lookup (self, objtype, csum);
+  if (!ret_variant)
     {
-      if (!ostree_repo_load_variant (self->parent_repo, objtype, sha256, &ret_variant, error))
+      if (!sha256)
+        sha256 = tmp_checksum = ostree_checksum_from_bytes (csum);
+
+      if (!load_variant_uncached (self, objtype, sha256, &ret_variant, error))
         goto out;
-    }
-  else
-    {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No such metadata object %s.%s",
-                   sha256, ostree_object_type_to_string (objtype));
-      goto out;
+
+      metadata_cache_insert (self, objtype, csum, ret_variant);
     }
 
   ret = TRUE;
@@ -3973,6 +6579,32 @@ ostree_repo_load_variant (OstreeRepo  *self,
   return ret;
 }
 
+gboolean
+ostree_repo_load_variant_c (OstreeRepo          *self,
+                            OstreeObjectType     objtype,
+                            const guchar        *csum, 
+                            GVariant           **out_variant,
+                            GError             **error)
+{
+  return load_variant_internal (self, objtype, csum, NULL, out_variant, error);
+}
+
+gboolean
+ostree_repo_load_variant (OstreeRepo  *self,
+                          OstreeObjectType  objtype,
+                          const char    *sha256, 
+                          GVariant     **out_variant,
+                          GError       **error)
+{
+  guchar csum[32];
+
+  if (!ostree_validate_checksum_string (sha256, error))
+    return FALSE;
+
+  ostree_checksum_inplace_to_bytes (sha256, csum);
+  return load_variant_internal (self, objtype, csum, sha256, out_variant, error);
+}
+
 /**
  * ostree_repo_list_objects:
  * @self:
@@ -4086,7 +6718,7 @@ checkout_file_from_input (GFile          *file,
           dir = g_file_get_parent (file);
           if (!ostree_create_temp_file_from_input (dir, NULL, "checkout",
                                                    temp_info ? temp_info : finfo,
-                                                   xattrs, input, &temp_file, 
+                                                   xattrs, input, &temp_file, NULL,
                                                    cancellable, error))
             goto out;
           
@@ -4109,248 +6741,631 @@ checkout_file_from_input (GFile          *file,
   return ret;
 }
 
-static gboolean
-checkout_file_hardlink (OstreeRepo                  *self,
-                        OstreeRepoCheckoutMode    mode,
-                        OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                        GFile                    *source,
-                        GFile                    *destination,
-                        gboolean                 *out_was_supported,
-                        GCancellable             *cancellable,
-                        GError                  **error)
+/*
+ * Name of the loose object which holds the content of the file
+ * @checksum in @self; bare repositories store it directly.
+ */
+static const char *
+loose_content_suffix (OstreeRepo *self)
 {
-  gboolean ret = FALSE;
-  gboolean ret_was_supported = FALSE;
-  ot_lobj GFile *dir = NULL;
+  return self->mode == OSTREE_REPO_MODE_BARE ? "file" : "filecontent";
+}
 
-  if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) != -1)
-    ret_was_supported = TRUE;
-  else if (errno == EMLINK || errno == EXDEV)
+/* Buffer size for copying file data by hand */
+#define OSTREE_REPO_COPY_BUFSIZE (128 * 1024)
+
+const char *
+ostree_repo_checkout_method_to_string (OstreeRepoCheckoutMethod method)
+{
+  switch (method)
     {
-      /* EMLINK and EXDEV shouldn't be fatal; we just can't do the
-       * optimization of hardlinking instead of copying.
-       */
-      ret_was_supported = FALSE;
+    case OSTREE_REPO_CHECKOUT_METHOD_HARDLINK:
+      return "hardlink";
+    case OSTREE_REPO_CHECKOUT_METHOD_REFLINK:
+      return "reflink";
+    case OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE:
+      return "copy_file_range";
+    case OSTREE_REPO_CHECKOUT_METHOD_SENDFILE:
+      return "sendfile";
+    case OSTREE_REPO_CHECKOUT_METHOD_COPY:
+      return "copy";
+    case OSTREE_REPO_CHECKOUT_METHOD_PACK:
+      return "pack";
+    case OSTREE_REPO_CHECKOUT_METHOD_STREAM:
+      return "stream";
+    default:
+      g_assert_not_reached ();
     }
-  else if (errno == EEXIST && overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
-    { 
-      /* Idiocy, from man rename(2)
-       *
-       * "If oldpath and newpath are existing hard links referring to
-       * the same file, then rename() does nothing, and returns a
-       * success status."
-       *
-       * So we can't make this atomic.  
-       */
-      (void) unlink (ot_gfile_get_path_cached (destination));
-      if (link (ot_gfile_get_path_cached (source), ot_gfile_get_path_cached (destination)) < 0)
+}
+
+/**
+ * ostree_repo_get_checkout_stats:
+ * @counts: (out): Number of regular files checked out by each #OstreeRepoCheckoutMethod
+ *
+ * Counts are cumulative over the lifetime of @self.
+ */
+void
+ostree_repo_get_checkout_stats (OstreeRepo *self,
+                                guint       counts[OSTREE_REPO_CHECKOUT_N_METHODS])
+{
+  guint i;
+
+  for (i = 0; i < OSTREE_REPO_CHECKOUT_N_METHODS; i++)
+    counts[i] = g_atomic_int_get (&self->checkout_method_counts[i]);
+}
+
+static inline void
+count_checkout_method (OstreeRepo               *self,
+                       OstreeRepoCheckoutMethod  method)
+{
+  g_atomic_int_inc (&self->checkout_method_counts[method]);
+}
+
+/*
+ * Returns: The cheapest method not yet known to fail for copying from
+ * filesystem @src_dev to @dest_dev
+ */
+static OstreeRepoCheckoutMethod
+lookup_copy_method (OstreeRepo   *self,
+                    dev_t         src_dev,
+                    dev_t         dest_dev)
+{
+  OstreeRepoCheckoutMethod ret = OSTREE_REPO_CHECKOUT_METHOD_REFLINK;
+  guint i;
+
+  g_mutex_lock (&self->cache_lock);
+  for (i = 0; i < self->copy_methods->len; i++)
+    {
+      OstreeRepoCopyMethod *entry = &g_array_index (self->copy_methods, OstreeRepoCopyMethod, i);
+      if (entry->src_dev == src_dev && entry->dest_dev == dest_dev)
         {
-          ot_util_set_error_from_errno (error, errno);
-          goto out;
+          ret = entry->method;
+          break;
         }
     }
-  else
+  g_mutex_unlock (&self->cache_lock);
+
+  return ret;
+}
+
+/*
+ * Record that copies from @src_dev to @dest_dev should use @method,
+ * because the ones before it aren't supported.
+ */
+static void
+downgrade_copy_method (OstreeRepo               *self,
+                       dev_t                     src_dev,
+                       dev_t                     dest_dev,
+                       OstreeRepoCheckoutMethod  method)
+{
+  OstreeRepoCopyMethod new_entry;
+  guint i;
+
+  g_mutex_lock (&self->cache_lock);
+  for (i = 0; i < self->copy_methods->len; i++)
     {
-      ot_util_set_error_from_errno (error, errno);
-      goto out;
+      OstreeRepoCopyMethod *entry = &g_array_index (self->copy_methods, OstreeRepoCopyMethod, i);
+      if (entry->src_dev == src_dev && entry->dest_dev == dest_dev)
+        {
+          entry->method = MAX (entry->method, method);
+          break;
+        }
+    }
+  if (i == self->copy_methods->len)
+    {
+      new_entry.src_dev = src_dev;
+      new_entry.dest_dev = dest_dev;
+      new_entry.method = method;
+      g_array_append_val (self->copy_methods, new_entry);
     }
+  g_mutex_unlock (&self->cache_lock);
+}
 
-  ret = TRUE;
-  if (out_was_supported)
-    *out_was_supported = ret_was_supported;
- out:
-  return ret;
+static gboolean
+write_file_data (int            dest_fd,
+                 const guchar  *data,
+                 gsize          len,
+                 GError       **error)
+{
+  while (len > 0)
+    {
+      ssize_t bytes_written = write (dest_fd, data, MIN (len, G_MAXINT32));
+      if (bytes_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          ot_util_set_error_from_errno (error, errno);
+          return FALSE;
+        }
+      data += bytes_written;
+      len -= bytes_written;
+    }
+  return TRUE;
 }
 
+/*
+ * Copy all of @src_fd to the empty file @dest_fd, sharing extents if
+ * the filesystem supports it.  @out_method is set to the method which
+ * was used.
+ */
 static gboolean
-find_loose_for_checkout (OstreeRepo             *self,
-                         const char             *checksum,
-                         GFile                 **out_loose_path,
-                         GCancellable           *cancellable,
-                         GError                **error)
+copy_file_data (OstreeRepo                *self,
+                int                        src_fd,
+                int                        dest_fd,
+                OstreeRepoCheckoutMethod  *out_method,
+                GCancellable              *cancellable,
+                GError                   **error)
 {
   gboolean ret = FALSE;
-  ot_lobj GFile *path = NULL;
-  struct stat stbuf;
+  struct stat src_stbuf;
+  struct stat dest_stbuf;
+  OstreeRepoCheckoutMethod method;
+  ot_lfree char *buf = NULL;
 
-  do
+  if (fstat (src_fd, &src_stbuf) < 0 || fstat (dest_fd, &dest_stbuf) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  method = lookup_copy_method (self, src_stbuf.st_dev, dest_stbuf.st_dev);
+
+  if (method == OSTREE_REPO_CHECKOUT_METHOD_REFLINK)
     {
-      if (self->mode == OSTREE_REPO_MODE_BARE)
-        path = ostree_repo_get_object_path (self, checksum, OSTREE_OBJECT_TYPE_FILE);
+#ifdef FICLONE
+      if (ioctl (dest_fd, FICLONE, src_fd) == 0)
+        goto done;
+      else if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EXDEV || errno == EINVAL)
+        {
+          method = OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE;
+          downgrade_copy_method (self, src_stbuf.st_dev, dest_stbuf.st_dev, method);
+        }
       else
-        path = ostree_repo_get_archive_content_path (self, checksum);
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Cloning file: ");
+          goto out;
+        }
+#else
+      method = OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE;
+#endif
+    }
 
-      if (lstat (ot_gfile_get_path_cached (path), &stbuf) < 0)
+  if (method == OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE)
+    {
+#ifdef HAVE_COPY_FILE_RANGE
+      off_t remaining = src_stbuf.st_size;
+
+      while (remaining > 0)
         {
-          if (errno != ENOENT)
+          ssize_t bytes_copied = copy_file_range (src_fd, NULL, dest_fd, NULL,
+                                                  MIN (remaining, G_MAXINT32), 0);
+          if (bytes_copied < 0)
             {
+              if (errno == EINTR)
+                continue;
+              else if (remaining == src_stbuf.st_size
+                       && (errno == ENOSYS || errno == EXDEV
+                           || errno == EINVAL || errno == EOPNOTSUPP))
+                {
+                  method = OSTREE_REPO_CHECKOUT_METHOD_SENDFILE;
+                  downgrade_copy_method (self, src_stbuf.st_dev, dest_stbuf.st_dev, method);
+                  break;
+                }
               ot_util_set_error_from_errno (error, errno);
+              g_prefix_error (error, "Copying file: ");
               goto out;
             }
-          self = self->parent_repo;
+          else if (bytes_copied == 0)
+            {
+              /* Some filesystems copy nothing rather than failing;
+               * finish another way.
+               */
+              method = OSTREE_REPO_CHECKOUT_METHOD_SENDFILE;
+              break;
+            }
+          remaining -= bytes_copied;
         }
-      else if (S_ISLNK (stbuf.st_mode))
+      if (method == OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE)
+        goto done;
+#else
+      method = OSTREE_REPO_CHECKOUT_METHOD_SENDFILE;
+#endif
+    }
+
+  if (method == OSTREE_REPO_CHECKOUT_METHOD_SENDFILE)
+    {
+      off_t remaining = src_stbuf.st_size - lseek (src_fd, 0, SEEK_CUR);
+
+      while (remaining > 0)
         {
-          /* Don't check out symbolic links via hardlink; it's very easy
-           * to hit the maximum number of hardlinks to an inode this way,
-           * especially since right now we have a lot of symbolic links to
-           * busybox.
-           *
-           * fs/ext4/ext4.h:#define EXT4_LINK_MAX		65000
-           */
-          self = self->parent_repo;
+          ssize_t bytes_copied = sendfile (dest_fd, src_fd, NULL, MIN (remaining, G_MAXINT32));
+          if (bytes_copied < 0)
+            {
+              if (errno == EINTR)
+                continue;
+              else if (errno == EINVAL || errno == ENOSYS)
+                {
+                  method = OSTREE_REPO_CHECKOUT_METHOD_COPY;
+                  downgrade_copy_method (self, src_stbuf.st_dev, dest_stbuf.st_dev, method);
+                  break;
+                }
+              ot_util_set_error_from_errno (error, errno);
+              g_prefix_error (error, "Copying file: ");
+              goto out;
+            }
+          else if (bytes_copied == 0)
+            {
+              method = OSTREE_REPO_CHECKOUT_METHOD_COPY;
+              break;
+            }
+          remaining -= bytes_copied;
         }
-      else
+      if (method == OSTREE_REPO_CHECKOUT_METHOD_SENDFILE)
+        goto done;
+    }
+
+  /* Both file offsets are at the end of whatever was copied so far */
+  buf = g_malloc (OSTREE_REPO_COPY_BUFSIZE);
+  while (TRUE)
+    {
+      ssize_t bytes_read;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      bytes_read = read (src_fd, buf, OSTREE_REPO_COPY_BUFSIZE);
+      if (bytes_read < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      else if (bytes_read == 0)
         break;
 
-      g_clear_object (&path);
-    } while (self != NULL);
+      if (!write_file_data (dest_fd, (guchar*)buf, bytes_read, error))
+        goto out;
+    }
 
+ done:
   ret = TRUE;
-  ot_transfer_out_value (out_loose_path, &path);
+  *out_method = method;
  out:
   return ret;
 }
 
-typedef struct {
-  OstreeRepo               *repo;
-  OstreeRepoCheckoutMode    mode;
-  OstreeRepoCheckoutOverwriteMode    overwrite_mode;
-  GFile                    *destination;
-  OstreeRepoFile           *source;
-  GFileInfo                *source_info;
-  GCancellable             *cancellable;
-
-  gboolean                  caught_error;
-  GError                   *error;
-
-  GSimpleAsyncResult       *result;
-} CheckoutOneFileAsyncData;
-
-static void
-checkout_file_async_data_free (gpointer      data)
+/*
+ * Create the regular file @destination with the content of @src_fd,
+ * or if it is -1, the @src_len bytes at @src_data, and the ownership,
+ * mode and @xattrs of @source_info.
+ */
+static gboolean
+checkout_regular_file (OstreeRepo                  *self,
+                       OstreeRepoCheckoutMode    mode,
+                       OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                       GFileInfo                *source_info,
+                       GVariant                 *xattrs,
+                       int                       src_fd,
+                       const guchar             *src_data,
+                       gsize                     src_len,
+                       GFile                    *destination,
+                       GCancellable             *cancellable,
+                       GError                  **error)
 {
-  CheckoutOneFileAsyncData *checkout_data = data;
-
-  g_clear_object (&checkout_data->repo);
-  g_clear_object (&checkout_data->destination);
-  g_clear_object (&checkout_data->source);
-  g_clear_object (&checkout_data->source_info);
-  g_clear_object (&checkout_data->cancellable);
-  g_free (checkout_data);
-}
+  gboolean ret = FALSE;
+  int dest_fd = -1;
+  guint32 file_mode;
+  const char *dest_path;
+  OstreeRepoCheckoutMethod method;
+  ot_lobj GFile *dir = NULL;
+  ot_lfree char *temp_path = NULL;
 
-static void
-checkout_file_thread (GSimpleAsyncResult     *result,
-                      GObject                *src,
-                      GCancellable           *cancellable)
-{
-  const char *checksum;
-  gboolean hardlink_supported;
-  GError *local_error = NULL;
-  GError **error = &local_error;
-  ot_lobj GFile *loose_path = NULL;
-  ot_lobj GInputStream *input = NULL;
-  ot_lvariant GVariant *xattrs = NULL;
-  CheckoutOneFileAsyncData *checkout_data;
+  if (overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
+    {
+      dir = g_file_get_parent (destination);
+      temp_path = g_build_filename (ot_gfile_get_path_cached (dir), "checkout-XXXXXX", NULL);
+      dest_fd = g_mkstemp_full (temp_path, O_WRONLY | O_CLOEXEC, 0600);
+      dest_path = temp_path;
+    }
+  else
+    {
+      dest_path = ot_gfile_get_path_cached (destination);
+      dest_fd = open (dest_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+  if (dest_fd == -1)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
 
-  checkout_data = g_simple_async_result_get_op_res_gpointer (result);
+  if (src_fd != -1)
+    {
+      if (!copy_file_data (self, src_fd, dest_fd, &method, cancellable, error))
+        goto out;
+    }
+  else
+    {
+      if (!write_file_data (dest_fd, src_data, src_len, error))
+        goto out;
+      method = OSTREE_REPO_CHECKOUT_METHOD_PACK;
+    }
 
-  /* Hack to avoid trying to create device files as a user */
-  if (checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_USER
-      && g_file_info_get_file_type (checkout_data->source_info) == G_FILE_TYPE_SPECIAL)
-    goto out;
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      guint32 uid = g_file_info_get_attribute_uint32 (source_info, "unix::uid");
+      guint32 gid = g_file_info_get_attribute_uint32 (source_info, "unix::gid");
 
-  checksum = ostree_repo_file_get_checksum ((OstreeRepoFile*)checkout_data->source);
+      if (fchown (dest_fd, uid, gid) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "fchown(%u, %u) failed: ", uid, gid);
+          goto out;
+        }
+    }
 
-  if ((checkout_data->repo->mode == OSTREE_REPO_MODE_BARE
-       && checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_NONE)
-      || (checkout_data->repo->mode == OSTREE_REPO_MODE_ARCHIVE
-          && checkout_data->mode == OSTREE_REPO_CHECKOUT_MODE_USER))
+  file_mode = g_file_info_get_attribute_uint32 (source_info, "unix::mode");
+  if (fchmod (dest_fd, file_mode & 07777) < 0)
     {
-      if (!find_loose_for_checkout (checkout_data->repo, checksum, &loose_path,
-                                    cancellable, error))
-        goto out;
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "fchmod(%u) failed: ", file_mode);
+      goto out;
     }
 
-  if (loose_path)
+  if (xattrs != NULL)
     {
-      /* If we found one, try hardlinking */
-      if (!checkout_file_hardlink (checkout_data->repo, checkout_data->mode,
-                                   checkout_data->overwrite_mode, loose_path,
-                                   checkout_data->destination,
-                                   &hardlink_supported, cancellable, error))
+      if (!ostree_set_xattrs_fd (dest_fd, xattrs, cancellable, error))
         goto out;
     }
 
-  /* Fall back to copy if there's no loose object, or we couldn't hardlink */
-  if (loose_path == NULL || !hardlink_supported)
+  if (temp_path)
+    {
+      if (rename (temp_path, ot_gfile_get_path_cached (destination)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+    }
+
+  count_checkout_method (self, method);
+
+  ret = TRUE;
+ out:
+  if (dest_fd != -1)
+    {
+      (void) close (dest_fd);
+      if (!ret)
+        (void) unlink (dest_path);
+    }
+  return ret;
+}
+
+/*
+ * Check out the regular file @checksum by copying its loose object
+ * in @loose_repo, for when it can't be hardlinked.
+ */
+static gboolean
+checkout_file_copy_loose (OstreeRepo                  *self,
+                          OstreeRepoCheckoutMode    mode,
+                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                          OstreeRepo               *loose_repo,
+                          const char               *checksum,
+                          GFileInfo                *source_info,
+                          GFile                    *destination,
+                          GCancellable             *cancellable,
+                          GError                  **error)
+{
+  gboolean ret = FALSE;
+  int src_fd = -1;
+  ot_lvariant GVariant *xattrs = NULL;
+
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
     {
-      if (!ostree_repo_load_file (checkout_data->repo, checksum, &input, NULL, &xattrs,
+      if (!ostree_repo_load_file (loose_repo, checksum, NULL, NULL, &xattrs,
                                   cancellable, error))
         goto out;
+    }
 
-      if (!checkout_file_from_input (checkout_data->destination,
-                                     checkout_data->mode,
-                                     checkout_data->overwrite_mode,
-                                     checkout_data->source_info, xattrs, 
-                                     input, cancellable, error))
-        goto out;
+  if (!open_loose_object (loose_repo, checksum, loose_content_suffix (loose_repo),
+                          &src_fd, error))
+    goto out;
+  if (src_fd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Loose object %s disappeared", checksum);
+      goto out;
     }
 
+  if (!checkout_regular_file (self, mode, overwrite_mode, source_info, xattrs,
+                              src_fd, NULL, 0, destination, cancellable, error))
+    goto out;
+
+  ret = TRUE;
  out:
-  if (local_error)
-    g_simple_async_result_take_error (result, local_error);
+  if (src_fd != -1)
+    (void) close (src_fd);
+  return ret;
 }
 
-static void
-checkout_one_file_async (OstreeRepo                  *self,
+/*
+ * Check out the regular file @checksum straight from the pack mapping
+ * if it is stored there uncompressed; @out_done is set to %FALSE
+ * otherwise.
+ */
+static gboolean
+checkout_file_from_pack (OstreeRepo                  *self,
                          OstreeRepoCheckoutMode    mode,
                          OstreeRepoCheckoutOverwriteMode    overwrite_mode,
-                         OstreeRepoFile           *source,
+                         const char               *checksum,
                          GFileInfo                *source_info,
                          GFile                    *destination,
+                         gboolean                 *out_done,
                          GCancellable             *cancellable,
-                         GAsyncReadyCallback       callback,
-                         gpointer                  user_data)
+                         GError                  **error)
 {
-  CheckoutOneFileAsyncData *checkout_data;
+  gboolean ret = FALSE;
+  gboolean ret_done = FALSE;
+  guchar *pack_data;
+  guint64 pack_len;
+  guint64 pack_offset;
+  OstreePackFileEntry entry;
+  GMappedFile *pack_map = NULL;
+  ot_lfree char *pack_checksum = NULL;
+  ot_lvariant GVariant *file_header = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
 
-  checkout_data = g_new0 (CheckoutOneFileAsyncData, 1);
-  checkout_data->repo = g_object_ref (self);
-  checkout_data->mode = mode;
-  checkout_data->overwrite_mode = overwrite_mode;
-  checkout_data->destination = g_object_ref (destination);
-  checkout_data->source = g_object_ref (source);
-  checkout_data->source_info = g_object_ref (source_info);
-  checkout_data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  if (!find_object_in_packs (self, checksum, OSTREE_OBJECT_TYPE_FILE,
+                             &pack_checksum, &pack_offset, cancellable, error))
+    goto out;
 
-  checkout_data->result = g_simple_async_result_new ((GObject*) self,
-                                                     callback, user_data,
-                                                     checkout_one_file_async);
+  if (pack_checksum)
+    {
+      if (!ostree_repo_map_pack_file (self, pack_checksum, FALSE, &pack_data, &pack_len,
+                                      &pack_map, cancellable, error))
+        goto out;
 
-  g_simple_async_result_set_op_res_gpointer (checkout_data->result, checkout_data,
-                                             checkout_file_async_data_free);
+      if (!ostree_read_file_pack_entry (pack_data, pack_len, pack_offset, &entry, error))
+        goto out;
 
-  g_simple_async_result_run_in_thread (checkout_data->result,
-                                       checkout_file_thread, G_PRIORITY_DEFAULT,
-                                       cancellable);
-  g_object_unref (checkout_data->result);
+      if (!(entry.flags & OSTREE_PACK_FILE_ENTRY_FLAG_GZIP))
+        {
+          if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+            {
+              file_header = g_variant_new_from_data (OSTREE_FILE_HEADER_GVARIANT_FORMAT,
+                                                     entry.header, entry.header_len,
+                                                     TRUE, NULL, NULL);
+              g_variant_ref_sink (file_header);
+              g_variant_get_child (file_header, 5, "@a(ayay)", &xattrs);
+            }
+
+          if (!checkout_regular_file (self, mode, overwrite_mode, source_info, xattrs,
+                                      -1, entry.data, entry.data_len,
+                                      destination, cancellable, error))
+            goto out;
+          ret_done = TRUE;
+        }
+    }
+
+  ret = TRUE;
+  *out_done = ret_done;
+ out:
+  if (pack_map)
+    g_mapped_file_unref (pack_map);
+  return ret;
 }
 
 static gboolean
-checkout_one_file_finish (OstreeRepo               *self,
-                          GAsyncResult             *result,
-                          GError                  **error)
+checkout_file_hardlink (OstreeRepo                  *self,
+                        OstreeRepoCheckoutMode    mode,
+                        OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                        OstreeRepo               *loose_repo,
+                        const char               *checksum,
+                        GFile                    *destination,
+                        gboolean                 *out_was_supported,
+                        GCancellable             *cancellable,
+                        GError                  **error)
 {
-  GSimpleAsyncResult *simple;
+  gboolean ret = FALSE;
+  gboolean ret_was_supported = FALSE;
+  int dfd;
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+  const char *name;
 
-  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, checkout_one_file_async), FALSE);
+  if (!get_loose_object_dir_fd (loose_repo, checksum, &dfd, error))
+    goto out;
+  if (dfd == -1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Loose object %s disappeared", checksum);
+      goto out;
+    }
 
-  simple = G_SIMPLE_ASYNC_RESULT (result);
-  if (g_simple_async_result_propagate_error (simple, error))
-    return FALSE;
-  return TRUE;
+  get_loose_object_relpath (relpath, checksum, loose_content_suffix (loose_repo));
+  name = relpath + 3;
+
+  if (linkat (dfd, name, AT_FDCWD, ot_gfile_get_path_cached (destination), 0) != -1)
+    ret_was_supported = TRUE;
+  else if (errno == EMLINK || errno == EXDEV)
+    {
+      /* EMLINK and EXDEV shouldn't be fatal; we just can't do the
+       * optimization of hardlinking instead of copying.
+       */
+      ret_was_supported = FALSE;
+    }
+  else if (errno == EEXIST && overwrite_mode == OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES)
+    { 
+      /* Idiocy, from man rename(2)
+       *
+       * "If oldpath and newpath are existing hard links referring to
+       * the same file, then rename() does nothing, and returns a
+       * success status."
+       *
+       * So we can't make this atomic.  
+       */
+      (void) unlink (ot_gfile_get_path_cached (destination));
+      if (linkat (dfd, name, AT_FDCWD, ot_gfile_get_path_cached (destination), 0) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      ret_was_supported = TRUE;
+    }
+  else
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  ret = TRUE;
+  if (out_was_supported)
+    *out_was_supported = ret_was_supported;
+ out:
+  return ret;
+}
+
+/*
+ * Set @out_loose_repo to @self or the first parent repository which
+ * has the content of @checksum as a regular loose file, or %NULL.
+ */
+static gboolean
+find_loose_for_checkout (OstreeRepo             *self,
+                         const char             *checksum,
+                         OstreeRepo            **out_loose_repo,
+                         GCancellable           *cancellable,
+                         GError                **error)
+{
+  gboolean ret = FALSE;
+  gboolean found;
+  struct stat stbuf;
+
+  do
+    {
+      if (!stat_loose_object (self, checksum, loose_content_suffix (self),
+                              &stbuf, &found, error))
+        goto out;
+
+      if (!found)
+        self = self->parent_repo;
+      else if (S_ISLNK (stbuf.st_mode))
+        {
+          /* Don't check out symbolic links via hardlink; it's very easy
+           * to hit the maximum number of hardlinks to an inode this way,
+           * especially since right now we have a lot of symbolic links to
+           * busybox.
+           *
+           * fs/ext4/ext4.h:#define EXT4_LINK_MAX		65000
+           */
+          self = self->parent_repo;
+        }
+      else
+        break;
+    } while (self != NULL);
+
+  ret = TRUE;
+  *out_loose_repo = self;
+ out:
+  return ret;
 }
 
 typedef struct {
@@ -4365,15 +7380,13 @@ typedef struct {
   gboolean                  caught_error;
   GError                   *error;
 
-  guint                     pending_ops;
-  GMainLoop                *loop;
   GSimpleAsyncResult       *result;
-} CheckoutTreeAsyncData;
+} CheckoutOneFileAsyncData;
 
 static void
-checkout_tree_async_data_free (gpointer      data)
+checkout_file_async_data_free (gpointer      data)
 {
-  CheckoutTreeAsyncData *checkout_data = data;
+  CheckoutOneFileAsyncData *checkout_data = data;
 
   g_clear_object (&checkout_data->repo);
   g_clear_object (&checkout_data->destination);
@@ -4383,28 +7396,228 @@ checkout_tree_async_data_free (gpointer      data)
   g_free (checkout_data);
 }
 
-static void
-on_tree_async_child_op_complete (CheckoutTreeAsyncData   *data,
-                                 GError                  *local_error)
+/*
+ * Whether checkouts in @mode hardlink the loose file objects of @self.
+ */
+static gboolean
+checkout_can_hardlink (OstreeRepo               *self,
+                       OstreeRepoCheckoutMode    mode)
 {
-  data->pending_ops--;
+  return ((self->mode == OSTREE_REPO_MODE_BARE
+           && mode == OSTREE_REPO_CHECKOUT_MODE_NONE)
+          || (self->mode == OSTREE_REPO_MODE_ARCHIVE
+              && mode == OSTREE_REPO_CHECKOUT_MODE_USER));
+}
 
-  if (local_error)
-    {
-      if (!data->caught_error)
-        {
-          data->caught_error = TRUE;
-          g_propagate_error (&data->error, local_error);
-        }
-      else
-        g_clear_error (&local_error);
-    }
+static gboolean
+checkout_one_file (OstreeRepo                  *self,
+                   OstreeRepoCheckoutMode    mode,
+                   OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                   OstreeRepoFile           *source,
+                   GFileInfo                *source_info,
+                   GFile                    *destination,
+                   GCancellable             *cancellable,
+                   GError                  **error)
+{
+  gboolean ret = FALSE;
+  const char *checksum;
+  gboolean is_regular;
+  gboolean can_hardlink;
+  gboolean can_copy;
+  gboolean done = FALSE;
+  OstreeRepo *loose_repo = NULL;
+  ot_lobj GInputStream *input = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
 
-  if (data->pending_ops != 0)
-    return;
+  /* Hack to avoid trying to create device files as a user */
+  if (mode == OSTREE_REPO_CHECKOUT_MODE_USER
+      && g_file_info_get_file_type (source_info) == G_FILE_TYPE_SPECIAL)
+    return TRUE;
 
-  if (data->caught_error)
-    g_simple_async_result_take_error (data->result, data->error);
+  checksum = ostree_repo_file_get_checksum (source);
+  is_regular = g_file_info_get_file_type (source_info) == G_FILE_TYPE_REGULAR;
+
+  can_hardlink = checkout_can_hardlink (self, mode);
+  /* The content of a regular file is stored as is in both bare and
+   * archive repositories; only ownership, mode and xattrs differ.
+   */
+  can_copy = is_regular;
+
+  if (can_hardlink || can_copy)
+    {
+      if (!find_loose_for_checkout (self, checksum, &loose_repo,
+                                    cancellable, error))
+        goto out;
+    }
+
+  if (loose_repo && can_hardlink)
+    {
+      /* If we found one, try hardlinking */
+      if (!checkout_file_hardlink (self, mode, overwrite_mode,
+                                   loose_repo, checksum, destination,
+                                   &done, cancellable, error))
+        goto out;
+      if (done && is_regular)
+        count_checkout_method (self, OSTREE_REPO_CHECKOUT_METHOD_HARDLINK);
+    }
+
+  /* Otherwise reflink or copy the loose file */
+  if (!done && loose_repo && can_copy)
+    {
+      if (!checkout_file_copy_loose (self, mode, overwrite_mode,
+                                     loose_repo, checksum, source_info,
+                                     destination, cancellable, error))
+        goto out;
+      done = TRUE;
+    }
+
+  if (!done && !loose_repo && is_regular)
+    {
+      if (!checkout_file_from_pack (self, mode, overwrite_mode, checksum, source_info,
+                                    destination, &done, cancellable, error))
+        goto out;
+    }
+
+  /* Fall back to writing from the object stream */
+  if (!done)
+    {
+      if (!ostree_repo_load_file (self, checksum, &input, NULL, &xattrs,
+                                  cancellable, error))
+        goto out;
+
+      if (!checkout_file_from_input (destination, mode, overwrite_mode,
+                                     source_info, xattrs, 
+                                     input, cancellable, error))
+        goto out;
+      if (is_regular)
+        count_checkout_method (self, OSTREE_REPO_CHECKOUT_METHOD_STREAM);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static void
+checkout_file_thread (GSimpleAsyncResult     *result,
+                      GObject                *src,
+                      GCancellable           *cancellable)
+{
+  GError *local_error = NULL;
+  CheckoutOneFileAsyncData *checkout_data;
+
+  checkout_data = g_simple_async_result_get_op_res_gpointer (result);
+
+  if (!checkout_one_file (checkout_data->repo, checkout_data->mode,
+                          checkout_data->overwrite_mode,
+                          checkout_data->source, checkout_data->source_info,
+                          checkout_data->destination,
+                          cancellable, &local_error))
+    g_simple_async_result_take_error (result, local_error);
+}
+
+static void
+checkout_one_file_async (OstreeRepo                  *self,
+                         OstreeRepoCheckoutMode    mode,
+                         OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                         OstreeRepoFile           *source,
+                         GFileInfo                *source_info,
+                         GFile                    *destination,
+                         GCancellable             *cancellable,
+                         GAsyncReadyCallback       callback,
+                         gpointer                  user_data)
+{
+  CheckoutOneFileAsyncData *checkout_data;
+
+  checkout_data = g_new0 (CheckoutOneFileAsyncData, 1);
+  checkout_data->repo = g_object_ref (self);
+  checkout_data->mode = mode;
+  checkout_data->overwrite_mode = overwrite_mode;
+  checkout_data->destination = g_object_ref (destination);
+  checkout_data->source = g_object_ref (source);
+  checkout_data->source_info = g_object_ref (source_info);
+  checkout_data->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+  checkout_data->result = g_simple_async_result_new ((GObject*) self,
+                                                     callback, user_data,
+                                                     checkout_one_file_async);
+
+  g_simple_async_result_set_op_res_gpointer (checkout_data->result, checkout_data,
+                                             checkout_file_async_data_free);
+
+  g_simple_async_result_run_in_thread (checkout_data->result,
+                                       checkout_file_thread, G_PRIORITY_DEFAULT,
+                                       cancellable);
+  g_object_unref (checkout_data->result);
+}
+
+static gboolean
+checkout_one_file_finish (OstreeRepo               *self,
+                          GAsyncResult             *result,
+                          GError                  **error)
+{
+  GSimpleAsyncResult *simple;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, checkout_one_file_async), FALSE);
+
+  simple = G_SIMPLE_ASYNC_RESULT (result);
+  if (g_simple_async_result_propagate_error (simple, error))
+    return FALSE;
+  return TRUE;
+}
+
+typedef struct {
+  OstreeRepo               *repo;
+  OstreeRepoCheckoutMode    mode;
+  OstreeRepoCheckoutOverwriteMode    overwrite_mode;
+  GFile                    *destination;
+  OstreeRepoFile           *source;
+  GFileInfo                *source_info;
+  GCancellable             *cancellable;
+
+  gboolean                  caught_error;
+  GError                   *error;
+
+  guint                     pending_ops;
+  GMainLoop                *loop;
+  GSimpleAsyncResult       *result;
+} CheckoutTreeAsyncData;
+
+static void
+checkout_tree_async_data_free (gpointer      data)
+{
+  CheckoutTreeAsyncData *checkout_data = data;
+
+  g_clear_object (&checkout_data->repo);
+  g_clear_object (&checkout_data->destination);
+  g_clear_object (&checkout_data->source);
+  g_clear_object (&checkout_data->source_info);
+  g_clear_object (&checkout_data->cancellable);
+  g_free (checkout_data);
+}
+
+static void
+on_tree_async_child_op_complete (CheckoutTreeAsyncData   *data,
+                                 GError                  *local_error)
+{
+  data->pending_ops--;
+
+  if (local_error)
+    {
+      if (!data->caught_error)
+        {
+          data->caught_error = TRUE;
+          g_propagate_error (&data->error, local_error);
+        }
+      else
+        g_clear_error (&local_error);
+    }
+
+  if (data->pending_ops != 0)
+    return;
+
+  if (data->caught_error)
+    g_simple_async_result_take_error (data->result, data->error);
   g_simple_async_result_complete_in_idle (data->result);
   g_object_unref (data->result);
 }
@@ -4582,6 +7795,874 @@ ostree_repo_checkout_tree_finish (OstreeRepo               *self,
   return TRUE;
 }
 
+typedef struct {
+  gboolean done;
+  gboolean success;
+  GError **error;
+} CheckoutTreeSyncData;
+
+static void
+on_checkout_tree_sync_complete (GObject         *object,
+                                GAsyncResult    *result,
+                                gpointer         user_data)
+{
+  CheckoutTreeSyncData *data = user_data;
+
+  data->success = ostree_repo_checkout_tree_finish ((OstreeRepo*)object, result,
+                                                    data->error);
+  data->done = TRUE;
+}
+
+static gboolean
+checkout_tree_sync (OstreeRepo               *self,
+                    OstreeRepoCheckoutMode    mode,
+                    OstreeRepoCheckoutOverwriteMode    overwrite_mode,
+                    GFile                    *destination,
+                    OstreeRepoFile           *source,
+                    GFileInfo                *source_info,
+                    GCancellable             *cancellable,
+                    GError                  **error)
+{
+  GMainContext *context;
+  CheckoutTreeSyncData data;
+
+  memset (&data, 0, sizeof (data));
+  data.error = error;
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  ostree_repo_checkout_tree_async (self, mode, overwrite_mode,
+                                   destination, source, source_info,
+                                   cancellable, on_checkout_tree_sync_complete,
+                                   &data);
+  while (!data.done)
+    g_main_context_iteration (context, TRUE);
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+
+  return data.success;
+}
+
+/*
+ * Apply ownership, mode and xattrs to the existing directory @path;
+ * in user mode, only the mode.
+ */
+static gboolean
+checkout_update_directory_metadata (const char               *path,
+                                    OstreeRepoCheckoutMode    mode,
+                                    guint32                   uid,
+                                    guint32                   gid,
+                                    guint32                   dir_mode,
+                                    GVariant                 *xattrs,
+                                    GCancellable             *cancellable,
+                                    GError                  **error)
+{
+  gboolean ret = FALSE;
+  int fd = -1;
+
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER)
+    {
+      if (lchown (path, uid, gid) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "lchown(%u, %u) failed: ", uid, gid);
+          goto out;
+        }
+    }
+
+  if (chmod (path, dir_mode & 07777) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      g_prefix_error (error, "chmod(%u) failed: ", dir_mode);
+      goto out;
+    }
+
+  if (mode != OSTREE_REPO_CHECKOUT_MODE_USER && xattrs != NULL)
+    {
+      fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd == -1)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      if (!ostree_set_xattrs_fd (fd, xattrs, cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  if (fd != -1)
+    (void) close (fd);
+  return ret;
+}
+
+/*
+ * Give the existing directory @path the ownership, mode and xattrs of
+ * the directory @source in the repository.
+ */
+static gboolean
+checkout_update_directory_from_source (OstreeRepoCheckoutMode    mode,
+                                       GFile                    *path,
+                                       OstreeRepoFile           *source,
+                                       GCancellable             *cancellable,
+                                       GError                  **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFileInfo *source_info = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
+
+  source_info = g_file_query_info ((GFile*)source, OSTREE_GIO_FAST_QUERYINFO,
+                                   G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                   cancellable, error);
+  if (!source_info)
+    goto out;
+
+  if (!ostree_repo_file_get_xattrs (source, &xattrs, cancellable, error))
+    goto out;
+  if (!checkout_update_directory_metadata (ot_gfile_get_path_cached (path), mode,
+                                           g_file_info_get_attribute_uint32 (source_info, "unix::uid"),
+                                           g_file_info_get_attribute_uint32 (source_info, "unix::gid"),
+                                           g_file_info_get_attribute_uint32 (source_info, "unix::mode"),
+                                           xattrs, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static GFile *
+resolve_diff_item_path (GFile          *root,
+                        OstreeDiffItem *item)
+{
+  /* Diff paths are absolute */
+  return g_file_resolve_relative_path (root, item->path + 1);
+}
+
+/**
+ * ostree_repo_checkout_tree_incremental:
+ * @self: Repo
+ * @mode: Checkout mode
+ * @destination: Directory holding a checkout of @from_commit
+ * @from_commit: Commit @destination was checked out from
+ * @to_commit: Commit to update @destination to
+ * @cancellable:
+ * @error:
+ *
+ * Update the checkout @destination of @from_commit in place, so that
+ * it holds @to_commit.  Only entries that differ between the two
+ * commits are removed, replaced or added; subdirectories with equal
+ * dirtree and dirmeta checksums are skipped without being read.
+ *
+ * Local modifications to @destination are not detected; entries that
+ * are unchanged between the commits are left as they are.
+ */
+gboolean
+ostree_repo_checkout_tree_incremental (OstreeRepo               *self,
+                                       OstreeRepoCheckoutMode    mode,
+                                       GFile                    *destination,
+                                       const char               *from_commit,
+                                       const char               *to_commit,
+                                       GCancellable             *cancellable,
+                                       GError                  **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  ot_lptrarray GPtrArray *modified = NULL;
+  ot_lptrarray GPtrArray *removed = NULL;
+  ot_lptrarray GPtrArray *added = NULL;
+  ot_lobj GFile *from_root = NULL;
+  ot_lobj GFile *target_root = NULL;
+
+  modified = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+  removed = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+  added = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+
+  if (!ostree_diff_commits (self, from_commit, to_commit,
+                            modified, removed, added,
+                            cancellable, error))
+    goto out;
+
+  from_root = ostree_repo_file_new_root (self, from_commit);
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)from_root, error))
+    goto out;
+  target_root = ostree_repo_file_new_root (self, to_commit);
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)target_root, error))
+    goto out;
+
+  for (i = 0; i < removed->len; i++)
+    {
+      OstreeDiffItem *item = removed->pdata[i];
+      ot_lobj GFile *path = resolve_diff_item_path (destination, item);
+
+      if (!ot_gio_shutil_rm_rf (path, cancellable, error))
+        goto out;
+    }
+
+  for (i = 0; i < modified->len + added->len; i++)
+    {
+      gboolean is_added = i >= modified->len;
+      OstreeDiffItem *item = is_added ? added->pdata[i - modified->len] : modified->pdata[i];
+      /* Only directories have a dirmeta checksum */
+      gboolean target_is_dir = item->target_meta_checksum != NULL;
+      gboolean type_changed = !is_added && (item->objtype == OSTREE_OBJECT_TYPE_DIR_TREE) != target_is_dir;
+      ot_lobj GFile *path = resolve_diff_item_path (destination, item);
+      ot_lobj GFile *source = resolve_diff_item_path (target_root, item);
+      ot_lobj GFileInfo *source_info = NULL;
+
+      source_info = g_file_query_info (source, OSTREE_GIO_FAST_QUERYINFO,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       cancellable, error);
+      if (!source_info)
+        goto out;
+
+      /* Entries changing between file and directory are replaced */
+      if (type_changed)
+        {
+          if (!ot_gio_shutil_rm_rf (path, cancellable, error))
+            goto out;
+        }
+
+      if (target_is_dir && !is_added && !type_changed)
+        {
+          /* Only the directory's own metadata changed here; changed
+           * entries below it are listed separately.
+           */
+          if (!checkout_update_directory_from_source (mode, path, (OstreeRepoFile*)source,
+                                                      cancellable, error))
+            goto out;
+        }
+      else if (target_is_dir)
+        {
+          if (!checkout_tree_sync (self, mode, OSTREE_REPO_CHECKOUT_OVERWRITE_NONE,
+                                   path, (OstreeRepoFile*)source, source_info,
+                                   cancellable, error))
+            goto out;
+        }
+      else
+        {
+          if (!checkout_one_file (self, mode,
+                                  (is_added || type_changed) ? OSTREE_REPO_CHECKOUT_OVERWRITE_NONE
+                                  : OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES,
+                                  (OstreeRepoFile*)source, source_info, path,
+                                  cancellable, error))
+            goto out;
+        }
+    }
+
+  /* The tree diff never reports the root directory itself */
+  if (strcmp (ostree_repo_file_get_checksum ((OstreeRepoFile*)from_root),
+              ostree_repo_file_get_checksum ((OstreeRepoFile*)target_root)) != 0)
+    {
+      if (!checkout_update_directory_from_source (mode, destination, (OstreeRepoFile*)target_root,
+                                                  cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Number of threads linking files from a reference checkout */
+#define OSTREE_REPO_REFERENCE_LINK_THREADS (4)
+/* Files linked by each reference checkout work item */
+#define OSTREE_REPO_REFERENCE_LINK_CHUNK (256)
+/* Files checked out from the repository at once by a reference checkout */
+#define OSTREE_REPO_REFERENCE_MAX_PENDING (64)
+
+typedef struct {
+  char *relpath;
+  char meta_checksum[65];
+} ReferenceCheckoutDir;
+
+typedef struct {
+  char *relpath;
+  char checksum[65];
+} ReferenceCheckoutFile;
+
+/*
+ * Everything a checkout with a reference does, in tree order.  Paths
+ * are relative to both the destination and the reference checkout;
+ * the root is "".
+ */
+typedef struct {
+  GPtrArray *dirs;
+  GPtrArray *links;
+  GPtrArray *from_repo;
+} ReferenceCheckoutPlan;
+
+static void
+reference_checkout_dir_free (ReferenceCheckoutDir *dir)
+{
+  g_free (dir->relpath);
+  g_free (dir);
+}
+
+static void
+reference_checkout_file_free (ReferenceCheckoutFile *file)
+{
+  g_free (file->relpath);
+  g_free (file);
+}
+
+static char *
+reference_checkout_child_path (GString     *relpath,
+                               const char  *name)
+{
+  if (relpath->len == 0)
+    return g_strdup (name);
+  return g_strconcat (relpath->str, "/", name, NULL);
+}
+
+/*
+ * Binary search the sorted dirtree entry array @entries, whose
+ * elements start with the entry name.
+ */
+static gboolean
+lookup_dirtree_entry (GVariant     *entries,
+                      const char   *name,
+                      gsize        *out_index)
+{
+  gsize lo = 0;
+  gsize hi = g_variant_n_children (entries);
+
+  while (lo < hi)
+    {
+      gsize mid = (lo + hi) / 2;
+      ot_lvariant GVariant *entry = g_variant_get_child_value (entries, mid);
+      const char *entry_name;
+      int cmp;
+
+      g_variant_get_child (entry, 0, "&s", &entry_name);
+      cmp = strcmp (name, entry_name);
+      if (cmp == 0)
+        {
+          *out_index = mid;
+          return TRUE;
+        }
+      else if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return FALSE;
+}
+
+static gboolean
+plan_reference_checkout (OstreeRepo            *self,
+                         ReferenceCheckoutPlan *plan,
+                         GString               *relpath,
+                         const char            *contents_checksum,
+                         const char            *meta_checksum,
+                         const char            *ref_contents_checksum,
+                         const char            *ref_meta_checksum,
+                         GCancellable          *cancellable,
+                         GError               **error)
+{
+  gboolean ret = FALSE;
+  gsize base_len = relpath->len;
+  gboolean same;
+  int i, n;
+  ReferenceCheckoutDir *dir;
+  ot_lvariant GVariant *tree = NULL;
+  ot_lvariant GVariant *files = NULL;
+  ot_lvariant GVariant *dirs = NULL;
+  ot_lvariant GVariant *ref_tree = NULL;
+  ot_lvariant GVariant *ref_files = NULL;
+  ot_lvariant GVariant *ref_dirs = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  dir = g_new0 (ReferenceCheckoutDir, 1);
+  dir->relpath = g_strdup (relpath->str);
+  memcpy (dir->meta_checksum, meta_checksum, 65);
+  g_ptr_array_add (plan->dirs, dir);
+
+  same = (ref_contents_checksum != NULL
+          && strcmp (contents_checksum, ref_contents_checksum) == 0
+          && strcmp (meta_checksum, ref_meta_checksum) == 0);
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE, contents_checksum,
+                                 &tree, error))
+    goto out;
+  /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
+  files = g_variant_get_child_value (tree, 0);
+  dirs = g_variant_get_child_value (tree, 1);
+
+  if (!same && ref_contents_checksum != NULL)
+    {
+      if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_TREE, ref_contents_checksum,
+                                     &ref_tree, error))
+        goto out;
+      ref_files = g_variant_get_child_value (ref_tree, 0);
+      ref_dirs = g_variant_get_child_value (ref_tree, 1);
+    }
+
+  n = g_variant_n_children (files);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      gboolean link_from_reference = same;
+      gsize ref_index;
+      ReferenceCheckoutFile *file;
+      ot_lvariant GVariant *csum_v = NULL;
+
+      g_variant_get_child (files, i, "(&s@ay)", &name, &csum_v);
+
+      if (!same && ref_files && lookup_dirtree_entry (ref_files, name, &ref_index))
+        {
+          ot_lvariant GVariant *ref_csum_v = NULL;
+
+          g_variant_get_child (ref_files, ref_index, "(&s@ay)", NULL, &ref_csum_v);
+          link_from_reference = g_variant_equal (csum_v, ref_csum_v);
+        }
+
+      file = g_new (ReferenceCheckoutFile, 1);
+      file->relpath = reference_checkout_child_path (relpath, name);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), file->checksum);
+      g_ptr_array_add (link_from_reference ? plan->links : plan->from_repo, file);
+    }
+
+  n = g_variant_n_children (dirs);
+  for (i = 0; i < n; i++)
+    {
+      const char *name;
+      gsize ref_index;
+      char child_contents[65];
+      char child_meta[65];
+      char ref_child_contents[65];
+      char ref_child_meta[65];
+      gboolean have_ref = FALSE;
+      ot_lvariant GVariant *contents_csum_v = NULL;
+      ot_lvariant GVariant *meta_csum_v = NULL;
+
+      g_variant_get_child (dirs, i, "(&s@ay@ay)", &name, &contents_csum_v, &meta_csum_v);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (contents_csum_v), child_contents);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (meta_csum_v), child_meta);
+
+      if (same)
+        {
+          memcpy (ref_child_contents, child_contents, 65);
+          memcpy (ref_child_meta, child_meta, 65);
+          have_ref = TRUE;
+        }
+      else if (ref_dirs && lookup_dirtree_entry (ref_dirs, name, &ref_index))
+        {
+          ot_lvariant GVariant *ref_contents_csum_v = NULL;
+          ot_lvariant GVariant *ref_meta_csum_v = NULL;
+
+          g_variant_get_child (ref_dirs, ref_index, "(&s@ay@ay)", NULL,
+                               &ref_contents_csum_v, &ref_meta_csum_v);
+          ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (ref_contents_csum_v),
+                                              ref_child_contents);
+          ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (ref_meta_csum_v),
+                                              ref_child_meta);
+          have_ref = TRUE;
+        }
+
+      if (relpath->len > 0)
+        g_string_append_c (relpath, '/');
+      g_string_append (relpath, name);
+      if (!plan_reference_checkout (self, plan, relpath, child_contents, child_meta,
+                                    have_ref ? ref_child_contents : NULL,
+                                    have_ref ? ref_child_meta : NULL,
+                                    cancellable, error))
+        goto out;
+      g_string_truncate (relpath, base_len);
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+typedef struct {
+  OstreeRepo *repo;
+  /* "file" or "filecontent", whichever checkouts hardlink */
+  const char *object_suffix;
+  const char *dest_path;
+  const char *ref_path;
+  GPtrArray *links;
+  /* Set for entries that couldn't be verified or linked (EXDEV, EMLINK) */
+  guint8 *fallback;
+  volatile gint first_errno;
+} ReferenceLinkData;
+
+/*
+ * Whether @ref_path is still a hardlink of the loose object @checksum.
+ * Anything else may have been changed since it was checked out, for
+ * example by triggers.
+ */
+static gboolean
+reference_file_is_object (ReferenceLinkData  *link_data,
+                          const char         *ref_path,
+                          const char         *checksum)
+{
+  char relpath[OSTREE_LOOSE_OBJECT_RELPATH_MAX];
+  struct stat ref_stbuf;
+  struct stat object_stbuf;
+
+  get_loose_object_relpath (relpath, checksum, link_data->object_suffix);
+  if (fstatat (link_data->repo->objects_dir_fd, relpath, &object_stbuf, AT_SYMLINK_NOFOLLOW) < 0
+      || lstat (ref_path, &ref_stbuf) < 0)
+    return FALSE;
+
+  return ref_stbuf.st_dev == object_stbuf.st_dev
+    && ref_stbuf.st_ino == object_stbuf.st_ino;
+}
+
+static void
+reference_link_thread (gpointer     data,
+                       gpointer     user_data)
+{
+  guint start = GPOINTER_TO_UINT (data) - 1;
+  ReferenceLinkData *link_data = user_data;
+  guint end = MIN (start + OSTREE_REPO_REFERENCE_LINK_CHUNK, link_data->links->len);
+  guint i;
+  GString *src = g_string_new (link_data->ref_path);
+  GString *dest = g_string_new (link_data->dest_path);
+  gsize src_base = src->len;
+  gsize dest_base = dest->len;
+
+  for (i = start; i < end && g_atomic_int_get (&link_data->first_errno) == 0; i++)
+    {
+      ReferenceCheckoutFile *file = link_data->links->pdata[i];
+
+      g_string_truncate (src, src_base);
+      g_string_append_c (src, '/');
+      g_string_append (src, file->relpath);
+      g_string_truncate (dest, dest_base);
+      g_string_append_c (dest, '/');
+      g_string_append (dest, file->relpath);
+
+      if (!reference_file_is_object (link_data, src->str, file->checksum))
+        link_data->fallback[i] = TRUE;
+      else if (link (src->str, dest->str) < 0)
+        {
+          if (errno == EXDEV || errno == EMLINK || errno == ENOENT)
+            link_data->fallback[i] = TRUE;
+          else
+            (void) g_atomic_int_compare_and_exchange (&link_data->first_errno, 0, errno);
+        }
+    }
+
+  g_string_free (src, TRUE);
+  g_string_free (dest, TRUE);
+}
+
+typedef struct {
+  guint pending;
+  GError *error;
+} ReferenceRepoCheckoutData;
+
+static void
+on_reference_file_checked_out (GObject          *src,
+                               GAsyncResult     *result,
+                               gpointer          user_data)
+{
+  ReferenceRepoCheckoutData *data = user_data;
+  GError *local_error = NULL;
+
+  data->pending--;
+  if (!checkout_one_file_finish ((OstreeRepo*)src, result, &local_error))
+    {
+      if (data->error == NULL)
+        g_propagate_error (&data->error, local_error);
+      else
+        g_clear_error (&local_error);
+    }
+}
+
+/*
+ * Check out the entries of @files for which @only is set (all of them
+ * if @only is %NULL) from the repository, in worker threads like
+ * ostree_repo_checkout_tree_async().  @root is the root of the commit.
+ */
+static gboolean
+checkout_from_repo_by_paths (OstreeRepo               *self,
+                             OstreeRepoCheckoutMode    mode,
+                             GFile                    *root,
+                             GFile                    *destination,
+                             GPtrArray                *files,
+                             const guint8             *only,
+                             guint                    *out_n_checked_out,
+                             GCancellable             *cancellable,
+                             GError                  **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  guint n_checked_out = 0;
+  GMainContext *context;
+  ReferenceRepoCheckoutData data;
+
+  memset (&data, 0, sizeof (data));
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  for (i = 0; i < files->len && data.error == NULL; i++)
+    {
+      ReferenceCheckoutFile *file = files->pdata[i];
+      ot_lobj GFile *source = NULL;
+      ot_lobj GFile *dest = NULL;
+      ot_lobj GFileInfo *source_info = NULL;
+
+      if (only && !only[i])
+        continue;
+
+      source = g_file_resolve_relative_path (root, file->relpath);
+      dest = g_file_resolve_relative_path (destination, file->relpath);
+      source_info = g_file_query_info (source, OSTREE_GIO_FAST_QUERYINFO,
+                                       G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                       cancellable, &data.error);
+      if (!source_info)
+        break;
+
+      checkout_one_file_async (self, mode, OSTREE_REPO_CHECKOUT_OVERWRITE_NONE,
+                               (OstreeRepoFile*)source, source_info, dest,
+                               cancellable, on_reference_file_checked_out, &data);
+      data.pending++;
+      n_checked_out++;
+
+      while (data.pending >= OSTREE_REPO_REFERENCE_MAX_PENDING)
+        g_main_context_iteration (context, TRUE);
+    }
+
+  while (data.pending > 0)
+    g_main_context_iteration (context, TRUE);
+
+  g_main_context_pop_thread_default (context);
+  g_main_context_unref (context);
+
+  if (data.error)
+    {
+      g_propagate_error (error, data.error);
+      goto out;
+    }
+
+  ret = TRUE;
+  *out_n_checked_out = n_checked_out;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_repo_checkout_tree_with_reference:
+ * @self: Repo
+ * @mode: Checkout mode
+ * @destination: Directory to create
+ * @commit: Commit to check out
+ * @reference: An unmodified checkout of @reference_commit, made with the same @mode
+ * @reference_commit: Commit @reference was checked out from
+ * @out_timings: (out) (allow-none): Time spent in each phase
+ * @cancellable:
+ * @error:
+ *
+ * Check out @commit to @destination, hardlinking every file whose
+ * checksum is the same in @reference_commit from @reference.  The
+ * entries of subdirectories with identical dirtree and dirmeta
+ * checksums are found directly from the dirtree objects, without a
+ * #GFile per entry, and linked by several threads.  Other files are
+ * checked out from the repository as usual, several at a time.
+ *
+ * A file is only linked from @reference if it is still a hardlink of
+ * the repository's loose object, so files replaced since @reference
+ * was checked out, e.g. by triggers, are not reused.  For modes in
+ * which checkouts copy files rather than hardlinking objects, nothing
+ * can be verified and everything is checked out from the repository.
+ *
+ * Directories are created first, then files are linked, and finally
+ * the directory metadata is applied.
+ */
+gboolean
+ostree_repo_checkout_tree_with_reference (OstreeRepo                 *self,
+                                          OstreeRepoCheckoutMode      mode,
+                                          GFile                      *destination,
+                                          const char                 *commit,
+                                          GFile                      *reference,
+                                          const char                 *reference_commit,
+                                          OstreeRepoCheckoutTimings  *out_timings,
+                                          GCancellable               *cancellable,
+                                          GError                    **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+  gint64 start_time;
+  gint64 phase_time;
+  GString *relpath = NULL;
+  GString *path = NULL;
+  guint n_fallback = 0;
+  guint n_from_repo = 0;
+  GThreadPool *pool = NULL;
+  ReferenceCheckoutPlan plan;
+  ReferenceLinkData link_data;
+  OstreeRepoCheckoutTimings timings;
+  char contents_checksum[65];
+  char meta_checksum[65];
+  char ref_contents_checksum[65];
+  char ref_meta_checksum[65];
+  ot_lvariant GVariant *commit_v = NULL;
+  ot_lvariant GVariant *ref_commit_v = NULL;
+  ot_lvariant GVariant *csum_v = NULL;
+  ot_lobj GFile *root = NULL;
+
+  memset (&timings, 0, sizeof (timings));
+  memset (&link_data, 0, sizeof (link_data));
+  plan.dirs = g_ptr_array_new_with_free_func ((GDestroyNotify)reference_checkout_dir_free);
+  plan.links = g_ptr_array_new_with_free_func ((GDestroyNotify)reference_checkout_file_free);
+  plan.from_repo = g_ptr_array_new_with_free_func ((GDestroyNotify)reference_checkout_file_free);
+
+  start_time = g_get_monotonic_time ();
+
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, commit,
+                                 &commit_v, error))
+    goto out;
+  if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_COMMIT, reference_commit,
+                                 &ref_commit_v, error))
+    goto out;
+
+  /* PARSE OSTREE_SERIALIZED_COMMIT_VARIANT */
+  g_variant_get_child (commit_v, 6, "@ay", &csum_v);
+  ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), contents_checksum);
+  g_clear_pointer (&csum_v, (GDestroyNotify) g_variant_unref);
+  g_variant_get_child (commit_v, 7, "@ay", &csum_v);
+  ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), meta_checksum);
+  g_clear_pointer (&csum_v, (GDestroyNotify) g_variant_unref);
+  g_variant_get_child (ref_commit_v, 6, "@ay", &csum_v);
+  ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), ref_contents_checksum);
+  g_clear_pointer (&csum_v, (GDestroyNotify) g_variant_unref);
+  g_variant_get_child (ref_commit_v, 7, "@ay", &csum_v);
+  ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v), ref_meta_checksum);
+
+  relpath = g_string_new ("");
+  if (!plan_reference_checkout (self, &plan, relpath,
+                                contents_checksum, meta_checksum,
+                                ref_contents_checksum, ref_meta_checksum,
+                                cancellable, error))
+    goto out;
+
+  phase_time = g_get_monotonic_time ();
+  timings.scan_usec = phase_time - start_time;
+
+  /* Directories are writable by us until their metadata is applied */
+  path = g_string_new (ot_gfile_get_path_cached (destination));
+  for (i = 0; i < plan.dirs->len; i++)
+    {
+      ReferenceCheckoutDir *dir = plan.dirs->pdata[i];
+
+      g_string_truncate (path, strlen (ot_gfile_get_path_cached (destination)));
+      if (dir->relpath[0] != '\0')
+        {
+          g_string_append_c (path, '/');
+          g_string_append (path, dir->relpath);
+        }
+      if (mkdir (path->str, 0700) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          g_prefix_error (error, "Creating %s: ", path->str);
+          goto out;
+        }
+    }
+
+  timings.mkdir_usec = g_get_monotonic_time () - phase_time;
+  phase_time = g_get_monotonic_time ();
+
+  link_data.repo = self;
+  link_data.object_suffix = self->mode == OSTREE_REPO_MODE_ARCHIVE ? "filecontent" : "file";
+  link_data.dest_path = ot_gfile_get_path_cached (destination);
+  link_data.ref_path = ot_gfile_get_path_cached (reference);
+  link_data.links = plan.links;
+  link_data.fallback = g_new0 (guint8, plan.links->len);
+  if (!checkout_can_hardlink (self, mode))
+    memset (link_data.fallback, TRUE, plan.links->len);
+  else
+    {
+      pool = g_thread_pool_new (reference_link_thread, &link_data,
+                                OSTREE_REPO_REFERENCE_LINK_THREADS, FALSE, error);
+      if (!pool)
+        goto out;
+      /* Work items are chunk start indexes plus one, since NULL can't be pushed */
+      for (i = 0; i < plan.links->len; i += OSTREE_REPO_REFERENCE_LINK_CHUNK)
+        g_thread_pool_push (pool, GUINT_TO_POINTER (i + 1), NULL);
+      g_thread_pool_free (pool, FALSE, TRUE);
+      pool = NULL;
+    }
+
+  if (link_data.first_errno != 0)
+    {
+      ot_util_set_error_from_errno (error, link_data.first_errno);
+      g_prefix_error (error, "Linking from reference checkout: ");
+      goto out;
+    }
+
+  root = ostree_repo_file_new_root (self, commit);
+  if (!ostree_repo_file_ensure_resolved ((OstreeRepoFile*)root, error))
+    goto out;
+
+  if (!checkout_from_repo_by_paths (self, mode, root, destination,
+                                    plan.links, link_data.fallback, &n_fallback,
+                                    cancellable, error))
+    goto out;
+  if (!checkout_from_repo_by_paths (self, mode, root, destination,
+                                    plan.from_repo, NULL, &n_from_repo,
+                                    cancellable, error))
+    goto out;
+  timings.n_linked = plan.links->len - n_fallback;
+  timings.n_from_repo = n_fallback + n_from_repo;
+
+  timings.link_usec = g_get_monotonic_time () - phase_time;
+  phase_time = g_get_monotonic_time ();
+
+  /* Children first, in case a directory isn't searchable by us */
+  for (i = plan.dirs->len; i > 0; i--)
+    {
+      ReferenceCheckoutDir *dir = plan.dirs->pdata[i - 1];
+      guint32 uid, gid, dir_mode;
+      ot_lvariant GVariant *dirmeta = NULL;
+      ot_lvariant GVariant *xattrs = NULL;
+
+      if (!ostree_repo_load_variant (self, OSTREE_OBJECT_TYPE_DIR_META, dir->meta_checksum,
+                                     &dirmeta, error))
+        goto out;
+      /* PARSE OSTREE_DIRMETA_GVARIANT_FORMAT */
+      g_variant_get (dirmeta, "(uuu@a(ayay))", &uid, &gid, &dir_mode, &xattrs);
+
+      g_string_truncate (path, strlen (ot_gfile_get_path_cached (destination)));
+      if (dir->relpath[0] != '\0')
+        {
+          g_string_append_c (path, '/');
+          g_string_append (path, dir->relpath);
+        }
+      if (!checkout_update_directory_metadata (path->str, mode,
+                                               GUINT32_FROM_BE (uid),
+                                               GUINT32_FROM_BE (gid),
+                                               GUINT32_FROM_BE (dir_mode),
+                                               xattrs, cancellable, error))
+        goto out;
+    }
+
+  timings.metadata_usec = g_get_monotonic_time () - phase_time;
+  timings.n_directories = plan.dirs->len;
+
+  ret = TRUE;
+  if (out_timings)
+    *out_timings = timings;
+ out:
+  if (relpath)
+    g_string_free (relpath, TRUE);
+  if (path)
+    g_string_free (path, TRUE);
+  g_free (link_data.fallback);
+  g_ptr_array_unref (plan.dirs);
+  g_ptr_array_unref (plan.links);
+  g_ptr_array_unref (plan.from_repo);
+  return ret;
+}
+
 gboolean
 ostree_repo_read_commit (OstreeRepo *self,
                          const char *rev, 
@@ -65,6 +65,12 @@ GFile *       ostree_repo_get_object_path (OstreeRepo   *self,
                                            const char   *object,
                                            OstreeObjectType type);
 
+gboolean      ostree_repo_delete_object (OstreeRepo           *self,
+                                         OstreeObjectType      objtype,
+                                         const char           *sha256,
+                                         GCancellable         *cancellable,
+                                         GError              **error);
+
 GFile *       ostree_repo_get_archive_content_path (OstreeRepo    *self,
                                                     const char    *checksum);
 
@@ -120,6 +126,14 @@ gboolean      ostree_repo_stage_file_object_trusted (OstreeRepo   *self,
                                                      GCancellable *cancellable,
                                                      GError      **error);
 
+gboolean      ostree_repo_stage_object_link (OstreeRepo       *self,
+                                             OstreeRepo       *source,
+                                             OstreeObjectType  objtype,
+                                             const char       *checksum,
+                                             gboolean         *out_linked,
+                                             GCancellable     *cancellable,
+                                             GError          **error);
+
 gboolean      ostree_repo_resolve_rev (OstreeRepo  *self,
                                        const char  *rev,
                                        gboolean     allow_noent,
@@ -137,6 +151,13 @@ gboolean      ostree_repo_list_all_refs (OstreeRepo       *repo,
                                          GCancellable     *cancellable,
                                          GError          **error);
 
+void          ostree_repo_set_metadata_cache_size (OstreeRepo  *self,
+                                                   guint        n_entries);
+
+void          ostree_repo_get_metadata_cache_stats (OstreeRepo  *self,
+                                                    guint64     *out_hits,
+                                                    guint64     *out_misses);
+
 gboolean      ostree_repo_load_variant_c (OstreeRepo  *self,
                                           OstreeObjectType expected_type,
                                           const guchar  *csum,       
@@ -167,9 +188,85 @@ gboolean ostree_repo_map_pack_file (OstreeRepo    *self,
                                     gboolean       is_meta,
                                     guchar       **out_data,
                                     guint64       *out_len,
+                                    GMappedFile  **out_map,
                                     GCancellable  *cancellable,
                                     GError       **error);
 
+/**
+ * OstreeRepoPackCacheStats:
+ *
+ * State of the mappings of one kind of pack file, for debugging.
+ * Counters are cumulative over the lifetime of the repository.
+ */
+typedef struct {
+  guint    n_mappings;
+  guint64  mapped_bytes;
+  guint64  hits;
+  guint64  misses;
+  guint64  evictions;
+} OstreeRepoPackCacheStats;
+
+void     ostree_repo_set_pack_cache_limits (OstreeRepo  *self,
+                                            guint        max_mappings,
+                                            guint64      max_bytes);
+
+void     ostree_repo_set_sequential_pack_access (OstreeRepo  *self,
+                                                 gboolean     sequential);
+
+void     ostree_repo_get_pack_cache_stats (OstreeRepo                *self,
+                                           OstreeRepoPackCacheStats  *out_index_stats,
+                                           OstreeRepoPackCacheStats  *out_data_stats);
+
+/**
+ * OstreeRepoStat:
+ * @OSTREE_REPO_STAT_LOOSE_LOOKUPS: Searches for a loose object
+ * @OSTREE_REPO_STAT_LOOSE_HITS: Searches which found a loose object
+ * @OSTREE_REPO_STAT_PACK_LOOKUPS: Searches of the pack indexes
+ * @OSTREE_REPO_STAT_PACK_HITS: Searches which found a packed object
+ * @OSTREE_REPO_STAT_PACK_MAPS: Pack index and data files mapped
+ * @OSTREE_REPO_STAT_PACK_CACHE_HITS: Pack files which were already mapped
+ * @OSTREE_REPO_STAT_BYTES_HASHED: Object data checksummed while staging
+ * @OSTREE_REPO_STAT_BYTES_WRITTEN: Data written to temporary files while staging
+ * @OSTREE_REPO_STAT_TMPFILES_CREATED: Temporary files created while staging
+ * @OSTREE_REPO_STAT_FIND_OBJECT_USEC: Time searching for objects
+ * @OSTREE_REPO_STAT_HASH_USEC: Time checksumming while staging
+ * @OSTREE_REPO_STAT_STAGE_USEC: Time staging objects, including checksumming and writing temporary files
+ * @OSTREE_REPO_STAT_MKDIR_USEC: Time creating objects/XX directories
+ *
+ * Counters collected by a repository with
+ * ostree_repo_set_collect_stats().  Times are in microseconds, summed
+ * over all threads.
+ */
+typedef enum {
+  OSTREE_REPO_STAT_LOOSE_LOOKUPS,
+  OSTREE_REPO_STAT_LOOSE_HITS,
+  OSTREE_REPO_STAT_PACK_LOOKUPS,
+  OSTREE_REPO_STAT_PACK_HITS,
+  OSTREE_REPO_STAT_PACK_MAPS,
+  OSTREE_REPO_STAT_PACK_CACHE_HITS,
+  OSTREE_REPO_STAT_BYTES_HASHED,
+  OSTREE_REPO_STAT_BYTES_WRITTEN,
+  OSTREE_REPO_STAT_TMPFILES_CREATED,
+  OSTREE_REPO_STAT_FIND_OBJECT_USEC,
+  OSTREE_REPO_STAT_HASH_USEC,
+  OSTREE_REPO_STAT_STAGE_USEC,
+  OSTREE_REPO_STAT_MKDIR_USEC
+} OstreeRepoStat;
+
+#define OSTREE_REPO_N_STATS (OSTREE_REPO_STAT_MKDIR_USEC + 1)
+
+const char * ostree_repo_stat_to_string (OstreeRepoStat stat);
+
+void     ostree_repo_set_collect_stats (OstreeRepo  *self,
+                                        gboolean     collect);
+
+void     ostree_repo_set_default_collect_stats (gboolean collect);
+
+void     ostree_repo_get_stats (OstreeRepo  *self,
+                                guint64      values[OSTREE_REPO_N_STATS]);
+
+void     ostree_repo_get_total_stats (guint64 values[OSTREE_REPO_N_STATS]);
+
 gboolean ostree_repo_load_file (OstreeRepo         *self,
                                 const char         *entry_sha256,
                                 GInputStream      **out_input,
@@ -188,16 +285,30 @@ typedef OstreeRepoCommitFilterResult (*OstreeRepoCommitFilter) (OstreeRepo    *r
                                                                 GFileInfo     *file_info,
                                                                 gpointer       user_data);
 
+/**
+ * OstreeRepoCommitModifier:
+ *
+ * If @stat_cache is set, files of local directories whose stat data
+ * matches are staged using the checksum from the cache, without being
+ * read; the cache is updated with the checksums of all other files.
+ * Its root is set to each directory being staged.  It must only be
+ * used with the same @filter and @skip_xattrs settings it was
+ * populated with.  @stat_cache_verify ignores existing entries,
+ * rehashing every file.
+ */
 typedef struct {
   volatile gint refcount;
 
-  guint reserved_flags : 31;
+  guint reserved_flags : 30;
+  guint stat_cache_verify : 1;
   guint skip_xattrs : 1;
 
   OstreeRepoCommitFilter filter;
   gpointer user_data;
 
-  gpointer reserved[3];
+  OstreeStatCache *stat_cache;
+
+  gpointer reserved[2];
 } OstreeRepoCommitModifier;
 
 OstreeRepoCommitModifier *ostree_repo_commit_modifier_new (void);
@@ -219,6 +330,38 @@ gboolean      ostree_repo_stage_archive_to_mtree (OstreeRepo         *self,
                                                   GCancellable *cancellable,
                                                   GError      **error);
 
+/**
+ * OstreeRepoImportStats:
+ *
+ * Counts and time, in microseconds, spent by
+ * ostree_repo_stage_archive_to_mtree_with_stats().  @read_usec is
+ * spent reading and decompressing entry data, @stage_usec is the sum
+ * over all worker threads of hashing and writing buffered entries,
+ * and @large_usec is spent streaming files too large to buffer.
+ * @bytes and @large_bytes count the regular file data of each.
+ */
+typedef struct {
+  guint n_files;
+  guint n_directories;
+  guint n_hardlinks;
+  guint64 bytes;
+  guint64 large_bytes;
+
+  guint64 read_usec;
+  guint64 stage_usec;
+  guint64 large_usec;
+  guint64 total_usec;
+} OstreeRepoImportStats;
+
+gboolean      ostree_repo_stage_archive_to_mtree_with_stats (OstreeRepo         *self,
+                                                             GFile              *archive,
+                                                             OstreeMutableTree  *tree,
+                                                             OstreeRepoCommitModifier *modifier,
+                                                             gboolean            autocreate_parents,
+                                                             OstreeRepoImportStats *out_stats,
+                                                             GCancellable *cancellable,
+                                                             GError      **error);
+
 gboolean      ostree_repo_stage_mtree (OstreeRepo         *self,
                                        OstreeMutableTree  *tree,
                                        char              **out_contents_checksum,
@@ -260,6 +403,43 @@ gboolean     ostree_repo_resync_cached_remote_pack_indexes (OstreeRepo       *se
                                                             GCancellable     *cancellable,
                                                             GError          **error);
 
+gboolean     ostree_repo_list_cached_remote_pack_indexes (OstreeRepo       *self,
+                                                          const char       *remote_name,
+                                                          GPtrArray       **out_meta_indexes,
+                                                          GPtrArray       **out_data_indexes,
+                                                          GCancellable     *cancellable,
+                                                          GError          **error);
+
+gboolean     ostree_repo_take_cached_remote_refs_summary (OstreeRepo       *self,
+                                                          const char       *remote_name,
+                                                          GFile            *summary_path,
+                                                          GCancellable     *cancellable,
+                                                          GError          **error);
+
+gboolean     ostree_repo_load_cached_remote_refs_summary (OstreeRepo       *self,
+                                                          const char       *remote_name,
+                                                          GVariant        **out_summary,
+                                                          GCancellable     *cancellable,
+                                                          GError          **error);
+
+gboolean     ostree_repo_get_remote_cache_validators (OstreeRepo       *self,
+                                                      const char       *remote_name,
+                                                      const char       *path,
+                                                      char            **out_etag,
+                                                      char            **out_last_modified,
+                                                      char            **out_contents,
+                                                      GCancellable     *cancellable,
+                                                      GError          **error);
+
+gboolean     ostree_repo_set_remote_cache_validators (OstreeRepo       *self,
+                                                      const char       *remote_name,
+                                                      const char       *path,
+                                                      const char       *etag,
+                                                      const char       *last_modified,
+                                                      const char       *contents,
+                                                      GCancellable     *cancellable,
+                                                      GError          **error);
+
 gboolean     ostree_repo_clean_cached_remote_pack_data (OstreeRepo       *self,
                                                         const char       *remote_name,
                                                         GCancellable     *cancellable,
@@ -323,6 +503,71 @@ ostree_repo_checkout_tree_finish (OstreeRepo               *self,
                                   GAsyncResult             *result,
                                   GError                  **error);
 
+/**
+ * OstreeRepoCheckoutTimings:
+ *
+ * Counts and wall clock time, in microseconds, of the phases of
+ * ostree_repo_checkout_tree_with_reference().  Files checked out from
+ * the repository count towards @link_usec.
+ */
+typedef struct {
+  guint n_directories;
+  guint n_linked;
+  guint n_from_repo;
+
+  guint64 scan_usec;
+  guint64 mkdir_usec;
+  guint64 link_usec;
+  guint64 metadata_usec;
+} OstreeRepoCheckoutTimings;
+
+gboolean
+ostree_repo_checkout_tree_with_reference (OstreeRepo                 *self,
+                                          OstreeRepoCheckoutMode      mode,
+                                          GFile                      *destination,
+                                          const char                 *commit,
+                                          GFile                      *reference,
+                                          const char                 *reference_commit,
+                                          OstreeRepoCheckoutTimings  *out_timings,
+                                          GCancellable               *cancellable,
+                                          GError                    **error);
+
+gboolean
+ostree_repo_checkout_tree_incremental (OstreeRepo               *self,
+                                       OstreeRepoCheckoutMode    mode,
+                                       GFile                    *destination,
+                                       const char               *from_commit,
+                                       const char               *to_commit,
+                                       GCancellable             *cancellable,
+                                       GError                  **error);
+
+/**
+ * OstreeRepoCheckoutMethod:
+ *
+ * How the content of a regular file was put in place by checkout.
+ * Files are hardlinked when possible; otherwise the loose object is
+ * reflinked or copied, using the cheapest method known to work
+ * between the two filesystems.  Files without a loose object are
+ * written straight from the pack mapping when stored uncompressed,
+ * and otherwise from the object stream.
+ */
+typedef enum {
+  OSTREE_REPO_CHECKOUT_METHOD_HARDLINK,
+  OSTREE_REPO_CHECKOUT_METHOD_REFLINK,
+  OSTREE_REPO_CHECKOUT_METHOD_COPY_FILE_RANGE,
+  OSTREE_REPO_CHECKOUT_METHOD_SENDFILE,
+  OSTREE_REPO_CHECKOUT_METHOD_COPY,
+  OSTREE_REPO_CHECKOUT_METHOD_PACK,
+  OSTREE_REPO_CHECKOUT_METHOD_STREAM
+} OstreeRepoCheckoutMethod;
+
+#define OSTREE_REPO_CHECKOUT_N_METHODS (OSTREE_REPO_CHECKOUT_METHOD_STREAM + 1)
+
+const char * ostree_repo_checkout_method_to_string (OstreeRepoCheckoutMethod method);
+
+void         ostree_repo_get_checkout_stats (OstreeRepo *self,
+                                             guint       counts[OSTREE_REPO_CHECKOUT_N_METHODS]);
+
 gboolean       ostree_repo_read_commit (OstreeRepo *self,
                                         const char *rev,
                                         GFile       **out_root,
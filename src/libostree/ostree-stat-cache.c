@@ -0,0 +1,506 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include "ostree.h"
+#include "otutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define OSTREE_STAT_CACHE_MAGIC "OSTv1STATCACHE"
+#define OSTREE_STAT_CACHE_MAGIC_V0 "OSTv0STATCACHE"
+
+typedef struct {
+  guint64 dev;
+  guint64 ino;
+  guint32 mode;
+  guint64 size;
+  guint64 mtime;
+  guint64 ctime;
+  char checksum[65];
+} OstreeStatCacheEntry;
+
+struct OstreeStatCache {
+  /* Time the loaded cache was written */
+  guint64 timestamp;
+  char *commit;
+  /* Canonical path of the directory lookups are relative to */
+  char *root;
+  /* root/path -> OstreeStatCacheEntry */
+  GHashTable *entries;
+};
+
+static guint64
+timespec_to_nsec (const struct timespec *ts)
+{
+  return (guint64)ts->tv_sec * G_GUINT64_CONSTANT (1000000000) + ts->tv_nsec;
+}
+
+/**
+ * ostree_stat_cache_new:
+ *
+ * Returns: An empty cache mapping paths to content checksums, valid
+ * as long as lstat() on the path returns the same data.  Set the
+ * directory paths are relative to with ostree_stat_cache_set_root().
+ * Free with ostree_stat_cache_free().
+ */
+OstreeStatCache *
+ostree_stat_cache_new (void)
+{
+  OstreeStatCache *ret = g_new0 (OstreeStatCache, 1);
+  ret->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, g_free);
+  return ret;
+}
+
+void
+ostree_stat_cache_free (OstreeStatCache *cache)
+{
+  if (!cache)
+    return;
+  g_hash_table_destroy (cache->entries);
+  g_free (cache->commit);
+  g_free (cache->root);
+  g_free (cache);
+}
+
+/**
+ * ostree_stat_cache_load:
+ *
+ * Merge the entries saved in @path into @cache.  It is not an error
+ * for @path not to exist.
+ */
+gboolean
+ostree_stat_cache_load (OstreeStatCache  *cache,
+                        GFile            *path,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  gboolean ret = FALSE;
+  const char *magic;
+  guint64 timestamp;
+  GVariantIter *entries_iter = NULL;
+  const char *entry_path;
+  const char *commit;
+  guint64 dev, ino, size, mtime, ctime;
+  guint32 mode;
+  ot_lvariant GVariant *cache_variant = NULL;
+  ot_lvariant GVariant *metadata = NULL;
+  ot_lvariant GVariant *csum_v = NULL;
+
+  if (!g_file_query_exists (path, cancellable))
+    return TRUE;
+
+  if (!ot_util_variant_map (path, OSTREE_STAT_CACHE_VARIANT_FORMAT, FALSE,
+                            &cache_variant, error))
+    goto out;
+
+  g_variant_get (cache_variant, "(&st@a{sv}a(sttutttay))",
+                 &magic, &timestamp, &metadata, &entries_iter);
+  /* Caches from before entries were keyed by their root directory
+   * are simply discarded.
+   */
+  if (strcmp (magic, OSTREE_STAT_CACHE_MAGIC_V0) == 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+  if (strcmp (magic, OSTREE_STAT_CACHE_MAGIC) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Invalid stat cache '%s'", ot_gfile_get_path_cached (path));
+      goto out;
+    }
+  cache->timestamp = GUINT64_FROM_BE (timestamp);
+
+  if (g_variant_lookup (metadata, "commit", "&s", &commit))
+    {
+      if (!ostree_validate_checksum_string (commit, error))
+        goto out;
+      ostree_stat_cache_set_commit (cache, commit);
+    }
+
+  while (g_variant_iter_loop (entries_iter, "(&sttuttt@ay)",
+                              &entry_path, &dev, &ino, &mode, &size,
+                              &mtime, &ctime, &csum_v))
+    {
+      OstreeStatCacheEntry *entry;
+
+      if (!ostree_validate_structureof_csum_v (csum_v, error))
+        goto out;
+
+      entry = g_new (OstreeStatCacheEntry, 1);
+      entry->dev = GUINT64_FROM_BE (dev);
+      entry->ino = GUINT64_FROM_BE (ino);
+      entry->mode = GUINT32_FROM_BE (mode);
+      entry->size = GUINT64_FROM_BE (size);
+      entry->mtime = GUINT64_FROM_BE (mtime);
+      entry->ctime = GUINT64_FROM_BE (ctime);
+      ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v),
+                                          entry->checksum);
+      g_hash_table_replace (cache->entries, g_strdup (entry_path), entry);
+    }
+  csum_v = NULL;
+
+  ret = TRUE;
+ out:
+  if (entries_iter)
+    g_variant_iter_free (entries_iter);
+  return ret;
+}
+
+/**
+ * ostree_stat_cache_save:
+ *
+ * Write all entries of @cache to @path, sorted by path.
+ */
+gboolean
+ostree_stat_cache_save (OstreeStatCache  *cache,
+                        GFile            *path,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+  gboolean ret = FALSE;
+  GList *sorted_paths = NULL;
+  GList *iter;
+  GVariantBuilder *builder = NULL;
+  GVariantBuilder *metadata_builder = NULL;
+  struct timespec now;
+  ot_lvariant GVariant *cache_variant = NULL;
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE ("a(sttutttay)"));
+
+  sorted_paths = g_hash_table_get_keys (cache->entries);
+  sorted_paths = g_list_sort (sorted_paths, (GCompareFunc)strcmp);
+  for (iter = sorted_paths; iter; iter = iter->next)
+    {
+      const char *entry_path = iter->data;
+      OstreeStatCacheEntry *entry = g_hash_table_lookup (cache->entries, entry_path);
+
+      g_variant_builder_add (builder, "(sttuttt@ay)",
+                             entry_path,
+                             GUINT64_TO_BE (entry->dev),
+                             GUINT64_TO_BE (entry->ino),
+                             GUINT32_TO_BE (entry->mode),
+                             GUINT64_TO_BE (entry->size),
+                             GUINT64_TO_BE (entry->mtime),
+                             GUINT64_TO_BE (entry->ctime),
+                             ostree_checksum_to_bytes_v (entry->checksum));
+    }
+
+  metadata_builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+  if (cache->commit)
+    g_variant_builder_add (metadata_builder, "{sv}", "commit",
+                           g_variant_new_string (cache->commit));
+
+  clock_gettime (CLOCK_REALTIME, &now);
+
+  cache_variant = g_variant_new ("(st@a{sv}@a(sttutttay))",
+                                 OSTREE_STAT_CACHE_MAGIC,
+                                 GUINT64_TO_BE (timespec_to_nsec (&now)),
+                                 g_variant_builder_end (metadata_builder),
+                                 g_variant_builder_end (builder));
+  g_variant_ref_sink (cache_variant);
+
+  if (!ot_util_variant_save (path, cache_variant, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  g_list_free (sorted_paths);
+  if (builder)
+    g_variant_builder_unref (builder);
+  if (metadata_builder)
+    g_variant_builder_unref (metadata_builder);
+  return ret;
+}
+
+/**
+ * ostree_stat_cache_get_commit:
+ *
+ * Returns: (transfer none): The commit the cached directory was last
+ * checked out from or committed as, or %NULL if unknown
+ */
+const char *
+ostree_stat_cache_get_commit (OstreeStatCache  *cache)
+{
+  return cache->commit;
+}
+
+void
+ostree_stat_cache_set_commit (OstreeStatCache  *cache,
+                              const char       *commit)
+{
+  g_free (cache->commit);
+  cache->commit = g_strdup (commit);
+}
+
+/**
+ * ostree_stat_cache_set_root:
+ * @root: Local directory
+ *
+ * Make paths given to ostree_stat_cache_lookup(),
+ * ostree_stat_cache_update() and ostree_stat_cache_add_tree() relative
+ * to @root.  Entries are stored under the canonical path of @root, so
+ * several directories can share one cache without their entries
+ * colliding.  @root need not exist yet, but its parent should.
+ */
+void
+ostree_stat_cache_set_root (OstreeStatCache  *cache,
+                            GFile            *root)
+{
+  const char *path = ot_gfile_get_path_cached (root);
+  char *resolved;
+
+  g_free (cache->root);
+  cache->root = NULL;
+
+  resolved = realpath (path, NULL);
+  if (!resolved)
+    {
+      ot_lobj GFile *parent = g_file_get_parent (root);
+      char *resolved_parent = parent ? realpath (ot_gfile_get_path_cached (parent), NULL) : NULL;
+
+      if (resolved_parent)
+        {
+          cache->root = g_build_filename (resolved_parent, ot_gfile_get_basename_cached (root), NULL);
+          free (resolved_parent);
+        }
+      else
+        cache->root = g_strdup (path);
+    }
+  else
+    {
+      cache->root = g_strdup (resolved);
+      free (resolved);
+    }
+}
+
+static char *
+make_key (OstreeStatCache  *cache,
+          const char       *path)
+{
+  g_assert (cache->root != NULL);
+  return g_build_filename (cache->root, path, NULL);
+}
+
+/**
+ * ostree_stat_cache_lookup:
+ * @path: Path relative to the cached directory
+ * @stbuf: Result of lstat() on @path
+ *
+ * Returns: (transfer none): The content checksum recorded for @path,
+ * or %NULL if the file may have changed since.
+ *
+ * Like git's index, entries whose modification time is not strictly
+ * earlier than the second in which the cache was written are never
+ * trusted, since the file could have been changed again within the
+ * timestamp granularity of the filesystem.
+ */
+const char *
+ostree_stat_cache_lookup (OstreeStatCache  *cache,
+                          const char       *path,
+                          struct stat      *stbuf)
+{
+  OstreeStatCacheEntry *entry;
+  guint64 mtime;
+  ot_lfree char *key = make_key (cache, path);
+
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (!entry)
+    return NULL;
+
+  mtime = timespec_to_nsec (&stbuf->st_mtim);
+  if (mtime / G_GUINT64_CONSTANT (1000000000) >= cache->timestamp / G_GUINT64_CONSTANT (1000000000))
+    return NULL;
+
+  if (entry->dev != (guint64)stbuf->st_dev
+      || entry->ino != (guint64)stbuf->st_ino
+      || entry->mode != (guint32)stbuf->st_mode
+      || entry->size != (guint64)stbuf->st_size
+      || entry->mtime != mtime
+      || entry->ctime != timespec_to_nsec (&stbuf->st_ctim))
+    return NULL;
+
+  return entry->checksum;
+}
+
+/**
+ * ostree_stat_cache_update:
+ * @path: Path relative to the cached directory
+ * @stbuf: Result of lstat() on @path
+ * @checksum: Content checksum of @path
+ *
+ * Record that @path, as described by @stbuf, has content checksum
+ * @checksum.
+ */
+void
+ostree_stat_cache_update (OstreeStatCache  *cache,
+                          const char       *path,
+                          struct stat      *stbuf,
+                          const char       *checksum)
+{
+  OstreeStatCacheEntry *entry = g_new (OstreeStatCacheEntry, 1);
+
+  entry->dev = stbuf->st_dev;
+  entry->ino = stbuf->st_ino;
+  entry->mode = stbuf->st_mode;
+  entry->size = stbuf->st_size;
+  entry->mtime = timespec_to_nsec (&stbuf->st_mtim);
+  entry->ctime = timespec_to_nsec (&stbuf->st_ctim);
+  memcpy (entry->checksum, checksum, 65);
+  g_hash_table_replace (cache->entries, make_key (cache, path), entry);
+}
+
+static gboolean
+add_tree_recurse (OstreeStatCache  *cache,
+                  OstreeRepo       *repo,
+                  GVariant         *dirtree_csum_v,
+                  GString          *path,
+                  gsize             root_len,
+                  int               recursion_depth,
+                  GCancellable     *cancellable,
+                  GError          **error)
+{
+  gboolean ret = FALSE;
+  gsize base_len = path->len;
+  GVariantIter viter;
+  const char *name;
+  struct stat stbuf;
+  ot_lvariant GVariant *dirtree = NULL;
+  ot_lvariant GVariant *files_variant = NULL;
+  ot_lvariant GVariant *dirs_variant = NULL;
+  ot_lvariant GVariant *csum_v = NULL;
+  ot_lvariant GVariant *meta_csum_v = NULL;
+
+  if (recursion_depth > OSTREE_MAX_RECURSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Maximum recursion limit reached");
+      goto out;
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (!ostree_repo_load_variant_c (repo, OSTREE_OBJECT_TYPE_DIR_TREE,
+                                   ostree_checksum_bytes_peek (dirtree_csum_v),
+                                   &dirtree, error))
+    goto out;
+
+  /* PARSE OSTREE_SERIALIZED_TREE_VARIANT */
+  files_variant = g_variant_get_child_value (dirtree, 0);
+  dirs_variant = g_variant_get_child_value (dirtree, 1);
+
+  g_variant_iter_init (&viter, files_variant);
+  while (g_variant_iter_loop (&viter, "(&s@ay)", &name, &csum_v))
+    {
+      char checksum[65];
+
+      g_string_append_c (path, '/');
+      g_string_append (path, name);
+
+      /* Files that disappeared or were replaced meanwhile are simply
+       * left out of the cache.
+       */
+      if (lstat (path->str, &stbuf) == 0
+          && !S_ISDIR (stbuf.st_mode))
+        {
+          ostree_checksum_inplace_from_bytes (ostree_checksum_bytes_peek (csum_v),
+                                              checksum);
+          ostree_stat_cache_update (cache, path->str + root_len + 1, &stbuf, checksum);
+        }
+
+      g_string_truncate (path, base_len);
+    }
+  csum_v = NULL;
+
+  g_variant_iter_init (&viter, dirs_variant);
+  while (g_variant_iter_loop (&viter, "(&s@ay@ay)", &name, &csum_v, &meta_csum_v))
+    {
+      g_string_append_c (path, '/');
+      g_string_append (path, name);
+
+      if (!add_tree_recurse (cache, repo, csum_v, path, root_len, recursion_depth + 1,
+                             cancellable, error))
+        goto out;
+
+      g_string_truncate (path, base_len);
+    }
+  csum_v = NULL;
+  meta_csum_v = NULL;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * ostree_stat_cache_add_tree:
+ * @dirtree_checksum: Tree which was just checked out into @dir
+ * @dir: Local directory
+ *
+ * Record the current stat data of every regular file and symbolic
+ * link below @dir, with the content checksum it has in
+ * @dirtree_checksum.  Paths are recorded relative to the root set with
+ * ostree_stat_cache_set_root(), which is usually @dir, but may be the
+ * path @dir will be renamed to.  This should be called right after a
+ * checkout, before anything else has had the chance to modify @dir.
+ * If no root was set, @dir is used.
+ */
+gboolean
+ostree_stat_cache_add_tree (OstreeStatCache  *cache,
+                            OstreeRepo       *repo,
+                            const char       *dirtree_checksum,
+                            GFile            *dir,
+                            GCancellable     *cancellable,
+                            GError          **error)
+{
+  gboolean ret = FALSE;
+  GString *path = NULL;
+  ot_lvariant GVariant *csum_v = NULL;
+
+  if (!cache->root)
+    ostree_stat_cache_set_root (cache, dir);
+
+  csum_v = ostree_checksum_to_bytes_v (dirtree_checksum);
+  g_variant_ref_sink (csum_v);
+
+  path = g_string_new (ot_gfile_get_path_cached (dir));
+  if (path->len > 0 && path->str[path->len - 1] == '/')
+    g_string_truncate (path, path->len - 1);
+
+  if (!add_tree_recurse (cache, repo, csum_v, path, path->len, 0,
+                         cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (path)
+    g_string_free (path, TRUE);
+  return ret;
+}
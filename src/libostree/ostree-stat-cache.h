@@ -0,0 +1,86 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * Author: Colin Walters <walters@verbum.org>
+ */
+
+#ifndef _OSTREE_STAT_CACHE
+#define _OSTREE_STAT_CACHE
+
+#include <sys/stat.h>
+
+#include "ostree-core.h"
+#include "ostree-types.h"
+
+G_BEGIN_DECLS
+
+/**
+ * OSTREE_STAT_CACHE_VARIANT_FORMAT:
+ *
+ * s - Magic
+ * t - Time the cache was written, in nanoseconds (big endian)
+ * a{sv} - Metadata; "commit" is the commit the directory was last
+ *         checked out from or committed as, if any
+ * a(sttutttay) - Sorted array of (absolute path, device, inode, mode, size,
+ *                mtime, ctime, content checksum); integers are big
+ *                endian, times are in nanoseconds
+ */
+#define OSTREE_STAT_CACHE_VARIANT_FORMAT G_VARIANT_TYPE ("(sta{sv}a(sttutttay))")
+
+OstreeStatCache *ostree_stat_cache_new (void);
+
+void ostree_stat_cache_free (OstreeStatCache *cache);
+
+gboolean ostree_stat_cache_load (OstreeStatCache  *cache,
+                                 GFile            *path,
+                                 GCancellable     *cancellable,
+                                 GError          **error);
+
+gboolean ostree_stat_cache_save (OstreeStatCache  *cache,
+                                 GFile            *path,
+                                 GCancellable     *cancellable,
+                                 GError          **error);
+
+const char *ostree_stat_cache_get_commit (OstreeStatCache  *cache);
+
+void ostree_stat_cache_set_commit (OstreeStatCache  *cache,
+                                   const char       *commit);
+
+void ostree_stat_cache_set_root (OstreeStatCache  *cache,
+                                 GFile            *root);
+
+const char *ostree_stat_cache_lookup (OstreeStatCache  *cache,
+                                      const char       *path,
+                                      struct stat      *stbuf);
+
+void ostree_stat_cache_update (OstreeStatCache  *cache,
+                               const char       *path,
+                               struct stat      *stbuf,
+                               const char       *checksum);
+
+gboolean ostree_stat_cache_add_tree (OstreeStatCache  *cache,
+                                     OstreeRepo       *repo,
+                                     const char       *dirtree_checksum,
+                                     GFile            *dir,
+                                     GCancellable     *cancellable,
+                                     GError          **error);
+
+G_END_DECLS
+
+#endif /* _OSTREE_STAT_CACHE */
@@ -33,6 +33,8 @@ struct OstreeMutableTree;
 typedef struct OstreeMutableTree OstreeMutableTree;
 struct OstreeRepoFile;
 typedef struct OstreeRepoFile OstreeRepoFile;
+struct OstreeStatCache;
+typedef struct OstreeStatCache OstreeStatCache;
 
 G_END_DECLS
 
@@ -29,6 +29,8 @@
 #include <ostree-mutable-tree.h>
 #include <ostree-repo-file.h>
 #include <ostree-traverse.h>
+#include <ostree-diff.h>
+#include <ostree-stat-cache.h>
 #include <ostree-sysroot.h>
 
 #endif
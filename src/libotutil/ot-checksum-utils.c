@@ -26,13 +26,343 @@
 
 #include <string.h>
 
+#ifdef HAVE_SHA_NI_INTRINSICS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const guint32 sha256_initial_state[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#ifdef HAVE_SHA_NI_INTRINSICS
+
+static const guint32 sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Four rounds using message words @m, starting at round @k */
+#define SHA256_ROUNDS(m, k)                                             \
+  G_STMT_START {                                                        \
+    msg = _mm_add_epi32 (m, _mm_loadu_si128 ((const __m128i *) &sha256_k[k])); \
+    state1 = _mm_sha256rnds2_epu32 (state1, state0, msg);               \
+    msg = _mm_shuffle_epi32 (msg, 0x0E);                                \
+    state0 = _mm_sha256rnds2_epu32 (state0, state1, msg);               \
+  } G_STMT_END
+
+/* Finish the next message words in @next from the current and previous ones */
+#define SHA256_MSG2(next, cur, prev) \
+  next = _mm_sha256msg2_epu32 (_mm_add_epi32 (next, _mm_alignr_epi8 (cur, prev, 4)), cur)
+
+#define SHA256_MSG1(prev, cur) \
+  prev = _mm_sha256msg1_epu32 (prev, cur)
+
+/*
+ * Process @n_blocks 64-byte blocks of @data into @state with the SHA
+ * extensions, which keep the state as ABEF and CDGH halves.
+ */
+__attribute__((target ("sha,sse4.1")))
+static void
+sha256_blocks_sha_ni (guint32       *state,
+                      const guchar  *data,
+                      gsize          n_blocks)
+{
+  const __m128i byteswap = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, saved0, saved1;
+  __m128i msg, m0, m1, m2, m3, tmp;
+  guint k;
+
+  tmp = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &state[0]), 0xB1);
+  state1 = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i *) &state[4]), 0x1B);
+  state0 = _mm_alignr_epi8 (tmp, state1, 8);
+  state1 = _mm_blend_epi16 (state1, tmp, 0xF0);
+
+  for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+      saved0 = state0;
+      saved1 = state1;
+
+      m0 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (data + 0)), byteswap);
+      SHA256_ROUNDS (m0, 0);
+      m1 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (data + 16)), byteswap);
+      SHA256_ROUNDS (m1, 4);
+      SHA256_MSG1 (m0, m1);
+      m2 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (data + 32)), byteswap);
+      SHA256_ROUNDS (m2, 8);
+      SHA256_MSG1 (m1, m2);
+      m3 = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (data + 48)), byteswap);
+      SHA256_ROUNDS (m3, 12);
+      SHA256_MSG2 (m0, m3, m2);
+      SHA256_MSG1 (m2, m3);
+
+      for (k = 16; k < 48; k += 16)
+        {
+          SHA256_ROUNDS (m0, k);
+          SHA256_MSG2 (m1, m0, m3);
+          SHA256_MSG1 (m3, m0);
+          SHA256_ROUNDS (m1, k + 4);
+          SHA256_MSG2 (m2, m1, m0);
+          SHA256_MSG1 (m0, m1);
+          SHA256_ROUNDS (m2, k + 8);
+          SHA256_MSG2 (m3, m2, m1);
+          SHA256_MSG1 (m1, m2);
+          SHA256_ROUNDS (m3, k + 12);
+          SHA256_MSG2 (m0, m3, m2);
+          SHA256_MSG1 (m2, m3);
+        }
+
+      SHA256_ROUNDS (m0, 48);
+      SHA256_MSG2 (m1, m0, m3);
+      SHA256_MSG1 (m3, m0);
+      SHA256_ROUNDS (m1, 52);
+      SHA256_MSG2 (m2, m1, m0);
+      SHA256_ROUNDS (m2, 56);
+      SHA256_MSG2 (m3, m2, m1);
+      SHA256_ROUNDS (m3, 60);
+
+      state0 = _mm_add_epi32 (state0, saved0);
+      state1 = _mm_add_epi32 (state1, saved1);
+    }
+
+  tmp = _mm_shuffle_epi32 (state0, 0x1B);
+  state1 = _mm_shuffle_epi32 (state1, 0xB1);
+  state0 = _mm_blend_epi16 (tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8 (state1, tmp, 8);
+
+  _mm_storeu_si128 ((__m128i *) &state[0], state0);
+  _mm_storeu_si128 ((__m128i *) &state[4], state1);
+}
+
+static gboolean
+cpu_has_sha_ni (void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid (1, &eax, &ebx, &ecx, &edx)
+      || !(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+    return FALSE;
+  if (__get_cpuid_max (0, NULL) < 7)
+    return FALSE;
+  __cpuid_count (7, 0, eax, ebx, ecx, edx);
+  /* CPUID.(EAX=7,ECX=0):EBX.SHA */
+  return (ebx & (1 << 29)) != 0;
+}
+
+#endif
+
+static gboolean
+use_sha_ni (void)
+{
+#ifdef HAVE_SHA_NI_INTRINSICS
+  static gsize initialized;
+  static gboolean have_sha_ni;
+
+  if (g_once_init_enter (&initialized))
+    {
+      /* OSTREE_CHECKSUM_BACKEND=glib forces GChecksum, for testing */
+      have_sha_ni = cpu_has_sha_ni ()
+        && g_strcmp0 (g_getenv ("OSTREE_CHECKSUM_BACKEND"), "glib") != 0;
+      g_once_init_leave (&initialized, 1);
+    }
+  return have_sha_ni;
+#else
+  return FALSE;
+#endif
+}
+
+static inline void
+sha256_blocks (guint32       *state,
+               const guchar  *data,
+               gsize          n_blocks)
+{
+#ifdef HAVE_SHA_NI_INTRINSICS
+  sha256_blocks_sha_ni (state, data, n_blocks);
+#else
+  g_assert_not_reached ();
+#endif
+}
+
+/**
+ * ot_checksum_get_implementation:
+ *
+ * Returns: Name of the SHA-256 implementation OtChecksum uses on this CPU
+ */
+const char *
+ot_checksum_get_implementation (void)
+{
+  return use_sha_ni () ? "sha-ni" : "glib";
+}
+
+void
+ot_checksum_init (OtChecksum *checksum)
+{
+  memset (checksum, 0, sizeof (*checksum));
+  if (use_sha_ni ())
+    memcpy (checksum->state, sha256_initial_state, sizeof (checksum->state));
+  else
+    checksum->fallback = g_checksum_new (G_CHECKSUM_SHA256);
+}
+
+void
+ot_checksum_update (OtChecksum    *checksum,
+                    const guchar  *data,
+                    gsize          len)
+{
+  gsize n_blocks;
+
+  g_return_if_fail (!checksum->finished);
+
+  if (checksum->fallback)
+    {
+      g_checksum_update (checksum->fallback, data, len);
+      return;
+    }
+
+  checksum->length += len;
+
+  if (checksum->buf_len > 0)
+    {
+      gsize n = MIN (len, sizeof (checksum->buf) - checksum->buf_len);
+
+      memcpy (checksum->buf + checksum->buf_len, data, n);
+      checksum->buf_len += n;
+      data += n;
+      len -= n;
+      if (checksum->buf_len < sizeof (checksum->buf))
+        return;
+      sha256_blocks (checksum->state, checksum->buf, 1);
+      checksum->buf_len = 0;
+    }
+
+  /* Whole blocks straight from the caller's buffer */
+  n_blocks = len / 64;
+  if (n_blocks > 0)
+    {
+      sha256_blocks (checksum->state, data, n_blocks);
+      data += n_blocks * 64;
+      len -= n_blocks * 64;
+    }
+
+  memcpy (checksum->buf, data, len);
+  checksum->buf_len = len;
+}
+
+static void
+checksum_finish (OtChecksum *checksum)
+{
+  guint64 bit_length;
+  guint i;
+
+  if (checksum->fallback)
+    {
+      gsize len = sizeof (checksum->digest);
+      g_checksum_get_digest (checksum->fallback, checksum->digest, &len);
+      g_assert (len == sizeof (checksum->digest));
+      return;
+    }
+
+  checksum->buf[checksum->buf_len++] = 0x80;
+  if (checksum->buf_len > 56)
+    {
+      memset (checksum->buf + checksum->buf_len, 0, 64 - checksum->buf_len);
+      sha256_blocks (checksum->state, checksum->buf, 1);
+      checksum->buf_len = 0;
+    }
+  memset (checksum->buf + checksum->buf_len, 0, 56 - checksum->buf_len);
+  bit_length = GUINT64_TO_BE (checksum->length * 8);
+  memcpy (checksum->buf + 56, &bit_length, 8);
+  sha256_blocks (checksum->state, checksum->buf, 1);
+
+  for (i = 0; i < 8; i++)
+    {
+      guint32 v = GUINT32_TO_BE (checksum->state[i]);
+      memcpy (checksum->digest + i * 4, &v, 4);
+    }
+}
+
+/**
+ * ot_checksum_get_digest:
+ * @checksum:
+ * @out_digest: (out): 32 bytes
+ *
+ * After this, @checksum can't be updated any more.
+ */
+void
+ot_checksum_get_digest (OtChecksum *checksum,
+                        guchar     *out_digest)
+{
+  if (!checksum->finished)
+    {
+      checksum_finish (checksum);
+      checksum->finished = TRUE;
+    }
+  memcpy (out_digest, checksum->digest, sizeof (checksum->digest));
+}
+
+void
+ot_checksum_clear (OtChecksum *checksum)
+{
+  g_clear_pointer (&checksum->fallback, (GDestroyNotify) g_checksum_free);
+}
+
+/**
+ * ot_checksum_many:
+ * @n_buffers: Number of buffers
+ * @buffers: (array length=n_buffers): Data to checksum
+ * @lengths: (array length=n_buffers): Length of each buffer
+ * @out_digests: (out): 32 bytes for each buffer
+ *
+ * Checksum many small buffers, such as metadata objects, at once,
+ * without setting up a checksum for each.
+ */
+void
+ot_checksum_many (guint                  n_buffers,
+                  const guchar * const  *buffers,
+                  const gsize           *lengths,
+                  guchar                *out_digests)
+{
+  guint i;
+
+  if (use_sha_ni ())
+    {
+      for (i = 0; i < n_buffers; i++)
+        {
+          OtChecksum checksum;
+
+          ot_checksum_init (&checksum);
+          ot_checksum_update (&checksum, buffers[i], lengths[i]);
+          ot_checksum_get_digest (&checksum, out_digests + i * 32);
+        }
+    }
+  else
+    {
+      GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA256);
+
+      for (i = 0; i < n_buffers; i++)
+        {
+          gsize len = 32;
+
+          g_checksum_reset (checksum);
+          g_checksum_update (checksum, buffers[i], lengths[i]);
+          g_checksum_get_digest (checksum, out_digests + i * 32, &len);
+        }
+      g_checksum_free (checksum);
+    }
+}
+
 guchar *
-ot_csum_from_gchecksum (GChecksum  *checksum)
+ot_csum_from_checksum (OtChecksum  *checksum)
 {
   guchar *ret = g_malloc (32);
-  gsize len = 32;
-  
-  g_checksum_get_digest (checksum, ret, &len);
-  g_assert (len == 32);
+
+  ot_checksum_get_digest (checksum, ret);
   return ret;
 }
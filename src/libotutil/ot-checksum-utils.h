@@ -1,6 +1,6 @@
 /* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
  *
- * Copyright (C) 2011 Colin Walters <walters@verbum.org>.
+ * Copyright (C) 2011 Colin Walters <walters@verbum.org>
  *
  * This library is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public
@@ -27,7 +27,46 @@
 
 G_BEGIN_DECLS
 
-guchar *ot_csum_from_gchecksum (GChecksum *checksum);
+/* Good size for buffers read only to be checksummed */
+#define OT_CHECKSUM_BUFFER_SIZE (64 * 1024)
+
+/**
+ * OtChecksum:
+ *
+ * SHA-256 state, using the CPU's SHA extensions when it has them and
+ * GChecksum otherwise.  Allocate it anywhere, and pair
+ * ot_checksum_init() with ot_checksum_clear().
+ */
+typedef struct {
+  /*< private >*/
+  GChecksum *fallback;
+  guint32    state[8];
+  guint64    length;
+  guchar     buf[64];
+  guint      buf_len;
+  gboolean   finished;
+  guchar     digest[32];
+} OtChecksum;
+
+void         ot_checksum_init (OtChecksum *checksum);
+
+void         ot_checksum_update (OtChecksum    *checksum,
+                                 const guchar  *data,
+                                 gsize          len);
+
+void         ot_checksum_get_digest (OtChecksum *checksum,
+                                     guchar     *out_digest);
+
+void         ot_checksum_clear (OtChecksum *checksum);
+
+void         ot_checksum_many (guint                  n_buffers,
+                               const guchar * const  *buffers,
+                               const gsize           *lengths,
+                               guchar                *out_digests);
+
+const char * ot_checksum_get_implementation (void);
+
+guchar *ot_csum_from_checksum (OtChecksum *checksum);
 
 G_END_DECLS
 
@@ -254,7 +254,7 @@ ot_gio_write_update_checksum (GOutputStream  *out,
                               gconstpointer   data,
                               gsize           len,
                               gsize          *out_bytes_written,
-                              GChecksum      *checksum,
+                              OtChecksum     *checksum,
                               GCancellable   *cancellable,
                               GError        **error)
 {
@@ -272,8 +272,8 @@ ot_gio_write_update_checksum (GOutputStream  *out,
     }
 
   if (checksum)
-    g_checksum_update (checksum, data, len);
-  
+    ot_checksum_update (checksum, data, len);
+
   ret = TRUE;
  out:
   return ret;
@@ -282,21 +282,23 @@ ot_gio_write_update_checksum (GOutputStream  *out,
 gboolean
 ot_gio_splice_update_checksum (GOutputStream  *out,
                                GInputStream   *in,
-                               GChecksum      *checksum,
+                               OtChecksum     *checksum,
                                GCancellable   *cancellable,
                                GError        **error)
 {
   gboolean ret = FALSE;
+  ot_lfree char *buf = NULL;
 
   g_return_val_if_fail (out != NULL || checksum != NULL, FALSE);
 
   if (checksum != NULL)
     {
       gsize bytes_read, bytes_written;
-      char buf[4096];
+
+      buf = g_malloc (OT_CHECKSUM_BUFFER_SIZE);
       do
         {
-          if (!g_input_stream_read_all (in, buf, sizeof(buf), &bytes_read, cancellable, error))
+          if (!g_input_stream_read_all (in, buf, OT_CHECKSUM_BUFFER_SIZE, &bytes_read, cancellable, error))
             goto out;
           if (!ot_gio_write_update_checksum (out, buf, bytes_read, &bytes_written, checksum,
                                              cancellable, error))
@@ -323,20 +325,20 @@ ot_gio_splice_get_checksum (GOutputStream  *out,
                             GError        **error)
 {
   gboolean ret = FALSE;
-  GChecksum *checksum = NULL;
+  OtChecksum checksum;
   ot_lfree guchar *ret_csum = NULL;
 
-  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  ot_checksum_init (&checksum);
 
-  if (!ot_gio_splice_update_checksum (out, in, checksum, cancellable, error))
+  if (!ot_gio_splice_update_checksum (out, in, &checksum, cancellable, error))
     goto out;
 
-  ret_csum = ot_csum_from_gchecksum (checksum);
+  ret_csum = ot_csum_from_checksum (&checksum);
 
   ret = TRUE;
   ot_transfer_out_value (out_csum, &ret_csum);
  out:
-  g_clear_pointer (&checksum, (GDestroyNotify) g_checksum_free);
+  ot_checksum_clear (&checksum);
   return ret;
 }
 
@@ -485,3 +487,62 @@ ot_gio_shutil_cp_al_or_fallback (GFile         *src,
   return ret;
 }
 
+/**
+ * ot_gio_shutil_rm_rf:
+ * @path: Path to remove
+ * @cancellable:
+ * @error:
+ *
+ * Remove @path, recursively if it is a directory.  Symbolic links are
+ * not followed.  It is not an error if @path doesn't exist.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+ot_gio_shutil_rm_rf (GFile         *path,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFileEnumerator *enumerator = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  GError *temp_error = NULL;
+
+  if (unlink (ot_gfile_get_path_cached (path)) == 0 || errno == ENOENT)
+    return TRUE;
+  else if (errno != EISDIR && errno != EPERM)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  enumerator = g_file_enumerate_children (path, "standard::name",
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, error);
+  if (!enumerator)
+    goto out;
+
+  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+    {
+      ot_lobj GFile *child = g_file_get_child (path, g_file_info_get_name (file_info));
+
+      if (!ot_gio_shutil_rm_rf (child, cancellable, error))
+        goto out;
+      g_clear_object (&file_info);
+    }
+  if (temp_error)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
+
+  if (rmdir (ot_gfile_get_path_cached (path)) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
@@ -65,7 +65,7 @@ gboolean ot_gio_write_update_checksum (GOutputStream  *out,
                                        gconstpointer   data,
                                        gsize           len,
                                        gsize          *out_bytes_written,
-                                       GChecksum      *checksum,
+                                       OtChecksum     *checksum,
                                        GCancellable   *cancellable,
                                        GError        **error);
 
@@ -77,7 +77,7 @@ gboolean ot_gio_splice_get_checksum (GOutputStream  *out,
 
 gboolean ot_gio_splice_update_checksum (GOutputStream  *out,
                                         GInputStream   *in,
-                                        GChecksum      *checksum,
+                                        OtChecksum     *checksum,
                                         GCancellable   *cancellable,
                                         GError        **error);
 
@@ -101,6 +101,10 @@ gboolean ot_gio_shutil_cp_al_or_fallback (GFile         *src,
                                           GCancellable  *cancellable,
                                           GError       **error);
 
+gboolean ot_gio_shutil_rm_rf (GFile         *path,
+                              GCancellable  *cancellable,
+                              GError       **error);
+
 
 G_END_DECLS
 
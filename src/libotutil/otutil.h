@@ -36,12 +36,12 @@
   } G_STMT_END;
 
 #include <ot-local-alloc.h>
+#include <ot-checksum-utils.h>
 #include <ot-gio-utils.h>
 #include <ot-opt-utils.h>
 #include <ot-unix-utils.h>
 #include <ot-variant-utils.h>
 #include <ot-spawn-utils.h>
-#include <ot-checksum-utils.h>
 
 void ot_ptrarray_add_many (GPtrArray  *a, ...) G_GNUC_NULL_TERMINATED; 
 
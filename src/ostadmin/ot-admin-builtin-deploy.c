@@ -32,11 +32,13 @@ typedef struct {
 } OtAdminDeploy;
 
 static gboolean opt_no_kernel;
+static gboolean opt_incremental;
 static char *opt_ostree_dir;
 
 static GOptionEntry options[] = {
   { "ostree-dir", 0, 0, G_OPTION_ARG_STRING, &opt_ostree_dir, "Path to OSTree root directory", NULL },
   { "no-kernel", 0, 0, G_OPTION_ARG_NONE, &opt_no_kernel, "Don't update kernel related config (initramfs, bootloader)", NULL },
+  { "incremental", 0, 0, G_OPTION_ARG_NONE, &opt_incremental, "Build the new checkout from a hardlinked copy of the previous checkout of NAME", NULL },
   { NULL }
 };
 
@@ -72,6 +74,57 @@ update_current (const char         *deploy_target,
   return ret;
 }
 
+/*
+ * If @deploy_path is a symbolic link to a previous checkout made with
+ * --atomic-retarget, return that checkout and its commit.
+ */
+static gboolean
+find_previous_checkout (GFile             *deploy_path,
+                        GFile            **out_previous,
+                        char             **out_previous_commit,
+                        GCancellable      *cancellable,
+                        GError           **error)
+{
+  gboolean ret = FALSE;
+  const char *target;
+  const char *last_dash;
+  GError *temp_error = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lobj GFile *parent = NULL;
+  ot_lobj GFile *ret_previous = NULL;
+  ot_lfree char *ret_previous_commit = NULL;
+
+  file_info = g_file_query_info (deploy_path, OSTREE_GIO_FAST_QUERYINFO,
+                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                 cancellable, &temp_error);
+  if (!file_info)
+    {
+      if (g_error_matches (temp_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_clear_error (&temp_error);
+          ret = TRUE;
+        }
+      else
+        g_propagate_error (error, temp_error);
+      goto out;
+    }
+
+  target = g_file_info_get_symlink_target (file_info);
+  last_dash = target ? strrchr (target, '-') : NULL;
+  if (last_dash && ostree_validate_checksum_string (last_dash + 1, NULL))
+    {
+      parent = g_file_get_parent (deploy_path);
+      ret_previous = g_file_resolve_relative_path (parent, target);
+      ret_previous_commit = g_strdup (last_dash + 1);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_previous, &ret_previous);
+  ot_transfer_out_value (out_previous_commit, &ret_previous_commit);
+ out:
+  return ret;
+}
+
 static gboolean
 do_checkout (OtAdminDeploy     *self,
              const char        *deploy_target,
@@ -86,6 +139,10 @@ do_checkout (OtAdminDeploy     *self,
   ot_lfree char *repo_path = NULL;
   ot_lfree char *repo_arg = NULL;
   ot_lptrarray GPtrArray *checkout_args = NULL;
+  ot_lobj GFile *previous = NULL;
+  ot_lfree char *previous_commit = NULL;
+  ot_lfree char *reference_arg = NULL;
+  ot_lfree char *reference_commit_arg = NULL;
 
   repo_path = g_build_filename (opt_ostree_dir, "repo", NULL);
   repo_arg = g_strconcat ("--repo=", repo_path, NULL);
@@ -97,7 +154,23 @@ do_checkout (OtAdminDeploy     *self,
 
   checkout_args = g_ptr_array_new ();
   ot_ptrarray_add_many (checkout_args, "ostree", repo_arg,
-                        "checkout", "--atomic-retarget", revision ? revision : deploy_target,
+                        "checkout", "--atomic-retarget", NULL);
+  if (opt_incremental)
+    g_ptr_array_add (checkout_args, "--incremental");
+  else
+    {
+      /* Most of a new deployment is usually the same as the previous one */
+      if (!find_previous_checkout (deploy_path, &previous, &previous_commit,
+                                   cancellable, error))
+        goto out;
+      if (previous && g_file_query_exists (previous, cancellable))
+        {
+          reference_arg = g_strconcat ("--reference=", ot_gfile_get_path_cached (previous), NULL);
+          reference_commit_arg = g_strconcat ("--reference-commit=", previous_commit, NULL);
+          ot_ptrarray_add_many (checkout_args, reference_arg, reference_commit_arg, NULL);
+        }
+    }
+  ot_ptrarray_add_many (checkout_args, revision ? revision : deploy_target,
                         ot_gfile_get_path_cached (deploy_path), NULL);
   g_ptr_array_add (checkout_args, NULL);
 
@@ -46,6 +46,13 @@ typedef struct {
 
   guint64 content_length;
 
+  /* Validators sent with the request, and those in the response */
+  char *if_none_match;
+  char *if_modified_since;
+  gboolean not_modified;
+  char *etag;
+  char *last_modified;
+
   GCancellable *cancellable;
   GSimpleAsyncResult *result;
 } OstreeFetcherPendingURI;
@@ -65,6 +72,10 @@ pending_uri_free (OstreeFetcherPendingURI *pending)
   g_clear_object (&pending->request_body);
   g_clear_object (&pending->out_stream);
   g_clear_object (&pending->cancellable);
+  g_free (pending->if_none_match);
+  g_free (pending->if_modified_since);
+  g_free (pending->etag);
+  g_free (pending->last_modified);
   g_free (pending);
 }
 
@@ -187,19 +198,32 @@ on_request_sent (GObject        *object,
 {
   OstreeFetcherPendingURI *pending = user_data;
   GError *local_error = NULL;
+  ot_lobj SoupMessage *msg = NULL;
 
   pending->request_body = soup_request_send_finish ((SoupRequest*) object,
                                                    result, &local_error);
+  msg = soup_request_http_get_message ((SoupRequestHTTP*)pending->request);
   if (!pending->request_body)
     {
       pending->state = OSTREE_FETCHER_STATE_COMPLETE;
       g_simple_async_result_take_error (pending->result, local_error);
       g_simple_async_result_complete (pending->result);
     }
+  else if (msg->status_code == SOUP_STATUS_NOT_MODIFIED)
+    {
+      pending->state = OSTREE_FETCHER_STATE_COMPLETE;
+      pending->not_modified = TRUE;
+      (void) g_input_stream_close (pending->request_body, NULL, NULL);
+      g_simple_async_result_complete (pending->result);
+    }
   else
     {
       GOutputStreamSpliceFlags flags = G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET;
 
+      pending->etag = g_strdup (soup_message_headers_get_one (msg->response_headers, "ETag"));
+      pending->last_modified = g_strdup (soup_message_headers_get_one (msg->response_headers,
+                                                                       "Last-Modified"));
+
       pending->state = OSTREE_FETCHER_STATE_DOWNLOADING;
 
       pending->content_length = soup_request_get_content_length (pending->request);
@@ -227,9 +251,32 @@ ostree_fetcher_request_uri_async (OstreeFetcher         *self,
                                   GCancellable          *cancellable,
                                   GAsyncReadyCallback    callback,
                                   gpointer               user_data)
+{
+  ostree_fetcher_request_uri_with_validators_async (self, uri, NULL, NULL,
+                                                    cancellable, callback, user_data);
+}
+
+/**
+ * ostree_fetcher_request_uri_with_validators_async:
+ * @etag: (allow-none): Sent as If-None-Match
+ * @last_modified: (allow-none): Sent as If-Modified-Since
+ *
+ * Like ostree_fetcher_request_uri_async(), but make the request
+ * conditional on the resource having changed.  Complete with
+ * ostree_fetcher_request_uri_with_validators_finish().
+ */
+void
+ostree_fetcher_request_uri_with_validators_async (OstreeFetcher         *self,
+                                                  SoupURI               *uri,
+                                                  const char            *etag,
+                                                  const char            *last_modified,
+                                                  GCancellable          *cancellable,
+                                                  GAsyncReadyCallback    callback,
+                                                  gpointer               user_data)
 {
   OstreeFetcherPendingURI *pending;
   GError *local_error = NULL;
+  SoupMessage *msg;
 
   pending = g_new0 (OstreeFetcherPendingURI, 1);
   pending->refcount = 1;
@@ -239,10 +286,15 @@ ostree_fetcher_request_uri_async (OstreeFetcher         *self,
   pending->request = soup_requester_request_uri (self->requester, uri, &local_error);
   g_assert_no_error (local_error);
 
+  msg = soup_request_http_get_message ((SoupRequestHTTP*)pending->request);
+  if (etag)
+    soup_message_headers_replace (msg->request_headers, "If-None-Match", etag);
+  if (last_modified)
+    soup_message_headers_replace (msg->request_headers, "If-Modified-Since", last_modified);
+
   pending->refcount++;
-  g_hash_table_insert (self->message_to_request,
-                       soup_request_http_get_message ((SoupRequestHTTP*)pending->request),
-                       pending);
+  /* Transfers the message reference */
+  g_hash_table_insert (self->message_to_request, msg, pending);
 
   pending->result = g_simple_async_result_new ((GObject*) self,
                                                callback, user_data,
@@ -272,6 +324,47 @@ ostree_fetcher_request_uri_finish (OstreeFetcher         *self,
   return g_object_ref (pending->tmpfile);
 }
 
+/**
+ * ostree_fetcher_request_uri_with_validators_finish:
+ * @out_not_modified: Set if the server replied 304 Not Modified
+ * @out_etag: (allow-none): ETag of the response
+ * @out_last_modified: (allow-none): Last-Modified of the response
+ *
+ * Returns: The downloaded file, or %NULL on error or if the resource
+ * was not modified.
+ */
+GFile *
+ostree_fetcher_request_uri_with_validators_finish (OstreeFetcher         *self,
+                                                   GAsyncResult          *result,
+                                                   gboolean              *out_not_modified,
+                                                   char                 **out_etag,
+                                                   char                 **out_last_modified,
+                                                   GError               **error)
+{
+  GSimpleAsyncResult *simple;
+  OstreeFetcherPendingURI *pending;
+
+  g_return_val_if_fail (g_simple_async_result_is_valid (result, (GObject*)self, ostree_fetcher_request_uri_async), FALSE);
+
+  *out_not_modified = FALSE;
+  simple = G_SIMPLE_ASYNC_RESULT (result);
+  if (g_simple_async_result_propagate_error (simple, error))
+    return NULL;
+  pending = g_simple_async_result_get_op_res_gpointer (simple);
+
+  if (out_etag)
+    *out_etag = g_strdup (pending->etag);
+  if (out_last_modified)
+    *out_last_modified = g_strdup (pending->last_modified);
+
+  if (pending->not_modified)
+    {
+      *out_not_modified = TRUE;
+      return NULL;
+    }
+  return g_object_ref (pending->tmpfile);
+}
+
 static char *
 format_size_pair (guint64 start,
                   guint64 max)
@@ -61,6 +61,21 @@ GFile *ostree_fetcher_request_uri_finish (OstreeFetcher         *self,
                                           GAsyncResult          *result,
                                           GError               **error);
 
+void ostree_fetcher_request_uri_with_validators_async (OstreeFetcher         *self,
+                                                       SoupURI               *uri,
+                                                       const char            *etag,
+                                                       const char            *last_modified,
+                                                       GCancellable          *cancellable,
+                                                       GAsyncReadyCallback    callback,
+                                                       gpointer               user_data);
+
+GFile *ostree_fetcher_request_uri_with_validators_finish (OstreeFetcher         *self,
+                                                          GAsyncResult          *result,
+                                                          gboolean              *out_not_modified,
+                                                          char                 **out_etag,
+                                                          char                 **out_last_modified,
+                                                          GError               **error);
+
 G_END_DECLS
 
 #endif
@@ -88,12 +88,27 @@ typedef struct {
 
   GHashTable   *file_checksums_to_fetch;
 
+  /* Ref path -> validators (strv of ETag, Last-Modified), saved once
+   * the refs are written.
+   */
+  GHashTable   *ref_validators;
+
+  /* Binary refs summary, or %NULL if the remote has none */
+  gboolean      fetched_refs_summary;
+  GVariant     *refs_summary;
+
   GMainLoop    *loop;
 
   /* Used in meta fetch phase */
   guint         outstanding_uri_requests;
   guint         outstanding_meta_requests;
 
+  /* Used while fetching pack indexes */
+  GQueue        pack_indexes_to_fetch;
+  guint         outstanding_pack_index_requests;
+  guint         n_pack_indexes_fetched;
+  guint         n_pack_indexes_total;
+
   /* Used in content fetch phase */
   guint         outstanding_filemeta_requests;
   guint         outstanding_filecontent_requests;
@@ -154,6 +169,11 @@ uri_fetch_update_status (gpointer user_data)
  
   status = g_string_new ("");
 
+  if (pull_data->n_pack_indexes_fetched < pull_data->n_pack_indexes_total)
+    g_string_append_printf (status, "%u/%u pack indexes fetched; ",
+                            pull_data->n_pack_indexes_fetched,
+                            pull_data->n_pack_indexes_total);
+
   if (pull_data->loose_files != NULL)
     g_string_append_printf (status, "%u loose files to fetch: ",
                             g_hash_table_size (pull_data->loose_files)
@@ -190,6 +210,7 @@ check_outstanding_requests_handle_error (OtPullData          *pull_data,
 {
   if (pull_data->outstanding_uri_requests == 0 &&
       pull_data->outstanding_meta_requests == 0 &&
+      pull_data->outstanding_pack_index_requests == 0 &&
       pull_data->outstanding_filemeta_requests == 0 &&
       pull_data->outstanding_filecontent_requests == 0 &&
       pull_data->outstanding_checksum_requests == 0 &&
@@ -288,6 +309,138 @@ fetch_uri (OtPullData  *pull_data,
   return ret;
 }
 
+typedef struct {
+  OtPullData     *pull_data;
+  GFile          *result_file;
+  gboolean        not_modified;
+  char           *etag;
+  char           *last_modified;
+} OstreeFetchUriConditionalData;
+
+static void
+uri_fetch_conditional_on_complete (GObject        *object,
+                                   GAsyncResult   *result,
+                                   gpointer        user_data) 
+{
+  OstreeFetchUriConditionalData *data = user_data;
+  GError *local_error = NULL;
+
+  data->result_file = ostree_fetcher_request_uri_with_validators_finish ((OstreeFetcher*)object,
+                                                                         result,
+                                                                         &data->not_modified,
+                                                                         &data->etag,
+                                                                         &data->last_modified,
+                                                                         &local_error);
+  data->pull_data->outstanding_uri_requests--;
+  check_outstanding_requests_handle_error (data->pull_data, local_error);
+}
+
+/*
+ * Fetch @path relative to the base URI, unless it is unchanged since
+ * the validators saved for it were recorded; then the file and
+ * validators outputs are %NULL.  Otherwise the validators of the
+ * response are returned as a strv of ETag, Last-Modified and an empty
+ * contents string, for the caller to fill in and save with
+ * save_validators() once it has processed the response.
+ *
+ * If @out_cached_contents is given, validators are only sent when
+ * contents were saved with them, and those are returned on a 304.
+ */
+static gboolean
+fetch_uri_conditional (OtPullData  *pull_data,
+                       const char  *path,
+                       gboolean     use_validators,
+                       GFile      **out_temp_filename,
+                       char      ***out_validators,
+                       char       **out_cached_contents,
+                       GCancellable  *cancellable,
+                       GError     **error)
+{
+  gboolean ret = FALSE;
+  ot_lfree char *uri_string = NULL;
+  ot_lfree char *etag = NULL;
+  ot_lfree char *last_modified = NULL;
+  ot_lfree char *cached_contents = NULL;
+  OstreeFetchUriConditionalData fetch_data;
+  SoupURI *uri = NULL;
+  char **ret_validators = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  memset (&fetch_data, 0, sizeof (fetch_data));
+  fetch_data.pull_data = pull_data;
+
+  if (use_validators)
+    {
+      if (!ostree_repo_get_remote_cache_validators (pull_data->repo, pull_data->remote_name,
+                                                    path, &etag, &last_modified,
+                                                    out_cached_contents ? &cached_contents : NULL,
+                                                    cancellable, error))
+        goto out;
+
+      if (out_cached_contents && !cached_contents)
+        {
+          g_clear_pointer (&etag, g_free);
+          g_clear_pointer (&last_modified, g_free);
+        }
+    }
+
+  uri = suburi_new (pull_data->base_uri, path, NULL);
+  uri_string = soup_uri_to_string (uri, FALSE);
+  g_print ("Fetching %s\n", uri_string);
+
+  pull_data->outstanding_uri_requests++;
+  ostree_fetcher_request_uri_with_validators_async (pull_data->fetcher, uri, etag, last_modified,
+                                                    cancellable, uri_fetch_conditional_on_complete,
+                                                    &fetch_data);
+
+  run_mainloop_monitor_fetcher (pull_data);
+
+  if (pull_data->caught_error)
+    goto out;
+
+  if (fetch_data.result_file)
+    {
+      ret_validators = g_new0 (char *, 4);
+      ret_validators[0] = g_strdup (fetch_data.etag ? fetch_data.etag : "");
+      ret_validators[1] = g_strdup (fetch_data.last_modified ? fetch_data.last_modified : "");
+      ret_validators[2] = g_strdup ("");
+      g_clear_pointer (&cached_contents, g_free);
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_temp_filename, &fetch_data.result_file);
+  ot_transfer_out_value (out_validators, &ret_validators);
+  ot_transfer_out_value (out_cached_contents, &cached_contents);
+ out:
+  g_clear_object (&fetch_data.result_file);
+  g_free (fetch_data.etag);
+  g_free (fetch_data.last_modified);
+  g_strfreev (ret_validators);
+  if (uri)
+    soup_uri_free (uri);
+  return ret;
+}
+
+static gboolean
+save_validators (OtPullData    *pull_data,
+                 const char    *path,
+                 char         **validators,
+                 GCancellable  *cancellable,
+                 GError       **error)
+{
+  const char *etag = validators[0];
+  const char *last_modified = validators[1];
+  const char *contents = validators[2];
+
+  return ostree_repo_set_remote_cache_validators (pull_data->repo, pull_data->remote_name, path,
+                                                  *etag ? etag : NULL,
+                                                  *last_modified ? last_modified : NULL,
+                                                  *contents ? contents : NULL,
+                                                  cancellable, error);
+}
+
 static gboolean
 fetch_uri_contents_utf8 (OtPullData  *pull_data,
                          SoupURI     *uri,
@@ -449,42 +602,100 @@ find_object_in_remote_packs (OtPullData       *pull_data,
   return ret;
 }
 
-static gboolean
-fetch_one_cache_index (OtPullData           *pull_data,
-                       const char           *pack_checksum,
-                       gboolean              is_meta,
-                       GCancellable         *cancellable,
-                       GError              **error)
+/* Maximum number of pack index requests in flight */
+#define OT_PULL_MAX_PACK_INDEX_REQUESTS (8)
+
+typedef struct {
+  OtPullData  *pull_data;
+  char        *pack_checksum;
+  gboolean     is_meta;
+} OtFetchPackIndexData;
+
+static void
+destroy_fetch_pack_index_data (OtFetchPackIndexData *data)
 {
-  gboolean ret = FALSE;
+  g_free (data->pack_checksum);
+  g_free (data);
+}
+
+static void
+enqueue_pack_index_requests (OtPullData *pull_data);
+
+static void
+pack_index_fetch_on_complete (GObject        *object,
+                              GAsyncResult   *result,
+                              gpointer        user_data) 
+{
+  OtFetchPackIndexData *data = user_data;
+  OtPullData *pull_data = data->pull_data;
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  GCancellable *cancellable = NULL;
   ot_lobj GFile *tmp_path = NULL;
-  ot_lfree char *pack_index_name = NULL;
-  SoupURI *index_uri = NULL;
 
-  pack_index_name = ostree_get_pack_index_name (is_meta, pack_checksum);
-  index_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_index_name, NULL);
-  
-  if (!fetch_uri (pull_data, index_uri, "packindex-", &tmp_path,
-                  cancellable, error))
+  tmp_path = ostree_fetcher_request_uri_finish ((OstreeFetcher*)object, result, error);
+  if (!tmp_path)
     goto out;
-  
+
+  /* Indexes are validated and added to the cache as they arrive */
   if (!ostree_repo_add_cached_remote_pack_index (pull_data->repo, pull_data->remote_name,
-                                                 pack_checksum, is_meta, tmp_path,
+                                                 data->pack_checksum, data->is_meta, tmp_path,
                                                  cancellable, error))
     goto out;
-  
-  if (!ot_gfile_unlink (tmp_path, cancellable, error))
-    goto out;
-      
-  g_clear_object (&tmp_path);
 
-  ret = TRUE;
+  pull_data->n_pack_indexes_fetched++;
+
  out:
   if (tmp_path != NULL)
     (void) ot_gfile_unlink (tmp_path, NULL, NULL);
-  if (index_uri)
-    soup_uri_free (index_uri);
-  return ret;
+  pull_data->outstanding_pack_index_requests--;
+  if (local_error == NULL && !pull_data->caught_error)
+    enqueue_pack_index_requests (pull_data);
+  else
+    {
+      /* Let the outstanding requests drain */
+      g_queue_foreach (&pull_data->pack_indexes_to_fetch,
+                       (GFunc)destroy_fetch_pack_index_data, NULL);
+      g_queue_clear (&pull_data->pack_indexes_to_fetch);
+    }
+  check_outstanding_requests_handle_error (pull_data, local_error);
+  destroy_fetch_pack_index_data (data);
+}
+
+static void
+enqueue_pack_index_requests (OtPullData *pull_data)
+{
+  GCancellable *cancellable = NULL;
+
+  while (pull_data->outstanding_pack_index_requests < OT_PULL_MAX_PACK_INDEX_REQUESTS
+         && !g_queue_is_empty (&pull_data->pack_indexes_to_fetch))
+    {
+      OtFetchPackIndexData *data = g_queue_pop_head (&pull_data->pack_indexes_to_fetch);
+      ot_lfree char *pack_index_name = NULL;
+      SoupURI *index_uri;
+
+      pack_index_name = ostree_get_pack_index_name (data->is_meta, data->pack_checksum);
+      index_uri = suburi_new (pull_data->base_uri, "objects", "pack", pack_index_name, NULL);
+
+      pull_data->outstanding_pack_index_requests++;
+      ostree_fetcher_request_uri_async (pull_data->fetcher, index_uri, cancellable,
+                                        pack_index_fetch_on_complete, data);
+      soup_uri_free (index_uri);
+    }
+}
+
+static void
+queue_pack_index_fetch (OtPullData  *pull_data,
+                        const char  *pack_checksum,
+                        gboolean     is_meta)
+{
+  OtFetchPackIndexData *data = g_new0 (OtFetchPackIndexData, 1);
+
+  data->pull_data = pull_data;
+  data->pack_checksum = g_strdup (pack_checksum);
+  data->is_meta = is_meta;
+  g_queue_push_tail (&pull_data->pack_indexes_to_fetch, data);
+  pull_data->n_pack_indexes_total++;
 }
 
 static gboolean
@@ -494,30 +705,50 @@ fetch_and_cache_pack_indexes (OtPullData        *pull_data,
 {
   gboolean ret = FALSE;
   guint i;
+  const char *superindex_path = "objects/pack/index";
   ot_lobj GFile *superindex_tmppath = NULL;
   ot_lptrarray GPtrArray *cached_meta_indexes = NULL;
   ot_lptrarray GPtrArray *cached_data_indexes = NULL;
   ot_lptrarray GPtrArray *uncached_meta_indexes = NULL;
   ot_lptrarray GPtrArray *uncached_data_indexes = NULL;
-  ot_lvariant GVariant *superindex_variant = NULL;
-  GVariantIter *contents_iter = NULL;
-  SoupURI *superindex_uri = NULL;
+  char **validators = NULL;
 
-  superindex_uri = suburi_new (pull_data->base_uri, "objects", "pack", "index", NULL);
-  
-  if (!fetch_uri (pull_data, superindex_uri, "index-",
-                  &superindex_tmppath, cancellable, error))
+  /* Validators are only saved once every index the superindex
+   * references is cached, so a 304 means the cache is complete.
+   */
+  if (!ostree_repo_list_cached_remote_pack_indexes (pull_data->repo, pull_data->remote_name,
+                                                    &cached_meta_indexes, &cached_data_indexes,
+                                                    cancellable, error))
     goto out;
 
-  if (!ostree_repo_resync_cached_remote_pack_indexes (pull_data->repo, pull_data->remote_name,
-                                                      superindex_tmppath,
-                                                      &cached_meta_indexes,
-                                                      &cached_data_indexes,
-                                                      &uncached_meta_indexes,
-                                                      &uncached_data_indexes,
-                                                      cancellable, error))
+  if (!fetch_uri_conditional (pull_data, superindex_path, cached_meta_indexes != NULL,
+                              &superindex_tmppath, &validators, NULL, cancellable, error))
     goto out;
 
+  if (!superindex_tmppath)
+    {
+      g_print ("No changes in pack index\n");
+    }
+  else
+    {
+      g_clear_pointer (&cached_meta_indexes, (GDestroyNotify) g_ptr_array_unref);
+      g_clear_pointer (&cached_data_indexes, (GDestroyNotify) g_ptr_array_unref);
+
+      if (!ostree_repo_set_remote_cache_validators (pull_data->repo, pull_data->remote_name,
+                                                    superindex_path, NULL, NULL, NULL,
+                                                    cancellable, error))
+        goto out;
+
+      if (!ostree_repo_resync_cached_remote_pack_indexes (pull_data->repo, pull_data->remote_name,
+                                                          superindex_tmppath,
+                                                          &cached_meta_indexes,
+                                                          &cached_data_indexes,
+                                                          &uncached_meta_indexes,
+                                                          &uncached_data_indexes,
+                                                          cancellable, error))
+        goto out;
+    }
+
   for (i = 0; i < cached_meta_indexes->len; i++)
     g_ptr_array_add (pull_data->cached_meta_pack_indexes,
                      g_strdup (cached_meta_indexes->pdata[i]));
@@ -525,27 +756,42 @@ fetch_and_cache_pack_indexes (OtPullData        *pull_data,
     g_ptr_array_add (pull_data->cached_data_pack_indexes,
                      g_strdup (cached_data_indexes->pdata[i]));
 
-  for (i = 0; i < uncached_meta_indexes->len; i++)
+  if (!superindex_tmppath)
     {
-      const char *pack_checksum = uncached_meta_indexes->pdata[i];
-      if (!fetch_one_cache_index (pull_data, pack_checksum, TRUE, cancellable, error))
-        goto out;
-      g_ptr_array_add (pull_data->cached_meta_pack_indexes, g_strdup (pack_checksum));
+      ret = TRUE;
+      goto out;
     }
+
+  for (i = 0; i < uncached_meta_indexes->len; i++)
+    queue_pack_index_fetch (pull_data, uncached_meta_indexes->pdata[i], TRUE);
   for (i = 0; i < uncached_data_indexes->len; i++)
+    queue_pack_index_fetch (pull_data, uncached_data_indexes->pdata[i], FALSE);
+
+  if (pull_data->n_pack_indexes_total > 0)
     {
-      const char *pack_checksum = uncached_data_indexes->pdata[i];
-      if (!fetch_one_cache_index (pull_data, pack_checksum, FALSE, cancellable, error))
+      g_print ("Fetching %u pack indexes\n", pull_data->n_pack_indexes_total);
+      enqueue_pack_index_requests (pull_data);
+      run_mainloop_monitor_fetcher (pull_data);
+      if (pull_data->caught_error)
         goto out;
-      g_ptr_array_add (pull_data->cached_data_pack_indexes, g_strdup (pack_checksum));
     }
 
+  /* Keep the superindex order regardless of completion order */
+  for (i = 0; i < uncached_meta_indexes->len; i++)
+    g_ptr_array_add (pull_data->cached_meta_pack_indexes,
+                     g_strdup (uncached_meta_indexes->pdata[i]));
+  for (i = 0; i < uncached_data_indexes->len; i++)
+    g_ptr_array_add (pull_data->cached_data_pack_indexes,
+                     g_strdup (uncached_data_indexes->pdata[i]));
+
+  if (!save_validators (pull_data, superindex_path, validators, cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
-  if (superindex_uri)
-    soup_uri_free (superindex_uri);
-  if (contents_iter)
-    g_variant_iter_free (contents_iter);
+  if (superindex_tmppath)
+    (void) ot_gfile_unlink (superindex_tmppath, NULL, NULL);
+  g_strfreev (validators);
   return ret;
 }
 
@@ -903,6 +1149,71 @@ fetch_and_store_commit_metadata_recurse (OtPullData   *pull_data,
   return ret;
 }
 
+/*
+ * Fetch the binary refs summary once, revalidating the cached copy
+ * if there is one, so that all refs resolve from a single request.
+ * Older servers don't publish it; then refs_summary stays %NULL and
+ * each ref is fetched on its own.
+ */
+static gboolean
+ensure_refs_summary (OtPullData    *pull_data,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  gboolean ret = FALSE;
+  const char *summary_path = "refs/summary.v";
+  GError *temp_error = NULL;
+  ot_lobj GFile *tmpf = NULL;
+  ot_lvariant GVariant *cached_summary = NULL;
+  char **validators = NULL;
+
+  if (pull_data->fetched_refs_summary)
+    return TRUE;
+
+  if (!ostree_repo_load_cached_remote_refs_summary (pull_data->repo, pull_data->remote_name,
+                                                    &cached_summary, cancellable, error))
+    goto out;
+
+  if (!fetch_uri_conditional (pull_data, summary_path, cached_summary != NULL,
+                              &tmpf, &validators, NULL, cancellable, error))
+    goto out;
+
+  if (!tmpf)
+    {
+      g_print ("No changes in refs summary\n");
+      pull_data->refs_summary = g_variant_ref (cached_summary);
+    }
+  else
+    {
+      /* The server may answer with an error page for a missing file */
+      if (!ostree_repo_take_cached_remote_refs_summary (pull_data->repo, pull_data->remote_name,
+                                                        tmpf, cancellable, &temp_error))
+        {
+          if (verbose)
+            g_print ("No binary refs summary: %s\n", temp_error->message);
+          g_clear_error (&temp_error);
+        }
+      else
+        {
+          if (!save_validators (pull_data, summary_path, validators, cancellable, error))
+            goto out;
+          if (!ostree_repo_load_cached_remote_refs_summary (pull_data->repo, pull_data->remote_name,
+                                                            &pull_data->refs_summary,
+                                                            cancellable, error))
+            goto out;
+        }
+    }
+
+  pull_data->fetched_refs_summary = TRUE;
+
+  ret = TRUE;
+ out:
+  if (tmpf)
+    (void) unlink (ot_gfile_get_path_cached (tmpf));
+  g_strfreev (validators);
+  return ret;
+}
+
 static gboolean
 fetch_ref_contents (OtPullData    *pull_data,
                     const char    *ref,
@@ -912,14 +1223,55 @@ fetch_ref_contents (OtPullData    *pull_data,
 {
   gboolean ret = FALSE;
   ot_lfree char *ret_contents = NULL;
-  SoupURI *target_uri = NULL;
+  ot_lfree char *path = NULL;
+  ot_lobj GFile *tmpf = NULL;
+  char **validators = NULL;
+  gsize len;
 
-  target_uri = suburi_new (pull_data->base_uri, "refs", "heads", ref, NULL);
-  
-  if (!fetch_uri_contents_utf8 (pull_data, target_uri, &ret_contents, cancellable, error))
+  if (!ensure_refs_summary (pull_data, cancellable, error))
     goto out;
 
-  g_strchomp (ret_contents);
+  if (pull_data->refs_summary)
+    {
+      if (!ostree_refs_summary_lookup (pull_data->refs_summary, ref, &ret_contents, NULL, NULL))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                       "No such branch '%s' in remote %s", ref, pull_data->remote_name);
+          goto out;
+        }
+      ret = TRUE;
+      ot_transfer_out_value (out_contents, &ret_contents);
+      goto out;
+    }
+
+  /* On a 304, use the checksum fetched along with the validators;
+   * the local remote ref may have been changed since.
+   */
+  path = g_build_filename ("refs", "heads", ref, NULL);
+  if (!fetch_uri_conditional (pull_data, path, TRUE,
+                              &tmpf, &validators, &ret_contents, cancellable, error))
+    goto out;
+
+  if (tmpf)
+    {
+      if (!g_file_load_contents (tmpf, cancellable, &ret_contents, &len, NULL, error))
+        goto out;
+
+      if (!g_utf8_validate (ret_contents, -1, NULL))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Invalid UTF-8");
+          goto out;
+        }
+
+      g_strchomp (ret_contents);
+
+      /* Saved once the ref has been updated */
+      g_free (validators[2]);
+      validators[2] = g_strdup (ret_contents);
+      g_hash_table_replace (pull_data->ref_validators, g_strdup (path), validators);
+      validators = NULL;
+    }
 
   if (!ostree_validate_checksum_string (ret_contents, error))
     goto out;
@@ -927,8 +1279,9 @@ fetch_ref_contents (OtPullData    *pull_data,
   ret = TRUE;
   ot_transfer_out_value (out_contents, &ret_contents);
  out:
-  if (target_uri)
-    soup_uri_free (target_uri);
+  if (tmpf)
+    (void) unlink (ot_gfile_get_path_cached (tmpf));
+  g_strfreev (validators);
   return ret;
 }
 
@@ -1492,6 +1845,8 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
       goto out;
     }
 
+  pull_data->ref_validators = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, (GDestroyNotify)g_strfreev);
   requested_refs_to_fetch = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   updated_refs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
   commits_to_fetch = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
@@ -1541,6 +1896,29 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
         fetch_all_refs = FALSE;
 
       if (fetch_all_refs)
+        {
+          if (!ensure_refs_summary (pull_data, cancellable, error))
+            goto out;
+        }
+
+      if (fetch_all_refs && pull_data->refs_summary)
+        {
+          ot_lvariant GVariant *refs = NULL;
+          gsize j, n;
+
+          refs = g_variant_get_child_value (pull_data->refs_summary, 2);
+          n = g_variant_n_children (refs);
+          for (j = 0; j < n; j++)
+            {
+              const char *ref;
+              ot_lvariant GVariant *csum_v = NULL;
+
+              g_variant_get_child (refs, j, "(&s@aytt)", &ref, &csum_v, NULL, NULL);
+              g_hash_table_insert (requested_refs_to_fetch, g_strdup (ref),
+                                   ostree_checksum_from_bytes_v (csum_v));
+            }
+        }
+      else if (fetch_all_refs)
         {
           summary_uri = soup_uri_copy (pull_data->base_uri);
           path = g_build_filename (soup_uri_get_path (summary_uri), "refs", "summary", NULL);
@@ -1643,6 +2021,13 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
       g_print ("remote %s is now %s\n", remote_ref, checksum);
     }
 
+  g_hash_table_iter_init (&hash_iter, pull_data->ref_validators);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      if (!save_validators (pull_data, key, value, cancellable, error))
+        goto out;
+    }
+
   if (!ostree_repo_clean_cached_remote_pack_data (pull_data->repo, pull_data->remote_name,
                                                   cancellable, error))
     goto out;
@@ -1665,6 +2050,8 @@ ostree_builtin_pull (int argc, char **argv, GFile *repo_path, GError **error)
   if (pull_data->base_uri)
     soup_uri_free (pull_data->base_uri);
   g_clear_pointer (&pull_data->file_checksums_to_fetch, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->ref_validators, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&pull_data->refs_summary, (GDestroyNotify) g_variant_unref);
   g_clear_pointer (&pull_data->cached_meta_pack_indexes, (GDestroyNotify) g_ptr_array_unref);
   g_clear_pointer (&pull_data->cached_data_pack_indexes, (GDestroyNotify) g_ptr_array_unref);
   if (summary_uri)
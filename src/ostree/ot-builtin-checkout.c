@@ -36,6 +36,14 @@ static char *opt_subpath;
 static gboolean opt_union;
 static gboolean opt_from_stdin;
 static char *opt_from_file;
+static char *opt_stat_cache;
+static gboolean opt_show_methods;
+static gboolean opt_incremental;
+static char *opt_incremental_from;
+static char *opt_reference;
+static char *opt_reference_commit;
+
+static OstreeStatCache *stat_cache;
 
 static GOptionEntry options[] = {
   { "user-mode", 'U', 0, G_OPTION_ARG_NONE, &opt_user_mode, "Do not change file ownership or initialize extended attributes", NULL },
@@ -45,6 +53,12 @@ static GOptionEntry options[] = {
   { "no-triggers", 0, 0, G_OPTION_ARG_NONE, &opt_no_triggers, "Don't run triggers", NULL },
   { "from-stdin", 0, 0, G_OPTION_ARG_NONE, &opt_from_stdin, "Process many checkouts from standard input", NULL },
   { "from-file", 0, 0, G_OPTION_ARG_STRING, &opt_from_file, "Process many checkouts from input file", NULL },
+  { "stat-cache", 0, 0, G_OPTION_ARG_STRING, &opt_stat_cache, "Record checked out files in stat cache FILE, for use by diff", "FILE" },
+  { "show-methods", 0, 0, G_OPTION_ARG_NONE, &opt_show_methods, "Print how many files were hardlinked, reflinked or copied", NULL },
+  { "incremental", 0, 0, G_OPTION_ARG_NONE, &opt_incremental, "With --atomic-retarget, update a hardlinked copy of the previous checkout", NULL },
+  { "incremental-from", 0, 0, G_OPTION_ARG_STRING, &opt_incremental_from, "Update DESTINATION in place, assuming it holds a checkout of REV", "REV" },
+  { "reference", 0, 0, G_OPTION_ARG_STRING, &opt_reference, "Hardlink unchanged files from the unmodified checkout DIR", "DIR" },
+  { "reference-commit", 0, 0, G_OPTION_ARG_STRING, &opt_reference_commit, "Commit the --reference checkout was made from", "REV" },
   { NULL }
 };
 
@@ -124,6 +138,101 @@ parse_commit_from_symlink (GFile        *symlink,
   return ret;
 }
 
+/*
+ * Recreate the directory @src as @dest, which must not exist,
+ * hardlinking everything that isn't a directory.  Directories get the
+ * mode of the originals, and unless @user_mode, their ownership and
+ * xattrs.
+ */
+static gboolean
+clone_tree_hardlinked (GFile          *src,
+                       GFile          *dest,
+                       gboolean        user_mode,
+                       GCancellable   *cancellable,
+                       GError        **error)
+{
+  gboolean ret = FALSE;
+  const char *dest_path = ot_gfile_get_path_cached (dest);
+  GError *temp_error = NULL;
+  guint32 mode;
+  ot_lobj GFileInfo *src_info = NULL;
+  ot_lobj GFileEnumerator *enumerator = NULL;
+  ot_lobj GFileInfo *file_info = NULL;
+  ot_lvariant GVariant *xattrs = NULL;
+
+  src_info = g_file_query_info (src, OSTREE_GIO_FAST_QUERYINFO,
+                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                cancellable, error);
+  if (!src_info)
+    goto out;
+
+  if (mkdir (dest_path, 0700) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  enumerator = g_file_enumerate_children (src, OSTREE_GIO_FAST_QUERYINFO,
+                                          G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                          cancellable, error);
+  if (!enumerator)
+    goto out;
+
+  while ((file_info = g_file_enumerator_next_file (enumerator, cancellable, &temp_error)) != NULL)
+    {
+      const char *name = g_file_info_get_name (file_info);
+      ot_lobj GFile *src_child = g_file_get_child (src, name);
+      ot_lobj GFile *dest_child = g_file_get_child (dest, name);
+
+      if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+        {
+          if (!clone_tree_hardlinked (src_child, dest_child, user_mode,
+                                      cancellable, error))
+            goto out;
+        }
+      else if (link (ot_gfile_get_path_cached (src_child),
+                     ot_gfile_get_path_cached (dest_child)) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+
+      g_clear_object (&file_info);
+    }
+  if (temp_error)
+    {
+      g_propagate_error (error, temp_error);
+      goto out;
+    }
+
+  /* Metadata goes last, so read-only directories can be filled */
+  if (!user_mode)
+    {
+      if (lchown (dest_path,
+                  g_file_info_get_attribute_uint32 (src_info, "unix::uid"),
+                  g_file_info_get_attribute_uint32 (src_info, "unix::gid")) < 0)
+        {
+          ot_util_set_error_from_errno (error, errno);
+          goto out;
+        }
+      if (!ostree_get_xattrs_for_file (src, &xattrs, cancellable, error))
+        goto out;
+      if (!ostree_set_xattrs (dest, xattrs, cancellable, error))
+        goto out;
+    }
+
+  mode = g_file_info_get_attribute_uint32 (src_info, "unix::mode");
+  if (chmod (dest_path, mode & 07777) < 0)
+    {
+      ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 typedef struct {
   gboolean caught_error;
   GError **error;
@@ -167,6 +276,9 @@ process_one_checkout (OstreeRepo           *repo,
 {
   gboolean ret = FALSE;
   ProcessOneCheckoutData data;
+  guint i;
+  guint counts_before[OSTREE_REPO_CHECKOUT_N_METHODS];
+  guint counts_after[OSTREE_REPO_CHECKOUT_N_METHODS];
   ot_lobj OstreeRepoFile *root = NULL;
   ot_lobj OstreeRepoFile *subtree = NULL;
   ot_lobj GFileInfo *file_info = NULL;
@@ -191,6 +303,8 @@ process_one_checkout (OstreeRepo           *repo,
   data.loop = g_main_loop_new (NULL, TRUE);
   data.error = error;
 
+  ostree_repo_get_checkout_stats (repo, counts_before);
+
   ostree_repo_checkout_tree_async (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
                                    opt_union ? OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES : 0,
                                    target, subtree, file_info, cancellable,
@@ -200,6 +314,28 @@ process_one_checkout (OstreeRepo           *repo,
 
   if (data.caught_error)
     goto out;
+
+  if (opt_show_methods)
+    {
+      ostree_repo_get_checkout_stats (repo, counts_after);
+      g_print ("%s:", ot_gfile_get_path_cached (target));
+      for (i = 0; i < OSTREE_REPO_CHECKOUT_N_METHODS; i++)
+        g_print (" %s=%u", ostree_repo_checkout_method_to_string (i),
+                 counts_after[i] - counts_before[i]);
+      g_print ("\n");
+    }
+
+  /* In user mode, file ownership and xattrs differ from the commit, so
+   * the checked out files don't have the commit's checksums.
+   */
+  if (stat_cache && !opt_user_mode
+      && g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
+    {
+      if (!ostree_stat_cache_add_tree (stat_cache, repo,
+                                       ostree_repo_file_tree_get_content_checksum (subtree),
+                                       target, cancellable, error))
+        goto out;
+    }
                       
   ret = TRUE;
  out:
@@ -208,6 +344,34 @@ process_one_checkout (OstreeRepo           *repo,
   return ret;
 }
 
+/*
+ * Record the files of @resolved_commit which were just checked out
+ * into @target in the stat cache.
+ */
+static gboolean
+add_commit_to_stat_cache (OstreeRepo           *repo,
+                          const char           *resolved_commit,
+                          GFile                *target,
+                          GCancellable         *cancellable,
+                          GError              **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj OstreeRepoFile *root = NULL;
+
+  root = (OstreeRepoFile*)ostree_repo_file_new_root (repo, resolved_commit);
+  if (!ostree_repo_file_ensure_resolved (root, error))
+    goto out;
+
+  if (!ostree_stat_cache_add_tree (stat_cache, repo,
+                                   ostree_repo_file_tree_get_content_checksum (root),
+                                   target, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 process_many_checkouts (OstreeRepo         *repo,
                         GFile              *target,
@@ -290,12 +454,15 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
   ot_lobj OstreeRepo *repo = NULL;
   ot_lfree char *existing_commit = NULL;
   ot_lfree char *resolved_commit = NULL;
+  ot_lfree char *incremental_commit = NULL;
+  ot_lfree char *reference_commit = NULL;
   ot_lfree char *suffixed_destination = NULL;
   ot_lfree char *tmp_destination = NULL;
   ot_lobj GFileInfo *symlink_file_info = NULL;
   ot_lobj GFile *checkout_target = NULL;
   ot_lobj GFile *checkout_target_tmp = NULL;
   ot_lobj GFile *symlink_target = NULL;
+  ot_lobj GFile *stat_cache_path = NULL;
 
   context = g_option_context_new ("COMMIT DESTINATION - Check out a commit into a filesystem tree");
   g_option_context_add_main_entries (context, options, NULL);
@@ -317,6 +484,56 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
       goto out;
     }
 
+  if (opt_incremental || opt_incremental_from)
+    {
+      if (opt_subpath || opt_union || opt_from_stdin || opt_from_file)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Incremental checkouts may not be used with --subpath, --union, --from-stdin or --from-file");
+          goto out;
+        }
+      if (opt_incremental && !opt_atomic_retarget)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--incremental requires --atomic-retarget");
+          goto out;
+        }
+      if (opt_incremental_from && opt_atomic_retarget)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--incremental-from may not be used with --atomic-retarget");
+          goto out;
+        }
+    }
+
+  if (opt_reference || opt_reference_commit)
+    {
+      if (!(opt_reference && opt_reference_commit))
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--reference and --reference-commit must be used together");
+          goto out;
+        }
+      if (opt_subpath || opt_union || opt_from_stdin || opt_from_file
+          || opt_incremental || opt_incremental_from)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "--reference may not be used with --subpath, --union, --from-stdin, --from-file or incremental checkouts");
+          goto out;
+        }
+      if (!ostree_repo_resolve_rev (repo, opt_reference_commit, FALSE,
+                                    &reference_commit, error))
+        goto out;
+    }
+
+  if (opt_stat_cache)
+    {
+      stat_cache_path = g_file_new_for_path (opt_stat_cache);
+      stat_cache = ostree_stat_cache_new ();
+      if (!ostree_stat_cache_load (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+    }
+
   if (opt_from_stdin || opt_from_file)
     {
       if (opt_atomic_retarget)
@@ -328,6 +545,8 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
 
       destination = argv[1];
       checkout_target = g_file_new_for_path (destination);
+      if (stat_cache)
+        ostree_stat_cache_set_root (stat_cache, checkout_target);
 
       if (!process_many_checkouts (repo, checkout_target, cancellable, error))
         goto out;
@@ -349,6 +568,13 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
       if (!ostree_repo_resolve_rev (repo, commit, FALSE, &resolved_commit, error))
         goto out;
 
+      if (opt_incremental_from)
+        {
+          if (!ostree_repo_resolve_rev (repo, opt_incremental_from, FALSE,
+                                        &incremental_commit, error))
+            goto out;
+        }
+
       if (opt_atomic_retarget)
         {
           GError *temp_error = NULL;
@@ -377,6 +603,37 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
             {
               skip_checkout = strcmp (existing_commit, resolved_commit) == 0;
             }
+
+          /* Left over from an interrupted or failed checkout */
+          if (!skip_checkout
+              && !ot_gio_shutil_rm_rf (checkout_target_tmp, cancellable, error))
+            goto out;
+
+          if (opt_incremental && existing_commit && !skip_checkout)
+            {
+              GError *clone_error = NULL;
+              ot_lfree char *previous_destination = NULL;
+              ot_lobj GFile *previous_target = NULL;
+
+              /* Update a hardlinked copy of the previous checkout, so
+               * the tree the symlink points to stays intact until the
+               * new one is complete.
+               */
+              previous_destination = g_strconcat (destination, "-", existing_commit, NULL);
+              previous_target = g_file_new_for_path (previous_destination);
+              if (clone_tree_hardlinked (previous_target, checkout_target_tmp, opt_user_mode,
+                                         cancellable, &clone_error))
+                incremental_commit = g_strdup (existing_commit);
+              else
+                {
+                  if (!g_error_matches (clone_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+                    g_printerr ("ostree-checkout: Can't link previous checkout %s (%s), doing a full checkout\n",
+                                previous_destination, clone_error->message);
+                  g_clear_error (&clone_error);
+                  if (!ot_gio_shutil_rm_rf (checkout_target_tmp, cancellable, error))
+                    goto out;
+                }
+            }
         }
       else
         {
@@ -384,17 +641,66 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
           skip_checkout = FALSE;
         }
 
+      /* With --atomic-retarget, entries are recorded under the final
+       * name of the temporary checkout.
+       */
+      if (stat_cache)
+        ostree_stat_cache_set_root (stat_cache, checkout_target);
+
       if (skip_checkout)
         {
           g_print ("ostree-checkout: Rev %s is already checked out as %s\n", commit, resolved_commit);
         }
       else
         {
-          if (!process_one_checkout (repo, resolved_commit, opt_subpath,
-                                     checkout_target_tmp ? checkout_target_tmp : checkout_target,
-                                     cancellable, error))
+          if (incremental_commit)
+            {
+              if (!ostree_repo_checkout_tree_incremental (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
+                                                          checkout_target_tmp ? checkout_target_tmp : checkout_target,
+                                                          incremental_commit, resolved_commit,
+                                                          cancellable, error))
+                goto out;
+            }
+          else if (reference_commit)
+            {
+              OstreeRepoCheckoutTimings timings;
+              ot_lobj GFile *reference = g_file_new_for_path (opt_reference);
+
+              if (!ostree_repo_checkout_tree_with_reference (repo, opt_user_mode ? OSTREE_REPO_CHECKOUT_MODE_USER : 0,
+                                                             checkout_target_tmp ? checkout_target_tmp : checkout_target,
+                                                             resolved_commit, reference, reference_commit,
+                                                             &timings, cancellable, error))
+                goto out;
+
+              g_print ("ostree-checkout: %u directories, %u files linked from reference, %u from repository\n",
+                       timings.n_directories, timings.n_linked, timings.n_from_repo);
+              g_print ("ostree-checkout: scan %.3fs, mkdir %.3fs, link %.3fs, metadata %.3fs\n",
+                       timings.scan_usec / 1000000.0, timings.mkdir_usec / 1000000.0,
+                       timings.link_usec / 1000000.0, timings.metadata_usec / 1000000.0);
+            }
+          else if (!process_one_checkout (repo, resolved_commit, opt_subpath,
+                                          checkout_target_tmp ? checkout_target_tmp : checkout_target,
+                                          cancellable, error))
             goto out;
 
+          /* Only stamp the cache with the commit if it now describes
+           * the whole checkout.  Incremental checkouts keep files of the
+           * previous checkout without reading them, so they can't be
+           * recorded.
+           */
+          if (stat_cache)
+            {
+              gboolean complete = !(incremental_commit || opt_subpath
+                                    || opt_union || opt_user_mode);
+
+              if (complete && reference_commit
+                  && !add_commit_to_stat_cache (repo, resolved_commit,
+                                                checkout_target_tmp ? checkout_target_tmp : checkout_target,
+                                                cancellable, error))
+                goto out;
+              ostree_stat_cache_set_commit (stat_cache, complete ? resolved_commit : NULL);
+            }
+
           if (!opt_no_triggers)
             {
               if (!ostree_run_triggers_in_root (checkout_target_tmp ? checkout_target_tmp : checkout_target,
@@ -415,9 +721,17 @@ ostree_builtin_checkout (int argc, char **argv, GFile *repo_path, GError **error
         }
     }
 
+  if (stat_cache)
+    {
+      if (!ostree_stat_cache_save (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+    }
+
   ret = TRUE;
  out:
   if (context)
     g_option_context_free (context);
+  ostree_stat_cache_free (stat_cache);
+  stat_cache = NULL;
   return ret;
 }
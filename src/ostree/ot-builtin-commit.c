@@ -40,10 +40,13 @@ static char *statoverride_file;
 static char *opt_related_objects_file;
 static gboolean skip_if_unchanged;
 static gboolean tar_autocreate_parents;
+static gboolean opt_tar_stats;
 static gboolean no_xattrs;
 static char **trees;
 static gint owner_uid = -1;
 static gint owner_gid = -1;
+static char *opt_stat_cache;
+static gboolean opt_verify;
 
 static GOptionEntry options[] = {
   { "subject", 's', 0, G_OPTION_ARG_STRING, &subject, "One line subject", "subject" },
@@ -58,8 +61,11 @@ static GOptionEntry options[] = {
   { "owner-gid", 0, 0, G_OPTION_ARG_INT, &owner_gid, "Set file ownership group id", "GID" },
   { "no-xattrs", 0, 0, G_OPTION_ARG_NONE, &no_xattrs, "Do not import extended attributes", NULL },
   { "tar-autocreate-parents", 0, 0, G_OPTION_ARG_NONE, &tar_autocreate_parents, "When loading tar archives, automatically create parent directories as needed", NULL },
+  { "tar-stats", 0, 0, G_OPTION_ARG_NONE, &opt_tar_stats, "Print the throughput of each stage of tar archive imports", NULL },
   { "skip-if-unchanged", 0, 0, G_OPTION_ARG_NONE, &skip_if_unchanged, "If the contents are unchanged from previous commit, do nothing", NULL },
   { "statoverride", 0, 0, G_OPTION_ARG_FILENAME, &statoverride_file, "File containing list of modifications to make to permissions", "path" },
+  { "stat-cache", 0, 0, G_OPTION_ARG_FILENAME, &opt_stat_cache, "Reuse checksums of files unchanged since the parent commit according to stat cache FILE, and update it", "FILE" },
+  { "verify", 0, 0, G_OPTION_ARG_NONE, &opt_verify, "Rehash all files, ignoring the stat cache", NULL },
   { "related-objects-file", 0, 0, G_OPTION_ARG_FILENAME, &opt_related_objects_file, "File containing newline-separated pairs of (checksum SPACE name) of related objects", "path" },
   { NULL }
 };
@@ -211,6 +217,32 @@ commit_filter (OstreeRepo         *self,
   return OSTREE_REPO_COMMIT_FILTER_ALLOW;
 }
 
+static double
+mb_per_sec (guint64 bytes,
+            guint64 usec)
+{
+  if (usec == 0)
+    return 0;
+  return (bytes / (1024.0 * 1024.0)) / (usec / 1000000.0);
+}
+
+static void
+print_import_stats (const char            *path,
+                    OstreeRepoImportStats *stats)
+{
+  g_print ("%s: %u files, %u directories, %u hardlinks, %.1f MB in %.3fs\n",
+           path, stats->n_files, stats->n_directories, stats->n_hardlinks,
+           (stats->bytes + stats->large_bytes) / (1024.0 * 1024.0),
+           stats->total_usec / 1000000.0);
+  g_print ("%s: read %.1f MB/s, stage %.1f MB/s per thread, overall %.1f MB/s\n",
+           path, mb_per_sec (stats->bytes, stats->read_usec),
+           mb_per_sec (stats->bytes, stats->stage_usec),
+           mb_per_sec (stats->bytes + stats->large_bytes, stats->total_usec));
+  if (stats->large_bytes > 0)
+    g_print ("%s: large files streamed at %.1f MB/s\n",
+             path, mb_per_sec (stats->large_bytes, stats->large_usec));
+}
+
 gboolean
 ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
 {
@@ -236,6 +268,8 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
   ot_lfree char *parent_content_checksum = NULL;
   ot_lfree char *parent_metadata_checksum = NULL;
   OstreeRepoCommitModifier *modifier = NULL;
+  OstreeStatCache *stat_cache = NULL;
+  ot_lobj GFile *stat_cache_path = NULL;
   GMappedFile *metadata_mappedf = NULL;
   GVariantBuilder metadata_builder;
   gboolean metadata_builder_initialized = FALSE;
@@ -335,6 +369,14 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
   if (owner_uid >= 0 || owner_gid >= 0 || statoverride_file != NULL
       || no_xattrs)
     {
+      /* Cached checksums are for the files as they are on disk */
+      if (opt_stat_cache)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "--stat-cache may not be used with --owner-uid, --owner-gid, --statoverride or --no-xattrs");
+          goto out;
+        }
+
       modifier = ostree_repo_commit_modifier_new ();
       modifier->skip_xattrs = no_xattrs;
       modifier->filter = commit_filter;
@@ -344,6 +386,25 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
   if (!ostree_repo_resolve_rev (repo, branch, TRUE, &parent, error))
     goto out;
 
+  if (opt_stat_cache)
+    {
+      stat_cache_path = g_file_new_for_path (opt_stat_cache);
+      stat_cache = ostree_stat_cache_new ();
+      if (!ostree_stat_cache_load (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+
+      /* Only trust a cache that was last synchronized with our parent */
+      if (g_strcmp0 (ostree_stat_cache_get_commit (stat_cache), parent) != 0)
+        {
+          ostree_stat_cache_free (stat_cache);
+          stat_cache = ostree_stat_cache_new ();
+        }
+
+      modifier = ostree_repo_commit_modifier_new ();
+      modifier->stat_cache = stat_cache;
+      modifier->stat_cache_verify = opt_verify;
+    }
+
   if (skip_if_unchanged && parent)
     {
       if (!ostree_repo_load_variant (repo, OSTREE_OBJECT_TYPE_COMMIT,
@@ -399,11 +460,17 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
             }
           else if (strcmp (tree_type, "tar") == 0)
             {
+              OstreeRepoImportStats import_stats;
+
               arg = g_file_new_for_path (tree);
-              if (!ostree_repo_stage_archive_to_mtree (repo, arg, mtree, modifier,
-                                                       tar_autocreate_parents,
-                                                       cancellable, error))
+              if (!ostree_repo_stage_archive_to_mtree_with_stats (repo, arg, mtree, modifier,
+                                                                  tar_autocreate_parents,
+                                                                  &import_stats,
+                                                                  cancellable, error))
                 goto out;
+
+              if (opt_tar_stats)
+                print_import_stats (tree, &import_stats);
             }
           else if (strcmp (tree_type, "ref") == 0)
             {
@@ -492,6 +559,13 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
       g_print ("%s\n", parent);
     }
 
+  if (stat_cache)
+    {
+      ostree_stat_cache_set_commit (stat_cache, skip_commit ? parent : commit_checksum);
+      if (!ostree_stat_cache_save (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+    }
+
   ret = TRUE;
  out:
   if (in_transaction)
@@ -506,5 +580,6 @@ ostree_builtin_commit (int argc, char **argv, GFile *repo_path, GError **error)
     g_option_context_free (context);
   if (modifier)
     ostree_repo_commit_modifier_unref (modifier);
+  ostree_stat_cache_free (stat_cache);
   return ret;
 }
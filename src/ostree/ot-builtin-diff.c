@@ -27,10 +27,16 @@
 
 #include <glib/gi18n.h>
 
+static char *opt_stat_cache;
+
 static GOptionEntry options[] = {
+  { "stat-cache", 0, 0, G_OPTION_ARG_STRING, &opt_stat_cache, "Use and update stat cache FILE for the local directory", "FILE" },
   { NULL }
 };
 
+static OstreeStatCache *stat_cache;
+static GFile *stat_cache_root;
+
 static gboolean
 parse_file_or_commit (OstreeRepo  *repo,
                       const char  *arg,
@@ -77,10 +83,34 @@ get_file_checksum (GFile  *f,
     }
   else
     {
-      if (!ostree_checksum_file (f, OSTREE_OBJECT_TYPE_FILE,
-                                 &csum, cancellable, error))
-        goto out;
-      ret_checksum = ostree_checksum_from_bytes (csum);
+      struct stat stbuf;
+      ot_lfree char *relpath = NULL;
+      gboolean have_stat = FALSE;
+
+      if (stat_cache)
+        relpath = g_file_get_relative_path (stat_cache_root, f);
+      if (relpath)
+        {
+          if (lstat (ot_gfile_get_path_cached (f), &stbuf) < 0)
+            {
+              ot_util_set_error_from_errno (error, errno);
+              goto out;
+            }
+          have_stat = !S_ISDIR (stbuf.st_mode);
+        }
+
+      if (have_stat)
+        ret_checksum = g_strdup (ostree_stat_cache_lookup (stat_cache, relpath, &stbuf));
+
+      if (!ret_checksum)
+        {
+          if (!ostree_checksum_file (f, OSTREE_OBJECT_TYPE_FILE,
+                                     &csum, cancellable, error))
+            goto out;
+          ret_checksum = ostree_checksum_from_bytes (csum);
+          if (have_stat)
+            ostree_stat_cache_update (stat_cache, relpath, &stbuf, ret_checksum);
+        }
     }
 
   ret = TRUE;
@@ -411,6 +441,68 @@ diff_dirs (GFile          *a,
   return ret;
 }
 
+static gboolean
+diff_commits (OstreeRepo     *repo,
+              OstreeRepoFile *src,
+              OstreeRepoFile *target,
+              GCancellable   *cancellable,
+              GError        **error)
+{
+  gboolean ret = FALSE;
+  int i;
+  ot_lptrarray GPtrArray *modified = NULL;
+  ot_lptrarray GPtrArray *removed = NULL;
+  ot_lptrarray GPtrArray *added = NULL;
+  ot_lptrarray GPtrArray *added_children = NULL;
+
+  modified = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+  removed = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+  added = g_ptr_array_new_with_free_func ((GDestroyNotify)ostree_diff_item_unref);
+
+  if (!ostree_diff_commits (repo,
+                            ostree_repo_file_get_commit (src),
+                            ostree_repo_file_get_commit (target),
+                            modified, removed, added,
+                            cancellable, error))
+    goto out;
+
+  for (i = 0; i < modified->len; i++)
+    {
+      OstreeDiffItem *diff = modified->pdata[i];
+      g_print ("M    %s\n", diff->path);
+    }
+  for (i = 0; i < removed->len; i++)
+    {
+      OstreeDiffItem *diff = removed->pdata[i];
+      g_print ("D    %s\n", diff->path);
+    }
+  for (i = 0; i < added->len; i++)
+    {
+      OstreeDiffItem *diff = added->pdata[i];
+      g_print ("A    %s\n", diff->path);
+
+      /* Only new directories are listed by the tree diff; show their contents too */
+      if (diff->objtype == OSTREE_OBJECT_TYPE_DIR_TREE)
+        {
+          ot_lobj GFile *added_dir = NULL;
+          int j;
+
+          added_dir = g_file_resolve_relative_path ((GFile*)target, diff->path + 1);
+          if (added_children)
+            g_ptr_array_unref (added_children);
+          added_children = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
+          if (!diff_add_dir_recurse (added_dir, added_children, cancellable, error))
+            goto out;
+          for (j = 0; j < added_children->len; j++)
+            g_print ("A    %s\n", ot_gfile_get_path_cached (added_children->pdata[j]));
+        }
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 gboolean
 ostree_builtin_diff (int argc, char **argv, GFile *repo_path, GError **error)
 {
@@ -428,6 +520,7 @@ ostree_builtin_diff (int argc, char **argv, GFile *repo_path, GError **error)
   ot_lptrarray GPtrArray *modified = NULL;
   ot_lptrarray GPtrArray *removed = NULL;
   ot_lptrarray GPtrArray *added = NULL;
+  ot_lobj GFile *stat_cache_path = NULL;
 
   context = g_option_context_new ("REV TARGETDIR - Compare directory TARGETDIR against revision REV");
   g_option_context_add_main_entries (context, options, NULL);
@@ -468,6 +561,30 @@ ostree_builtin_diff (int argc, char **argv, GFile *repo_path, GError **error)
   if (!parse_file_or_commit (repo, target, &targetf, cancellable, error))
     goto out;
 
+  if (OSTREE_IS_REPO_FILE (srcf) && OSTREE_IS_REPO_FILE (targetf))
+    {
+      if (!diff_commits (repo, (OstreeRepoFile*)srcf, (OstreeRepoFile*)targetf,
+                         cancellable, error))
+        goto out;
+      ret = TRUE;
+      goto out;
+    }
+
+  if (opt_stat_cache)
+    {
+      stat_cache_root = !OSTREE_IS_REPO_FILE (targetf) ? targetf : srcf;
+      if (OSTREE_IS_REPO_FILE (stat_cache_root))
+        stat_cache_root = NULL;
+    }
+  if (stat_cache_root)
+    {
+      stat_cache_path = g_file_new_for_path (opt_stat_cache);
+      stat_cache = ostree_stat_cache_new ();
+      if (!ostree_stat_cache_load (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+      ostree_stat_cache_set_root (stat_cache, stat_cache_root);
+    }
+
   modified = g_ptr_array_new_with_free_func ((GDestroyNotify)diff_item_unref);
   removed = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
   added = g_ptr_array_new_with_free_func ((GDestroyNotify)g_object_unref);
@@ -475,6 +592,12 @@ ostree_builtin_diff (int argc, char **argv, GFile *repo_path, GError **error)
   if (!diff_dirs (srcf, targetf, modified, removed, added, cancellable, error))
     goto out;
 
+  if (stat_cache)
+    {
+      if (!ostree_stat_cache_save (stat_cache, stat_cache_path, cancellable, error))
+        goto out;
+    }
+
   for (i = 0; i < modified->len; i++)
     {
       DiffItem *diff = modified->pdata[i];
@@ -502,5 +625,8 @@ ostree_builtin_diff (int argc, char **argv, GFile *repo_path, GError **error)
  out:
   if (context)
     g_option_context_free (context);
+  ostree_stat_cache_free (stat_cache);
+  stat_cache = NULL;
+  stat_cache_root = NULL;
   return ret;
 }
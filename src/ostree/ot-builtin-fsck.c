@@ -30,18 +30,371 @@
 
 static gboolean quiet;
 static gboolean delete;
+static gboolean full;
 
 static GOptionEntry options[] = {
   { "quiet", 'q', 0, G_OPTION_ARG_NONE, &quiet, "Don't display informational messages", NULL },
   { "delete", 0, 0, G_OPTION_ARG_NONE, &delete, "Remove corrupted objects", NULL },
+  { "full", 0, 0, G_OPTION_ARG_NONE, &full, "Verify all objects, ignoring the journal of previous runs", NULL },
   { NULL }
 };
 
+/* fsck journal, written after each successful run:
+ * s - OSTv1FSCKJOURNAL
+ * a(yaya(ttt)) - loose objects (objtype, checksum, stat data of object files)
+ * a(baya(ttt)) - packs (is_meta, pack checksum, stat data of index and data)
+ * a(yay) - packed objects whose content was verified (objtype, checksum)
+ *
+ * Stat data is (size, mtime, ctime), with times in nanoseconds.  A
+ * pack only having the same stat data says nothing about whether the
+ * objects in it were ever checksummed, hence the last list.
+ */
+#define OT_FSCK_JOURNAL_VARIANT_FORMAT G_VARIANT_TYPE ("(sa(yaya(ttt))a(baya(ttt))a(yay))")
+
 typedef struct {
   OstreeRepo *repo;
   guint n_pack_files;
+  guint n_skipped_pack_files;
+  guint n_objects;
+  guint n_skipped_objects;
+
+  /* Object name -> a(ttt) from the previous run */
+  GHashTable *old_loose_journal;
+  /* Pack checksum -> a(ttt) from the previous run */
+  GHashTable *old_pack_journal;
+
+  /* Serialized names of packed objects verified by the previous run */
+  GHashTable *old_verified_packed;
+
+  /* Same as above, for this run */
+  GHashTable *new_loose_journal;
+  GHashTable *new_pack_journal;
+  GHashTable *new_verified_packed;
+
+  /* Journal keys of packs verified by a previous run */
+  GHashTable *unchanged_packs;
 } OtFsckData;
 
+static GFile *
+get_journal_path (OstreeRepo *repo)
+{
+  return g_file_get_child (ostree_repo_get_path (repo), "fsck-journal");
+}
+
+/* Meta and data packs are distinct files, even with the same checksum */
+static char *
+get_pack_journal_key (const char *pack_checksum,
+                      gboolean    is_meta)
+{
+  return g_strconcat (is_meta ? "meta-" : "data-", pack_checksum, NULL);
+}
+
+static gboolean
+append_stat_data (GFile            *path,
+                  gboolean          allow_noent,
+                  GVariantBuilder  *builder,
+                  gboolean         *out_exists,
+                  GError          **error)
+{
+  gboolean ret = FALSE;
+  struct stat stbuf;
+
+  if (lstat (ot_gfile_get_path_cached (path), &stbuf) < 0)
+    {
+      if (errno == ENOENT && allow_noent)
+        {
+          *out_exists = FALSE;
+          ret = TRUE;
+        }
+      else
+        ot_util_set_error_from_errno (error, errno);
+      goto out;
+    }
+
+  g_variant_builder_add (builder, "(ttt)",
+                         GUINT64_TO_BE ((guint64)stbuf.st_size),
+                         GUINT64_TO_BE ((guint64)stbuf.st_mtim.tv_sec * G_GUINT64_CONSTANT (1000000000)
+                                        + stbuf.st_mtim.tv_nsec),
+                         GUINT64_TO_BE ((guint64)stbuf.st_ctim.tv_sec * G_GUINT64_CONSTANT (1000000000)
+                                        + stbuf.st_ctim.tv_nsec));
+
+  *out_exists = TRUE;
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * Compute the stat data for the loose files backing object
+ * @checksum.  If the object isn't stored loose in this repository,
+ * @out_stat_data will be %NULL.
+ */
+static gboolean
+get_loose_stat_data (OtFsckData         *data,
+                     const char         *checksum,
+                     OstreeObjectType    objtype,
+                     GVariant          **out_stat_data,
+                     GError            **error)
+{
+  gboolean ret = FALSE;
+  gboolean exists;
+  GVariantBuilder *builder = NULL;
+  ot_lobj GFile *object_path = NULL;
+  ot_lobj GFile *content_path = NULL;
+  ot_lvariant GVariant *ret_stat_data = NULL;
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ttt)"));
+
+  object_path = ostree_repo_get_object_path (data->repo, checksum, objtype);
+  if (!append_stat_data (object_path, TRUE, builder, &exists, error))
+    goto out;
+
+  if (exists)
+    {
+      if (objtype == OSTREE_OBJECT_TYPE_FILE
+          && ostree_repo_get_mode (data->repo) == OSTREE_REPO_MODE_ARCHIVE)
+        {
+          content_path = ostree_repo_get_archive_content_path (data->repo, checksum);
+          if (!append_stat_data (content_path, TRUE, builder, &exists, error))
+            goto out;
+        }
+
+      ret_stat_data = g_variant_ref_sink (g_variant_builder_end (builder));
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_stat_data, &ret_stat_data);
+ out:
+  if (builder)
+    g_variant_builder_unref (builder);
+  return ret;
+}
+
+static gboolean
+get_pack_stat_data (OtFsckData         *data,
+                    const char         *pack_checksum,
+                    gboolean            is_meta,
+                    GVariant          **out_stat_data,
+                    GError            **error)
+{
+  gboolean ret = FALSE;
+  gboolean exists;
+  GVariantBuilder *builder = NULL;
+  ot_lfree char *path = NULL;
+  ot_lobj GFile *pack_index_path = NULL;
+  ot_lobj GFile *pack_data_path = NULL;
+  ot_lvariant GVariant *ret_stat_data = NULL;
+
+  builder = g_variant_builder_new (G_VARIANT_TYPE ("a(ttt)"));
+
+  path = ostree_get_relative_pack_index_path (is_meta, pack_checksum);
+  pack_index_path = g_file_resolve_relative_path (ostree_repo_get_path (data->repo), path);
+  if (!append_stat_data (pack_index_path, FALSE, builder, &exists, error))
+    goto out;
+
+  g_free (path);
+  path = ostree_get_relative_pack_data_path (is_meta, pack_checksum);
+  pack_data_path = g_file_resolve_relative_path (ostree_repo_get_path (data->repo), path);
+  if (!append_stat_data (pack_data_path, FALSE, builder, &exists, error))
+    goto out;
+
+  ret_stat_data = g_variant_ref_sink (g_variant_builder_end (builder));
+
+  ret = TRUE;
+  ot_transfer_out_value (out_stat_data, &ret_stat_data);
+ out:
+  if (builder)
+    g_variant_builder_unref (builder);
+  return ret;
+}
+
+static gboolean
+journal_matches (GHashTable   *journal,
+                 gconstpointer key,
+                 GVariant     *stat_data)
+{
+  GVariant *old_stat_data;
+
+  if (full || journal == NULL || stat_data == NULL)
+    return FALSE;
+
+  old_stat_data = g_hash_table_lookup (journal, key);
+  return old_stat_data != NULL && g_variant_equal (old_stat_data, stat_data);
+}
+
+static gboolean
+load_journal (OtFsckData     *data,
+              GCancellable   *cancellable,
+              GError        **error)
+{
+  gboolean ret = FALSE;
+  const char *magic;
+  guchar objtype_u8;
+  gboolean is_meta;
+  ot_lobj GFile *journal_path = NULL;
+  ot_lvariant GVariant *journal = NULL;
+  ot_lvariant GVariant *csum_bytes = NULL;
+  ot_lvariant GVariant *stat_data = NULL;
+  GVariantIter *loose_iter = NULL;
+  GVariantIter *packs_iter = NULL;
+  GVariantIter *verified_iter = NULL;
+
+  journal_path = get_journal_path (data->repo);
+  if (full || !g_file_query_exists (journal_path, cancellable))
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  if (!ot_util_variant_map (journal_path, OT_FSCK_JOURNAL_VARIANT_FORMAT, FALSE,
+                            &journal, error))
+    goto out;
+
+  g_variant_get (journal, "(&sa(yaya(ttt))a(baya(ttt))a(yay))",
+                 &magic, &loose_iter, &packs_iter, &verified_iter);
+
+  /* A journal we don't understand just means everything gets verified */
+  if (strcmp (magic, "OSTv1FSCKJOURNAL") != 0)
+    {
+      ret = TRUE;
+      goto out;
+    }
+
+  data->old_loose_journal = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                   (GDestroyNotify)g_variant_unref,
+                                                   (GDestroyNotify)g_variant_unref);
+  while (g_variant_iter_loop (loose_iter, "(y@ay@a(ttt))",
+                              &objtype_u8, &csum_bytes, &stat_data))
+    {
+      ot_lfree char *checksum = NULL;
+
+      if (g_variant_n_children (csum_bytes) != 32
+          || !ostree_validate_structureof_objtype (objtype_u8, NULL))
+        continue;
+
+      checksum = ostree_checksum_from_bytes_v (csum_bytes);
+      g_hash_table_replace (data->old_loose_journal,
+                            ot_util_variant_take_ref (ostree_object_name_serialize (checksum, objtype_u8)),
+                            g_variant_ref (stat_data));
+    }
+  csum_bytes = NULL;
+  stat_data = NULL;
+
+  data->old_pack_journal = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  g_free,
+                                                  (GDestroyNotify)g_variant_unref);
+  while (g_variant_iter_loop (packs_iter, "(b@ay@a(ttt))",
+                              &is_meta, &csum_bytes, &stat_data))
+    {
+      ot_lfree char *checksum = NULL;
+
+      if (g_variant_n_children (csum_bytes) != 32)
+        continue;
+
+      checksum = ostree_checksum_from_bytes_v (csum_bytes);
+      g_hash_table_replace (data->old_pack_journal,
+                            get_pack_journal_key (checksum, is_meta),
+                            g_variant_ref (stat_data));
+    }
+  csum_bytes = NULL;
+  stat_data = NULL;
+
+  data->old_verified_packed = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                     (GDestroyNotify)g_variant_unref, NULL);
+  while (g_variant_iter_loop (verified_iter, "(y@ay)", &objtype_u8, &csum_bytes))
+    {
+      ot_lfree char *checksum = NULL;
+
+      if (g_variant_n_children (csum_bytes) != 32
+          || !ostree_validate_structureof_objtype (objtype_u8, NULL))
+        continue;
+
+      checksum = ostree_checksum_from_bytes_v (csum_bytes);
+      g_hash_table_add (data->old_verified_packed,
+                        ot_util_variant_take_ref (ostree_object_name_serialize (checksum, objtype_u8)));
+    }
+  csum_bytes = NULL;
+
+  ret = TRUE;
+ out:
+  if (loose_iter)
+    g_variant_iter_free (loose_iter);
+  if (packs_iter)
+    g_variant_iter_free (packs_iter);
+  if (verified_iter)
+    g_variant_iter_free (verified_iter);
+  return ret;
+}
+
+static gboolean
+save_journal (OtFsckData     *data,
+              GCancellable   *cancellable,
+              GError        **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  GVariantBuilder loose_builder;
+  GVariantBuilder packs_builder;
+  GVariantBuilder verified_builder;
+  ot_lobj GFile *journal_path = NULL;
+  ot_lvariant GVariant *journal = NULL;
+
+  g_variant_builder_init (&loose_builder, G_VARIANT_TYPE ("a(yaya(ttt))"));
+  g_hash_table_iter_init (&hash_iter, data->new_loose_journal);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      ostree_object_name_deserialize ((GVariant*)key, &checksum, &objtype);
+      g_variant_builder_add (&loose_builder, "(y@ay@a(ttt))",
+                             (guchar)objtype,
+                             ostree_checksum_to_bytes_v (checksum),
+                             (GVariant*)value);
+    }
+
+  g_variant_builder_init (&packs_builder, G_VARIANT_TYPE ("a(baya(ttt))"));
+  g_hash_table_iter_init (&hash_iter, data->new_pack_journal);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *pack_key = key;
+
+      g_variant_builder_add (&packs_builder, "(b@ay@a(ttt))",
+                             g_str_has_prefix (pack_key, "meta-"),
+                             ostree_checksum_to_bytes_v (strchr (pack_key, '-') + 1),
+                             (GVariant*)value);
+    }
+
+  g_variant_builder_init (&verified_builder, G_VARIANT_TYPE ("a(yay)"));
+  g_hash_table_iter_init (&hash_iter, data->new_verified_packed);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+
+      ostree_object_name_deserialize ((GVariant*)key, &checksum, &objtype);
+      g_variant_builder_add (&verified_builder, "(y@ay)",
+                             (guchar)objtype,
+                             ostree_checksum_to_bytes_v (checksum));
+    }
+
+  journal = g_variant_new ("(s@a(yaya(ttt))@a(baya(ttt))@a(yay))",
+                           "OSTv1FSCKJOURNAL",
+                           g_variant_builder_end (&loose_builder),
+                           g_variant_builder_end (&packs_builder),
+                           g_variant_builder_end (&verified_builder));
+  g_variant_ref_sink (journal);
+
+  journal_path = get_journal_path (data->repo);
+  if (!ot_util_variant_save (journal_path, journal, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 fsck_one_pack_file (OtFsckData        *data,
                     const char        *pack_checksum,
@@ -124,13 +477,54 @@ fsck_one_pack_file (OtFsckData        *data,
   return ret;
 }
 
+static gboolean
+fsck_pack_file_list (OtFsckData     *data,
+                     GPtrArray      *pack_indexes,
+                     gboolean        is_meta,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  gboolean ret = FALSE;
+  guint i;
+
+  for (i = 0; i < pack_indexes->len; i++)
+    {
+      const char *pack_checksum = pack_indexes->pdata[i];
+      ot_lfree char *key = NULL;
+      ot_lvariant GVariant *stat_data = NULL;
+
+      key = get_pack_journal_key (pack_checksum, is_meta);
+
+      if (!get_pack_stat_data (data, pack_checksum, is_meta, &stat_data, error))
+        goto out;
+
+      if (journal_matches (data->old_pack_journal, key, stat_data))
+        {
+          g_hash_table_add (data->unchanged_packs, g_strdup (key));
+          data->n_skipped_pack_files++;
+        }
+      else
+        {
+          if (!fsck_one_pack_file (data, pack_checksum, is_meta, cancellable, error))
+            goto out;
+          data->n_pack_files++;
+        }
+
+      g_hash_table_replace (data->new_pack_journal, key, g_variant_ref (stat_data));
+      key = NULL; /* Transfer ownership */
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
 static gboolean
 fsck_pack_files (OtFsckData  *data,
                  GCancellable   *cancellable,
                  GError        **error)
 {
   gboolean ret = FALSE;
-  guint i;
   ot_lptrarray GPtrArray *meta_pack_indexes = NULL;
   ot_lptrarray GPtrArray *data_pack_indexes = NULL;
   
@@ -138,32 +532,200 @@ fsck_pack_files (OtFsckData  *data,
                                       cancellable, error))
     goto out;
 
-  for (i = 0; i < meta_pack_indexes->len; i++)
+  if (!fsck_pack_file_list (data, meta_pack_indexes, TRUE, cancellable, error))
+    goto out;
+  if (!fsck_pack_file_list (data, data_pack_indexes, FALSE, cancellable, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/**
+ * Determine whether the object named by @serialized_key can be
+ * skipped because every copy of it was verified by a previous run and
+ * hasn't changed since.  Also records the object into the journal for
+ * this run, which is only saved once every object has been verified.
+ */
+static gboolean
+check_object_unchanged (OtFsckData        *data,
+                        GHashTable        *objects,
+                        GVariant          *serialized_key,
+                        const char        *checksum,
+                        OstreeObjectType   objtype,
+                        gboolean          *out_unchanged,
+                        GError           **error)
+{
+  gboolean ret = FALSE;
+  gboolean ret_unchanged = FALSE;
+  gboolean is_loose;
+  gboolean is_packed;
+  GVariant *objdata;
+  const char *pack_checksum;
+  ot_lvariant GVariant *stat_data = NULL;
+  GVariantIter *packs_iter = NULL;
+
+  objdata = g_hash_table_lookup (objects, serialized_key);
+  if (!objdata)
     {
-      const char *pack_checksum = meta_pack_indexes->pdata[i];
+      /* Probably in a parent repository */
+      ret = TRUE;
+      goto out;
+    }
+
+  g_variant_get (objdata, "(bas)", &is_loose, &packs_iter);
 
-      if (!fsck_one_pack_file (data, pack_checksum, TRUE, cancellable, error))
+  is_packed = g_variant_iter_n_children (packs_iter) > 0;
+  ret_unchanged = is_loose || is_packed;
+
+  if (is_loose)
+    {
+      if (!get_loose_stat_data (data, checksum, objtype, &stat_data, error))
         goto out;
 
-      data->n_pack_files++;
+      if (stat_data)
+        g_hash_table_replace (data->new_loose_journal, g_variant_ref (serialized_key),
+                              g_variant_ref (stat_data));
+
+      if (!journal_matches (data->old_loose_journal, serialized_key, stat_data))
+        ret_unchanged = FALSE;
     }
-  for (i = 0; i < data_pack_indexes->len; i++)
+
+  if (is_packed)
     {
-      const char *pack_checksum = data_pack_indexes->pdata[i];
+      g_hash_table_add (data->new_verified_packed, g_variant_ref (serialized_key));
 
-      if (!fsck_one_pack_file (data, pack_checksum, FALSE, cancellable, error))
-        goto out;
+      if (data->old_verified_packed == NULL
+          || !g_hash_table_contains (data->old_verified_packed, serialized_key))
+        ret_unchanged = FALSE;
+    }
 
-      data->n_pack_files++;
+  while (ret_unchanged && g_variant_iter_loop (packs_iter, "&s", &pack_checksum))
+    {
+      ot_lfree char *key = get_pack_journal_key (pack_checksum, OSTREE_OBJECT_TYPE_IS_META (objtype));
+
+      if (!g_hash_table_contains (data->unchanged_packs, key))
+        ret_unchanged = FALSE;
     }
 
   ret = TRUE;
  out:
+  if (packs_iter)
+    g_variant_iter_free (packs_iter);
+  *out_unchanged = ret_unchanged;
+  return ret;
+}
+
+/*
+ * Report that the object @serialized_key has checksum @actual_checksum.
+ * With --delete, objects which are only loose are removed instead, so
+ * they can be fetched or committed again.
+ */
+static gboolean
+handle_corrupted_object (OtFsckData     *data,
+                         GHashTable     *objects,
+                         GVariant       *serialized_key,
+                         const char     *actual_checksum,
+                         GCancellable   *cancellable,
+                         GError        **error)
+{
+  gboolean ret = FALSE;
+  const char *checksum;
+  OstreeObjectType objtype;
+  GVariant *objdata;
+  gboolean is_loose = FALSE;
+  gboolean is_packed = FALSE;
+
+  ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+  objdata = g_hash_table_lookup (objects, serialized_key);
+  if (objdata)
+    {
+      GVariantIter *packs_iter;
+
+      g_variant_get (objdata, "(bas)", &is_loose, &packs_iter);
+      is_packed = g_variant_iter_n_children (packs_iter) > 0;
+      g_variant_iter_free (packs_iter);
+    }
+
+  if (!(delete && is_loose && !is_packed))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "corrupted object %s.%s; actual checksum: %s",
+                   checksum, ostree_object_type_to_string (objtype),
+                   actual_checksum);
+      goto out;
+    }
+
+  if (!ostree_repo_delete_object (data->repo, objtype, checksum, cancellable, error))
+    goto out;
+  g_hash_table_remove (data->new_loose_journal, serialized_key);
+  g_print ("Deleted corrupted object %s.%s\n", checksum,
+           ostree_object_type_to_string (objtype));
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+/* Metadata objects are small, so they're checksummed this many at a time */
+#define OT_FSCK_METADATA_BATCH 16
+
+/**
+ * Verify the checksums of the metadata objects collected in @names
+ * and @metadata, then empty both arrays.
+ */
+static gboolean
+fsck_metadata_batch (OtFsckData     *data,
+                     GHashTable     *objects,
+                     GPtrArray      *names,
+                     GPtrArray      *metadata,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  gboolean ret = FALSE;
+  const guchar *buffers[OT_FSCK_METADATA_BATCH];
+  gsize lengths[OT_FSCK_METADATA_BATCH];
+  guchar digests[OT_FSCK_METADATA_BATCH * 32];
+  guint i;
+
+  g_assert (metadata->len <= OT_FSCK_METADATA_BATCH);
+
+  for (i = 0; i < metadata->len; i++)
+    {
+      buffers[i] = g_variant_get_data (metadata->pdata[i]);
+      lengths[i] = g_variant_get_size (metadata->pdata[i]);
+    }
+
+  ot_checksum_many (metadata->len, buffers, lengths, digests);
+
+  for (i = 0; i < metadata->len; i++)
+    {
+      const char *checksum;
+      OstreeObjectType objtype;
+      char actual_checksum[65];
+
+      ostree_object_name_deserialize (names->pdata[i], &checksum, &objtype);
+      ostree_checksum_inplace_from_bytes (digests + i * 32, actual_checksum);
+      if (strcmp (checksum, actual_checksum) != 0)
+        {
+          if (!handle_corrupted_object (data, objects, names->pdata[i], actual_checksum,
+                                        cancellable, error))
+            goto out;
+        }
+    }
+
+  ret = TRUE;
+ out:
+  g_ptr_array_set_size (names, 0);
+  g_ptr_array_set_size (metadata, 0);
   return ret;
 }
 
 static gboolean
 fsck_reachable_objects_from_commits (OtFsckData            *data,
+                                     GHashTable            *objects,
                                      GHashTable            *commits,
                                      GCancellable          *cancellable,
                                      GError               **error)
@@ -172,6 +734,8 @@ fsck_reachable_objects_from_commits (OtFsckData            *data,
   GHashTableIter hash_iter;
   gpointer key, value;
   ot_lhash GHashTable *reachable_objects = NULL;
+  ot_lptrarray GPtrArray *pending_names = NULL;
+  ot_lptrarray GPtrArray *pending_metadata = NULL;
   ot_lobj GInputStream *input = NULL;
   ot_lobj GFileInfo *file_info = NULL;
   ot_lvariant GVariant *xattrs = NULL;
@@ -180,6 +744,8 @@ fsck_reachable_objects_from_commits (OtFsckData            *data,
   ot_lfree char *tmp_checksum = NULL;
 
   reachable_objects = ostree_traverse_new_reachable ();
+  pending_names = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+  pending_metadata = g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
 
   g_hash_table_iter_init (&hash_iter, commits);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
@@ -203,9 +769,21 @@ fsck_reachable_objects_from_commits (OtFsckData            *data,
       GVariant *serialized_key = key;
       const char *checksum;
       OstreeObjectType objtype;
+      gboolean unchanged;
 
       ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
 
+      if (!check_object_unchanged (data, objects, serialized_key, checksum, objtype,
+                                   &unchanged, error))
+        goto out;
+
+      if (unchanged)
+        {
+          data->n_skipped_objects++;
+          continue;
+        }
+      data->n_objects++;
+
       g_clear_object (&input);
       g_clear_object (&file_info);
       g_clear_pointer (&xattrs, (GDestroyNotify) g_variant_unref);
@@ -248,10 +826,16 @@ fsck_reachable_objects_from_commits (OtFsckData            *data,
             }
           else
             g_assert_not_reached ();
-          
-          input = g_memory_input_stream_new_from_data (g_variant_get_data (metadata),
-                                                       g_variant_get_size (metadata),
-                                                       NULL);
+
+          g_ptr_array_add (pending_names, g_variant_ref (serialized_key));
+          g_ptr_array_add (pending_metadata, g_variant_ref (metadata));
+          if (pending_metadata->len == OT_FSCK_METADATA_BATCH)
+            {
+              if (!fsck_metadata_batch (data, objects, pending_names, pending_metadata,
+                                        cancellable, error))
+                goto out;
+            }
+          continue;
         }
       else if (objtype == OSTREE_OBJECT_TYPE_FILE)
         {
@@ -285,14 +869,16 @@ fsck_reachable_objects_from_commits (OtFsckData            *data,
       tmp_checksum = ostree_checksum_from_bytes (computed_csum);
       if (strcmp (checksum, tmp_checksum) != 0)
         {
-          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "corrupted object %s.%s; actual checksum: %s",
-                       checksum, ostree_object_type_to_string (objtype),
-                       tmp_checksum);
-          goto out;
+          if (!handle_corrupted_object (data, objects, serialized_key, tmp_checksum,
+                                        cancellable, error))
+            goto out;
         }
     }
 
+  if (!fsck_metadata_batch (data, objects, pending_names, pending_metadata,
+                            cancellable, error))
+    goto out;
+
   ret = TRUE;
  out:
   return ret;
@@ -311,6 +897,8 @@ ostree_builtin_fsck (int argc, char **argv, GFile *repo_path, GError **error)
   ot_lhash GHashTable *objects = NULL;
   ot_lhash GHashTable *commits = NULL;
 
+  memset (&data, 0, sizeof (data));
+
   context = g_option_context_new ("- Check the repository for consistency");
   g_option_context_add_main_entries (context, options, NULL);
 
@@ -320,9 +908,22 @@ ostree_builtin_fsck (int argc, char **argv, GFile *repo_path, GError **error)
   repo = ostree_repo_new (repo_path);
   if (!ostree_repo_check (repo, error))
     goto out;
+  /* Every packed object gets read */
+  ostree_repo_set_sequential_pack_access (repo, TRUE);
 
-  memset (&data, 0, sizeof (data));
   data.repo = repo;
+  data.new_loose_journal = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                  (GDestroyNotify)g_variant_unref,
+                                                  (GDestroyNotify)g_variant_unref);
+  data.new_pack_journal = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free,
+                                                 (GDestroyNotify)g_variant_unref);
+  data.new_verified_packed = g_hash_table_new_full (ostree_hash_object_name, g_variant_equal,
+                                                    (GDestroyNotify)g_variant_unref, NULL);
+  data.unchanged_packs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!load_journal (&data, cancellable, error))
+    goto out;
 
   g_print ("Enumerating objects...\n");
 
@@ -347,22 +948,38 @@ ostree_builtin_fsck (int argc, char **argv, GFile *repo_path, GError **error)
         g_hash_table_insert (commits, g_variant_ref (serialized_key), serialized_key);
     }
 
-  g_clear_pointer (&objects, (GDestroyNotify) g_hash_table_unref);
+  /* Pack files go first, so objects in packs verified by a previous
+   * run can be skipped.
+   */
+  g_print ("Verifying structure of pack files...\n");
+
+  if (!fsck_pack_files (&data, cancellable, error))
+    goto out;
 
   g_print ("Verifying content integrity of %u commit objects...\n",
            (guint)g_hash_table_size (commits));
 
-  if (!fsck_reachable_objects_from_commits (&data, commits, cancellable, error))
+  if (!fsck_reachable_objects_from_commits (&data, objects, commits, cancellable, error))
     goto out;
 
-  g_print ("Verifying structure of pack files...\n");
-
-  if (!fsck_pack_files (&data, cancellable, error))
+  if (!save_journal (&data, cancellable, error))
     goto out;
 
+  if (!quiet)
+    g_print ("Verified %u objects and %u pack files; %u objects and %u pack files unchanged since last run\n",
+             data.n_objects, data.n_pack_files,
+             data.n_skipped_objects, data.n_skipped_pack_files);
+
   ret = TRUE;
  out:
   if (context)
     g_option_context_free (context);
+  g_clear_pointer (&data.old_loose_journal, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.old_pack_journal, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.old_verified_packed, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.new_loose_journal, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.new_pack_journal, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.new_verified_packed, (GDestroyNotify) g_hash_table_unref);
+  g_clear_pointer (&data.unchanged_packs, (GDestroyNotify) g_hash_table_unref);
   return ret;
 }
@@ -101,7 +101,7 @@ static gboolean
 write_bytes_update_checksum (GOutputStream *output,
                              gconstpointer  bytes,
                              gsize          len,
-                             GChecksum     *checksum,
+                             OtChecksum    *checksum,
                              guint64       *inout_offset,
                              GCancellable  *cancellable,
                              GError       **error)
@@ -111,7 +111,7 @@ write_bytes_update_checksum (GOutputStream *output,
 
   if (len > 0)
     {
-      g_checksum_update (checksum, (guchar*) bytes, len);
+      ot_checksum_update (checksum, (guchar*) bytes, len);
       if (!g_output_stream_write_all (output, bytes, len, &bytes_written,
                                       cancellable, error))
         goto out;
@@ -127,7 +127,7 @@ write_bytes_update_checksum (GOutputStream *output,
 static gboolean
 write_padding (GOutputStream    *output,
                guint             alignment,
-               GChecksum        *checksum,
+               OtChecksum       *checksum,
                guint64          *inout_offset,
                GCancellable     *cancellable,
                GError          **error)
@@ -320,6 +320,8 @@ pack_one_data_object (OtRepackData        *data,
 
   switch (data->int_compression)
     {
+    case OT_COMPRESSION_NONE:
+      break;
     case OT_COMPRESSION_GZIP:
       {
         entry_flags |= OSTREE_PACK_FILE_ENTRY_FLAG_GZIP;
@@ -327,7 +329,9 @@ pack_one_data_object (OtRepackData        *data,
       }
     default:
       {
-        g_assert_not_reached ();
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                     "Unsupported internal compression");
+        goto out;
       }
     }
 
@@ -400,11 +404,14 @@ create_pack_file (OtRepackData        *data,
   ot_lobj GFile *pack_file_path = NULL;
   ot_lobj GFile *pack_index_path = NULL;
   GVariantBuilder index_content_builder;
-  GChecksum *pack_checksum = NULL;
+  OtChecksum pack_checksum;
+  guchar pack_digest[32];
 
   if (g_cancellable_set_error_if_cancelled (cancellable, error))
     return FALSE;
 
+  ot_checksum_init (&pack_checksum);
+
   if (!ostree_create_temp_regular_file (ostree_repo_get_tmpdir (data->repo),
                                         "pack-index", NULL,
                                         &index_temppath,
@@ -422,14 +429,13 @@ create_pack_file (OtRepackData        *data,
   index_content_list = g_ptr_array_new_with_free_func ((GDestroyNotify)g_variant_unref);
 
   offset = 0;
-  pack_checksum = g_checksum_new (G_CHECKSUM_SHA256);
 
   pack_header = g_variant_new ("(s@a{sv}t)",
                                is_meta ? "OSTv0PACKMETAFILE" : "OSTv0PACKDATAFILE",
                                g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0),
                                (guint64)objects->len);
 
-  if (!ostree_write_variant_with_size (pack_out, pack_header, offset, &bytes_written, pack_checksum,
+  if (!ostree_write_variant_with_size (pack_out, pack_header, offset, &bytes_written, &pack_checksum,
                                        cancellable, error))
     goto out;
   offset += bytes_written;
@@ -461,7 +467,7 @@ create_pack_file (OtRepackData        *data,
             goto out;
         }
 
-      if (!write_padding (pack_out, 4, pack_checksum, &offset, cancellable, error))
+      if (!write_padding (pack_out, 4, &pack_checksum, &offset, cancellable, error))
         goto out;
 
       /* offset points to aligned header size */
@@ -474,7 +480,7 @@ create_pack_file (OtRepackData        *data,
       
       bytes_written = 0;
       if (!ostree_write_variant_with_size (pack_out, packed_object, offset, &bytes_written, 
-                                           pack_checksum, cancellable, error))
+                                           &pack_checksum, cancellable, error))
         goto out;
       offset += bytes_written;
     }
@@ -505,8 +511,11 @@ create_pack_file (OtRepackData        *data,
   if (!g_output_stream_close (index_out, cancellable, error))
     goto out;
 
+  ot_checksum_get_digest (&pack_checksum, pack_digest);
+  pack_name = ostree_checksum_from_bytes (pack_digest);
+
   if (!ostree_repo_add_pack_file (data->repo,
-                                  g_checksum_get_string (pack_checksum),
+                                  pack_name,
                                   is_meta,
                                   index_temppath,
                                   pack_temppath,
@@ -517,7 +526,7 @@ create_pack_file (OtRepackData        *data,
   if (!ostree_repo_regenerate_pack_index (data->repo, cancellable, error))
     goto out;
 
-  g_print ("Created pack file '%s' with %u objects\n", g_checksum_get_string (pack_checksum), objects->len);
+  g_print ("Created pack file '%s' with %u objects\n", pack_name, objects->len);
 
   if (!opt_keep_all_loose)
     {
@@ -544,8 +553,7 @@ create_pack_file (OtRepackData        *data,
     (void) unlink (ot_gfile_get_path_cached (index_temppath));
   if (pack_temppath)
     (void) unlink (ot_gfile_get_path_cached (pack_temppath));
-  if (pack_checksum)
-    g_checksum_free (pack_checksum);
+  ot_checksum_clear (&pack_checksum);
   return ret;
 }
 
@@ -77,17 +77,15 @@ prune_loose_object (OtPruneData    *data,
 {
   gboolean ret = FALSE;
   ot_lvariant GVariant *key = NULL;
-  ot_lobj GFile *objf = NULL;
 
   key = ostree_object_name_serialize (checksum, objtype);
 
-  objf = ostree_repo_get_object_path (data->repo, checksum, objtype);
-
   if (!g_hash_table_lookup_extended (data->reachable, key, NULL, NULL))
     {
       if (delete)
         {
-          if (!ot_gfile_unlink (objf, cancellable, error))
+          if (!ostree_repo_delete_object (data->repo, objtype, checksum,
+                                          cancellable, error))
             goto out;
           g_print ("Deleted: %s.%s\n", checksum, ostree_object_type_to_string (objtype));
         }
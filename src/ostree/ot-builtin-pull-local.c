@@ -27,6 +27,9 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define OT_PULL_LOCAL_IMPORT_THREADS 4
 
 static GOptionEntry options[] = {
   { NULL }
@@ -35,6 +38,15 @@ static GOptionEntry options[] = {
 typedef struct {
   OstreeRepo *src_repo;
   OstreeRepo *dest_repo;
+
+  /* Cleared once link() fails across filesystems */
+  volatile gint can_hardlink;
+
+  volatile gint n_linked;
+  volatile gint n_imported;
+
+  GCancellable *cancellable;
+  GError * volatile first_error;
 } OtLocalCloneData;
 
 static gboolean
@@ -91,6 +103,255 @@ import_one_object (OtLocalCloneData *data,
   return ret;
 }
 
+static void
+import_object_thread (gpointer     item,
+                      gpointer     user_data)
+{
+  OtLocalCloneData *data = user_data;
+  GVariant *serialized_key = item;
+  GError *local_error = NULL;
+  const char *checksum;
+  OstreeObjectType objtype;
+  gboolean linked = FALSE;
+
+  if (g_atomic_pointer_get (&data->first_error) != NULL)
+    return;
+
+  ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+
+  if (g_atomic_int_get (&data->can_hardlink))
+    {
+      if (!ostree_repo_stage_object_link (data->dest_repo, data->src_repo, objtype, checksum,
+                                          &linked, data->cancellable, &local_error))
+        {
+          /* Only stop trying for the rest if linking can't work at all */
+          if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED))
+            g_atomic_int_set (&data->can_hardlink, FALSE);
+          else if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED))
+            goto out;
+          g_clear_error (&local_error);
+        }
+    }
+
+  if (linked)
+    g_atomic_int_inc (&data->n_linked);
+  else
+    {
+      if (!import_one_object (data, checksum, objtype, data->cancellable, &local_error))
+        goto out;
+      g_atomic_int_inc (&data->n_imported);
+    }
+
+ out:
+  if (local_error)
+    {
+      if (!g_atomic_pointer_compare_and_exchange (&data->first_error, NULL, local_error))
+        g_error_free (local_error);
+    }
+}
+
+/*
+ * Hardlink or copy @relpath of the source repository into the
+ * temporary directory of the destination.
+ */
+static gboolean
+copy_pack_file (OtLocalCloneData *data,
+                const char       *relpath,
+                GFile           **out_temp_path,
+                GCancellable     *cancellable,
+                GError          **error)
+{
+  gboolean ret = FALSE;
+  ot_lobj GFile *src = NULL;
+  ot_lobj GFile *ret_temp_path = NULL;
+  ot_lfree char *basename = NULL;
+  ot_lfree char *temp_name = NULL;
+
+  src = g_file_resolve_relative_path (ostree_repo_get_path (data->src_repo), relpath);
+  basename = g_file_get_basename (src);
+  /* Other imports may be copying the same pack */
+  temp_name = g_strdup_printf ("pack-%08x%08x-%s", g_random_int (), g_random_int (), basename);
+  ret_temp_path = g_file_get_child (ostree_repo_get_tmpdir (data->dest_repo), temp_name);
+
+  if (!(g_atomic_int_get (&data->can_hardlink)
+        && link (ot_gfile_get_path_cached (src), ot_gfile_get_path_cached (ret_temp_path)) == 0))
+    {
+      if (!g_file_copy (src, ret_temp_path, G_FILE_COPY_NOFOLLOW_SYMLINKS,
+                        cancellable, NULL, NULL, error))
+        goto out;
+    }
+
+  ret = TRUE;
+  ot_transfer_out_value (out_temp_path, &ret_temp_path);
+ out:
+  return ret;
+}
+
+static gboolean
+copy_packs (OtLocalCloneData *data,
+            GHashTable       *packs,
+            gboolean          is_meta,
+            GCancellable     *cancellable,
+            GError          **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&hash_iter, packs);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      const char *pack_checksum = key;
+      ot_lfree char *index_relpath = NULL;
+      ot_lfree char *data_relpath = NULL;
+      ot_lobj GFile *index_temp_path = NULL;
+      ot_lobj GFile *data_temp_path = NULL;
+
+      index_relpath = ostree_get_relative_pack_index_path (is_meta, pack_checksum);
+      if (!copy_pack_file (data, index_relpath, &index_temp_path, cancellable, error))
+        goto out;
+      data_relpath = ostree_get_relative_pack_data_path (is_meta, pack_checksum);
+      if (!copy_pack_file (data, data_relpath, &data_temp_path, cancellable, error))
+        goto out;
+
+      if (!ostree_repo_add_pack_file (data->dest_repo, pack_checksum, is_meta,
+                                      index_temp_path, data_temp_path,
+                                      cancellable, error))
+        goto out;
+    }
+
+  ret = TRUE;
+ out:
+  return ret;
+}
+
+static GHashTable *
+new_pack_set (GPtrArray *pack_checksums)
+{
+  GHashTable *ret = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  guint i;
+
+  for (i = 0; pack_checksums && i < pack_checksums->len; i++)
+    {
+      char *pack_checksum = g_strdup (pack_checksums->pdata[i]);
+      g_hash_table_replace (ret, pack_checksum, pack_checksum);
+    }
+  return ret;
+}
+
+/*
+ * When both repositories have the same mode, objects the source only
+ * has in packs are best copied by taking the whole pack.  Pick a pack
+ * of the source itself (not of its parent) that the destination
+ * doesn't have yet for each such object in @objects_to_copy, and
+ * remove the objects those packs provide from the set.
+ */
+static gboolean
+find_packs_to_copy (OtLocalCloneData *data,
+                    GHashTable       *objects_to_copy,
+                    GHashTable      **out_meta_packs,
+                    GHashTable      **out_data_packs,
+                    GCancellable     *cancellable,
+                    GError          **error)
+{
+  gboolean ret = FALSE;
+  GHashTableIter hash_iter;
+  gpointer key, value;
+  ot_lhash GHashTable *src_objects = NULL;
+  ot_lhash GHashTable *src_meta_packs = NULL;
+  ot_lhash GHashTable *src_data_packs = NULL;
+  ot_lhash GHashTable *ret_meta_packs = NULL;
+  ot_lhash GHashTable *ret_data_packs = NULL;
+  ot_lptrarray GPtrArray *meta_indexes = NULL;
+  ot_lptrarray GPtrArray *data_indexes = NULL;
+  ot_lptrarray GPtrArray *dest_meta_indexes = NULL;
+  ot_lptrarray GPtrArray *dest_data_indexes = NULL;
+  guint i;
+
+  ret_meta_packs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  ret_data_packs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  if (!ostree_repo_list_pack_indexes (data->src_repo, &meta_indexes, &data_indexes,
+                                      cancellable, error))
+    goto out;
+  if (meta_indexes->len == 0 && data_indexes->len == 0)
+    goto done;
+
+  if (!ostree_repo_list_pack_indexes (data->dest_repo, &dest_meta_indexes, &dest_data_indexes,
+                                      cancellable, error))
+    goto out;
+
+  src_meta_packs = new_pack_set (meta_indexes);
+  src_data_packs = new_pack_set (data_indexes);
+  for (i = 0; i < dest_meta_indexes->len; i++)
+    g_hash_table_remove (src_meta_packs, dest_meta_indexes->pdata[i]);
+  for (i = 0; i < dest_data_indexes->len; i++)
+    g_hash_table_remove (src_data_packs, dest_data_indexes->pdata[i]);
+
+  if (!ostree_repo_list_objects (data->src_repo, OSTREE_REPO_LIST_OBJECTS_ALL, &src_objects,
+                                 cancellable, error))
+    goto out;
+
+  g_hash_table_iter_init (&hash_iter, objects_to_copy);
+  while (g_hash_table_iter_next (&hash_iter, &key, &value))
+    {
+      GVariant *serialized_key = key;
+      GVariant *objdata;
+      GVariantIter *pack_array_iter;
+      const char *checksum;
+      const char *pack_checksum;
+      OstreeObjectType objtype;
+      gboolean is_loose;
+      GHashTable *src_packs;
+      GHashTable *target_packs;
+
+      objdata = g_hash_table_lookup (src_objects, serialized_key);
+      if (!objdata)
+        continue;
+
+      g_variant_get (objdata, "(bas)", &is_loose, &pack_array_iter);
+      if (is_loose)
+        {
+          g_variant_iter_free (pack_array_iter);
+          continue;
+        }
+
+      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+      if (OSTREE_OBJECT_TYPE_IS_META (objtype))
+        {
+          src_packs = src_meta_packs;
+          target_packs = ret_meta_packs;
+        }
+      else
+        {
+          src_packs = src_data_packs;
+          target_packs = ret_data_packs;
+        }
+
+      while (g_variant_iter_next (pack_array_iter, "&s", &pack_checksum))
+        {
+          if (g_hash_table_lookup (src_packs, pack_checksum))
+            {
+              if (!g_hash_table_lookup (target_packs, pack_checksum))
+                {
+                  char *duped_checksum = g_strdup (pack_checksum);
+                  g_hash_table_replace (target_packs, duped_checksum, duped_checksum);
+                }
+              g_hash_table_iter_remove (&hash_iter);
+              break;
+            }
+        }
+      g_variant_iter_free (pack_array_iter);
+    }
+
+ done:
+  ret = TRUE;
+  ot_transfer_out_value (out_meta_packs, &ret_meta_packs);
+  ot_transfer_out_value (out_data_packs, &ret_data_packs);
+ out:
+  return ret;
+}
+
 gboolean
 ostree_builtin_pull_local (int argc, char **argv, GFile *repo_path, GError **error)
 {
@@ -110,6 +371,9 @@ ostree_builtin_pull_local (int argc, char **argv, GFile *repo_path, GError **err
   ot_lhash GHashTable *refs_to_clone = NULL;
   ot_lhash GHashTable *source_objects = NULL;
   ot_lhash GHashTable *objects_to_copy = NULL;
+  ot_lhash GHashTable *meta_packs = NULL;
+  ot_lhash GHashTable *data_packs = NULL;
+  GThreadPool *pool = NULL;
   OtLocalCloneData data;
 
   context = g_option_context_new ("SRC_REPO [REFS...] -  Copy data from SRC_REPO");
@@ -140,6 +404,7 @@ ostree_builtin_pull_local (int argc, char **argv, GFile *repo_path, GError **err
   data.src_repo = ostree_repo_new (src_f);
   if (!ostree_repo_check (data.src_repo, error))
     goto out;
+  ostree_repo_set_sequential_pack_access (data.src_repo, TRUE);
 
   src_repo_dir = g_object_ref (ostree_repo_get_path (data.src_repo));
   dest_repo_dir = g_object_ref (ostree_repo_get_path (data.dest_repo));
@@ -200,20 +465,55 @@ ostree_builtin_pull_local (int argc, char **argv, GFile *repo_path, GError **err
 
   if (!ostree_repo_prepare_transaction (data.dest_repo, cancellable, error))
     goto out;
-  
+
+  /* Objects of a repository in the same mode are already in the
+   * destination format and verified; take them as they are.
+   */
+  if (ostree_repo_get_mode (data.src_repo) == ostree_repo_get_mode (data.dest_repo))
+    {
+      data.can_hardlink = TRUE;
+
+      if (!find_packs_to_copy (&data, objects_to_copy, &meta_packs, &data_packs,
+                               cancellable, error))
+        goto out;
+
+      if (g_hash_table_size (meta_packs) > 0 || g_hash_table_size (data_packs) > 0)
+        {
+          g_print ("Copying %u packs\n",
+                   g_hash_table_size (meta_packs) + g_hash_table_size (data_packs));
+          if (!copy_packs (&data, meta_packs, TRUE, cancellable, error))
+            goto out;
+          if (!copy_packs (&data, data_packs, FALSE, cancellable, error))
+            goto out;
+          if (!ostree_repo_regenerate_pack_index (data.dest_repo, cancellable, error))
+            goto out;
+        }
+    }
+
+  data.cancellable = cancellable;
+  pool = g_thread_pool_new (import_object_thread, &data,
+                            OT_PULL_LOCAL_IMPORT_THREADS, FALSE, error);
+  if (!pool)
+    goto out;
+
   g_hash_table_iter_init (&hash_iter, objects_to_copy);
   while (g_hash_table_iter_next (&hash_iter, &key, &value))
-    {
-      GVariant *serialized_key = key;
-      const char *checksum;
-      OstreeObjectType objtype;
+    g_thread_pool_push (pool, key, NULL);
 
-      ostree_object_name_deserialize (serialized_key, &checksum, &objtype);
+  /* Waits for all objects to be imported */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  pool = NULL;
 
-      if (!import_one_object (&data, checksum, objtype, cancellable, error))
-        goto out;
+  if (data.first_error)
+    {
+      g_propagate_error (error, data.first_error);
+      data.first_error = NULL;
+      goto out;
     }
 
+  if (data.n_linked > 0)
+    g_print ("Linked %d objects, imported %d\n", data.n_linked, data.n_imported);
+
   if (!ostree_repo_commit_transaction (data.dest_repo, NULL, error))
     goto out;
 
@@ -231,6 +531,10 @@ ostree_builtin_pull_local (int argc, char **argv, GFile *repo_path, GError **err
 
   ret = TRUE;
  out:
+  if (pool)
+    g_thread_pool_free (pool, TRUE, TRUE);
+  if (data.first_error)
+    g_error_free (data.first_error);
   if (data.src_repo)
     g_object_unref (data.src_repo);
   if (data.dest_repo)
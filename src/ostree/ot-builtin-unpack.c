@@ -153,6 +153,7 @@ ostree_builtin_unpack (int argc, char **argv, GFile *repo_path, GError **error)
   repo = ostree_repo_new (repo_path);
   if (!ostree_repo_check (repo, error))
     goto out;
+  ostree_repo_set_sequential_pack_access (repo, TRUE);
 
   if (ostree_repo_get_mode (repo) != OSTREE_REPO_MODE_ARCHIVE)
     {
@@ -27,6 +27,7 @@
 #include <string.h>
 
 #include "ot-main.h"
+#include "ostree.h"
 #include "otutil.h"
 
 int
@@ -40,7 +41,7 @@ ostree_usage (char **argv, OstreeBuiltin *builtins, gboolean is_error)
   else
     print_func = g_print;
 
-  print_func ("usage: %s --repo=PATH COMMAND [options]\n",
+  print_func ("usage: %s [--stats] --repo=PATH COMMAND [options]\n",
               argv[0]);
   print_func ("Builtin commands:\n");
 
@@ -52,6 +53,57 @@ ostree_usage (char **argv, OstreeBuiltin *builtins, gboolean is_error)
   return (is_error ? 1 : 0);
 }
 
+/*
+ * Remove a --stats option given before the command name (among the
+ * leading --repo= and --stats arguments) from @argv.  Later
+ * arguments belong to the builtin and are left alone.
+ *
+ * Returns: %TRUE if it was given
+ */
+static gboolean
+take_stats_option (int    *argc,
+                   char  **argv)
+{
+  gboolean ret = FALSE;
+  int i, j;
+
+  for (i = 1, j = 1; i < *argc; i++)
+    {
+      if (strcmp (argv[i], "--stats") == 0)
+        ret = TRUE;
+      else if (g_str_has_prefix (argv[i], "--repo="))
+        argv[j++] = argv[i];
+      else
+        {
+          for (; i < *argc; i++)
+            argv[j++] = argv[i];
+          break;
+        }
+    }
+  argv[j] = NULL;
+  *argc = j;
+
+  return ret;
+}
+
+/* Print the counters of the repositories used by the command as JSON,
+ * including any the builtin didn't release
+ */
+static void
+print_stats (void)
+{
+  guint64 values[OSTREE_REPO_N_STATS];
+  guint i;
+
+  ostree_repo_get_total_stats (values);
+
+  g_printerr ("{");
+  for (i = 0; i < OSTREE_REPO_N_STATS; i++)
+    g_printerr ("%s\"%s\": %" G_GUINT64_FORMAT, i > 0 ? ", " : "",
+                ostree_repo_stat_to_string (i), values[i]);
+  g_printerr ("}\n");
+}
+
 static void
 prep_builtin_argv (const char *builtin,
                    int argc,
@@ -84,6 +136,7 @@ ostree_run (int    argc,
   char **cmd_argv = NULL;
   gboolean am_root;
   gboolean have_repo_arg;
+  gboolean stats;
   const char *binname = NULL;
   const char *slash = NULL;
   const char *cmd = NULL;
@@ -98,6 +151,10 @@ ostree_run (int    argc,
 
   g_set_prgname (argv[0]);
 
+  stats = take_stats_option (&argc, argv);
+  if (stats)
+    ostree_repo_set_default_collect_stats (TRUE);
+
   if (argc < 2)
     return ostree_usage (argv, builtins, 1);
 
@@ -169,6 +226,8 @@ ostree_run (int    argc,
     goto out;
 
  out:
+  if (stats)
+    print_stats ();
   g_free (cmd_argv);
   g_clear_object (&repo_file);
   if (error)
@@ -0,0 +1,146 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Measure SHA-256 throughput
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "otutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Usage: ostree-bench-checksum [MEGABYTES] [SMALL-SIZE]
+ *
+ * Checksums MEGABYTES (default 256) of data in OT_CHECKSUM_BUFFER_SIZE
+ * chunks with OtChecksum and with GChecksum, then the same amount as
+ * buffers of SMALL-SIZE bytes (default 512, about the size of a
+ * metadata object) with ot_checksum_many() and with a GChecksum per
+ * buffer, and prints the throughput of each in MB/s.
+ */
+
+#define SMALL_BATCH 16
+
+static void
+print_rate (const char  *name,
+            gsize        total,
+            GTimer      *timer)
+{
+  g_print ("%-24s %8.1f MB/s\n", name,
+           total / (1024.0 * 1024.0) / g_timer_elapsed (timer, NULL));
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  guint megabytes;
+  gsize small_size;
+  gsize total;
+  gsize offset;
+  gsize len;
+  guchar *data;
+  guchar digest[32];
+  guchar ot_digest[32];
+  guchar digests[SMALL_BATCH * 32];
+  const guchar *buffers[SMALL_BATCH];
+  gsize lengths[SMALL_BATCH];
+  char *name;
+  GTimer *timer;
+  GChecksum *gchecksum;
+  OtChecksum checksum;
+  guint i;
+
+  megabytes = argc > 1 ? (guint) strtoul (argv[1], NULL, 10) : 256;
+  small_size = argc > 2 ? (gsize) strtoul (argv[2], NULL, 10) : 512;
+  megabytes = MAX (megabytes, 1);
+  small_size = MAX (small_size, 1);
+
+  total = (gsize)megabytes * 1024 * 1024;
+  data = g_malloc (OT_CHECKSUM_BUFFER_SIZE);
+  for (i = 0; i < OT_CHECKSUM_BUFFER_SIZE; i++)
+    data[i] = (guchar) (i * 2654435761U >> 24);
+  timer = g_timer_new ();
+
+  g_timer_start (timer);
+  ot_checksum_init (&checksum);
+  for (offset = 0; offset < total; offset += OT_CHECKSUM_BUFFER_SIZE)
+    ot_checksum_update (&checksum, data, OT_CHECKSUM_BUFFER_SIZE);
+  ot_checksum_get_digest (&checksum, ot_digest);
+  ot_checksum_clear (&checksum);
+  g_timer_stop (timer);
+  name = g_strdup_printf ("OtChecksum (%s)", ot_checksum_get_implementation ());
+  print_rate (name, total, timer);
+  g_free (name);
+
+  g_timer_start (timer);
+  gchecksum = g_checksum_new (G_CHECKSUM_SHA256);
+  for (offset = 0; offset < total; offset += OT_CHECKSUM_BUFFER_SIZE)
+    g_checksum_update (gchecksum, data, OT_CHECKSUM_BUFFER_SIZE);
+  len = sizeof (digest);
+  g_checksum_get_digest (gchecksum, digest, &len);
+  g_checksum_free (gchecksum);
+  g_timer_stop (timer);
+  print_rate ("GChecksum", total, timer);
+
+  if (memcmp (digest, ot_digest, sizeof (digest)) != 0)
+    {
+      g_printerr ("OtChecksum and GChecksum disagree\n");
+      return 1;
+    }
+
+  small_size = MIN (small_size, OT_CHECKSUM_BUFFER_SIZE / SMALL_BATCH);
+  for (i = 0; i < SMALL_BATCH; i++)
+    {
+      buffers[i] = data + i * small_size;
+      lengths[i] = small_size;
+    }
+
+  g_timer_start (timer);
+  for (offset = 0; offset < total; offset += SMALL_BATCH * small_size)
+    ot_checksum_many (SMALL_BATCH, buffers, lengths, digests);
+  g_timer_stop (timer);
+  print_rate ("ot_checksum_many", total, timer);
+
+  g_timer_start (timer);
+  for (offset = 0; offset < total; offset += SMALL_BATCH * small_size)
+    {
+      for (i = 0; i < SMALL_BATCH; i++)
+        {
+          len = sizeof (digest);
+          gchecksum = g_checksum_new (G_CHECKSUM_SHA256);
+          g_checksum_update (gchecksum, buffers[i], lengths[i]);
+          g_checksum_get_digest (gchecksum, digest, &len);
+          g_checksum_free (gchecksum);
+        }
+    }
+  g_timer_stop (timer);
+  print_rate ("GChecksum per buffer", total, timer);
+
+  if (memcmp (digest, digests + (SMALL_BATCH - 1) * 32, sizeof (digest)) != 0)
+    {
+      g_printerr ("ot_checksum_many and GChecksum disagree\n");
+      return 1;
+    }
+
+  g_timer_destroy (timer);
+  g_free (data);
+  return 0;
+}
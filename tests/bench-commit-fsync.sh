@@ -0,0 +1,50 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+# Compare commit throughput with core.fsync off and on.
+# Usage: bench-commit-fsync.sh [NUMBER-OF-FILES]
+
+set -e
+
+. libtest.sh
+
+n_files=${1:-10000}
+
+mkdir files
+cd files
+for i in `seq $n_files`; do
+    d=dir$((i % 100))
+    test -d $d || mkdir $d
+    echo "content $i" > $d/file$i
+done
+cd ..
+
+for fsync in false true; do
+    rm -rf repo-$fsync
+    mkdir repo-$fsync
+    ostree --repo=repo-$fsync init
+    ostree --repo=repo-$fsync config set core.fsync $fsync
+    cd files
+    start=`date +%s.%N`
+    ostree --repo=../repo-$fsync commit -b bench -s "Benchmark" > /dev/null
+    end=`date +%s.%N`
+    cd ..
+    n_objects=`find repo-$fsync/objects -type f | wc -l`
+    echo "fsync=$fsync: $n_objects objects in `echo "$end - $start" | bc` s, `echo "$n_objects / ($end - $start)" | bc` objects/s"
+done
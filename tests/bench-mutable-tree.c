@@ -0,0 +1,148 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Measure OstreeMutableTree heap use per entry
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ostree.h"
+#include "otutil.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Usage: ostree-bench-mutable-tree [FILES] [PER-DIR]
+ *
+ * Builds an OstreeMutableTree of FILES (default 100000) files spread
+ * over directories of PER-DIR (default 50) files each, and prints the
+ * heap growth per file.  Every file has a distinct name, so sharing
+ * of names between directories doesn't make the figure look better
+ * than it would be for a real tree.  Only API which libostree has
+ * always had is used, so to compare with an older version, build
+ * this file against it.  Run it under valgrind --tool=massif for a
+ * second opinion.
+ */
+
+/* Bytes of heap in use; without mallinfo2(), the resident set size */
+static gsize
+heap_in_use (void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 info = mallinfo2 ();
+  return info.uordblks + info.hblkhd;
+#else
+  FILE *f;
+  unsigned long size = 0;
+  unsigned long resident = 0;
+
+  f = fopen ("/proc/self/statm", "r");
+  if (f)
+    {
+      if (fscanf (f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+      fclose (f);
+    }
+  return (gsize)resident * sysconf (_SC_PAGESIZE);
+#endif
+}
+
+static void
+make_checksum (guint  n,
+               char  *buf)
+{
+  guchar csum[32];
+  guint i;
+
+  for (i = 0; i < sizeof (csum); i++)
+    csum[i] = (guchar) ((n + i) * 2654435761U >> 24);
+  ostree_checksum_inplace_from_bytes (csum, buf);
+}
+
+static void
+print_usage (const char *name,
+             gsize       before,
+             gsize       after,
+             guint       n_files)
+{
+  g_print ("%-24s %8.1f bytes/file (%" G_GSIZE_FORMAT " KiB total)\n", name,
+           (double)(after - before) / n_files, (after - before) / 1024);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  guint n_files;
+  guint per_dir;
+  guint i;
+  gsize before;
+  gsize after;
+  char checksum[65];
+  char name[32];
+  OstreeMutableTree *root;
+  OstreeMutableTree *dir = NULL;
+
+  g_type_init ();
+
+  n_files = argc > 1 ? (guint) strtoul (argv[1], NULL, 10) : 100000;
+  per_dir = argc > 2 ? (guint) strtoul (argv[2], NULL, 10) : 50;
+  n_files = MAX (n_files, 1);
+  per_dir = MAX (per_dir, 1);
+
+  /* Warm up the type system and the quark table outside the measurement */
+  root = ostree_mutable_tree_new ();
+  g_object_unref (root);
+
+  before = heap_in_use ();
+  root = ostree_mutable_tree_new ();
+  for (i = 0; i < n_files; i++)
+    {
+      if (i % per_dir == 0)
+        {
+          g_clear_object (&dir);
+          g_snprintf (name, sizeof (name), "dir-%u", i / per_dir);
+          if (!ostree_mutable_tree_ensure_dir (root, name, &dir, error))
+            goto out;
+        }
+      make_checksum (i, checksum);
+      g_snprintf (name, sizeof (name), "file-%u", i);
+      if (!ostree_mutable_tree_replace_file (dir, name, checksum, error))
+        goto out;
+    }
+  g_clear_object (&dir);
+  after = heap_in_use ();
+  print_usage ("OstreeMutableTree", before, after, n_files);
+  g_object_unref (root);
+
+ out:
+  g_clear_object (&dir);
+  if (local_error)
+    {
+      g_printerr ("%s\n", local_error->message);
+      g_error_free (local_error);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,218 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Measure contention on the pack index and data caches
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "ostree.h"
+#include "otutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Usage: ostree-bench-pack-cache REPO [MAX-THREADS] [SECONDS]
+ *
+ * REPO must have packs (see "ostree pack").  For 1, 2, 4, ... up to
+ * MAX-THREADS threads, each thread repeatedly looks up the index and
+ * data mapping of every pack in turn, and the total number of lookups
+ * per second is printed.  Once the caches are warm, this measures
+ * only the cost of the cache itself.
+ */
+
+typedef struct {
+  OstreeRepo *repo;
+  GPtrArray *meta_indexes;
+  GPtrArray *data_indexes;
+  volatile gint stop;
+  GError * volatile first_error;
+} BenchData;
+
+static gboolean
+lookup_pack (OstreeRepo   *repo,
+             const char   *pack_checksum,
+             gboolean      is_meta,
+             GError      **error)
+{
+  gboolean ret = FALSE;
+  GMappedFile *map = NULL;
+  ot_lvariant GVariant *index_variant = NULL;
+
+  if (!ostree_repo_load_pack_index (repo, pack_checksum, is_meta,
+                                    &index_variant, NULL, error))
+    goto out;
+  if (!ostree_repo_map_pack_file (repo, pack_checksum, is_meta,
+                                  NULL, NULL, &map, NULL, error))
+    goto out;
+
+  ret = TRUE;
+ out:
+  if (map)
+    g_mapped_file_unref (map);
+  return ret;
+}
+
+static gpointer
+lookup_thread (gpointer user_data)
+{
+  BenchData *data = user_data;
+  GError *local_error = NULL;
+  guint64 n_lookups = 0;
+  guint n_packs = data->meta_indexes->len + data->data_indexes->len;
+  guint i = GPOINTER_TO_UINT (g_thread_self ()) % n_packs;
+
+  while (!g_atomic_int_get (&data->stop))
+    {
+      gboolean is_meta = i < data->meta_indexes->len;
+      const char *pack_checksum;
+
+      if (is_meta)
+        pack_checksum = data->meta_indexes->pdata[i];
+      else
+        pack_checksum = data->data_indexes->pdata[i - data->meta_indexes->len];
+
+      if (!lookup_pack (data->repo, pack_checksum, is_meta, &local_error))
+        {
+          if (!g_atomic_pointer_compare_and_exchange (&data->first_error, NULL, local_error))
+            g_error_free (local_error);
+          break;
+        }
+
+      n_lookups++;
+      i = (i + 1) % n_packs;
+    }
+
+  return GSIZE_TO_POINTER ((gsize) n_lookups);
+}
+
+static gboolean
+run_threads (BenchData  *data,
+             guint       n_threads,
+             guint       seconds,
+             GError    **error)
+{
+  gboolean ret = FALSE;
+  GThread **threads;
+  GTimer *timer;
+  guint64 n_lookups = 0;
+  guint i;
+
+  data->stop = 0;
+  threads = g_new0 (GThread *, n_threads);
+  timer = g_timer_new ();
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("bench-pack-cache", lookup_thread, data);
+
+  g_usleep ((gulong)seconds * G_USEC_PER_SEC);
+  g_atomic_int_set (&data->stop, 1);
+
+  for (i = 0; i < n_threads; i++)
+    n_lookups += (guint64) GPOINTER_TO_SIZE (g_thread_join (threads[i]));
+  g_timer_stop (timer);
+
+  if (data->first_error)
+    {
+      g_propagate_error (error, data->first_error);
+      data->first_error = NULL;
+      goto out;
+    }
+
+  g_print ("%u threads: %.0f lookups/s\n", n_threads,
+           n_lookups / g_timer_elapsed (timer, NULL));
+
+  ret = TRUE;
+ out:
+  g_timer_destroy (timer);
+  g_free (threads);
+  return ret;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  GError *local_error = NULL;
+  GError **error = &local_error;
+  BenchData data;
+  OstreeRepoPackCacheStats index_stats;
+  OstreeRepoPackCacheStats data_stats;
+  guint max_threads;
+  guint seconds;
+  guint n_threads;
+  ot_lobj GFile *repo_path = NULL;
+
+  g_type_init ();
+
+  memset (&data, 0, sizeof (data));
+
+  if (argc < 2)
+    {
+      g_printerr ("usage: %s REPO [MAX-THREADS] [SECONDS]\n", argv[0]);
+      return 1;
+    }
+
+  max_threads = argc > 2 ? (guint) strtoul (argv[2], NULL, 10) : 8;
+  seconds = argc > 3 ? (guint) strtoul (argv[3], NULL, 10) : 2;
+  max_threads = MAX (max_threads, 1);
+
+  repo_path = g_file_new_for_path (argv[1]);
+  data.repo = ostree_repo_new (repo_path);
+  if (!ostree_repo_check (data.repo, error))
+    goto out;
+
+  if (!ostree_repo_list_pack_indexes (data.repo, &data.meta_indexes, &data.data_indexes,
+                                      NULL, error))
+    goto out;
+  if (data.meta_indexes->len + data.data_indexes->len == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Repository has no packs");
+      goto out;
+    }
+
+  for (n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+    {
+      if (!run_threads (&data, n_threads, seconds, error))
+        goto out;
+    }
+
+  ostree_repo_get_pack_cache_stats (data.repo, &index_stats, &data_stats);
+  g_print ("index mappings: %u, hits: %" G_GUINT64_FORMAT ", misses: %" G_GUINT64_FORMAT
+           ", evictions: %" G_GUINT64_FORMAT "\n",
+           index_stats.n_mappings, index_stats.hits, index_stats.misses, index_stats.evictions);
+  g_print ("data mappings: %u, hits: %" G_GUINT64_FORMAT ", misses: %" G_GUINT64_FORMAT
+           ", evictions: %" G_GUINT64_FORMAT "\n",
+           data_stats.n_mappings, data_stats.hits, data_stats.misses, data_stats.evictions);
+
+ out:
+  if (data.meta_indexes)
+    g_ptr_array_unref (data.meta_indexes);
+  if (data.data_indexes)
+    g_ptr_array_unref (data.data_indexes);
+  g_clear_object (&data.repo);
+  if (local_error)
+    {
+      g_printerr ("%s\n", local_error->message);
+      g_error_free (local_error);
+      return 1;
+    }
+  return 0;
+}
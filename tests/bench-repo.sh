@@ -0,0 +1,155 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+# Time the core repository operations on a synthetic tree made by
+# gen-tree, and print the results as JSON: for each operation, the
+# elapsed time, files and megabytes of the tree per second, peak RSS
+# in kilobytes, and the number of system calls.
+#
+# Peak RSS needs GNU time, and system calls are counted with strace
+# -c in a second, untimed run of the whole suite; either is null when
+# the tool is missing.  Pulling over HTTP is skipped, and null, if
+# ostree-pull or run-apache isn't available.
+#
+# Usage: bench-repo.sh [GEN-TREE-OPTIONS...]
+
+set -e
+
+. libtest.sh
+
+${SRCDIR}/gen-tree "$@" files > tree-size.txt
+read n_files n_bytes < tree-size.txt
+# Same tree with a tenth of the files changed
+${SRCDIR}/gen-tree "$@" --change-ratio 0.1 files-changed > /dev/null
+
+operations="commit checkout diff commit-changed prune fsck pack pull-local pull-http unpack"
+
+time_cmd=
+if test -x /usr/bin/time && /usr/bin/time -f %M -o /dev/null true 2>/dev/null; then
+    time_cmd=/usr/bin/time
+fi
+have_strace=
+if command -v strace > /dev/null; then
+    have_strace=yes
+fi
+have_http=
+if command -v ostree-pull > /dev/null && test -x ${SRCDIR}/run-apache; then
+    have_http=yes
+fi
+
+mkdir ostree-srv
+if test -n "$have_http"; then
+    setup_httpd
+fi
+
+# run_op NAME COMMAND... runs COMMAND in the current directory,
+# recording the elapsed time and peak RSS in the "timed" pass, and
+# the system calls in the "strace" pass.
+run_op () {
+    name=$1
+    shift
+    if test $pass = timed; then
+        start=`date +%s.%N`
+        if test -n "$time_cmd"; then
+            $time_cmd -f %M -o ${test_tmpdir}/rss-$name.txt "$@" > /dev/null
+        else
+            "$@" > /dev/null
+        fi
+        end=`date +%s.%N`
+        echo "$start $end" | awk '{ print $2 - $1 }' > ${test_tmpdir}/seconds-$name.txt
+    else
+        strace -f -c -o ${test_tmpdir}/strace-$name.txt "$@" > /dev/null
+        awk '$1 ~ /^[0-9.]+$/ && $NF != "total" { n += $4 } END { print n }' \
+            ${test_tmpdir}/strace-$name.txt > ${test_tmpdir}/syscalls-$name.txt
+    fi
+}
+
+run_suite () {
+    pass=$1
+    repo=${test_tmpdir}/ostree-srv/$pass
+
+    mkdir $repo
+    ostree --repo=$repo init --archive
+
+    cd ${test_tmpdir}/files
+    run_op commit ostree --repo=$repo commit -b bench -s "Benchmark"
+    cd ${test_tmpdir}
+    run_op checkout ostree --repo=$repo checkout bench checkout-$pass
+    run_op diff ostree --repo=$repo diff bench files-changed
+    cd ${test_tmpdir}/files-changed
+    run_op commit-changed ostree --repo=$repo commit -b bench -s "Benchmark changes"
+    cd ${test_tmpdir}
+    run_op prune ostree --repo=$repo prune --depth=0 --delete
+    run_op fsck ostree --repo=$repo fsck -q --full
+    run_op pack ostree --repo=$repo pack
+
+    mkdir repo-local-$pass
+    ostree --repo=repo-local-$pass init --archive
+    run_op pull-local ostree --repo=repo-local-$pass pull-local $repo
+
+    if test -n "$have_http"; then
+        mkdir repo-http-$pass
+        ostree --repo=repo-http-$pass init
+        ostree --repo=repo-http-$pass remote add origin $(cat httpd-address)/ostree/$pass
+        run_op pull-http ostree-pull --repo=repo-http-$pass origin bench
+    fi
+
+    run_op unpack ostree --repo=$repo unpack
+}
+
+# Print the contents of FILE, or null if there is none
+json_value () {
+    if test -s "$1"; then
+        cat "$1"
+    else
+        echo null
+    fi
+}
+
+run_suite timed
+if test -n "$have_strace"; then
+    run_suite strace
+fi
+
+cd ${test_tmpdir}
+echo "{"
+echo "  \"files\": $n_files,"
+echo "  \"bytes\": $n_bytes,"
+echo "  \"operations\": {"
+sep=
+for op in $operations; do
+    if test -n "$sep"; then
+        echo "$sep"
+    fi
+    sep=","
+    if test -f seconds-$op.txt; then
+        seconds=`cat seconds-$op.txt`
+        ops_per_s=`echo "$n_files $seconds" | awk '{ printf "%.1f", $2 > 0 ? $1 / $2 : 0 }'`
+        mb_per_s=`echo "$n_bytes $seconds" | awk '{ printf "%.2f", $2 > 0 ? $1 / 1048576 / $2 : 0 }'`
+    else
+        seconds=null
+        ops_per_s=null
+        mb_per_s=null
+    fi
+    echo -n "    \"$op\": { \"seconds\": $seconds, \"ops_per_s\": $ops_per_s, \"mb_per_s\": $mb_per_s, "
+    echo -n "\"peak_rss_kb\": `json_value rss-$op.txt`, \"syscalls\": `json_value syscalls-$op.txt` }"
+done
+echo
+echo "  }"
+echo "}"
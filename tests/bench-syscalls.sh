@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+# Count the system calls made by commit, ls and checkout, using
+# strace -c.
+# Usage: bench-syscalls.sh [NUMBER-OF-FILES]
+
+set -e
+
+. libtest.sh
+
+n_files=${1:-10000}
+
+mkdir files
+cd files
+for i in `seq $n_files`; do
+    d=dir$((i % 100))
+    test -d $d || mkdir $d
+    echo "content $i" > $d/file$i
+done
+cd ..
+
+mkdir repo
+ostree --repo=repo init
+
+count_syscalls () {
+    name=$1
+    shift
+    strace -f -c -o strace-$name.txt "$@" > /dev/null
+    total=`awk '$NF == "total" { print $4 }' strace-$name.txt`
+    echo "$name: $total syscalls"
+    # The five most frequent calls
+    awk '$1 ~ /^[0-9.]+$/ && $NF != "total" { print $4, $NF }' strace-$name.txt \
+        | sort -n -r | head -5 | while read calls syscall; do
+        echo "    $syscall: $calls"
+    done
+}
+
+cd files
+count_syscalls commit ostree --repo=../repo commit -b bench -s "Benchmark"
+cd ..
+count_syscalls ls ostree --repo=repo ls -R bench
+count_syscalls checkout ostree --repo=repo checkout bench checkout-bench
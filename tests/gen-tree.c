@@ -0,0 +1,240 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Generate a deterministic synthetic file tree for benchmarks
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* The layout and contents of the tree depend only on the options
+ * other than --change-ratio, so the same command always produces the
+ * same tree.  File sizes are distributed log-uniformly between
+ * --min-size and --max-size, and a --dup-ratio fraction of files
+ * repeat the contents of an earlier one.
+ *
+ * Running again over an existing tree with --change-ratio rewrites
+ * that fraction of the files with new contents and leaves the rest
+ * identical, which gives a second revision to diff or commit.
+ *
+ * Prints the number of files and their total size in bytes.
+ */
+
+static int opt_seed = 0;
+static int opt_files = 10000;
+static int opt_depth = 3;
+static int opt_fanout = 10;
+static int opt_min_size = 0;
+static int opt_max_size = 65536;
+static double opt_dup_ratio = 0.1;
+static double opt_change_ratio = 0;
+
+static GOptionEntry options[] = {
+  { "seed", 0, 0, G_OPTION_ARG_INT, &opt_seed, "Random seed (default 0)", "SEED" },
+  { "files", 0, 0, G_OPTION_ARG_INT, &opt_files, "Number of files (default 10000)", "N" },
+  { "depth", 0, 0, G_OPTION_ARG_INT, &opt_depth, "Maximum directory depth (default 3)", "N" },
+  { "fanout", 0, 0, G_OPTION_ARG_INT, &opt_fanout, "Subdirectories per directory (default 10)", "N" },
+  { "min-size", 0, 0, G_OPTION_ARG_INT, &opt_min_size, "Minimum file size in bytes (default 0)", "BYTES" },
+  { "max-size", 0, 0, G_OPTION_ARG_INT, &opt_max_size, "Maximum file size in bytes (default 65536)", "BYTES" },
+  { "dup-ratio", 0, 0, G_OPTION_ARG_DOUBLE, &opt_dup_ratio, "Fraction of files duplicating another (default 0.1)", "RATIO" },
+  { "change-ratio", 0, 0, G_OPTION_ARG_DOUBLE, &opt_change_ratio, "Fraction of files with changed contents (default 0)", "RATIO" },
+  { NULL }
+};
+
+static void
+set_error_from_errno (GError      **error,
+                      const char   *path)
+{
+  int errsv = errno;
+  g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+               "%s: %s", path, g_strerror (errsv));
+}
+
+static gboolean
+write_contents (const char  *path,
+                guint32      content_seed,
+                guint        size,
+                GError     **error)
+{
+  gboolean ret = FALSE;
+  FILE *f = NULL;
+  GRand *rand;
+  guint32 buf[1024];
+  guint remaining = size;
+
+  rand = g_rand_new_with_seed (content_seed);
+
+  f = fopen (path, "w");
+  if (!f)
+    {
+      set_error_from_errno (error, path);
+      goto out;
+    }
+
+  while (remaining > 0)
+    {
+      guint n = MIN (remaining, sizeof (buf));
+      guint i;
+
+      for (i = 0; i < (n + 3) / 4; i++)
+        buf[i] = g_rand_int (rand);
+      if (fwrite (buf, 1, n, f) != n)
+        {
+          set_error_from_errno (error, path);
+          goto out;
+        }
+      remaining -= n;
+    }
+
+  if (fclose (f) != 0)
+    {
+      f = NULL;
+      set_error_from_errno (error, path);
+      goto out;
+    }
+  f = NULL;
+
+  ret = TRUE;
+ out:
+  if (f)
+    fclose (f);
+  g_rand_free (rand);
+  return ret;
+}
+
+static gboolean
+generate_tree (const char  *root,
+               guint64     *out_total_size,
+               GError     **error)
+{
+  gboolean ret = FALSE;
+  GRand *rand;
+  GString *path;
+  guint *sizes;
+  guint32 *content_seeds;
+  guint64 total_size = 0;
+  double log_min = log ((double)opt_min_size + 1);
+  double log_max = log ((double)opt_max_size + 1);
+  guint i;
+
+  rand = g_rand_new_with_seed ((guint32)opt_seed);
+  path = g_string_new ("");
+  sizes = g_new0 (guint, opt_files);
+  content_seeds = g_new0 (guint32, opt_files);
+
+  for (i = 0; i < (guint)opt_files; i++)
+    {
+      guint depth = g_rand_int_range (rand, 0, opt_depth + 1);
+      double size_point = g_rand_double_range (rand, log_min, log_max);
+      gboolean is_dup = g_rand_double (rand) < opt_dup_ratio;
+      guint dup_of = g_rand_int_range (rand, 0, MAX (i, 1));
+      gboolean changed = g_rand_double (rand) < opt_change_ratio;
+      guint32 content_seed;
+      guint d;
+
+      g_string_assign (path, root);
+      for (d = 0; d < depth; d++)
+        g_string_append_printf (path, "/d%d", g_rand_int_range (rand, 0, opt_fanout));
+
+      if (g_mkdir_with_parents (path->str, 0755) != 0)
+        {
+          set_error_from_errno (error, path->str);
+          goto out;
+        }
+      g_string_append_printf (path, "/f%u", i);
+
+      if (is_dup && dup_of < i)
+        {
+          sizes[i] = sizes[dup_of];
+          content_seeds[i] = content_seeds[dup_of];
+        }
+      else
+        {
+          sizes[i] = (guint) (exp (size_point) - 1);
+          content_seeds[i] = (guint32)opt_seed * 2654435761U + i;
+        }
+      /* Changed files get contents no other file has; files that
+       * duplicate them keep the original contents.
+       */
+      content_seed = changed ? ~content_seeds[i] : content_seeds[i];
+
+      if (!write_contents (path->str, content_seed, sizes[i], error))
+        goto out;
+      total_size += sizes[i];
+    }
+
+  ret = TRUE;
+  *out_total_size = total_size;
+ out:
+  g_free (content_seeds);
+  g_free (sizes);
+  g_string_free (path, TRUE);
+  g_rand_free (rand);
+  return ret;
+}
+
+int
+main (int     argc,
+      char  **argv)
+{
+  GError *error = NULL;
+  GOptionContext *context;
+  guint64 total_size;
+
+  g_type_init ();
+
+  context = g_option_context_new ("DIR - Generate a synthetic file tree in DIR");
+  g_option_context_add_main_entries (context, options, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    goto out;
+
+  if (argc != 2)
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "A directory must be specified");
+      goto out;
+    }
+  if (opt_files < 0 || opt_depth < 0 || opt_fanout < 1
+      || opt_min_size < 0 || opt_max_size < opt_min_size)
+    {
+      g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Invalid tree parameters");
+      goto out;
+    }
+
+  if (!generate_tree (argv[1], &total_size, &error))
+    goto out;
+
+  g_print ("%d %" G_GUINT64_FORMAT "\n", opt_files, total_size);
+
+ out:
+  g_option_context_free (context);
+  if (error)
+    {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      return 1;
+    }
+  return 0;
+}
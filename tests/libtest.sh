@@ -64,6 +64,12 @@ assert_file_has_content () {
     fi
 }
 
+assert_not_file_has_content () {
+    if grep -q -e "$2" "$1"; then
+	echo 1>&2 "File '$1' matches regexp '$2'"; exit 1
+    fi
+}
+
 setup_test_repository () {
     mode=$1
     shift
@@ -109,28 +115,10 @@ setup_test_repository () {
     cd $oldpwd
 }
 
-setup_fake_remote_repo1() {
-    oldpwd=`pwd`
-    mkdir ostree-srv
-    cd ostree-srv
-    mkdir gnomerepo
-    ${CMD_PREFIX} ostree --repo=gnomerepo init --archive
-    mkdir gnomerepo-files
-    cd gnomerepo-files 
-    echo first > firstfile
-    mkdir baz
-    echo moo > baz/cow
-    echo alien > baz/saucer
-    ${CMD_PREFIX} ostree  --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "A remote commit" -m "Some Commit body"
-    mkdir baz/deeper
-    ${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Add deeper"
-    echo hi > baz/deeper/ohyeah
-    mkdir baz/another/
-    echo x > baz/another/y
-    ${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "The rest"
-    cd ..
-    rm -rf gnomerepo-files
-    
+# Serve ${test_tmpdir}/ostree-srv at /ostree/ of the address written
+# to ${test_tmpdir}/httpd-address
+setup_httpd () {
+    httpd_oldpwd=`pwd`
     cd ${test_tmpdir}
     mkdir ${test_tmpdir}/httpd
     cd httpd
@@ -145,6 +133,12 @@ ServerName localhost
 LoadModule alias_module modules/mod_alias.so
 LoadModule cgi_module modules/mod_cgi.so
 LoadModule env_module modules/mod_env.so
+<IfModule !log_config_module>
+LoadModule log_config_module modules/mod_log_config.so
+</IfModule>
+
+LogFormat "%r %>s" requests
+CustomLog access_log requests
 
 StartServers 1
 
@@ -164,6 +158,33 @@ EOF
 	echo "Error: timed out waiting for httpd-address file"
 	exit 1
     fi
+    cd ${httpd_oldpwd}
+}
+
+setup_fake_remote_repo1() {
+    oldpwd=`pwd`
+    mkdir ostree-srv
+    cd ostree-srv
+    mkdir gnomerepo
+    ${CMD_PREFIX} ostree --repo=gnomerepo init --archive
+    mkdir gnomerepo-files
+    cd gnomerepo-files 
+    echo first > firstfile
+    mkdir baz
+    echo moo > baz/cow
+    echo alien > baz/saucer
+    ${CMD_PREFIX} ostree  --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "A remote commit" -m "Some Commit body"
+    mkdir baz/deeper
+    ${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "Add deeper"
+    echo hi > baz/deeper/ohyeah
+    mkdir baz/another/
+    echo x > baz/another/y
+    ${CMD_PREFIX} ostree --repo=${test_tmpdir}/ostree-srv/gnomerepo commit -b main -s "The rest"
+    cd ..
+    rm -rf gnomerepo-files
+    
+    setup_httpd
+
     cd ${oldpwd} 
 
     export OSTREE="ostree --repo=repo"
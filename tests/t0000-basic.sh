@@ -19,7 +19,7 @@
 
 set -e
 
-echo "1..30"
+echo "1..39"
 
 . libtest.sh
 
@@ -114,6 +114,63 @@ cd ${test_tmpdir}
 assert_file_has_content diff-test2-2 'M */four$'
 echo "ok diff file changing type"
 
+cd ${test_tmpdir}
+$OSTREE checkout test2 checkout-test2-diff
+cd checkout-test2-diff
+rm four
+mkdir four
+touch four/other
+echo changed > yet/message
+chmod 700 yet/another
+$OSTREE commit -b test2-diff -s "Diff commits"
+cd ${test_tmpdir}
+$OSTREE diff test2 test2-diff > diff-commits
+assert_file_has_content diff-commits '^M */four$'
+assert_not_file_has_content diff-commits '^[DA] */four'
+assert_file_has_content diff-commits '^M */yet/message$'
+assert_file_has_content diff-commits '^M */yet/another$'
+# Directories are only modified if their own metadata is
+assert_not_file_has_content diff-commits ' /yet$'
+assert_not_file_has_content diff-commits ' /$'
+$OSTREE diff test2-diff test2 > diff-commits
+assert_file_has_content diff-commits '^M */four$'
+assert_not_file_has_content diff-commits '^[DA] */four'
+rm -rf checkout-test2-diff diff-commits
+echo "ok diff commits"
+
+cd ${test_tmpdir}
+$OSTREE checkout --stat-cache=stat-cache test2 checkout-test2-statcache
+assert_has_file stat-cache
+$OSTREE diff --stat-cache=stat-cache test2 ./checkout-test2-statcache > diff-statcache
+assert_not_file_has_content diff-statcache 'four'
+echo modified > checkout-test2-statcache/four
+$OSTREE diff --stat-cache=stat-cache test2 ./checkout-test2-statcache > diff-statcache
+assert_file_has_content diff-statcache 'M */four$'
+$OSTREE checkout --stat-cache=stat-cache test2 checkout-test2-statcache-b
+$OSTREE diff --stat-cache=stat-cache test2 ./checkout-test2-statcache-b > diff-statcache
+assert_not_file_has_content diff-statcache 'four'
+$OSTREE diff --stat-cache=stat-cache test2 ./checkout-test2-statcache > diff-statcache
+assert_file_has_content diff-statcache 'M */four$'
+rm -rf checkout-test2-statcache-b
+echo "ok diff stat cache"
+
+cd ${test_tmpdir}/checkout-test2-statcache
+$OSTREE commit -b test2-statcache -s "Stat cache 1" --stat-cache=${test_tmpdir}/stat-cache
+echo changed-again > four
+echo new > statcache-new-file
+$OSTREE commit -b test2-statcache -s "Stat cache 2" --stat-cache=${test_tmpdir}/stat-cache
+$OSTREE commit -b test2-statcache -s "Stat cache 3" --stat-cache=${test_tmpdir}/stat-cache --verify
+cd ${test_tmpdir}
+$OSTREE diff test2-statcache^ test2-statcache > diff-statcache
+assert_not_file_has_content diff-statcache 'four'
+$OSTREE diff test2-statcache^^ test2-statcache^ > diff-statcache
+assert_file_has_content diff-statcache 'M */four$'
+assert_file_has_content diff-statcache 'A */statcache-new-file$'
+$OSTREE checkout test2-statcache checkout-test2-statcache-2
+assert_file_has_content checkout-test2-statcache-2/four 'changed-again'
+rm -rf checkout-test2-statcache checkout-test2-statcache-2 stat-cache diff-statcache
+echo "ok commit stat cache"
+
 cd ${test_tmpdir}/checkout-test2-4
 echo afile > oh-look-a-file
 cat > ${test_tmpdir}/ostree-commit-metadata <<EOF
@@ -132,7 +189,13 @@ echo "ok metadata content"
 cd ${test_tmpdir}
 mkdir repo2
 ${CMD_PREFIX} ostree --repo=repo2 init
-${CMD_PREFIX} ostree --repo=repo2 pull-local repo
+${CMD_PREFIX} ostree --repo=repo2 config set core.fsync true
+${CMD_PREFIX} ostree --repo=repo2 pull-local repo > pull-local.txt
+assert_file_has_content pull-local.txt '^Linked '
+rev=$($OSTREE rev-parse test2)
+assert_has_file repo2/objects/${rev:0:2}/${rev:2}.commit
+assert_streq "$(ls repo2/tmp | grep '^link-' || true)" ""
+${CMD_PREFIX} ostree --repo=repo2 fsck
 echo "ok pull-local"
 
 cd ${test_tmpdir}
@@ -221,3 +284,89 @@ rm -rf test2-checkout
 parent_rev_test2=$(ostree --repo=repo rev-parse test2)
 ${CMD_PREFIX} ostree --repo=shadow-repo checkout "${parent_rev_test2}" test2-checkout
 echo "ok checkout from shadow repo"
+
+cd ${test_tmpdir}
+rm -rf fsync-repo
+mkdir fsync-repo
+${CMD_PREFIX} ostree --repo=fsync-repo init
+${CMD_PREFIX} ostree --repo=fsync-repo config set core.fsync true
+cd ${test_tmpdir}/checkout-test2-4
+${CMD_PREFIX} ostree --repo=${test_tmpdir}/fsync-repo commit -b test2 -s "Synced commit"
+cd ${test_tmpdir}
+${CMD_PREFIX} ostree --repo=fsync-repo fsck -q
+rm -rf fsync-checkout
+${CMD_PREFIX} ostree --repo=fsync-repo checkout test2 fsync-checkout
+assert_file_has_content fsync-checkout/yet/another/tree/green "leaf"
+echo "ok commit with fsync"
+
+cd ${test_tmpdir}
+rm -rf user-checkout
+$OSTREE checkout -U --show-methods test2 user-checkout > methods
+assert_file_has_content methods 'hardlink=0'
+assert_file_has_content methods 'stream=0'
+assert_file_has_content user-checkout/yet/another/tree/green "leaf"
+echo "ok user mode checkout copies loose files"
+
+cd ${test_tmpdir}
+rm -rf incremental-checkout
+$OSTREE checkout 'test2^' incremental-checkout
+$OSTREE checkout --incremental-from='test2^' test2 incremental-checkout
+$OSTREE diff test2 ./incremental-checkout > diff-incremental
+test ! -s diff-incremental
+$OSTREE checkout --incremental-from=test2 'test2^' incremental-checkout
+$OSTREE diff 'test2^' ./incremental-checkout > diff-incremental
+test ! -s diff-incremental
+echo "ok incremental checkout"
+
+cd ${test_tmpdir}
+rm -rf retarget-repo retarget-files retarget retarget-*
+mkdir retarget-repo
+ostree --repo=retarget-repo init
+mkdir retarget-files
+echo one > retarget-files/one
+cd retarget-files
+ostree --repo=${test_tmpdir}/retarget-repo commit -b retarget -s "Retarget 1"
+echo two > two
+ostree --repo=${test_tmpdir}/retarget-repo commit -b retarget -s "Retarget 2"
+cd ${test_tmpdir}
+ostree --repo=retarget-repo checkout --atomic-retarget 'retarget^' retarget
+previous=$(readlink retarget)
+two=$(ostree --repo=retarget-repo ls -C retarget /two | awk '{ print $5 }')
+mv retarget-repo/objects/${two:0:2}/${two:2}.file saved-two
+ostree --repo=retarget-repo checkout --atomic-retarget --incremental retarget retarget 2>/dev/null && (echo 1>&2 "checkout unexpectedly succeeded"; exit 1)
+test "$(readlink retarget)" = "${previous}"
+assert_file_has_content retarget/one one
+test ! -e retarget/two
+mv saved-two retarget-repo/objects/${two:0:2}/${two:2}.file
+ostree --repo=retarget-repo checkout --atomic-retarget --incremental retarget retarget
+assert_file_has_content retarget/two two
+test ! -e ${previous}/two
+ostree --repo=retarget-repo diff 'retarget^' ./${previous} > diff-retarget
+test ! -s diff-retarget
+rm -rf retarget-repo retarget-files retarget retarget-* diff-retarget
+echo "ok incremental atomic retarget leaves the previous checkout alone"
+
+cd ${test_tmpdir}
+rm -rf reference-checkout reference-checkout-2
+$OSTREE checkout 'test2^' reference-checkout
+# Replace a file like a trigger would; it must not be linked
+rm reference-checkout/yet/another/tree/green
+echo triggered > reference-checkout/yet/another/tree/green
+$OSTREE checkout --reference=reference-checkout --reference-commit='test2^' test2 reference-checkout-2 > reference-out
+assert_file_has_content reference-out 'files linked from reference'
+assert_file_has_content reference-checkout-2/yet/another/tree/green "leaf"
+$OSTREE diff test2 ./reference-checkout-2 > diff-reference
+test ! -s diff-reference
+echo "ok checkout with reference"
+
+cd ${test_tmpdir}/files
+echo stats > stats-file
+$OSTREE --stats commit -b test2 -s "Stats" 2> ${test_tmpdir}/stats.json
+assert_file_has_content ${test_tmpdir}/stats.json '"tmpfiles_created": [1-9]'
+assert_file_has_content ${test_tmpdir}/stats.json '"bytes_hashed": [1-9]'
+rm stats-file
+# After the command name, --stats is an option of the command
+if $OSTREE log --stats test2 > /dev/null 2>&1; then
+    echo 1>&2 "--stats after the command name was accepted"; exit 1
+fi
+echo "ok stats"
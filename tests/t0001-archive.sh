@@ -21,12 +21,13 @@ set -e
 
 . libtest.sh
 
-echo '1..22'
+echo '1..25'
 
 setup_test_repository "archive"
 echo "ok setup"
 
-$OSTREE checkout test2 checkout-test2
+$OSTREE checkout --show-methods test2 checkout-test2 > methods
+assert_file_has_content methods 'stream=0'
 echo "ok checkout"
 
 cd checkout-test2
@@ -110,3 +111,39 @@ echo "ok checkout metadata-packed"
 
 $OSTREE unpack
 echo "ok unpack"
+
+cd ${test_tmpdir}
+$OSTREE pack --internal-compression=none --delete-all-loose
+rm -rf checkout-test2-uncompressed
+$OSTREE checkout --show-methods test2 checkout-test2-uncompressed > methods
+assert_not_file_has_content methods ' pack=0'
+assert_file_has_content checkout-test2-uncompressed/baz/cow moo
+$OSTREE fsck
+$OSTREE unpack
+echo "ok checkout from uncompressed pack"
+
+cd ${test_tmpdir}
+$OSTREE pack --pack-size=1 --internal-compression=none
+test $(ls repo/objects/pack/ostdatapack-*.data | wc -l) -gt 1
+cp repo/config repo-config.orig
+$OSTREE config set core.pack-cache-mappings 1
+rm -rf checkout-test2-evicting
+$OSTREE checkout --show-methods test2 checkout-test2-evicting > methods
+assert_not_file_has_content methods ' pack=0'
+diff -r checkout-test2 checkout-test2-evicting
+$OSTREE fsck
+cp repo-config.orig repo/config
+$OSTREE unpack
+echo "ok checkout from packs with one mapping kept"
+
+cd ${test_tmpdir}
+$OSTREE rev-parse 'test2^' > test2-parent
+cp test2-parent repo/refs/heads/test2
+assert_streq "$($OSTREE rev-parse test2)" "$(cat test2-parent)"
+echo 'not a checksum' > repo/refs/heads/bogus
+cd ${test_tmpdir}/files
+$OSTREE commit -b summary-test -s 'Summary test'
+cd ${test_tmpdir}
+rm repo/refs/heads/bogus
+assert_has_file repo/refs/summary.v
+echo "ok archive refs files are authoritative"
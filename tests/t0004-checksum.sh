@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# Copyright (C) 2012 Colin Walters <walters@verbum.org>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+set -e
+
+echo "1..2"
+
+. libtest.sh
+
+${SRCDIR}/test-checksum > implementation
+echo "ok sha256 known answers with" `cat implementation`
+
+OSTREE_CHECKSUM_BACKEND=glib ${SRCDIR}/test-checksum > implementation
+assert_file_has_content implementation '^glib$'
+echo "ok sha256 known answers with glib"
@@ -19,7 +19,7 @@
 
 set -e
 
-echo "1..1"
+echo "1..4"
 
 . libtest.sh
 
@@ -32,3 +32,52 @@ chmod o-x firstfile
 $OSTREE fsck -q
 
 echo "ok chmod"
+
+cd ${test_tmpdir}
+assert_has_file repo/fsck-journal
+$OSTREE fsck > fsck-output
+assert_file_has_content fsck-output "0 objects and 0 pack files; [1-9][0-9]* objects"
+$OSTREE fsck --full > fsck-output
+assert_file_has_content fsck-output "; 0 objects and 0 pack files unchanged"
+
+echo "ok incremental"
+
+cd ${test_tmpdir}
+mkdir packrepo
+ostree --repo=packrepo init --archive
+mkdir packfiles
+echo packed > packfiles/somefile
+cd packfiles
+ostree --repo=../packrepo commit -b packed -s "Packed commit"
+cd ${test_tmpdir}
+rev=$(ostree --repo=packrepo rev-parse packed)
+# Corrupt the content before packing it, and hide the commit so the
+# first fsck doesn't reach the packed objects
+content=$(find packrepo/objects -name '*.filecontent')
+chmod u+w $content
+echo pAcked > $content
+mv packrepo/objects/${rev:0:2}/${rev:2}.commit saved.commit
+ostree --repo=packrepo pack
+ostree --repo=packrepo fsck -q
+mv saved.commit packrepo/objects/${rev:0:2}/${rev:2}.commit
+ostree --repo=packrepo fsck -q 2>/dev/null && (echo 1>&2 "fsck unexpectedly succeeded"; exit 1)
+
+echo "ok corrupted object in unchanged pack"
+
+cd ${test_tmpdir}
+mkdir deleterepo
+ostree --repo=deleterepo init
+mkdir deletefiles
+echo delete-me > deletefiles/somefile
+cd deletefiles
+ostree --repo=../deleterepo commit -b delete -s "Delete commit"
+cd ${test_tmpdir}
+content=$(find deleterepo/objects -name '*.file')
+chmod u+w $content
+echo dElete-me > $content
+ostree --repo=deleterepo fsck -q 2>/dev/null && (echo 1>&2 "fsck unexpectedly succeeded"; exit 1)
+ostree --repo=deleterepo fsck -q --delete > fsck-output
+assert_file_has_content fsck-output "Deleted corrupted object"
+test -z "$(find deleterepo/objects -name '*.file')"
+
+echo "ok fsck --delete"
@@ -19,7 +19,7 @@
 
 set -e
 
-echo "1..7"
+echo "1..8"
 
 . libtest.sh
 
@@ -62,7 +62,8 @@ echo foo1 > foo
 ln foo bar
 tar czf ${test_tmpdir}/hardlinktest.tar.gz .
 cd ${test_tmpdir}
-$OSTREE commit -s 'hardlinks' -b test-hardlinks --tree=tar=hardlinktest.tar.gz
+$OSTREE commit -s 'hardlinks' -b test-hardlinks --tar-stats --tree=tar=hardlinktest.tar.gz > import-stats.txt
+assert_file_has_content import-stats.txt '1 hardlinks'
 rm -rf hardlinktest
 echo "ok hardlink commit"
 
@@ -73,6 +74,31 @@ assert_file_has_content foo foo1
 assert_file_has_content bar foo1
 echo "ok hardlink contents"
 
+cd ${test_tmpdir}
+mkdir hardlinkorder
+cd hardlinkorder
+echo foo1 > foo
+ln foo bar
+tar cf ${test_tmpdir}/retarget.tar foo bar
+rm foo
+echo foo2 > foo
+tar rf ${test_tmpdir}/retarget.tar foo
+tar cf ${test_tmpdir}/replaced.tar foo bar
+rm bar
+echo bar2 > bar
+tar rf ${test_tmpdir}/replaced.tar bar
+cd ${test_tmpdir}
+rm -rf hardlinkorder
+$OSTREE commit -s 'retarget' -b test-hardlink-retarget --tree=tar=retarget.tar
+$OSTREE checkout test-hardlink-retarget test-hardlink-retarget-checkout
+assert_file_has_content test-hardlink-retarget-checkout/foo foo2
+assert_file_has_content test-hardlink-retarget-checkout/bar foo1
+$OSTREE commit -s 'replaced' -b test-hardlink-replaced --tree=tar=replaced.tar
+$OSTREE checkout test-hardlink-replaced test-hardlink-replaced-checkout
+assert_file_has_content test-hardlink-replaced-checkout/foo foo2
+assert_file_has_content test-hardlink-replaced-checkout/bar bar2
+echo "ok hardlinks follow archive order"
+
 cd ${test_tmpdir}
 mkdir multicommit-files
 cd multicommit-files
@@ -21,7 +21,7 @@ set -e
 
 . libtest.sh
 
-echo '1..4'
+echo '1..6'
 
 setup_fake_remote_repo1
 cd ${test_tmpdir}
@@ -56,3 +56,32 @@ cd checkout-origin-main
 assert_file_has_content firstfile '^first$'
 assert_file_has_content baz/cow '^moo$'
 echo "ok pull contents packed"
+
+cd ${test_tmpdir}
+: > httpd/access_log
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-again.txt
+assert_file_has_content pull-again.txt 'No changes in origin/main'
+assert_file_has_content pull-again.txt 'No changes in refs summary'
+assert_file_has_content repo/remote-cache/origin/validators 'refs/summary.v'
+assert_file_has_content httpd/access_log '^GET /ostree/gnomerepo/refs/summary.v HTTP/1.1 304$'
+echo "ok pull revalidates unchanged ref"
+
+cd ${test_tmpdir}
+# Serve a copy without the summary, so the ref itself is revalidated
+cp -a ostree-srv/gnomerepo ostree-srv/nosummaryrepo
+rm ostree-srv/nosummaryrepo/refs/summary.v
+rm -rf repo
+mkdir repo
+${CMD_PREFIX} ostree --repo=repo init
+${CMD_PREFIX} ostree --repo=repo remote add origin $(cat httpd-address)/ostree/nosummaryrepo
+${CMD_PREFIX} ostree-pull --repo=repo origin main
+remote_rev=$(ostree --repo=ostree-srv/gnomerepo rev-parse main)
+assert_file_has_content repo/remote-cache/origin/validators "^contents=${remote_rev}$"
+# A 304 must give the checksum fetched with the validators, not the local ref
+ostree --repo=ostree-srv/gnomerepo rev-parse 'main^' > repo/refs/remotes/origin/main
+: > httpd/access_log
+${CMD_PREFIX} ostree-pull --repo=repo origin main > pull-ref-again.txt
+assert_file_has_content httpd/access_log '^GET /ostree/nosummaryrepo/refs/heads/main HTTP/1.1 304$'
+assert_file_has_content pull-ref-again.txt "remote origin/main is now ${remote_rev}"
+assert_streq "$(${CMD_PREFIX} ostree --repo=repo rev-parse origin/main)" "${remote_rev}"
+echo "ok pull revalidates ref without summary"
@@ -0,0 +1,163 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Check OtChecksum against known SHA-256 digests
+ *
+ * Copyright (C) 2012 Colin Walters <walters@verbum.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include "otutil.h"
+
+#include <string.h>
+
+/* Usage: test-checksum
+ *
+ * Checksums each vector in one update, in two updates split at every
+ * offset, and in updates of several fixed sizes, then all of them
+ * with ot_checksum_many(), and prints the implementation used.  Set
+ * OSTREE_CHECKSUM_BACKEND=glib to test the GChecksum backend on CPUs
+ * with SHA extensions.
+ */
+
+typedef struct {
+  const char *data;
+  gsize repeat;
+  const char *digest;
+} TestVector;
+
+static const TestVector vectors[] = {
+  { "a", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+  { "a", 55, "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318" },
+  { "a", 56, "b35439a4ac6f0948b6d6f9e3c6af0f5f590ce20f1bde7090ef7970686ec6738a" },
+  { "a", 63, "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34" },
+  { "a", 64, "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb" },
+  { "a", 65, "635361c48bb9eab14198e76ea8ab7f1a41685d6ad62aa9146d301d4f17eb0ae0" },
+  { "abc", 1, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+  { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1,
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  { "a", 1000000, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" }
+};
+
+/* Sizes of the updates when not splitting at every offset */
+static const gsize update_sizes[] = { 1, 3, 55, 56, 63, 64, 65, 127, 4096 };
+
+static guchar *
+vector_data (const TestVector  *vector,
+             gsize             *out_len)
+{
+  gsize piece_len = strlen (vector->data);
+  gsize len = piece_len * vector->repeat;
+  guchar *data = g_malloc (MAX (len, 1));
+  gsize i;
+
+  for (i = 0; i < vector->repeat; i++)
+    memcpy (data + i * piece_len, vector->data, piece_len);
+  *out_len = len;
+  return data;
+}
+
+static gboolean
+check_digest (const TestVector  *vector,
+              const guchar      *digest,
+              const char        *how)
+{
+  char actual[65];
+  guint i;
+
+  for (i = 0; i < 32; i++)
+    g_snprintf (actual + i * 2, 3, "%02x", digest[i]);
+
+  if (strcmp (actual, vector->digest) != 0)
+    {
+      g_printerr ("SHA-256 of \"%s\" x %" G_GSIZE_FORMAT " (%s) is %s, expected %s\n",
+                  vector->data, vector->repeat, how, actual, vector->digest);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+check_updates (const TestVector  *vector,
+               const guchar      *data,
+               gsize              len,
+               gsize              first_len,
+               gsize              update_size,
+               const char        *how)
+{
+  OtChecksum checksum;
+  guchar digest[32];
+  gsize offset;
+
+  ot_checksum_init (&checksum);
+  ot_checksum_update (&checksum, data, first_len);
+  for (offset = first_len; offset < len; offset += update_size)
+    ot_checksum_update (&checksum, data + offset, MIN (update_size, len - offset));
+  ot_checksum_get_digest (&checksum, digest);
+  ot_checksum_clear (&checksum);
+
+  return check_digest (vector, digest, how);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  gboolean ok = TRUE;
+  guchar *data[G_N_ELEMENTS (vectors)];
+  gsize lengths[G_N_ELEMENTS (vectors)];
+  guchar digests[G_N_ELEMENTS (vectors) * 32];
+  guint i;
+  gsize j;
+
+  g_type_init ();
+
+  for (i = 0; i < G_N_ELEMENTS (vectors); i++)
+    {
+      const TestVector *vector = &vectors[i];
+      gsize len;
+
+      data[i] = vector_data (vector, &len);
+      lengths[i] = len;
+
+      ok &= check_updates (vector, data[i], len, len, 1, "one update");
+
+      /* Every split of the short vectors, around each block boundary */
+      if (len <= 130)
+        {
+          for (j = 0; j <= len; j++)
+            ok &= check_updates (vector, data[i], len, j, len, "split");
+        }
+
+      for (j = 0; j < G_N_ELEMENTS (update_sizes); j++)
+        ok &= check_updates (vector, data[i], len, 0, update_sizes[j], "fixed updates");
+    }
+
+  ot_checksum_many (G_N_ELEMENTS (vectors), (const guchar * const *) data, lengths, digests);
+  for (i = 0; i < G_N_ELEMENTS (vectors); i++)
+    ok &= check_digest (&vectors[i], digests + i * 32, "ot_checksum_many");
+
+  for (i = 0; i < G_N_ELEMENTS (vectors); i++)
+    g_free (data[i]);
+
+  if (!ok)
+    return 1;
+
+  g_print ("%s\n", ot_checksum_get_implementation ());
+  return 0;
+}